@@ -27,6 +27,19 @@ system_params = {
     'COMP_BATCH_SIZE': int(os.environ.get('NBA_COMP_BATCH_SIZE', 64)),
     'COPROC_PPDEPTH': int(os.environ.get('NBA_COPROC_PPDEPTH', 32)),
     'COPROC_CTX_PER_COMPTHREAD': 1,
+    'JUMBO_FRAME_SIZE': int(os.environ.get('NBA_JUMBO_FRAME_SIZE', 0)),
+    # The longest sleep of idle IO threads, i.e., the bound of added wakeup
+    # latency.  0 keeps them busy-polling.
+    'IO_IDLE_SLEEP_USEC': int(os.environ.get('NBA_IO_IDLE_SLEEP_USEC', 0)),
+    # 1 runs comp threads on their own cores (the hyperthread siblings of IO
+    # cores here), fed by IO threads over rings.
+    'COMP_DECOUPLED': int(os.environ.get('NBA_COMP_DECOUPLED', 0)),
+    # With COMP_DECOUPLED, idle comp threads steal batches queued for the
+    # others in the same node: 1 in any order, 2 keeping per-flow order.
+    'COMP_WORK_STEALING': int(os.environ.get('NBA_COMP_WORK_STEALING', 0)),
+    # 1 counts the CPU cycles of each element, at the cost of a TSC read
+    # per element and batch.
+    'COMP_ELEMENT_CYCLES': int(os.environ.get('NBA_COMP_ELEMENT_CYCLES', 0)),
 }
 print("IO batch size: {0[IO_BATCH_SIZE]}, computation batch size: {0[COMP_BATCH_SIZE]}".format(system_params))
 print("Coprocessor pipeline depth: {0[COPROC_PPDEPTH]}".format(system_params))
@@ -64,7 +77,9 @@ for node_id, node_cores in enumerate(node_cpus):
     node_local_coprocs.append([coproc for coproc in coprocessors if coproc.numa_node == node_id])
     for node_local_idx, coproc in enumerate(node_local_coprocs[node_id]):
         core_id = node_cores[-(node_local_idx + 1)]
-        coproc_threads.append(nba.CoprocThread(core_id=core_id + _ht_diff, device_id=coproc.device_id))
+        # Let the framework choose the driver for real devices.
+        driver = coproc.driver if coproc.driver == 'dummy' else None
+        coproc_threads.append(nba.CoprocThread(core_id=core_id + _ht_diff, device_id=coproc.device_id, driver=driver))
         coproc_input_queues.append(nba.Queue(node_id=node_id, template='taskin'))
 
 io_threads = []
@@ -95,9 +110,11 @@ for coproc_thread in coproc_threads:
     node_id = nba.node_of_cpu(coproc_thread.core_id)
     node_local_comp_threads = [comp_thread for comp_thread in comp_threads
                                if nba.node_of_cpu(comp_thread.core_id) == node_id]
+    coproc_input_queue = coproc_input_queues[coproc_threads.index(coproc_thread)]
     for comp_thread in node_local_comp_threads:
-        local_coproc_input_queues = [q for q in coproc_input_queues if q.node_id == node_id]
-        thread_connections.append((comp_thread, coproc_thread, local_coproc_input_queues[0]))
+        # Each comp thread is connected to all coprocessors in the same node
+        # and its offload dispatcher distributes tasks among them.
+        thread_connections.append((comp_thread, coproc_thread, coproc_input_queue))
         thread_connections.append((coproc_thread, comp_thread, coproc_completion_queues[comp_threads.index(comp_thread)]))
 
 pprint(io_threads)
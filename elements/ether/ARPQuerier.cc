@@ -1,24 +1,47 @@
 #include <nba/core/intrinsic.hh>
+#include <nba/core/timing.hh>
 #include <nba/element/element.hh>
 #include <nba/element/packet.hh>
+#include <nba/element/packetbatch.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/logging.hh>
 #include "ARPQuerier.hh"
 #include "util_arptable.hh"
 #include <net/if_arp.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <rte_ring.h>
 
 using namespace std;
 using namespace nba;
 
+static ARPTable *arp_table = nullptr;
+
+ARPQuerier::~ARPQuerier()
+{
+    /* Packets left when a graph reload retires this element. */
+    vector<void *> pkts;
+    _pending.flush(pkts);
+    pkts.insert(pkts.end(), _ready.begin(), _ready.end());
+    for (void *p : pkts)
+        PacketBatch::drop_packet(ctx->io_ctx->drop_queue, ((Packet *) p)->get_base());
+}
+
 int ARPQuerier::initialize()
 {
+    _table = arp_table;
+    _cache.init(_table);
+    _pending.configure(capacity_pkt, capacity_pkt_per_hop, request_interval_us, max_requests);
     return 0;
 }
 
 // per-system configuration
 int ARPQuerier::initialize_global()
 {
-    _table->configure(capacity_pkt, capacity_arp_entry, timeout_arp_entry);
+    if (arp_table == nullptr)
+        arp_table = new ARPTable();
+    arp_table->configure(capacity_pkt, capacity_arp_entry, timeout_arp_entry);
     return 0;
 };
 
@@ -35,15 +58,48 @@ int ARPQuerier::configure(comp_thread_context *ctx, std::vector<std::string> &ar
     // Default value: 2048, 0(unlimit), 5 min, 1 min, ?, false
 
     capacity_pkt = 2048;
+    capacity_pkt_per_hop = 64;
     capacity_arp_entry = 0;
     timeout_arp_entry = 5;
     renewal_timeout = 1;
+    request_interval_us = 100000;   // at most 10 requests/sec per next hop
+    max_requests = 5;
+
+    my_ip = 0;
+    if (args.size() == 2) {
+        struct in_addr addr;
+        if (inet_aton(args[0].c_str(), &addr) == 0)
+            rte_panic("ARPQuerier: invalid IP address %s\n", args[0].c_str());
+        my_ip = ntohl(addr.s_addr);
+        my_eth = EtherAddress(args[1]);
+    } else if (args.size() != 0) {
+        rte_panic("ARPQuerier: too many arguments. (expected: [MY_IP, MY_ETH])\n");
+    }
 
     _table = NULL;
 
     return 0;
 }
 
+void ARPQuerier::send_request(uint32_t ip, int out_port)
+{
+    uint8_t frame[ARP_REQUEST_FRAME_LEN];
+    arp_build_request(frame, my_eth, my_ip, ip);
+    ctx->io_tx_new(frame, sizeof(frame), out_port);
+}
+
+void ARPQuerier::release(uint32_t ip, const EtherAddress &eth)
+{
+    vector<void *> pkts;
+    _pending.release(ip, pkts);
+    for (void *p : pkts) {
+        Packet *q = (Packet *) p;
+        struct ether_hdr *ethh = (struct ether_hdr *) q->data();
+        memcpy(&ethh->d_addr, eth._data, ETHER_ADDR_LEN);
+        _ready.push_back(q);
+    }
+}
+
 int ARPQuerier::process(int input_port, Packet *pkt)
 {
     struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
@@ -54,10 +110,11 @@ int ARPQuerier::process(int input_port, Packet *pkt)
 
         // ARPResponse packet comes in..
         if ( (ntohs(ethh->ether_type) != ETHER_TYPE_ARP)
-                && (ntohs(arph->ar_op) != ARPOP_REPLY)
-                && (ntohs(arph->ar_hrd) != ARPHRD_ETHER)
-                && (ntohs(arph->ar_pro) != ETHER_TYPE_IPv4) ) {
-                return DROP;
+                || (ntohs(arph->ar_op) != ARPOP_REPLY)
+                || (ntohs(arph->ar_hrd) != ARPHRD_ETHER)
+                || (ntohs(arph->ar_pro) != ETHER_TYPE_IPv4) ) {
+            pkt->kill();
+            return 0;
         }
 
         uint32_t new_ip_addr;
@@ -70,32 +127,44 @@ int ARPQuerier::process(int input_port, Packet *pkt)
 
         _table->insert(new_ip_addr, (const EtherAddress)new_eth_addr);
 
-        // TODO: iterate ARP entry in ARP table & send pkts with added dest ip addr.
+        // Packets queued in other threads are released by their dispatch().
+        release(new_ip_addr, new_eth_addr);
+        pkt->kill();
     }
     else {
         // Find matching mac addr for forwarded packets..
         // Assumes IPv4 packet.
         if (ntohs(ethh->ether_type) != ETHER_TYPE_IPv4) {
-                return DROP;
+            pkt->kill();
+            return 0;
         }
 
         struct iphdr *iph = (struct iphdr *)(ethh + 1);
         EtherAddress dest_addr;
+        uint32_t next_hop = ntohl(iph->daddr);
 
-        dest_addr = _table->lookup(ntohl(iph->daddr));
-        if (!dest_addr.is_broadcast()) {
+        if (_cache.lookup(next_hop, &dest_addr)) {
             // Matching mac addr found. revise dest mac addr & forward packet.
-            int i;
-            for (i=0; i<6; ++i) {
-                ethh->d_addr.addr_bytes[i] = dest_addr._data[i];
-            }
+            memcpy(&ethh->d_addr, dest_addr._data, ETHER_ADDR_LEN);
+            output(0).push(pkt);
         }
         else {
-            // TODO: If not found, pkt should be stored to ARP table
-            // & ARP request pkt should be generated & echo-backed to input port.
-
-            // return (what?) as whole pkt is stored to ARP table, drop it?
-            return PENDING;
+            // Keep the packet until the next hop is resolved.
+            int out_port = anno_isset(&pkt->anno, NBA_ANNO_IFACE_OUT)
+                           ? (int) anno_get(&pkt->anno, NBA_ANNO_IFACE_OUT)
+                           : (int) anno_get(&pkt->anno, NBA_ANNO_IFACE_IN);
+            switch (_pending.enqueue(next_hop, pkt, get_usec(), out_port)) {
+            case ARPPendingQueues::QUEUED_SEND_REQUEST:
+                send_request(next_hop, out_port);
+                pkt->pend();
+                break;
+            case ARPPendingQueues::QUEUED:
+                pkt->pend();
+                break;
+            case ARPPendingQueues::REJECTED:
+                pkt->kill();
+                break;
+            }
         }
     }
 
@@ -104,9 +173,55 @@ int ARPQuerier::process(int input_port, Packet *pkt)
 
 int ARPQuerier::dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay)
 {
-    _table->handle_timer();
-    next_delay = 1000000; // 1 sec (in us)
     out_batch = nullptr;
+    next_delay = 1000; // 1 msec (in us)
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec >= prev.tv_sec + (time_t) renewal_timeout) {
+        _table->handle_timer();
+        prev = now;
+    }
+
+    if (!_pending.empty()) {
+        /* Release packets resolved by other threads. */
+        vector<uint32_t> ips;
+        _pending.next_hops(ips);
+        for (uint32_t ip : ips) {
+            EtherAddress eth;
+            if (_cache.lookup(ip, &eth))
+                release(ip, eth);
+        }
+
+        /* Retry unanswered requests and give up on unreachable hosts. */
+        vector<pair<uint32_t, int>> requests;
+        vector<void *> expired;
+        _pending.poll(get_usec(), requests, expired);
+        for (auto &r : requests)
+            send_request(r.first, r.second);
+        for (void *p : expired)
+            PacketBatch::drop_packet(ctx->io_ctx->drop_queue, ((Packet *) p)->get_base());
+    }
+
+    if (_ready.empty())
+        return 0;
+
+    /* Send the released packets as a new batch from our output. */
+    PacketBatch *batch = nullptr;
+    if (rte_mempool_get(ctx->batch_pool, (void **) &batch) != 0)
+        return 0;   // retry in the next round.
+    new (batch) PacketBatch();
+    batch->banno.bitmask = 0;
+    anno_set(&batch->banno, NBA_BANNO_LB_DECISION, -1);
+    batch->recv_timestamp = rdtscp();
+    unsigned n = RTE_MIN((unsigned) _ready.size(), (unsigned) NBA_MAX_COMP_BATCH_SIZE);
+    for (unsigned i = 0; i < n; i++) {
+        ADD_PACKET(batch, _ready[i]->get_base());
+        batch->results[i] = 0;
+    }
+    _ready.erase(_ready.begin(), _ready.begin() + n);
+    out_batch = batch;
+    next_delay = 0; // drain the rest immediately.
     return 0;
 }
 
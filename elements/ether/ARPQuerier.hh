@@ -4,11 +4,21 @@
 #include <nba/element/element.hh>
 #include <vector>
 #include <string>
+#include "util_arpcache.hh"
+#include "util_arppending.hh"
 
 namespace nba {
 
-class ARPTable;
-
+/*
+ * ARPQuerier([MY_IP, MY_ETH])
+ *
+ * Input 0 takes ARP replies, input 1 takes IPv4 packets towards the next
+ * hop in their destination address.  Resolved packets go out with the
+ * destination Ethernet address rewritten.  Unresolved packets wait in
+ * bounded per-next-hop queues while ARP requests from MY_IP/MY_ETH are
+ * sent (rate-limited) via the TX port of the packet, and are released
+ * from dispatch() once the next hop is resolved by any thread.
+ */
 class ARPQuerier : public SchedulableElement {
 public:
     ARPQuerier(): SchedulableElement(), _table(NULL)
@@ -16,9 +26,7 @@ public:
         prev = {0, 0};
     }
 
-    ~ARPQuerier()
-    {
-    }
+    ~ARPQuerier();
 
     const char *class_name() const { return "ARPQuerier"; }
     const char *port_count() const { return "2/1"; }
@@ -32,14 +40,26 @@ public:
     int dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay);
 
 private:
+    void send_request(uint32_t ip, int out_port);
+    void release(uint32_t ip, const EtherAddress &eth);
+
     unsigned capacity_pkt;
+    unsigned capacity_pkt_per_hop;
     unsigned capacity_arp_entry;
     unsigned timeout_arp_entry;
     unsigned renewal_timeout;
+    unsigned request_interval_us;
+    unsigned max_requests;
+
+    uint32_t my_ip;
+    EtherAddress my_eth;
 
     struct timespec prev;
 
-    ARPTable *_table;  // FIXME: use node-local storage
+    ARPTable *_table;   // shared by all computation threads
+    ARPCache _cache;    // per-thread cache of _table
+    ARPPendingQueues _pending;
+    std::vector<Packet *> _ready;   // resolved packets to be sent by dispatch()
 };
 
 EXPORT_ELEMENT(ARPQuerier);
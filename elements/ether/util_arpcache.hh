@@ -0,0 +1,83 @@
+#ifndef __NBA_UTIL_ARP_CACHE_HH__
+#define __NBA_UTIL_ARP_CACHE_HH__
+
+#include <cstdint>
+#include <vector>
+#include <rte_branch_prediction.h>
+#include "util_arptable.hh"
+
+namespace nba {
+
+/**
+ * A per-thread, direct-mapped cache of a shared ARPTable.
+ *
+ * Each slot remembers the generation of the table when it was filled.
+ * Any modification of the table (insertion, expiration, clear) bumps the
+ * generation and thus invalidates all slots at once, so a hit only reads
+ * the thread-local slot and the read-mostly generation counter without
+ * taking the table lock.  Misses are filled from the table.
+ *
+ * Entries that have timed out but are not yet removed by
+ * ARPTable::handle_timer() may keep hitting until the next removal.
+ */
+class ARPCache {
+public:
+    enum : unsigned { DEFAULT_SIZE = 1024 };
+
+    ARPCache() : _table(nullptr), _shift(31) { }
+
+    /** size is rounded up to a power of two (at least 2). */
+    void init(ARPTable *table, unsigned size = DEFAULT_SIZE)
+    {
+        unsigned bits = 1;
+        while ((1u << bits) < size)
+            bits++;
+        _table = table;
+        _shift = 32 - bits;
+        _slots.assign(1u << bits, slot());
+        /* Make all slots stale. */
+        uint32_t gen = table->generation();
+        for (slot &s : _slots)
+            s.generation = gen - 1;
+    }
+
+    /**
+     * Looks up ip (in host byte order).
+     * Returns 1 and sets eth if found, otherwise 0.
+     */
+    int lookup(uint32_t ip, EtherAddress *eth)
+    {
+        slot &s = _slots[(ip * 2654435761u) >> _shift];
+        uint32_t gen = _table->generation();
+        if (likely(s.ip == ip && s.generation == gen)) {
+            *eth = s.eth;
+            return 1;
+        }
+        /* Read the generation before the table so that a concurrent
+         * update leaves the slot stale rather than wrong. */
+        if (_table->lookup(ip, eth, 0) <= 0)
+            return 0;
+        s.ip = ip;
+        s.generation = gen;
+        s.eth = *eth;
+        return 1;
+    }
+
+private:
+    struct slot {
+        uint32_t ip;
+        uint32_t generation;
+        EtherAddress eth;
+        slot() : ip(0), generation(0) { }
+    };
+
+    ARPTable *_table;
+    unsigned _shift;
+    std::vector<slot> _slots;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
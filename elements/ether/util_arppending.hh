@@ -0,0 +1,180 @@
+#ifndef __NBA_UTIL_ARP_PENDING_HH__
+#define __NBA_UTIL_ARP_PENDING_HH__
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
+#include <rte_ether.h>
+#include "util_arptable.hh"
+
+namespace nba {
+
+/**
+ * Packets waiting for ARP resolution, queued per next hop.
+ *
+ * The queues are bounded both per next hop and in total.  An ARP request
+ * is due when the first packet for a next hop is queued, and again every
+ * request interval until the next hop is resolved.  After max_requests
+ * unanswered requests, the queued packets are given up.
+ *
+ * The queue does not own the packets: the caller frees the packets
+ * returned by release() and poll() or forwards them.
+ */
+class ARPPendingQueues {
+public:
+    enum EnqueueResult {
+        QUEUED,                 /* queued behind an outstanding request */
+        QUEUED_SEND_REQUEST,    /* queued; the caller should send a request now */
+        REJECTED,               /* the queue is full; the caller should drop it */
+    };
+
+    ARPPendingQueues()
+        : _capacity(2048), _per_hop_capacity(64),
+          _request_interval_us(100000), _max_requests(5), _count(0)
+    { }
+
+    void configure(unsigned capacity, unsigned per_hop_capacity,
+                   uint64_t request_interval_us, unsigned max_requests)
+    {
+        _capacity = capacity;
+        _per_hop_capacity = per_hop_capacity;
+        _request_interval_us = request_interval_us;
+        _max_requests = max_requests;
+    }
+
+    /** out_port is where the requests for a new next hop go. */
+    EnqueueResult enqueue(uint32_t ip, void *pkt, uint64_t now_us, int out_port = 0)
+    {
+        if (_count >= _capacity)
+            return REJECTED;
+        auto it = _hops.find(ip);
+        if (it == _hops.end()) {
+            struct next_hop &h = _hops[ip];
+            h.pkts.push_back(pkt);
+            h.last_request_us = now_us;
+            h.num_requests = 1;
+            h.out_port = out_port;
+            _count ++;
+            return QUEUED_SEND_REQUEST;
+        }
+        if (it->second.pkts.size() >= _per_hop_capacity)
+            return REJECTED;
+        it->second.pkts.push_back(pkt);
+        _count ++;
+        return QUEUED;
+    }
+
+    /** Moves the packets queued for ip (in arrival order) to pkts. */
+    void release(uint32_t ip, std::vector<void *> &pkts)
+    {
+        auto it = _hops.find(ip);
+        if (it == _hops.end())
+            return;
+        pkts.insert(pkts.end(), it->second.pkts.begin(), it->second.pkts.end());
+        _count -= it->second.pkts.size();
+        _hops.erase(it);
+    }
+
+    /**
+     * Collects the next hops whose request interval has passed, with
+     * their output ports, into requests, and moves the packets of the
+     * next hops that used up their requests to expired.
+     */
+    void poll(uint64_t now_us, std::vector<std::pair<uint32_t, int>> &requests,
+              std::vector<void *> &expired)
+    {
+        for (auto it = _hops.begin(); it != _hops.end(); ) {
+            struct next_hop &h = it->second;
+            if (now_us < h.last_request_us + _request_interval_us) {
+                ++ it;
+                continue;
+            }
+            if (h.num_requests >= _max_requests) {
+                expired.insert(expired.end(), h.pkts.begin(), h.pkts.end());
+                _count -= h.pkts.size();
+                it = _hops.erase(it);
+                continue;
+            }
+            h.last_request_us = now_us;
+            h.num_requests ++;
+            requests.push_back(std::make_pair(it->first, h.out_port));
+            ++ it;
+        }
+    }
+
+    /** Moves all queued packets to pkts and forgets the next hops. */
+    void flush(std::vector<void *> &pkts)
+    {
+        for (auto &kv : _hops)
+            pkts.insert(pkts.end(), kv.second.pkts.begin(), kv.second.pkts.end());
+        _hops.clear();
+        _count = 0;
+    }
+
+    /** Appends the next hops with queued packets to ips. */
+    void next_hops(std::vector<uint32_t> &ips) const
+    {
+        for (auto &kv : _hops)
+            ips.push_back(kv.first);
+    }
+
+    size_t size() const { return _count; }
+    bool empty() const { return _count == 0; }
+
+private:
+    struct next_hop {
+        std::deque<void *> pkts;
+        uint64_t last_request_us;
+        unsigned num_requests;
+        int out_port;
+    };
+
+    size_t _capacity;
+    size_t _per_hop_capacity;
+    uint64_t _request_interval_us;
+    unsigned _max_requests;
+    size_t _count;
+    std::unordered_map<uint32_t, struct next_hop> _hops;
+};
+
+enum : unsigned {
+    ARP_REQUEST_FRAME_LEN = 60,     /* the minimum Ethernet frame w/o FCS */
+};
+
+/**
+ * Builds a broadcast ARP request for tpa from sha/spa into frame,
+ * which must have ARP_REQUEST_FRAME_LEN bytes.  Addresses are in host
+ * byte order.
+ */
+static inline void arp_build_request(uint8_t *frame, const EtherAddress &sha,
+                                     uint32_t spa, uint32_t tpa)
+{
+    memset(frame, 0, ARP_REQUEST_FRAME_LEN);
+    struct ether_hdr *ethh = (struct ether_hdr *) frame;
+    memset(&ethh->d_addr, 0xff, ETHER_ADDR_LEN);
+    memcpy(&ethh->s_addr, sha._data, ETHER_ADDR_LEN);
+    ethh->ether_type = htons(ETHER_TYPE_ARP);
+
+    struct ether_arp *arp = (struct ether_arp *) (ethh + 1);
+    arp->ea_hdr.ar_hrd = htons(ARPHRD_ETHER);
+    arp->ea_hdr.ar_pro = htons(ETHER_TYPE_IPv4);
+    arp->ea_hdr.ar_hln = ETHER_ADDR_LEN;
+    arp->ea_hdr.ar_pln = 4;
+    arp->ea_hdr.ar_op = htons(ARPOP_REQUEST);
+    memcpy(arp->arp_sha, sha._data, ETHER_ADDR_LEN);
+    uint32_t a = htonl(spa);
+    memcpy(arp->arp_spa, &a, 4);
+    a = htonl(tpa);
+    memcpy(arp->arp_tpa, &a, 4);
+}
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -35,6 +35,7 @@ ARPTable::ARPTable()
 {
     _entry_count = _packet_count = 0;
     rte_rwlock_init(&_lock);
+    rte_atomic32_init(&_generation);
 
     _hash_map = new EntryHashMap();
     _age = new AgeList();
@@ -59,11 +60,8 @@ int ARPTable::configure(uint32_t packet_capacity, uint32_t entry_capacity, uint3
 void ARPTable::clear()
 {
     // Walk the arp cache table and free any stored packets and arp entries.
-    ARPEntry *entry_ptr;
     for (EntryHashMap::iterator it = _hash_map->begin(); it != _hash_map->end(); ++it) {
-        entry_ptr = it->second;
-        _hash_map->erase(it);
-        delete entry_ptr;
+        delete it->second;
         //ARPEntry *ae = _hash_map.erase(it);
         //while (Packet *p = ae->_head) {
         //  ae->_head = p->next();
@@ -71,7 +69,10 @@ void ARPTable::clear()
         //    ++_drops;
         //}
     }
+    _hash_map->clear();
+    _age->clear();
     _entry_count = _packet_count = 0;
+    rte_atomic32_inc(&_generation);
 }
 
 void ARPTable::slim(long now)
@@ -109,6 +110,9 @@ void ARPTable::slim(long now)
 
             _age->erase(list_it_to_erase);
             delete entry_ptr;
+            rte_atomic32_inc(&_generation);
+        } else {
+            ++list_it;
         }
     }
 
@@ -162,7 +166,7 @@ ARPTable::ARPEntry * ARPTable::ensure(uint32_t ip, long now)
 {
     rte_rwlock_write_lock(&_lock);
     EntryHashMap::iterator it = _hash_map->find(ip);
-    if (it != _hash_map->end()) {
+    if (it == _hash_map->end()) {
         ++_entry_count;
         if (_entry_capacity && _entry_count > _entry_capacity)
             slim(now);
@@ -173,6 +177,7 @@ ARPTable::ARPEntry * ARPTable::ensure(uint32_t ip, long now)
         _hash_map->insert(EntryHashMap::value_type(ip, ae));
 
         _age->push_back(ae);
+        return ae;
     }
     return it->second;
 }
@@ -188,6 +193,7 @@ int ARPTable::insert(uint32_t ip, const EtherAddress &eth)//, Packet **head)
 
     ae->_eth = eth;
     ae->_input_time = tv.tv_sec;
+    rte_atomic32_inc(&_generation);
 
     rte_rwlock_write_unlock(&_lock);
     return 0;
@@ -31,6 +31,7 @@
 #include <net/if_arp.h>
 #include <netinet/ip.h>
 #include <rte_config.h>
+#include <rte_atomic.h>
 #include <rte_rwlock.h>
 #include <rte_ether.h>
 
@@ -138,6 +139,13 @@ class ARPTable { public:
 
     rte_rwlock_t *get_rwlock() { return &_lock; };
 
+    /**
+     * Returns the number of modifications of the table so far.
+     * Per-thread caches (ARPCache) compare it with the value they
+     * recorded when filling an entry to invalidate stale entries.
+     */
+    uint32_t generation() { return (uint32_t) rte_atomic32_read(&_generation); }
+
     struct ARPEntry {
         uint32_t _ip;
         ARPEntry *_hashnext;
@@ -156,6 +164,9 @@ class ARPTable { public:
   private:
     rte_rwlock_t _lock;
 
+    /* Kept apart from the lock, which is written by readers. */
+    rte_atomic32_t _generation __rte_cache_aligned;
+
     typedef std::unordered_map<uint32_t, ARPEntry*> EntryHashMap;
     typedef std::list<ARPEntry *> AgeList;
     EntryHashMap *_hash_map;
@@ -193,7 +204,7 @@ inline EtherAddress
 ARPTable::lookup(uint32_t ip)
 {
     EtherAddress eth;
-    if (lookup(ip, &eth, 0) >= 0) {
+    if (lookup(ip, &eth, 0) > 0) {
         return eth;
     }
     else {
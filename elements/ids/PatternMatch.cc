@@ -0,0 +1,179 @@
+#include <nba/core/offloadtypes.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/computedevice.hh>
+#include <nba/framework/computecontext.hh>
+#include <nba/element/annotation.hh>
+#include <nba/element/nodelocalstorage.hh>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include "PatternMatch.hh"
+#ifdef USE_CUDA
+#include "PatternMatch_kernel.hh"
+#endif
+
+using namespace std;
+using namespace nba;
+
+/* The offset of payloads, the same as the read ROI of ids.payloads. */
+static const unsigned payload_offset = sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr);
+
+/* The automaton images built in initialize_global(), by RULES file. */
+static map<string, vector<uint8_t>> global_ac_images;
+
+PatternMatch::PatternMatch() : OffloadableElement(),
+    rules_filename("configs/ids-rules.txt"), image_d(nullptr)
+{
+    #ifdef USE_CUDA
+    auto ch = [this](ComputeDevice *cdev, ComputeContext *ctx, struct resource_param *res) {
+        this->accel_compute_handler(cdev, ctx, res);
+    };
+    offload_compute_handlers.insert({{"cuda", ch},});
+    auto ih = [this](ComputeDevice *dev) { this->accel_init_handler(dev); };
+    offload_init_handlers.insert({{"cuda", ih},});
+    #endif
+}
+
+string PatternMatch::nls_key(const char *name) const
+{
+    return string("ids.") + name + ":" + rules_filename;
+}
+
+int PatternMatch::initialize_global()
+{
+    if (global_ac_images.find(rules_filename) != global_ac_images.end())
+        return 0;
+    printf("element::PatternMatch: Loading the patterns from %s\n", rules_filename.c_str());
+    vector<string> patterns;
+    int ret = ac_load_rules(rules_filename.c_str(), patterns);
+    if (ret < 0)
+        rte_panic("PatternMatch: cannot open %s\n", rules_filename.c_str());
+    if (ret > 0)
+        rte_panic("PatternMatch: malformed pattern at %s:%d\n", rules_filename.c_str(), ret);
+    ACBuilder builder;
+    for (auto &p : patterns)
+        builder.add(p);
+    vector<uint8_t> &image = global_ac_images[rules_filename];
+    builder.build(image);
+    const struct ac_image_header *hdr = (const struct ac_image_header *) image.data();
+    printf("element::PatternMatch: %u patterns, %u states (%u dense), %lu bytes, prefilter %s\n",
+           hdr->num_patterns, hdr->num_states, hdr->num_dense, hdr->total_size,
+           hdr->use_prefilter ? "on" : "off");
+    return 0;
+}
+
+int PatternMatch::initialize_per_node()
+{
+    string image_key = nls_key("ac_image");
+    if (ctx->node_local_storage->has(image_key.c_str()))
+        return 0;
+    const vector<uint8_t> &image = global_ac_images[rules_filename];
+    ctx->node_local_storage->alloc(image_key.c_str(), image.size());
+    ctx->node_local_storage->alloc(nls_key("ac_image_dev_memobj").c_str(), sizeof(struct per_device_mem));
+    memcpy(ctx->node_local_storage->get_alloc(image_key.c_str()), image.data(), image.size());
+    ((struct per_device_mem *) ctx->node_local_storage->get_alloc(nls_key("ac_image_dev_memobj").c_str()))->clear();
+    return 0;
+}
+
+int PatternMatch::initialize()
+{
+    if (!matcher.attach(ctx->node_local_storage->get_alloc(nls_key("ac_image").c_str())))
+        rte_panic("PatternMatch: invalid automaton image.\n");
+    image_d = (struct per_device_mem *) ctx->node_local_storage->get_alloc(nls_key("ac_image_dev_memobj").c_str());
+    return 0;
+}
+
+int PatternMatch::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    for (auto &arg : args) {
+        char str[256];
+        if (sscanf(arg.c_str(), " RULES %255s", str) == 1)
+            rules_filename = str;
+        else
+            rte_panic("PatternMatch: invalid argument \"%s\"\n", arg.c_str());
+    }
+    return 0;
+}
+
+/* The CPU version, which scans the segments one after another. */
+int PatternMatch::process(int input_port, Packet *pkt)
+{
+    int id = -1;
+    uint32_t state = 0;
+    unsigned skip = payload_offset;
+    for (struct rte_mbuf *m = pkt->get_base(); m != nullptr && id < 0; m = m->next) {
+        unsigned len = rte_pktmbuf_data_len(m);
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        id = matcher.first_match(rte_pktmbuf_mtod_offset(m, const uint8_t *, skip),
+                                 len - skip, state);
+        skip = 0;
+    }
+    if (id < 0) {
+        output(0).push(pkt);
+        return 0;
+    }
+    anno_set(&pkt->anno, NBA_ANNO_IDS_MATCH, id);
+    output(1).push(pkt);
+    return 0;
+}
+
+int PatternMatch::postproc(int input_port, void *custom_output, Packet *pkt)
+{
+    uint32_t result = *((uint32_t *) custom_output);
+    if (result == 0) {
+        output(0).push(pkt);
+        return 0;
+    }
+    anno_set(&pkt->anno, NBA_ANNO_IDS_MATCH, result - 1);
+    output(1).push(pkt);
+    return 0;
+}
+
+size_t PatternMatch::get_desired_workgroup_size(const char *device_name) const
+{
+    #ifdef USE_CUDA
+    if (!strcmp(device_name, "cuda"))
+        return 128u;
+    #endif
+    return 128u;
+}
+
+void PatternMatch::accel_init_handler(ComputeDevice *device)
+{
+    /* As it is before initialize() is called, we need to get the
+     * pointers from the node-local storage by ourselves here. */
+    void *image = ctx->node_local_storage->get_alloc(nls_key("ac_image").c_str());
+    size_t image_size = ((struct ac_image_header *) image)->total_size;
+    image_d = (struct per_device_mem *) ctx->node_local_storage->get_alloc(nls_key("ac_image_dev_memobj").c_str());
+    /* Instances with the same rules share the image in each device. */
+    if (image_d->find(device) != nullptr)
+        return;
+    dev_mem_t *dev_image = image_d->add(device);
+    host_mem_t image_h = device->alloc_host_buffer(image_size, 0);
+    memcpy(device->unwrap_host_buffer(image_h), image, image_size);
+    *dev_image = device->alloc_device_buffer(image_size, 0, image_h);
+    device->memwrite(image_h, *dev_image, 0, image_size);
+}
+
+void PatternMatch::accel_compute_handler(ComputeDevice *cdev,
+                                         ComputeContext *cctx,
+                                         struct resource_param *res)
+{
+    struct kernel_arg arg;
+    void *ptr_arg = cdev->unwrap_device_buffer(*image_d->find(cdev));
+    arg = {&ptr_arg, sizeof(void *), alignof(void *)};
+    cctx->push_kernel_arg(arg);
+    dev_kernel_t kern;
+    #ifdef USE_CUDA
+    kern.ptr = ids_pattern_match_get_cuda_kernel();
+    #endif
+    cctx->enqueue_kernel_launch(kern, res);
+}
+
+// vim: ts=8 sts=4 sw=4 et
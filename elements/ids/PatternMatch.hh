@@ -0,0 +1,83 @@
+#ifndef __NBA_ELEMENT_IDS_PATTERNMATCH_HH__
+#define __NBA_ELEMENT_IDS_PATTERNMATCH_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "util_aho_corasick.hh"
+#include "PatternMatchDatablocks.hh"
+
+namespace nba {
+
+/*
+ * PatternMatch([RULES filename])
+ *
+ * Scans the payloads of IPv4 packets (from the end of an option-less
+ * IPv4 header to the end of packet) for a set of byte patterns, one per
+ * line of the RULES file (default: configs/ids-rules.txt; see
+ * ac_load_rules() for the syntax).  Packets matching any pattern go to
+ * the output 1 with the first matched pattern ID in NBA_ANNO_IDS_MATCH;
+ * the others go to the output 0.  Both the CPU and offload paths scan
+ * all segments of chained mbufs.
+ *
+ * The patterns of each RULES file are compiled once into an Aho-Corasick
+ * automaton image (see ACBuilder) that is shared by all threads in the
+ * same NUMA node and copied to the offload devices as-is.  Instances with
+ * different RULES files keep separate images.
+ */
+class PatternMatch : public OffloadableElement {
+public:
+    PatternMatch();
+    virtual ~PatternMatch() { }
+
+    const char *class_name() const { return "PatternMatch"; }
+    const char *port_count() const { return "1/2"; }
+
+    int initialize();
+    int initialize_global();        // per-system configuration
+    int initialize_per_node();      // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+
+    void get_supported_devices(std::vector<std::string> &device_names) const
+    {
+        device_names.push_back("cpu");
+        #ifdef USE_CUDA
+        device_names.push_back("cuda");
+        #endif
+    }
+
+    size_t get_used_datablocks(int *datablock_ids)
+    {
+        datablock_ids[0] = dbid_ids_payloads;
+        datablock_ids[1] = dbid_ids_match_results;
+        return 2;
+    }
+
+    /* CPU-only method */
+    int process(int input_port, Packet *pkt);
+
+    /* Offloaded methods */
+    size_t get_desired_workgroup_size(const char *device_name) const;
+    int get_offload_item_counter_dbid() const { return dbid_ids_payloads; }
+    void accel_init_handler(ComputeDevice *device);
+    void accel_compute_handler(ComputeDevice *dev,
+                               ComputeContext *ctx,
+                               struct resource_param *res);
+    int postproc(int input_port, void *custom_output, Packet *pkt);
+
+protected:
+    /* The node-local storage key of the given object for our RULES file. */
+    std::string nls_key(const char *name) const;
+
+    std::string rules_filename;
+    ACMatcher matcher;
+    struct per_device_mem *image_d;
+};
+
+EXPORT_ELEMENT(PatternMatch);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,35 @@
+#include "PatternMatchDatablocks.hh"
+#include <rte_malloc.h>
+
+namespace nba {
+
+int dbid_ids_payloads;
+int dbid_ids_match_results;
+
+static DataBlock* db_ids_payloads_ctor (void) {
+    #ifdef TESTING
+    DataBlock *ptr = (DataBlock *) malloc(sizeof(IDSPayloadsDataBlock));
+    #else
+    DataBlock *ptr = (DataBlock *) rte_malloc("datablock", sizeof(IDSPayloadsDataBlock), CACHE_LINE_SIZE);
+    #endif
+    assert(ptr != nullptr);
+    new (ptr) IDSPayloadsDataBlock();
+    return ptr;
+};
+static DataBlock* db_ids_match_results_ctor (void) {
+    #ifdef TESTING
+    DataBlock *ptr = (DataBlock *) malloc(sizeof(IDSMatchResultsDataBlock));
+    #else
+    DataBlock *ptr = (DataBlock *) rte_malloc("datablock", sizeof(IDSMatchResultsDataBlock), CACHE_LINE_SIZE);
+    #endif
+    assert(ptr != nullptr);
+    new (ptr) IDSMatchResultsDataBlock();
+    return ptr;
+};
+
+declare_datablock("ids.payloads", db_ids_payloads_ctor, dbid_ids_payloads);
+declare_datablock("ids.match_results", db_ids_match_results_ctor, dbid_ids_match_results);
+
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,72 @@
+#ifndef __NBA_PATTERNMATCH_DATABLOCKS_HH__
+#define __NBA_PATTERNMATCH_DATABLOCKS_HH__
+
+#include <nba/framework/datablock.hh>
+
+namespace nba {
+
+extern int dbid_ids_payloads;
+extern int dbid_ids_match_results;
+
+class IDSPayloadsDataBlock : DataBlock
+{
+public:
+    IDSPayloadsDataBlock() : DataBlock()
+    {}
+
+    virtual ~IDSPayloadsDataBlock()
+    {}
+
+    const char *name() const { return "ids.payloads"; }
+
+    void get_read_roi(struct read_roi_info *roi) const
+    {
+        roi->type = READ_WHOLE_PACKET;
+        roi->offset = 14 + 20;  /* after the Ethernet and option-less IPv4 headers */
+        roi->length = 0;        /* to the end of packet */
+        roi->align = 0;
+        roi->size_delta = 0;
+    }
+
+    void get_write_roi(struct write_roi_info *roi) const
+    {
+        roi->type = WRITE_NONE;
+        roi->offset = 0;
+        roi->length = 0;
+    }
+};
+
+class IDSMatchResultsDataBlock : DataBlock
+{
+public:
+    IDSMatchResultsDataBlock() : DataBlock()
+    {}
+
+    virtual ~IDSMatchResultsDataBlock()
+    {}
+
+    const char *name() const { return "ids.match_results"; }
+
+    void get_read_roi(struct read_roi_info *roi) const
+    {
+        roi->type = READ_NONE;
+        roi->offset = 0;
+        roi->length = 0;
+        roi->align = 0;
+    }
+
+    void get_write_roi(struct write_roi_info *roi) const
+    {
+        /* 0 if no pattern matches, otherwise the first pattern ID plus one. */
+        roi->type = WRITE_FIXED_SEGMENTS;
+        roi->offset = 0;
+        roi->length = sizeof(uint32_t);
+        roi->align = 0;
+    }
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
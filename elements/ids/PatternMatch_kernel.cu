@@ -0,0 +1,71 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// includes, project
+#include <cuda.h>
+#include <nba/core/errors.hh>
+#include <nba/core/accumidx.hh>
+#include <nba/engines/cuda/utils.hh>
+#include "PatternMatch_kernel.hh"
+#include "util_ac_shared.hh"
+
+#include <nba/framework/datablock_shared.hh>
+
+extern "C" {
+
+/* The index is given by the order in get_used_datablocks(). */
+#define dbid_ids_payloads_d      (0)
+#define dbid_ids_match_results_d (1)
+
+/* The GPU kernel, which scans one packet per thread. */
+__global__ void ids_pattern_match_cuda(
+        struct datablock_kernel_arg **datablocks,
+        uint32_t count, uint32_t *item_counts, uint32_t num_batches,
+        uint8_t *checkbits_d,
+        const uint8_t* __restrict__ image_d)
+{
+    uint32_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+
+    if (idx < count) {
+        uint32_t batch_idx, item_idx;
+        assert(nba::NBA_SUCCESS == nba::get_accum_idx(item_counts, num_batches,
+                                                      idx, batch_idx, item_idx));
+        struct datablock_kernel_arg *db_payloads = datablocks[dbid_ids_payloads_d];
+        struct datablock_kernel_arg *db_results  = datablocks[dbid_ids_match_results_d];
+        const uint8_t *payload = (const uint8_t *) db_payloads->batches[batch_idx].buffer_bases
+                                 + db_payloads->batches[batch_idx].item_offsets[item_idx].as_value<uintptr_t>();
+        const uint32_t length = db_payloads->batches[batch_idx].item_sizes[item_idx];
+        uint32_t *result = &((uint32_t *) db_results->batches[batch_idx].buffer_bases)[item_idx];
+
+        const struct ac_image_header *hdr = (const struct ac_image_header *) image_d;
+        const uint32_t *dense = (const uint32_t *) (image_d + hdr->dense_off);
+        const struct ac_node *nodes = (const struct ac_node *) (image_d + hdr->nodes_off);
+        const uint64_t *match = (const uint64_t *) (image_d + hdr->match_off);
+        const uint32_t *first = (const uint32_t *) (image_d + hdr->first_off);
+        const uint32_t num_dense = hdr->num_dense;
+
+        uint32_t s = 0, found = 0;
+        for (uint32_t i = 0; i < length; i++) {
+            s = ac_next_state(dense, num_dense, nodes, s, payload[i]);
+            if (ac_is_match(match, s)) {
+                found = first[s] + 1;
+                break;
+            }
+        }
+        *result = found;
+    }
+
+    __syncthreads();
+    if (threadIdx.x == 0 && checkbits_d != NULL) {
+        checkbits_d[blockIdx.x] = 1;
+    }
+}
+
+}
+
+void *nba::ids_pattern_match_get_cuda_kernel() {
+    return reinterpret_cast<void *> (ids_pattern_match_cuda);
+}
+
+// vim: ts=8 sts=4 sw=4 et
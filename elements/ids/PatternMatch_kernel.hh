@@ -0,0 +1,12 @@
+#ifndef __NBA_PATTERNMATCH_KERNEL_HH__
+#define __NBA_PATTERNMATCH_KERNEL_HH__
+
+namespace nba {
+
+extern void *ids_pattern_match_get_cuda_kernel();
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
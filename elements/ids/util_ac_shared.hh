@@ -0,0 +1,86 @@
+#ifndef __NBA_UTIL_AC_SHARED_HH__
+#define __NBA_UTIL_AC_SHARED_HH__
+
+/*
+ * This header is included by both .cc/.cu sources.
+ * It defines the flat image of an Aho-Corasick automaton, which is
+ * copied as-is to node-local storage and to devices.
+ */
+
+#include <cstdint>
+
+#ifdef __CUDACC__
+#define AC_FUNC __host__ __device__ inline
+#else
+#define AC_FUNC static inline
+#endif
+
+#define AC_IMAGE_MAGIC  (0x41434d31u)   /* "ACM1" */
+#define AC_NONE         (0xffffffffu)
+
+/* The section offsets are relative to the start of the header. */
+struct alignas(64) ac_image_header {
+    uint32_t magic;
+    uint32_t num_states;
+    uint32_t num_dense;         /* states [0, num_dense) have dense rows */
+    uint32_t num_patterns;
+    uint32_t use_prefilter;
+    uint32_t reserved;
+    uint64_t total_size;
+    uint64_t dense_off;         /* uint32_t[num_dense][256] */
+    uint64_t nodes_off;         /* struct ac_node[num_states] */
+    uint64_t match_off;         /* uint64_t[(num_states + 63) / 64], set if any output */
+    uint64_t first_off;         /* uint32_t[num_states], the lowest pattern id of outputs */
+    uint64_t dict_off;          /* uint32_t[num_states], the next suffix with own outputs */
+    uint64_t out_begin_off;     /* uint32_t[num_states + 1] */
+    uint64_t out_ids_off;       /* uint32_t[], own outputs of each state */
+    uint8_t prefilter_lo[16];   /* start bytes by low nibbles (see ACBuilder) */
+    uint8_t prefilter_hi[16];
+};
+
+/*
+ * A state with its goto transitions as a 256-bit bitmap.  The children
+ * of a state are numbered contiguously in the order of bytes, so the
+ * child of byte c is children + (the number of set bits below c).
+ */
+struct alignas(16) ac_node {
+    uint64_t bits[4];
+    uint32_t children;
+    uint32_t fail;
+    uint8_t prefix[4];          /* set bits in bits[0..k-1] */
+    uint32_t reserved;
+};
+
+AC_FUNC unsigned ac_popcount64(uint64_t x)
+{
+    #ifdef __CUDA_ARCH__
+    return __popcll(x);
+    #else
+    return __builtin_popcountll(x);
+    #endif
+}
+
+/** The transition from state s by byte c, following failure links. */
+AC_FUNC uint32_t ac_next_state(const uint32_t *dense, uint32_t num_dense,
+                               const struct ac_node *nodes, uint32_t s, uint8_t c)
+{
+    const unsigned k = c >> 6;
+    const uint64_t bit = 1llu << (c & 63);
+    while (s >= num_dense) {
+        const struct ac_node *n = &nodes[s];
+        uint64_t w = n->bits[k];
+        if (w & bit)
+            return n->children + n->prefix[k] + ac_popcount64(w & (bit - 1));
+        s = n->fail;
+    }
+    return dense[((uint64_t) s << 8) | c];
+}
+
+AC_FUNC bool ac_is_match(const uint64_t *match, uint32_t s)
+{
+    return (match[s >> 6] >> (s & 63)) & 1;
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
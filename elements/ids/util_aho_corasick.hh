@@ -0,0 +1,445 @@
+#ifndef __NBA_UTIL_AHO_CORASICK_HH__
+#define __NBA_UTIL_AHO_CORASICK_HH__
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#include "util_ac_shared.hh"
+
+namespace nba {
+
+/*
+ * Builds the flat image of an Aho-Corasick automaton (see
+ * util_ac_shared.hh) from a set of byte-string patterns.
+ *
+ * The states are numbered in BFS order so that the children of a state
+ * are contiguous and shallow states come first.  The states shallower
+ * than a few levels (up to max_dense states in total) get full 256-entry
+ * transition rows, as most of the scan time is spent near the root;
+ * deeper states keep only their goto transitions as a bitmap and fall
+ * back to failure links.  A state takes 48 bytes plus 4 bytes per child
+ * instead of 1 KB for a full DFA row, so large rule sets still fit in
+ * the last-level cache.
+ *
+ * The builder also derives a shufti-style prefilter of the bytes that
+ * leave the root: with 8 buckets selected by the high nibble modulo 8,
+ * a byte may start a match only if lo[b & 15] & hi[b >> 4] is non-zero.
+ * It is enabled when the candidate set (a superset of the actual start
+ * bytes) covers at most max_prefilter_bytes of 256 values.
+ */
+class ACBuilder {
+public:
+    ACBuilder() : max_dense(256), max_prefilter_bytes(64) { }
+
+    /** Adds a pattern and returns its id (the order of addition). */
+    uint32_t add(const std::string &pattern)
+    {
+        patterns.push_back(pattern);
+        return patterns.size() - 1;
+    }
+
+    size_t size() const { return patterns.size(); }
+
+    /** Builds the image into the given buffer.  Returns false if any pattern is empty. */
+    bool build(std::vector<uint8_t> &image, bool use_prefilter = true)
+    {
+        for (auto &p : patterns)
+            if (p.empty())
+                return false;
+
+        /* Build the trie with temporary ids. */
+        std::unordered_map<uint64_t, uint32_t> edges;
+        std::vector<std::vector<uint8_t>> kid_bytes(1);
+        std::vector<std::vector<uint32_t>> trie_outs(1);
+        for (uint32_t id = 0; id < patterns.size(); id++) {
+            uint32_t s = 0;
+            for (unsigned char c : patterns[id]) {
+                uint64_t key = ((uint64_t) s << 8) | c;
+                auto it = edges.find(key);
+                if (it == edges.end()) {
+                    uint32_t t = kid_bytes.size();
+                    edges.insert({key, t});
+                    kid_bytes.push_back({});
+                    trie_outs.push_back({});
+                    kid_bytes[s].push_back(c);
+                    s = t;
+                } else
+                    s = it->second;
+            }
+            trie_outs[s].push_back(id);
+        }
+        const uint32_t n = kid_bytes.size();
+
+        /* Renumber the states in BFS order with sorted children. */
+        std::vector<uint32_t> order;    // new id -> trie id
+        std::vector<uint32_t> depth;
+        order.reserve(n);
+        depth.reserve(n);
+        order.push_back(0);
+        depth.push_back(0);
+        nodes.assign(n, ac_node());
+        for (uint32_t v = 0; v < n; v++) {
+            uint32_t u = order[v];
+            std::vector<uint8_t> &kids = kid_bytes[u];
+            std::sort(kids.begin(), kids.end());
+            ac_node &node = nodes[v];
+            node.children = order.size();
+            for (uint8_t c : kids) {
+                node.bits[c >> 6] |= 1llu << (c & 63);
+                order.push_back(edges[((uint64_t) u << 8) | c]);
+                depth.push_back(depth[v] + 1);
+            }
+            unsigned acc = 0;
+            for (unsigned k = 0; k < 4; k++) {
+                node.prefix[k] = (uint8_t) acc;
+                acc += __builtin_popcountll(node.bits[k]);
+            }
+        }
+
+        /* Failure links, in BFS order so that shallower links are ready. */
+        std::vector<std::vector<uint32_t>> outs(n);
+        for (uint32_t v = 0; v < n; v++) {
+            outs[v] = trie_outs[order[v]];
+            std::sort(outs[v].begin(), outs[v].end());
+        }
+        nodes[0].fail = 0;
+        for (uint32_t v = 0; v < n; v++) {
+            const ac_node &node = nodes[v];
+            uint32_t child = node.children;
+            for (unsigned c = 0; c < 256; c++) {
+                if (!((node.bits[c >> 6] >> (c & 63)) & 1))
+                    continue;
+                uint32_t f = 0;
+                if (v != 0) {
+                    f = node.fail;
+                    while (f != 0 && child_of(f, c) == AC_NONE)
+                        f = nodes[f].fail;
+                    uint32_t t = child_of(f, c);
+                    f = (t == AC_NONE) ? 0 : t;
+                }
+                nodes[child].fail = f;
+                child ++;
+            }
+        }
+
+        /* Output sets: own outputs plus those reachable via dictionary links. */
+        std::vector<uint32_t> dict(n, AC_NONE), first(n, AC_NONE);
+        std::vector<uint64_t> match((n + 63) / 64, 0);
+        std::vector<uint32_t> out_begin(n + 1, 0), out_ids;
+        for (uint32_t v = 0; v < n; v++) {
+            if (v != 0) {
+                uint32_t f = nodes[v].fail;
+                dict[v] = outs[f].empty() ? dict[f] : f;
+                first[v] = first[f];
+            }
+            if (!outs[v].empty())
+                first[v] = std::min(first[v], outs[v][0]);
+            if (first[v] != AC_NONE)
+                match[v >> 6] |= 1llu << (v & 63);
+            out_begin[v] = out_ids.size();
+            out_ids.insert(out_ids.end(), outs[v].begin(), outs[v].end());
+        }
+        out_begin[n] = out_ids.size();
+
+        /* Dense rows for the shallowest levels. */
+        uint32_t num_dense = 1;
+        for (uint32_t d = 1; ; d++) {
+            uint32_t cnt = std::lower_bound(depth.begin(), depth.end(), d + 1) - depth.begin();
+            if (cnt > max_dense || cnt == num_dense)
+                break;
+            num_dense = cnt;
+        }
+        std::vector<uint32_t> dense((size_t) num_dense * 256);
+        for (uint32_t v = 0; v < num_dense; v++) {
+            for (unsigned c = 0; c < 256; c++) {
+                uint32_t t = child_of(v, c);
+                if (t == AC_NONE)
+                    t = (v == 0) ? 0 : dense[(size_t) nodes[v].fail * 256 + c];
+                dense[(size_t) v * 256 + c] = t;
+            }
+        }
+
+        /* Lay out the image. */
+        struct ac_image_header hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = AC_IMAGE_MAGIC;
+        hdr.num_states = n;
+        hdr.num_dense = num_dense;
+        hdr.num_patterns = patterns.size();
+        hdr.use_prefilter = use_prefilter && build_prefilter(hdr);
+        uint64_t off = sizeof(hdr);
+        hdr.dense_off = off;
+        off = align(off + dense.size() * sizeof(uint32_t));
+        hdr.nodes_off = off;
+        off = align(off + n * sizeof(ac_node));
+        hdr.match_off = off;
+        off = align(off + match.size() * sizeof(uint64_t));
+        hdr.first_off = off;
+        off = align(off + n * sizeof(uint32_t));
+        hdr.dict_off = off;
+        off = align(off + n * sizeof(uint32_t));
+        hdr.out_begin_off = off;
+        off = align(off + (n + 1) * sizeof(uint32_t));
+        hdr.out_ids_off = off;
+        off = align(off + out_ids.size() * sizeof(uint32_t));
+        hdr.total_size = off;
+
+        image.assign(off, 0);
+        uint8_t *base = image.data();
+        memcpy(base, &hdr, sizeof(hdr));
+        memcpy(base + hdr.dense_off, dense.data(), dense.size() * sizeof(uint32_t));
+        memcpy(base + hdr.nodes_off, nodes.data(), n * sizeof(ac_node));
+        memcpy(base + hdr.match_off, match.data(), match.size() * sizeof(uint64_t));
+        memcpy(base + hdr.first_off, first.data(), n * sizeof(uint32_t));
+        memcpy(base + hdr.dict_off, dict.data(), n * sizeof(uint32_t));
+        memcpy(base + hdr.out_begin_off, out_begin.data(), (n + 1) * sizeof(uint32_t));
+        if (!out_ids.empty())
+            memcpy(base + hdr.out_ids_off, out_ids.data(), out_ids.size() * sizeof(uint32_t));
+        nodes.clear();
+        return true;
+    }
+
+    uint32_t max_dense;
+    unsigned max_prefilter_bytes;
+
+private:
+    static uint64_t align(uint64_t off)
+    {
+        return (off + 63) & ~63llu;
+    }
+
+    uint32_t child_of(uint32_t s, unsigned c) const
+    {
+        const ac_node &node = nodes[s];
+        uint64_t w = node.bits[c >> 6], bit = 1llu << (c & 63);
+        if (!(w & bit))
+            return AC_NONE;
+        return node.children + node.prefix[c >> 6] + __builtin_popcountll(w & (bit - 1));
+    }
+
+    bool build_prefilter(struct ac_image_header &hdr) const
+    {
+        for (unsigned c = 0; c < 256; c++) {
+            if (child_of(0, c) == AC_NONE)
+                continue;
+            hdr.prefilter_lo[c & 15] |= 1u << ((c >> 4) & 7);
+            hdr.prefilter_hi[c >> 4] = 1u << ((c >> 4) & 7);
+        }
+        unsigned num_candidates = 0;
+        for (unsigned c = 0; c < 256; c++)
+            if (hdr.prefilter_lo[c & 15] & hdr.prefilter_hi[c >> 4])
+                num_candidates ++;
+        return num_candidates <= max_prefilter_bytes;
+    }
+
+    std::vector<std::string> patterns;
+    std::vector<ac_node> nodes;
+};
+
+/*
+ * A read-only view of an automaton image.  The image must stay alive
+ * and unmodified while attached.
+ */
+class ACMatcher {
+public:
+    ACMatcher() : hdr(nullptr) { }
+
+    bool attach(const void *image)
+    {
+        const struct ac_image_header *h = (const struct ac_image_header *) image;
+        if (h == nullptr || h->magic != AC_IMAGE_MAGIC)
+            return false;
+        const uint8_t *base = (const uint8_t *) image;
+        hdr       = h;
+        dense     = (const uint32_t *) (base + h->dense_off);
+        nodes     = (const struct ac_node *) (base + h->nodes_off);
+        match     = (const uint64_t *) (base + h->match_off);
+        first     = (const uint32_t *) (base + h->first_off);
+        dict      = (const uint32_t *) (base + h->dict_off);
+        out_begin = (const uint32_t *) (base + h->out_begin_off);
+        out_ids   = (const uint32_t *) (base + h->out_ids_off);
+        num_dense = h->num_dense;
+        prefilter = h->use_prefilter != 0;
+        #ifdef __SSSE3__
+        lo_tbl = _mm_loadu_si128((const __m128i *) h->prefilter_lo);
+        hi_tbl = _mm_loadu_si128((const __m128i *) h->prefilter_hi);
+        #endif
+        return true;
+    }
+
+    const struct ac_image_header *header() const { return hdr; }
+
+    /**
+     * Returns the id of the first matching pattern, i.e., the lowest id
+     * among the patterns ending at the earliest position, or -1.
+     */
+    int first_match(const uint8_t *data, size_t len) const
+    {
+        uint32_t s = 0;
+        return first_match(data, len, s);
+    }
+
+    /**
+     * Continues the scan from state s (0 at the start) and leaves the
+     * last state in it, so that data split into several buffers (e.g.,
+     * mbuf segments) can be scanned as a whole, one buffer after another.
+     */
+    int first_match(const uint8_t *data, size_t len, uint32_t &s) const
+    {
+        size_t i = 0;
+        while (i < len) {
+            if (s == 0 && prefilter) {
+                i = skip(data, i, len);
+                if (i == len)
+                    break;
+            }
+            s = ac_next_state(dense, num_dense, nodes, s, data[i]);
+            if (ac_is_match(match, s))
+                return (int) first[s];
+            i ++;
+        }
+        return -1;
+    }
+
+    /** Calls f(pattern_id, end_offset) for every occurrence of every pattern. */
+    template <typename F>
+    void for_each_match(const uint8_t *data, size_t len, F f) const
+    {
+        uint32_t s = 0;
+        size_t i = 0;
+        while (i < len) {
+            if (s == 0 && prefilter) {
+                i = skip(data, i, len);
+                if (i == len)
+                    break;
+            }
+            s = ac_next_state(dense, num_dense, nodes, s, data[i]);
+            i ++;
+            if (!ac_is_match(match, s))
+                continue;
+            uint32_t t = (out_begin[s] != out_begin[s + 1]) ? s : dict[s];
+            while (t != AC_NONE) {
+                for (uint32_t j = out_begin[t]; j < out_begin[t + 1]; j++)
+                    f(out_ids[j], i);
+                t = dict[t];
+            }
+        }
+    }
+
+private:
+    /* Returns the first position from i whose byte may leave the root. */
+    size_t skip(const uint8_t *data, size_t i, size_t len) const
+    {
+        #ifdef __SSSE3__
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        const __m128i zero = _mm_setzero_si128();
+        while (i + 16 <= len) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+            __m128i lo = _mm_shuffle_epi8(lo_tbl, _mm_and_si128(v, nibble));
+            __m128i hi = _mm_shuffle_epi8(hi_tbl, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+            unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero)) & 0xffff;
+            if (mask != 0)
+                return i + __builtin_ctz(mask);
+            i += 16;
+        }
+        #endif
+        while (i < len && !(hdr->prefilter_lo[data[i] & 15] & hdr->prefilter_hi[data[i] >> 4]))
+            i ++;
+        return i;
+    }
+
+    const struct ac_image_header *hdr;
+    const uint32_t *dense;
+    const struct ac_node *nodes;
+    const uint64_t *match;
+    const uint32_t *first;
+    const uint32_t *dict;
+    const uint32_t *out_begin;
+    const uint32_t *out_ids;
+    uint32_t num_dense;
+    bool prefilter;
+    #ifdef __SSSE3__
+    __m128i lo_tbl;
+    __m128i hi_tbl;
+    #endif
+};
+
+/*
+ * Parses a rule line into a pattern.  Bytes are taken literally except
+ * that "|xx xx ...|" gives bytes in hex, as in Snort content options.
+ * Returns false on malformed hex escapes or an empty pattern.
+ */
+static inline bool ac_parse_pattern(const char *line, std::string &pattern)
+{
+    pattern.clear();
+    const char *p = line;
+    while (*p != '\0') {
+        if (*p != '|') {
+            pattern.push_back(*p++);
+            continue;
+        }
+        p++;
+        while (*p != '|') {
+            if (*p == ' ') {
+                p++;
+                continue;
+            }
+            if (!isxdigit((unsigned char) p[0]) || !isxdigit((unsigned char) p[1]))
+                return false;
+            char hex[3] = { p[0], p[1], '\0' };
+            pattern.push_back((char) strtoul(hex, nullptr, 16));
+            p += 2;
+        }
+        p++;
+    }
+    return !pattern.empty();
+}
+
+/*
+ * Loads patterns from a rule file with one pattern per line.  Empty
+ * lines and lines starting with '#' are skipped, as are the leading
+ * and trailing whitespace of each line.
+ * Returns 0 on success, -1 if the file cannot be opened, or the line
+ * number of the first malformed rule.
+ */
+static inline int ac_load_rules(const char *filename, std::vector<std::string> &patterns)
+{
+    FILE *fin = fopen(filename, "r");
+    if (fin == nullptr)
+        return -1;
+    char buf[4096];
+    std::string pattern;
+    int lineno = 0, ret = 0;
+    while (fgets(buf, sizeof(buf), fin) != nullptr) {
+        lineno ++;
+        char *p = buf, *end = buf + strlen(buf);
+        while (isspace((unsigned char) *p))
+            p++;
+        while (end > p && isspace((unsigned char) end[-1]))
+            end--;
+        *end = '\0';
+        if (*p == '\0' || *p == '#')
+            continue;
+        if (!ac_parse_pattern(p, pattern)) {
+            ret = lineno;
+            break;
+        }
+        patterns.push_back(pattern);
+    }
+    fclose(fin);
+    return ret;
+}
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,64 @@
+#include "CheckIPHeaderBatch.hh"
+#include "util_checkip.hh"
+#include <nba/framework/logging.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/loadbalancer.hh>
+#include <nba/element/packetbatch.hh>
+#include <rte_ring.h>
+
+using namespace std;
+using namespace nba;
+
+/* A valid minimum-size frame standing in for excluded packets. */
+static const uint8_t placeholder_frame[60] __rte_cache_aligned = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x08, 0x00,
+    0x45, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00,
+    0x7a, 0xeb, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+int CheckIPHeaderBatch::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    return 0;
+}
+
+int CheckIPHeaderBatch::process_batch(int input_port, PacketBatch *batch)
+{
+    const uint8_t *frames[NBA_MAX_COMP_BATCH_SIZE];
+    uint64_t drop_mask[(NBA_MAX_COMP_BATCH_SIZE + 63) / 64];
+    FOR_EACH_PACKET_ALL(batch) {
+        if (IS_PACKET_INVALID(batch, pkt_idx))
+            frames[pkt_idx] = placeholder_frame;
+        else
+            frames[pkt_idx] = rte_pktmbuf_mtod(batch->packets[pkt_idx], const uint8_t *);
+    } END_FOR_ALL;
+    check_ipv4_frames(frames, batch->count, drop_mask);
+
+    unsigned num_dropped = 0;
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    batch->has_dropped = false;
+    #endif
+    for (unsigned w = 0; w < (batch->count + 63) / 64; w++) {
+        uint64_t bits = drop_mask[w];
+        while (bits != 0) {
+            unsigned pkt_idx = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            #if NBA_BATCHING_SCHEME != NBA_BATCHING_CONTINUOUS
+            PacketBatch::drop_packet(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
+            #endif
+            EXCLUDE_PACKET(batch, pkt_idx);
+            num_dropped ++;
+        }
+    }
+    if (num_dropped > 0) {
+        RTE_LOG(DEBUG, ELEM, "CheckIPHeaderBatch: dropped %u invalid packets\n", num_dropped);
+        #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+        batch->collect_excluded_packets();
+        batch->clean_drops(ctx->io_ctx->drop_queue);
+        #endif
+        if (ctx->inspector) ctx->inspector->drop_pkt_count += num_dropped;
+    }
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
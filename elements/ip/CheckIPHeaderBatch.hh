@@ -0,0 +1,43 @@
+#ifndef __NBA_ELEMENT_IP_CHECKIPHEADERBATCH_HH__
+#define __NBA_ELEMENT_IP_CHECKIPHEADERBATCH_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+
+namespace nba {
+
+/**
+ * A batch-level variant of CheckIPHeader.
+ *
+ * It validates the IPv4 headers of all packets in a batch at once
+ * (using AVX2 if available) and drops the invalid ones.
+ */
+class CheckIPHeaderBatch : public PerBatchElement {
+public:
+    CheckIPHeaderBatch(): PerBatchElement()
+    {
+    }
+
+    ~CheckIPHeaderBatch()
+    {
+    }
+
+    const char *class_name() const { return "CheckIPHeaderBatch"; }
+    const char *port_count() const { return "1/1"; }
+
+    int initialize() { return 0; }
+    int initialize_global() { return 0; };      // per-system configuration
+    int initialize_per_node() { return 0; };    // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+
+    int process_batch(int input_port, PacketBatch *batch);
+};
+
+EXPORT_ELEMENT(CheckIPHeaderBatch);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,160 @@
+#include "ConnTrack.hh"
+#include <nba/core/timing.hh>
+#include <nba/element/annotation.hh>
+#include <nba/element/packetbatch.hh>
+#include <nba/framework/logging.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/loadbalancer.hh>
+#include <cstdio>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <rte_ether.h>
+#include <rte_malloc.h>
+#include <rte_ring.h>
+
+using namespace std;
+using namespace nba;
+
+ConnTrack::~ConnTrack()
+{
+    if (owns_table) {
+        rte_free(table_mem);
+        delete table;
+    }
+}
+
+int ConnTrack::initialize()
+{
+    size_t size = ConnTable::memory_size(capacity);
+    if (table == nullptr) {
+        table_mem = rte_malloc_socket("conntrack", size, CACHE_LINE_SIZE, ctx->loc.node_id);
+        if (table_mem == nullptr)
+            rte_panic("ConnTrack: could not allocate %'lu bytes for %u connections.\n",
+                      size, capacity);
+        table = new ConnTable();
+        table->init(capacity, table_mem);
+        table->set_timeouts(tcp_timeout, udp_timeout);
+        table->set_strict(strict);
+        owns_table = true;
+    }
+    /* Visit every slot about once a second. */
+    sweep_slots = RTE_MAX(table->slot_count() * SWEEP_INTERVAL_US / 1000000, (size_t) 64);
+    RTE_LOG(INFO, ELEM, "ConnTrack@%u: %u connections in %'lu bytes\n",
+            ctx->loc.core_id, capacity, size);
+    return 0;
+}
+
+void ConnTrack::adopt_state(Element *prev)
+{
+    ConnTrack *p = dynamic_cast<ConnTrack *>(prev);
+    table_mem = p->table_mem;
+    table = p->table;
+    owns_table = p->owns_table;
+    p->owns_table = false;
+}
+
+int ConnTrack::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    for (auto &arg : args) {
+        unsigned value;
+        if (sscanf(arg.c_str(), " CAPACITY %u", &value) == 1 && value > 0)
+            capacity = value;
+        else if (sscanf(arg.c_str(), " TCP_TIMEOUT %u", &value) == 1)
+            tcp_timeout = value;
+        else if (sscanf(arg.c_str(), " UDP_TIMEOUT %u", &value) == 1)
+            udp_timeout = value;
+        else if (sscanf(arg.c_str(), " STRICT %u", &value) == 1)
+            strict = (value != 0);
+        else
+            rte_panic("ConnTrack: invalid argument \"%s\"\n", arg.c_str());
+    }
+    return 0;
+}
+
+/* Fills the 5-tuple of an Ethernet frame.  Returns false if not IPv4. */
+static inline bool parse_tuple(const uint8_t *frame, struct conn_tuple &t)
+{
+    const struct ether_hdr *ethh = (const struct ether_hdr *) frame;
+    if (ethh->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4))
+        return false;
+    const struct iphdr *iph = (const struct iphdr *) (ethh + 1);
+    t.saddr = ntohl(iph->saddr);
+    t.daddr = ntohl(iph->daddr);
+    t.proto = iph->protocol;
+    t.sport = t.dport = 0;
+    t.tcp_flags = 0;
+    /* Only the first fragment has the L4 header. */
+    if ((ntohs(iph->frag_off) & IP_OFFMASK) != 0)
+        return true;
+    const uint8_t *l4 = (const uint8_t *) iph + (iph->ihl << 2);
+    switch (t.proto) {
+    case IPPROTO_TCP: {
+        const struct tcphdr *tcph = (const struct tcphdr *) l4;
+        t.sport = ntohs(tcph->source);
+        t.dport = ntohs(tcph->dest);
+        t.tcp_flags = l4[13];
+        break; }
+    case IPPROTO_UDP: {
+        const struct udphdr *udph = (const struct udphdr *) l4;
+        t.sport = ntohs(udph->source);
+        t.dport = ntohs(udph->dest);
+        break; }
+    }
+    return true;
+}
+
+int ConnTrack::process_batch(int input_port, PacketBatch *batch)
+{
+    struct conn_tuple tuples[NBA_MAX_COMP_BATCH_SIZE];
+    struct conn_result results[NBA_MAX_COMP_BATCH_SIZE];
+    unsigned idxs[NBA_MAX_COMP_BATCH_SIZE];
+    unsigned n = 0;
+    FOR_EACH_PACKET(batch) {
+        const uint8_t *frame = rte_pktmbuf_mtod(batch->packets[pkt_idx], const uint8_t *);
+        if (parse_tuple(frame, tuples[n]))
+            idxs[n ++] = pkt_idx;
+    } END_FOR;
+
+    uint32_t now = (uint32_t) (get_usec() / 1000);
+    table->track_batch(tuples, n, now, results);
+
+    const uint64_t id_base = (uint64_t) ctx->loc.core_id << 32;
+    unsigned num_dropped = 0;
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    batch->has_dropped = false;
+    #endif
+    for (unsigned i = 0; i < n; i++) {
+        unsigned pkt_idx = idxs[i];
+        if (strict && results[i].state == CONN_INVALID) {
+            #if NBA_BATCHING_SCHEME != NBA_BATCHING_CONTINUOUS
+            PacketBatch::drop_packet(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
+            #endif
+            EXCLUDE_PACKET(batch, pkt_idx);
+            num_dropped ++;
+            continue;
+        }
+        Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+        anno_set(&pkt->anno, NBA_ANNO_FLOW_ID, id_base | results[i].flow_id);
+        anno_set(&pkt->anno, NBA_ANNO_CONN_STATE, results[i].state);
+    }
+    if (num_dropped > 0) {
+        #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+        batch->collect_excluded_packets();
+        batch->clean_drops(ctx->io_ctx->drop_queue);
+        #endif
+        if (ctx->inspector) ctx->inspector->drop_pkt_count += num_dropped;
+    }
+    return 0;
+}
+
+int ConnTrack::dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay)
+{
+    table->expire((uint32_t) (get_usec() / 1000), sweep_slots);
+    out_batch = nullptr;
+    next_delay = SWEEP_INTERVAL_US;
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
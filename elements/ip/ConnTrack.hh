@@ -0,0 +1,70 @@
+#ifndef __NBA_ELEMENT_IP_CONNTRACK_HH__
+#define __NBA_ELEMENT_IP_CONNTRACK_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "util_conntrack.hh"
+
+namespace nba {
+
+/*
+ * ConnTrack([CAPACITY n], [TCP_TIMEOUT sec], [UDP_TIMEOUT sec], [STRICT 0|1])
+ *
+ * Tracks the IPv4 TCP/UDP/ICMP connections in a per-thread table of at
+ * most CAPACITY (default: 1M) connections and sets the NBA_ANNO_FLOW_ID
+ * and NBA_ANNO_CONN_STATE annotations of each packet.  TCP_TIMEOUT and
+ * UDP_TIMEOUT are the idle timeouts of established TCP connections and
+ * replied UDP (or other) flows.  In the STRICT mode, TCP packets that
+ * neither start nor belong to a tracked connection are dropped.
+ *
+ * Idle connections are removed by dispatch() sweeping a part of the
+ * table every SWEEP_INTERVAL_US.  As the table is per-thread, the same
+ * connection must always go to the same computation thread (e.g., by
+ * RSS with a symmetric key).  Graph reloads keep the table of the
+ * running ConnTrack with the same arguments.
+ */
+class ConnTrack : public SchedulableElement, PerBatchElement {
+public:
+    static const uint64_t SWEEP_INTERVAL_US = 10000;
+
+    ConnTrack(): SchedulableElement(), PerBatchElement(),
+                 capacity(1u << 20), tcp_timeout(3600), udp_timeout(180),
+                 strict(false), table_mem(nullptr), table(nullptr), owns_table(false)
+    {
+    }
+
+    ~ConnTrack();
+
+    const char *class_name() const { return "ConnTrack"; }
+    const char *port_count() const { return "1/1"; }
+    int get_type() const { return SchedulableElement::get_type() | PerBatchElement::get_type(); }
+
+    int initialize();
+    int initialize_global() { return 0; };      // per-system configuration
+    int initialize_per_node() { return 0; };    // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+    void adopt_state(Element *prev);
+
+    int process_batch(int input_port, PacketBatch *batch);
+    int dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay);
+
+private:
+    unsigned capacity;
+    unsigned tcp_timeout;
+    unsigned udp_timeout;
+    bool strict;
+    size_t sweep_slots;     // slots to scan per dispatch()
+
+    void *table_mem;
+    ConnTable *table;       // shared with the replaced instance in reloads
+    bool owns_table;
+};
+
+EXPORT_ELEMENT(ConnTrack);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,135 @@
+#include "IPNAPT.hh"
+#include <nba/core/timing.hh>
+#include <nba/framework/config.hh>
+#include <nba/framework/logging.hh>
+#include <nba/framework/threadcontext.hh>
+#include <cstdio>
+#include <new>
+#include <arpa/inet.h>
+#include <rte_ether.h>
+#include <rte_malloc.h>
+
+using namespace std;
+using namespace nba;
+
+static NAPTPortMap *napt_map = nullptr;
+
+int IPNAPT::initialize()
+{
+    _map = napt_map;
+    part_idx = 0;
+    while (part_idx < comp_thread_confs.size()
+           && comp_thread_confs[part_idx].core_id != (int) ctx->loc.core_id)
+        part_idx ++;
+    assert(part_idx < _map->num_parts());
+    if (_part == nullptr) {
+        _part = new NAPTPartition();
+        _part->init(_map, part_idx, timeout * 1000);
+        owns_part = true;
+    }
+    /* Visit every port of the partition about once a second. */
+    sweep_ports = RTE_MAX(_map->part_size() * SWEEP_INTERVAL_US / 1000000, (uint64_t) 8);
+    now_ms = (uint32_t) (get_usec() / 1000);
+    RTE_LOG(INFO, ELEM, "IPNAPT@%u: external ports %u-%u\n", ctx->loc.core_id,
+            _map->part_lo(part_idx), _map->part_lo(part_idx) + _map->part_size() - 1);
+    return 0;
+}
+
+void IPNAPT::adopt_state(Element *prev)
+{
+    IPNAPT *p = dynamic_cast<IPNAPT *>(prev);
+    _part = p->_part;
+    owns_part = p->owns_part;
+    p->owns_part = false;
+}
+
+// per-system configuration
+int IPNAPT::initialize_global()
+{
+    if (napt_map == nullptr) {
+        void *mem = rte_malloc("napt_map", sizeof(NAPTPortMap), CACHE_LINE_SIZE);
+        if (mem == nullptr)
+            rte_panic("IPNAPT: could not allocate the port map.\n");
+        napt_map = new (mem) NAPTPortMap();
+    }
+    if (!napt_map->init(ext_addr, port_lo, port_hi, comp_thread_confs.size()))
+        rte_panic("IPNAPT: too few ports (%u-%u) for %lu computation threads.\n",
+                  port_lo, port_hi, comp_thread_confs.size());
+    return 0;
+}
+
+int IPNAPT::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    for (auto &arg : args) {
+        char addr[64];
+        unsigned lo, hi, value;
+        struct in_addr in;
+        if (sscanf(arg.c_str(), " EXTERNAL_IP %63s", addr) == 1) {
+            if (inet_aton(addr, &in) == 0)
+                rte_panic("IPNAPT: invalid IP address %s\n", addr);
+            ext_addr = in.s_addr;
+        } else if (sscanf(arg.c_str(), " PORTS %u - %u", &lo, &hi) == 2) {
+            if (lo == 0 || hi > 65535 || lo > hi)
+                rte_panic("IPNAPT: invalid port range %u-%u\n", lo, hi);
+            port_lo = lo;
+            port_hi = hi;
+        } else if (sscanf(arg.c_str(), " TIMEOUT %u", &value) == 1)
+            timeout = value;
+        else
+            rte_panic("IPNAPT: invalid argument \"%s\"\n", arg.c_str());
+    }
+    if (ext_addr == 0)
+        rte_panic("IPNAPT: EXTERNAL_IP is required.\n");
+    return 0;
+}
+
+int IPNAPT::process(int input_port, Packet *pkt)
+{
+    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
+    if (ethh->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4)) {
+        pkt->kill();
+        return 0;
+    }
+    struct iphdr *iph = (struct iphdr *) (ethh + 1);
+    int pidx = NAPTPortMap::proto_idx(iph->protocol);
+    /* Non-first fragments do not have ports. */
+    if (pidx < 0 || (ntohs(iph->frag_off) & IP_OFFMASK) != 0) {
+        pkt->kill();
+        return 0;
+    }
+    uint16_t *ports = (uint16_t *) ((uint8_t *) iph + (iph->ihl << 2));
+
+    if (input_port == 0) {
+        uint16_t ext_port = _part->map_outbound(pidx, iph->saddr, ports[0], now_ms);
+        if (ext_port == 0) {
+            pkt->kill();
+            return 0;
+        }
+        napt_rewrite_source(iph, ext_addr, ext_port);
+        output(0).push(pkt);
+    } else {
+        uint16_t ext_port = ntohs(ports[1]);
+        uint32_t int_addr;
+        uint16_t int_port;
+        if (iph->daddr != ext_addr || !_map->lookup(pidx, ext_port, int_addr, int_port)) {
+            pkt->kill();
+            return 0;
+        }
+        _map->touch(pidx, ext_port, now_ms);
+        napt_rewrite_dest(iph, int_addr, int_port);
+        output(1).push(pkt);
+    }
+    return 0;
+}
+
+int IPNAPT::dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay)
+{
+    now_ms = (uint32_t) (get_usec() / 1000);
+    _part->expire(now_ms, sweep_ports);
+    out_batch = nullptr;
+    next_delay = SWEEP_INTERVAL_US;
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
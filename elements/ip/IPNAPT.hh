@@ -0,0 +1,77 @@
+#ifndef __NBA_ELEMENT_IP_IPNAPT_HH__
+#define __NBA_ELEMENT_IP_IPNAPT_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "util_napt.hh"
+
+namespace nba {
+
+/*
+ * IPNAPT(EXTERNAL_IP a.b.c.d, [PORTS lo-hi], [TIMEOUT sec])
+ *
+ * Source NAPT of IPv4 TCP/UDP packets to EXTERNAL_IP.  Input 0 takes
+ * outbound packets, whose source is rewritten to EXTERNAL_IP and a port
+ * in PORTS (default: 1024-65535), and sends them out via output 0.
+ * Input 1 takes inbound packets, whose destination is rewritten back to
+ * the internal endpoint, and sends them out via output 1.  Other
+ * packets and inbound ones without mappings are dropped.  Mappings idle
+ * for TIMEOUT (default: 300) seconds are removed.
+ *
+ * Each computation thread allocates ports only from its own partition
+ * of PORTS, so no locks are taken.  Inbound packets may come to any
+ * thread, which reads the mapping written by the owner of the port.
+ * Graph reloads keep the mappings of the running IPNAPT with the same
+ * arguments, and refuse other IPNAPTs while one is running.
+ */
+class IPNAPT : public SchedulableElement {
+public:
+    static const uint64_t SWEEP_INTERVAL_US = 10000;
+
+    IPNAPT(): SchedulableElement(),
+              ext_addr(0), port_lo(1024), port_hi(65535), timeout(300), part_idx(0),
+              sweep_ports(0), now_ms(0), _map(nullptr), _part(nullptr), owns_part(false)
+    {
+    }
+
+    ~IPNAPT()
+    {
+        if (owns_part)
+            delete _part;
+    }
+
+    const char *class_name() const { return "IPNAPT"; }
+    const char *port_count() const { return "2/2"; }
+
+    int initialize();
+    int initialize_global();        // per-system configuration
+    int initialize_per_node() { return 0; };    // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+    void adopt_state(Element *prev);
+    bool has_global_state() const { return true; }
+
+    int process(int input_port, Packet *pkt);
+    int dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay);
+
+private:
+    uint32_t ext_addr;      // network order
+    unsigned port_lo;
+    unsigned port_hi;
+    unsigned timeout;
+    unsigned part_idx;
+    unsigned sweep_ports;   // ports to check per dispatch()
+    uint32_t now_ms;        // updated by dispatch()
+
+    NAPTPortMap *_map;      // shared by all computation threads
+    NAPTPartition *_part;   // shared with the replaced instance in reloads
+    bool owns_part;
+};
+
+EXPORT_ELEMENT(IPNAPT);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -24,12 +24,10 @@ using namespace nba;
 IPlookup::IPlookup() : OffloadableElement(),
     num_tx_ports(0), rr_port(0),
     p_rwlock_TBL24(nullptr), p_rwlock_TBLlong(nullptr), tables(),
-    TBL24_h(nullptr), TBLlong_h(nullptr), TBL24_d{nullptr}, TBLlong_d{nullptr}
+    TBL24_d(nullptr), TBLlong_d(nullptr)
 {
     #if defined(USE_CUDA) && defined(USE_KNAPP)
         #error "Currently running both CUDA and KNAPP at the same time is not supported."
-        // FIXME: to do this, we need to separate TBL24_d/TBLlong_d
-        // dev_mem_t variables for each device types.
     #endif
     #ifdef USE_CUDA
     auto ch = [this](ComputeDevice *cdev, ComputeContext *ctx, struct resource_param *res) {
@@ -54,10 +52,8 @@ IPlookup::IPlookup() : OffloadableElement(),
     p_rwlock_TBLlong = nullptr;
     TBL24 = nullptr;
     TBLlong = nullptr;
-    TBL24_h = { nullptr} ;
-    TBLlong_h = { nullptr };
-    TBL24_d = { nullptr };
-    TBLlong_d = { nullptr };
+    TBL24_d = nullptr;
+    TBLlong_d = nullptr;
 }
 
 int IPlookup::initialize_global()
@@ -77,12 +73,11 @@ int IPlookup::initialize_per_node()
     /* Storage for routing table. */
     ctx->node_local_storage->alloc("TBL24", sizeof(uint16_t) * ipv4route::get_TBL24_size());
     ctx->node_local_storage->alloc("TBLlong", sizeof(uint16_t) * ipv4route::get_TBLlong_size());
-    /* Storage for host memobjs. */
-    ctx->node_local_storage->alloc("TBL24_host_memobj", sizeof(host_mem_t));
-    ctx->node_local_storage->alloc("TBLlong_host_memobj", sizeof(host_mem_t));
-    /* Storage for device memobjs. */
-    ctx->node_local_storage->alloc("TBL24_dev_memobj", sizeof(dev_mem_t));
-    ctx->node_local_storage->alloc("TBLlong_dev_memobj", sizeof(dev_mem_t));
+    /* Storage for device memobjs of each device. */
+    ctx->node_local_storage->alloc("TBL24_dev_memobj", sizeof(struct per_device_mem));
+    ctx->node_local_storage->alloc("TBLlong_dev_memobj", sizeof(struct per_device_mem));
+    ((struct per_device_mem *) ctx->node_local_storage->get_alloc("TBL24_dev_memobj"))->clear();
+    ((struct per_device_mem *) ctx->node_local_storage->get_alloc("TBLlong_dev_memobj"))->clear();
 
     printf("element::IPlookup: Initializing FIB from the global RIB for NUMA node %d...\n", node_idx);
 
@@ -96,16 +91,14 @@ int IPlookup::initialize_per_node()
 int IPlookup::initialize()
 {
     /* Get routing table pointers from the node-local storage. */
-    TBL24_h = (host_mem_t *) ctx->node_local_storage->get_alloc("TBL24_host_memobj");
-    TBLlong_h = (host_mem_t *) ctx->node_local_storage->get_alloc("TBLlong_host_memobj");
     TBL24 = (uint16_t *) ctx->node_local_storage->get_alloc("TBL24");
     TBLlong = (uint16_t *) ctx->node_local_storage->get_alloc("TBLlong");
     //p_rwlock_TBL24 = ctx->node_local_storage->get_rwlock("TBL24");
     //p_rwlock_TBLlong = ctx->node_local_storage->get_rwlock("TBLlong");
 
     /* Get device pointers from the node-local storage. */
-    TBL24_d   = (dev_mem_t *) ctx->node_local_storage->get_alloc("TBL24_dev_memobj");
-    TBLlong_d = (dev_mem_t *) ctx->node_local_storage->get_alloc("TBLlong_dev_memobj");
+    TBL24_d   = (struct per_device_mem *) ctx->node_local_storage->get_alloc("TBL24_dev_memobj");
+    TBLlong_d = (struct per_device_mem *) ctx->node_local_storage->get_alloc("TBLlong_dev_memobj");
 
     rr_port = 0;
     return 0;
@@ -195,21 +188,22 @@ void IPlookup::accel_init_handler(ComputeDevice *device)
 
     TBL24   = (uint16_t *) ctx->node_local_storage->get_alloc("TBL24");
     TBLlong = (uint16_t *) ctx->node_local_storage->get_alloc("TBLlong");
-    TBL24_h   = (host_mem_t *) ctx->node_local_storage->get_alloc("TBL24_host_memobj");
-    TBLlong_h = (host_mem_t *) ctx->node_local_storage->get_alloc("TBLlong_host_memobj");
-    *TBL24_h   = device->alloc_host_buffer(TBL24_alloc_size, 0);
-    *TBLlong_h = device->alloc_host_buffer(TBLlong_alloc_size, 0);
-    memcpy(device->unwrap_host_buffer(*TBL24_h), TBL24, TBL24_alloc_size);
-    memcpy(device->unwrap_host_buffer(*TBLlong_h), TBLlong, TBLlong_alloc_size);
-
-    TBL24_d   = (dev_mem_t *) ctx->node_local_storage->get_alloc("TBL24_dev_memobj");
-    TBLlong_d = (dev_mem_t *) ctx->node_local_storage->get_alloc("TBLlong_dev_memobj");
-    *TBL24_d   = device->alloc_device_buffer(TBL24_alloc_size, 0, *TBL24_h);
-    *TBLlong_d = device->alloc_device_buffer(TBLlong_alloc_size, 0, *TBLlong_h);
+    host_mem_t TBL24_h   = device->alloc_host_buffer(TBL24_alloc_size, 0);
+    host_mem_t TBLlong_h = device->alloc_host_buffer(TBLlong_alloc_size, 0);
+    memcpy(device->unwrap_host_buffer(TBL24_h), TBL24, TBL24_alloc_size);
+    memcpy(device->unwrap_host_buffer(TBLlong_h), TBLlong, TBLlong_alloc_size);
+
+    /* Each device in the node gets its own copy. */
+    TBL24_d   = (struct per_device_mem *) ctx->node_local_storage->get_alloc("TBL24_dev_memobj");
+    TBLlong_d = (struct per_device_mem *) ctx->node_local_storage->get_alloc("TBLlong_dev_memobj");
+    dev_mem_t *TBL24_dm   = TBL24_d->add(device);
+    dev_mem_t *TBLlong_dm = TBLlong_d->add(device);
+    *TBL24_dm   = device->alloc_device_buffer(TBL24_alloc_size, 0, TBL24_h);
+    *TBLlong_dm = device->alloc_device_buffer(TBLlong_alloc_size, 0, TBLlong_h);
 
     /* Convert host-side routing table to host_mem_t and copy the routing table. */
-    device->memwrite(*TBL24_h,   *TBL24_d,   0, TBL24_alloc_size);
-    device->memwrite(*TBLlong_h, *TBLlong_d, 0, TBLlong_alloc_size);
+    device->memwrite(TBL24_h,   *TBL24_dm,   0, TBL24_alloc_size);
+    device->memwrite(TBLlong_h, *TBLlong_dm, 0, TBLlong_alloc_size);
 }
 
 void IPlookup::accel_compute_handler(ComputeDevice *cdev,
@@ -218,10 +212,10 @@ void IPlookup::accel_compute_handler(ComputeDevice *cdev,
 {
     struct kernel_arg arg;
     void *ptr_args[2];
-    ptr_args[0] = cdev->unwrap_device_buffer(*TBL24_d);
+    ptr_args[0] = cdev->unwrap_device_buffer(*TBL24_d->find(cdev));
     arg = {&ptr_args[0], sizeof(void *), alignof(void *)};
     cctx->push_kernel_arg(arg);
-    ptr_args[1] = cdev->unwrap_device_buffer(*TBLlong_d);
+    ptr_args[1] = cdev->unwrap_device_buffer(*TBLlong_d->find(cdev));
     arg = {&ptr_args[1], sizeof(void *), alignof(void *)};
     cctx->push_kernel_arg(arg);
     dev_kernel_t kern;
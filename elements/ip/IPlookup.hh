@@ -66,10 +66,8 @@ protected:
     ipv4route::route_hash_t tables[33];
     uint16_t *TBL24;
     uint16_t *TBLlong;
-    host_mem_t *TBL24_h;
-    host_mem_t *TBLlong_h;
-    dev_mem_t *TBL24_d;
-    dev_mem_t *TBLlong_d;
+    struct per_device_mem *TBL24_d;
+    struct per_device_mem *TBLlong_d;
 };
 
 EXPORT_ELEMENT(IPlookup);
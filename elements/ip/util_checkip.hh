@@ -0,0 +1,164 @@
+#ifndef __NBA_UTIL_CHECKIP_HH__
+#define __NBA_UTIL_CHECKIP_HH__
+
+#include <cstdint>
+#include <cstring>
+#include <nba/core/checksum.hh>
+#include <rte_ether.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace nba {
+
+/**
+ * Validates the IPv4 header of an Ethernet frame with the same checks as
+ * CheckIPHeader::process(): the ether type, the version and IHL, the
+ * total length against the header length, and the header checksum.
+ */
+static inline bool check_ipv4_frame(const uint8_t *frame)
+{
+    const struct ether_hdr *ethh = (const struct ether_hdr *) frame;
+    const struct iphdr *iph = (const struct iphdr *) (ethh + 1);
+    if (ntohs(ethh->ether_type) != ETHER_TYPE_IPv4)
+        return false;
+    if (iph->version != 4 || iph->ihl < 5)
+        return false;
+    if (iph->ihl * 4 > ntohs(iph->tot_len))
+        return false;
+    return ip_fast_csum(iph, iph->ihl) == 0;
+}
+
+/**
+ * Validates count frames and sets bit i of drop_mask (an array of
+ * (count + 63) / 64 words) for each invalid frame i.
+ */
+static inline void check_ipv4_frames_scalar(const uint8_t *const *frames, unsigned count,
+                                            uint64_t *drop_mask)
+{
+    memset(drop_mask, 0, sizeof(uint64_t) * ((count + 63) / 64));
+    for (unsigned i = 0; i < count; i++)
+        if (!check_ipv4_frame(frames[i]))
+            drop_mask[i >> 6] |= (1llu << (i & 63));
+}
+
+#ifdef __AVX2__
+namespace detail {
+
+/* Sums the 16-bit words of each row into a 32-bit lane (row i to lane i). */
+static inline __m256i checkip_sum_rows(__m256i rows[8])
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i s[8];
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm256_add_epi32(_mm256_unpacklo_epi16(rows[i], zero),
+                                _mm256_unpackhi_epi16(rows[i], zero));
+    __m256i s01 = _mm256_hadd_epi32(s[0], s[1]);
+    __m256i s23 = _mm256_hadd_epi32(s[2], s[3]);
+    __m256i s45 = _mm256_hadd_epi32(s[4], s[5]);
+    __m256i s67 = _mm256_hadd_epi32(s[6], s[7]);
+    __m256i s0123 = _mm256_hadd_epi32(s01, s23);
+    __m256i s4567 = _mm256_hadd_epi32(s45, s67);
+    /* Each 128-bit half holds the partial sums of rows 0-3 / 4-7. */
+    return _mm256_add_epi32(_mm256_permute2x128_si256(s0123, s4567, 0x20),
+                            _mm256_permute2x128_si256(s0123, s4567, 0x31));
+}
+
+/* Collects word 0 and word 1 of each row into w0 and w1 (row i to lane i). */
+static inline void checkip_transpose_words(const __m256i rows[8], __m256i &w0, __m256i &w1)
+{
+    __m128i lo[2], hi[2];
+    for (int k = 0; k < 2; k++) {
+        __m128i a = _mm_unpacklo_epi32(_mm256_castsi256_si128(rows[4 * k + 0]),
+                                       _mm256_castsi256_si128(rows[4 * k + 1]));
+        __m128i b = _mm_unpacklo_epi32(_mm256_castsi256_si128(rows[4 * k + 2]),
+                                       _mm256_castsi256_si128(rows[4 * k + 3]));
+        lo[k] = _mm_unpacklo_epi64(a, b);
+        hi[k] = _mm_unpackhi_epi64(a, b);
+    }
+    w0 = _mm256_inserti128_si256(_mm256_castsi128_si256(lo[0]), lo[1], 1);
+    w1 = _mm256_inserti128_si256(_mm256_castsi128_si256(hi[0]), hi[1], 1);
+}
+
+} // endns(detail)
+
+/**
+ * The AVX2 version of check_ipv4_frames_scalar(), eight frames at a time.
+ *
+ * The header checksum of option-less headers is summed vertically: each
+ * frame contributes a 32-byte row starting at the ether type, masked to
+ * the 20-byte IP header, and the rows are reduced to per-frame sums with
+ * horizontal adds.  The one's complement sum does not depend on the byte
+ * order, so the words are added as loaded.  Headers with options fall
+ * back to ip_fast_csum().  It reads 32 bytes from offset 12 of every
+ * frame, which the minimum Ethernet frame covers.
+ */
+static inline void check_ipv4_frames_avx2(const uint8_t *const *frames, unsigned count,
+                                          uint64_t *drop_mask)
+{
+    memset(drop_mask, 0, sizeof(uint64_t) * ((count + 63) / 64));
+    /* Bytes 2..21 of a row are the IP header. */
+    const __m256i hdr_mask = _mm256_setr_epi32(0xffff0000, -1, -1, -1, -1, 0x0000ffff, 0, 0);
+    /* Ether type 0x0800, version 4 and IHL 5 in the first row word. */
+    const __m256i fast_mask = _mm256_set1_epi32(0x00ffffff);
+    const __m256i fast_value = _mm256_set1_epi32(0x00450008);
+    const __m256i low16 = _mm256_set1_epi32(0xffff);
+    const __m256i min_tot_len = _mm256_set1_epi32(19);
+    unsigned i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i rows[8];
+        for (int j = 0; j < 8; j++)
+            rows[j] = _mm256_loadu_si256((const __m256i *) (frames[i + j] + 12));
+        /* Transpose the first two words of each row: the ether type,
+         * version/IHL and TOS (w0), and the total length (w1). */
+        __m256i w0, w1;
+        detail::checkip_transpose_words(rows, w0, w1);
+        for (int j = 0; j < 8; j++)
+            rows[j] = _mm256_and_si256(rows[j], hdr_mask);
+        __m256i sum = detail::checkip_sum_rows(rows);
+        sum = _mm256_add_epi32(_mm256_and_si256(sum, low16), _mm256_srli_epi32(sum, 16));
+        sum = _mm256_add_epi32(_mm256_and_si256(sum, low16), _mm256_srli_epi32(sum, 16));
+        __m256i csum_ok = _mm256_cmpeq_epi32(sum, low16);
+
+        __m256i fast = _mm256_cmpeq_epi32(_mm256_and_si256(w0, fast_mask), fast_value);
+        __m256i tot_len = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(w1, _mm256_set1_epi32(0xff)), 8),
+                                          _mm256_and_si256(_mm256_srli_epi32(w1, 8), _mm256_set1_epi32(0xff)));
+        __m256i len_ok = _mm256_cmpgt_epi32(tot_len, min_tot_len);
+        __m256i ok = _mm256_and_si256(fast, _mm256_and_si256(len_ok, csum_ok));
+        unsigned ok_bits = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+        unsigned fast_bits = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(fast));
+        unsigned drop_bits = (~ok_bits) & 0xffu;
+        /* Frames other than option-less IPv4 get the full check. */
+        unsigned slow_bits = (~fast_bits) & 0xffu;
+        while (slow_bits != 0) {
+            unsigned j = __builtin_ctz(slow_bits);
+            slow_bits &= slow_bits - 1;
+            if (check_ipv4_frame(frames[i + j]))
+                drop_bits &= ~(1u << j);
+        }
+        drop_mask[i >> 6] |= (uint64_t) drop_bits << (i & 63);
+    }
+    for (; i < count; i++)
+        if (!check_ipv4_frame(frames[i]))
+            drop_mask[i >> 6] |= (1llu << (i & 63));
+}
+#endif
+
+/** Uses the AVX2 version when the build target supports it. */
+static inline void check_ipv4_frames(const uint8_t *const *frames, unsigned count,
+                                     uint64_t *drop_mask)
+{
+#ifdef __AVX2__
+    check_ipv4_frames_avx2(frames, count, drop_mask);
+#else
+    check_ipv4_frames_scalar(frames, count, drop_mask);
+#endif
+}
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
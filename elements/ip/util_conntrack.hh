@@ -0,0 +1,399 @@
+#ifndef __NBA_UTIL_CONNTRACK_HH__
+#define __NBA_UTIL_CONNTRACK_HH__
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <netinet/in.h>
+
+namespace nba {
+
+enum ConnState : uint8_t {
+    CONN_INVALID = 0,   /* not tracked (e.g., table full or strict mode) */
+    CONN_NEW,           /* non-TCP flow not replied yet */
+    CONN_ESTABLISHED,
+    CONN_SYN_SENT,
+    CONN_SYN_RECV,
+    CONN_FIN_WAIT,      /* FIN seen in one direction */
+    CONN_TIME_WAIT,     /* FIN seen in both directions */
+    CONN_CLOSED,        /* RST seen */
+    CONN_NUM_STATES
+};
+
+enum : uint8_t {
+    CONN_TCP_FIN = 0x01,
+    CONN_TCP_SYN = 0x02,
+    CONN_TCP_RST = 0x04,
+    CONN_TCP_ACK = 0x10,
+};
+
+/* The 5-tuple of a packet, with the TCP flags if any. */
+struct conn_tuple {
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t tcp_flags;
+};
+
+struct conn_result {
+    uint32_t flow_id;
+    uint8_t state;
+    uint8_t reply;      /* 1 if the packet goes against the first one */
+};
+
+/**
+ * A per-thread connection tracking table.
+ *
+ * It is an open-addressing hash table with linear probing over 32-byte
+ * slots (two per cache line), keyed by the 5-tuple in a canonical order
+ * so that both directions of a connection share a slot.  It is sized to
+ * keep the load factor at most 1/2, and removals shift the following
+ * entries back instead of leaving tombstones.
+ *
+ * track_batch() hashes all tuples of a batch and prefetches their home
+ * slots before probing any of them.  Entries are only removed by
+ * expire(), which sweeps a bounded number of slots per call, so the
+ * results of a batch never refer to moved entries.
+ *
+ * Times are in milliseconds from any (wrapping) 32-bit clock.
+ */
+class ConnTable {
+public:
+    enum : unsigned { PREFETCH_WINDOW = 64 };
+
+    enum : uint8_t {
+        F_ORIG_HI   = 0x01,     /* the originator is the (addr, port)_hi side */
+        F_FIN_ORIG  = 0x02,
+        F_FIN_REPLY = 0x04,
+    };
+
+    struct entry {
+        uint32_t addr_lo, addr_hi;
+        uint16_t port_lo, port_hi;
+        uint8_t proto;          /* 0 for empty slots */
+        uint8_t state;
+        uint8_t flags;
+        uint8_t _reserved;
+        uint32_t flow_id;
+        uint32_t expires;
+        uint64_t num_pkts;
+    };
+    static_assert(sizeof(struct entry) == 32, "Two entries must fit in a cache line.");
+
+    ConnTable() : num_inserts(0), num_expired(0), num_invalid(0),
+                  _slots(nullptr), _mask(0), _shift(64), _capacity(0),
+                  _count(0), _next_flow_id(0), _cursor(0), _strict(false)
+    {
+        set_timeouts(3600, 180);
+    }
+
+    /** The bytes of memory (cache-aligned) for the given capacity. */
+    static size_t memory_size(size_t capacity)
+    {
+        return num_slots(capacity) * sizeof(struct entry);
+    }
+
+    /**
+     * Uses mem of memory_size(capacity) bytes for at most capacity
+     * connections.  The caller owns mem.
+     */
+    void init(size_t capacity, void *mem)
+    {
+        size_t n = num_slots(capacity);
+        unsigned bits = 0;
+        while ((1llu << bits) < n)
+            bits ++;
+        _slots = (struct entry *) mem;
+        _mask = n - 1;
+        _shift = 64 - bits;
+        _capacity = capacity;
+        _count = 0;
+        _cursor = 0;
+        memset(_slots, 0, n * sizeof(struct entry));
+    }
+
+    /** Timeouts of TCP established and UDP (or other) replied flows in seconds. */
+    void set_timeouts(uint32_t tcp_established_sec, uint32_t udp_sec)
+    {
+        static const uint32_t tcp_default[CONN_NUM_STATES] = {
+            0, 0, 0, 120, 60, 120, 120, 10,
+        };
+        for (unsigned s = 0; s < CONN_NUM_STATES; s++) {
+            _timeout[1][s] = tcp_default[s] * 1000;
+            _timeout[0][s] = udp_sec * 1000;
+        }
+        _timeout[1][CONN_ESTABLISHED] = tcp_established_sec * 1000;
+        _timeout[0][CONN_NEW] = 30 * 1000;
+    }
+
+    /** In the strict mode, TCP connections are created only by SYNs. */
+    void set_strict(bool strict) { _strict = strict; }
+
+    size_t size() const { return _count; }
+    size_t capacity() const { return _capacity; }
+    size_t slot_count() const { return _mask + 1; }
+
+    /** Tracks the packets of a batch, updating their connections. */
+    void track_batch(const struct conn_tuple *tuples, unsigned count, uint32_t now,
+                     struct conn_result *results)
+    {
+        uint64_t hashes[PREFETCH_WINDOW];
+        for (unsigned base = 0; base < count; base += PREFETCH_WINDOW) {
+            unsigned n = (count - base < PREFETCH_WINDOW) ? count - base : PREFETCH_WINDOW;
+            for (unsigned i = 0; i < n; i++) {
+                hashes[i] = hash(tuples[base + i]);
+                __builtin_prefetch(&_slots[hashes[i] >> _shift], 1, 3);
+            }
+            for (unsigned i = 0; i < n; i++)
+                track(tuples[base + i], hashes[i], now, results[base + i]);
+        }
+    }
+
+    /**
+     * Removes expired connections in the next max_slots slots.
+     * Returns the number of removed ones.
+     */
+    unsigned expire(uint32_t now, size_t max_slots)
+    {
+        unsigned removed = 0;
+        size_t i = _cursor;
+        for (size_t scanned = 0; scanned < max_slots && _count > 0; scanned ++) {
+            struct entry &e = _slots[i];
+            if (e.proto != 0 && (int32_t) (now - e.expires) >= 0) {
+                erase(i);
+                removed ++;
+                /* A following entry may have moved into slot i. */
+                continue;
+            }
+            i = (i + 1) & _mask;
+        }
+        _cursor = i;
+        num_expired += removed;
+        return removed;
+    }
+
+    /** Returns the entry of a tuple (in either direction), or nullptr. */
+    const struct entry *find(const struct conn_tuple &t) const
+    {
+        uint32_t alo, ahi;
+        uint16_t plo, phi;
+        canonicalize(t, alo, ahi, plo, phi);
+        for (size_t i = hash(t) >> _shift; ; i = (i + 1) & _mask) {
+            const struct entry &e = _slots[i];
+            if (e.proto == 0)
+                return nullptr;
+            if (e.addr_lo == alo && e.addr_hi == ahi && e.port_lo == plo
+                    && e.port_hi == phi && e.proto == t.proto)
+                return &e;
+        }
+    }
+
+    uint64_t num_inserts;
+    uint64_t num_expired;
+    uint64_t num_invalid;
+
+private:
+    static size_t num_slots(size_t capacity)
+    {
+        size_t n = 2;
+        while (n < 2 * capacity)
+            n <<= 1;
+        return n;
+    }
+
+    /* Returns true if (saddr, sport) is the hi side. */
+    static inline bool canonicalize(const struct conn_tuple &t,
+                                    uint32_t &alo, uint32_t &ahi,
+                                    uint16_t &plo, uint16_t &phi)
+    {
+        bool swap = (t.saddr > t.daddr) || (t.saddr == t.daddr && t.sport > t.dport);
+        alo = swap ? t.daddr : t.saddr;
+        ahi = swap ? t.saddr : t.daddr;
+        plo = swap ? t.dport : t.sport;
+        phi = swap ? t.sport : t.dport;
+        return swap;
+    }
+
+    static inline uint64_t mix(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9llu;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebllu;
+        return z ^ (z >> 31);
+    }
+
+    static inline uint64_t hash_canonical(uint32_t alo, uint32_t ahi, uint16_t plo,
+                                          uint16_t phi, uint8_t proto)
+    {
+        uint64_t a = ((uint64_t) alo << 32) | ahi;
+        uint64_t p = ((uint64_t) plo << 24) | ((uint64_t) phi << 8) | proto;
+        return mix(a ^ mix(p));
+    }
+
+    static inline uint64_t hash(const struct conn_tuple &t)
+    {
+        uint32_t alo, ahi;
+        uint16_t plo, phi;
+        canonicalize(t, alo, ahi, plo, phi);
+        return hash_canonical(alo, ahi, plo, phi, t.proto);
+    }
+
+    uint32_t timeout_of(const struct entry &e) const
+    {
+        return _timeout[e.proto == IPPROTO_TCP][e.state];
+    }
+
+    void track(const struct conn_tuple &t, uint64_t h, uint32_t now, struct conn_result &r)
+    {
+        uint32_t alo, ahi;
+        uint16_t plo, phi;
+        bool from_hi = canonicalize(t, alo, ahi, plo, phi);
+        size_t i = h >> _shift;
+        while (true) {
+            struct entry &e = _slots[i];
+            if (e.proto == 0)
+                break;
+            if (e.addr_lo == alo && e.addr_hi == ahi && e.port_lo == plo
+                    && e.port_hi == phi && e.proto == t.proto) {
+                bool reply = (from_hi != ((e.flags & F_ORIG_HI) != 0));
+                if ((int32_t) (now - e.expires) >= 0) {
+                    /* Not swept yet; start over as a new connection. */
+                    if (!init_state(e, t, from_hi)) {
+                        e.state = CONN_CLOSED;
+                        num_invalid ++;
+                        r = {e.flow_id, CONN_INVALID, 0};
+                        return;
+                    }
+                    e.flow_id = _next_flow_id ++;
+                    e.num_pkts = 0;
+                    reply = false;
+                } else if (t.proto == IPPROTO_TCP)
+                    update_tcp(e, t.tcp_flags, reply);
+                else if (reply)
+                    e.state = CONN_ESTABLISHED;
+                e.num_pkts ++;
+                e.expires = now + timeout_of(e);
+                r = {e.flow_id, e.state, (uint8_t) reply};
+                return;
+            }
+            i = (i + 1) & _mask;
+        }
+
+        /* Not found: insert at the empty slot i. */
+        struct entry &e = _slots[i];
+        if (_count == _capacity || !init_state(e, t, from_hi)) {
+            num_invalid ++;
+            r = {0, CONN_INVALID, 0};
+            return;
+        }
+        e.addr_lo = alo;
+        e.addr_hi = ahi;
+        e.port_lo = plo;
+        e.port_hi = phi;
+        e.proto = t.proto;
+        e.flow_id = _next_flow_id ++;
+        e.num_pkts = 1;
+        e.expires = now + timeout_of(e);
+        _count ++;
+        num_inserts ++;
+        r = {e.flow_id, e.state, 0};
+    }
+
+    /* Sets the state and flags of a new connection from its first packet.
+     * Returns false if the packet cannot start a connection. */
+    bool init_state(struct entry &e, const struct conn_tuple &t, bool from_hi)
+    {
+        e.flags = from_hi ? F_ORIG_HI : 0;
+        if (t.proto != IPPROTO_TCP) {
+            e.state = CONN_NEW;
+            return true;
+        }
+        uint8_t f = t.tcp_flags;
+        if (f & CONN_TCP_RST)
+            return false;
+        if ((f & (CONN_TCP_SYN | CONN_TCP_ACK)) == CONN_TCP_SYN) {
+            e.state = CONN_SYN_SENT;
+            return true;
+        }
+        if (_strict)
+            return false;
+        /* Pick up a connection in the middle (e.g., after a restart). */
+        e.state = (f & CONN_TCP_FIN) ? CONN_FIN_WAIT : CONN_ESTABLISHED;
+        if (f & CONN_TCP_FIN)
+            e.flags |= F_FIN_ORIG;
+        return true;
+    }
+
+    static void update_tcp(struct entry &e, uint8_t f, bool reply)
+    {
+        if (f & CONN_TCP_RST) {
+            e.state = CONN_CLOSED;
+            return;
+        }
+        bool syn_only = ((f & (CONN_TCP_SYN | CONN_TCP_ACK)) == CONN_TCP_SYN);
+        switch (e.state) {
+        case CONN_SYN_SENT:
+            if (reply && (f & CONN_TCP_SYN) && (f & CONN_TCP_ACK))
+                e.state = CONN_SYN_RECV;
+            break;
+        case CONN_SYN_RECV:
+            if (!reply && (f & CONN_TCP_ACK) && !(f & CONN_TCP_SYN))
+                e.state = CONN_ESTABLISHED;
+            break;
+        case CONN_ESTABLISHED:
+        case CONN_FIN_WAIT:
+            if (f & CONN_TCP_FIN) {
+                e.flags |= reply ? F_FIN_REPLY : F_FIN_ORIG;
+                e.state = ((e.flags & (F_FIN_ORIG | F_FIN_REPLY)) == (F_FIN_ORIG | F_FIN_REPLY))
+                          ? CONN_TIME_WAIT : CONN_FIN_WAIT;
+            }
+            break;
+        case CONN_TIME_WAIT:
+        case CONN_CLOSED:
+            /* Reuse of the same tuple by the originator. */
+            if (!reply && syn_only) {
+                e.state = CONN_SYN_SENT;
+                e.flags &= F_ORIG_HI;
+            }
+            break;
+        }
+    }
+
+    /* Removes slot i, shifting back the following entries that are
+     * allowed to move closer to their home slots. */
+    void erase(size_t i)
+    {
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & _mask;
+            struct entry &e = _slots[j];
+            if (e.proto == 0)
+                break;
+            size_t home = hash_canonical(e.addr_lo, e.addr_hi, e.port_lo,
+                                         e.port_hi, e.proto) >> _shift;
+            if (((j - home) & _mask) >= ((j - i) & _mask)) {
+                _slots[i] = e;
+                i = j;
+            }
+        }
+        _slots[i].proto = 0;
+        _count --;
+    }
+
+    struct entry *_slots;
+    size_t _mask;
+    unsigned _shift;
+    size_t _capacity;
+    size_t _count;
+    uint32_t _next_flow_id;
+    size_t _cursor;
+    bool _strict;
+    uint32_t _timeout[2][CONN_NUM_STATES];     /* [is_tcp][state] in msec */
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,319 @@
+#ifndef __NBA_UTIL_NAPT_HH__
+#define __NBA_UTIL_NAPT_HH__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <nba/core/checksum.hh>
+
+namespace nba {
+
+/**
+ * The reverse mappings of an external address, shared by all threads.
+ *
+ * Each (protocol, external port) has one 64-bit word holding the internal
+ * address and port, written only by the thread owning the port and read
+ * by any thread with plain atomic loads.  The ports are partitioned into
+ * contiguous ranges, one per thread, aligned to cache lines.
+ */
+class NAPTPortMap {
+public:
+    enum : unsigned { NUM_PROTOS = 2 };     /* TCP and UDP */
+
+    NAPTPortMap() : _ext_addr(0), _port_lo(0), _port_hi(0), _num_parts(0), _part_size(0)
+    {
+        memset(_rev, 0, sizeof(_rev));
+        memset(_last_used, 0, sizeof(_last_used));
+    }
+
+    /**
+     * ext_addr is in network byte order.  Ports in [port_lo, port_hi] are
+     * split into num_parts partitions.  Returns false if a partition
+     * would get less than 8 ports or port_lo is 0.  The mappings left
+     * by the previous configuration are removed.
+     */
+    bool init(uint32_t ext_addr, uint16_t port_lo, uint16_t port_hi, unsigned num_parts)
+    {
+        if (num_parts == 0 || port_lo == 0 || port_hi < port_lo)
+            return false;
+        /* Multiples of 8 keep partitions in distinct cache lines. */
+        unsigned part_size = ((port_hi - port_lo + 1u) / num_parts) & ~7u;
+        if (part_size < 8)
+            return false;
+        _ext_addr = ext_addr;
+        _port_lo = port_lo;
+        _port_hi = port_hi;
+        _num_parts = num_parts;
+        _part_size = part_size;
+        memset(_rev, 0, sizeof(_rev));
+        memset(_last_used, 0, sizeof(_last_used));
+        return true;
+    }
+
+    uint32_t ext_addr() const { return _ext_addr; }
+    unsigned num_parts() const { return _num_parts; }
+
+    /** The ports of a partition are [part_lo(p), part_lo(p) + part_size()). */
+    uint16_t part_lo(unsigned part) const { return _port_lo + part * _part_size; }
+    unsigned part_size() const { return _part_size; }
+
+    static inline int proto_idx(uint8_t proto)
+    {
+        return (proto == IPPROTO_TCP) ? 0 : ((proto == IPPROTO_UDP) ? 1 : -1);
+    }
+
+    /** Returns true and the internal address/port (network order) of ext_port. */
+    inline bool lookup(int pidx, uint16_t ext_port, uint32_t &int_addr, uint16_t &int_port) const
+    {
+        uint64_t w = __atomic_load_n(&_rev[pidx][ext_port], __ATOMIC_ACQUIRE);
+        if (!(w & VALID))
+            return false;
+        int_addr = (uint32_t) (w >> 16);
+        int_port = (uint16_t) w;
+        return true;
+    }
+
+    /* Below are called by the owner of ext_port only. */
+    inline void set(int pidx, uint16_t ext_port, uint32_t int_addr, uint16_t int_port)
+    {
+        uint64_t w = VALID | ((uint64_t) int_addr << 16) | int_port;
+        __atomic_store_n(&_rev[pidx][ext_port], w, __ATOMIC_RELEASE);
+    }
+
+    inline void clear(int pidx, uint16_t ext_port)
+    {
+        __atomic_store_n(&_rev[pidx][ext_port], 0, __ATOMIC_RELEASE);
+    }
+
+    /* The last use in either direction, in msec. */
+    inline void touch(int pidx, uint16_t ext_port, uint32_t now)
+    {
+        if (__atomic_load_n(&_last_used[pidx][ext_port], __ATOMIC_RELAXED) != now)
+            __atomic_store_n(&_last_used[pidx][ext_port], now, __ATOMIC_RELAXED);
+    }
+
+    inline uint32_t last_used(int pidx, uint16_t ext_port) const
+    {
+        return __atomic_load_n(&_last_used[pidx][ext_port], __ATOMIC_RELAXED);
+    }
+
+private:
+    static const uint64_t VALID = 1llu << 63;
+
+    uint32_t _ext_addr;
+    uint16_t _port_lo, _port_hi;
+    unsigned _num_parts;
+    unsigned _part_size;
+    uint64_t _rev[NUM_PROTOS][65536] __attribute__((aligned(64)));
+    uint32_t _last_used[NUM_PROTOS][65536] __attribute__((aligned(64)));
+};
+
+/**
+ * The per-thread part of NAPT: the forward mappings of the internal
+ * endpoints and the free external ports of the thread's partition.
+ *
+ * Mappings are endpoint-independent: an internal (address, port) keeps
+ * the same external port for all remote endpoints until it stays idle
+ * for the timeout.  As the forward mappings are per-thread, the packets
+ * from an internal endpoint must always come to the same thread.
+ */
+class NAPTPartition {
+public:
+    NAPTPartition() : num_mappings(0), num_exhausted(0), num_expired(0),
+                      _map(nullptr), _part(0), _cursor(0), _timeout_ms(0) { }
+
+    void init(NAPTPortMap *map, unsigned part, uint32_t timeout_ms)
+    {
+        _map = map;
+        _part = part;
+        _timeout_ms = timeout_ms;
+        unsigned n = map->part_size();
+        unsigned slots = 2;
+        while (slots < 4 * n)   /* two protocols, load factor <= 1/2 */
+            slots <<= 1;
+        _fwd.assign(slots, fwd_entry());
+        for (int p = 0; p < (int) NAPTPortMap::NUM_PROTOS; p++) {
+            _free[p].clear();
+            for (unsigned i = 0; i < n; i++)
+                _free[p].push_back(map->part_lo(part) + i);
+            _free_head[p] = 0;
+            _free_count[p] = n;
+        }
+        _cursor = 0;
+    }
+
+    /**
+     * Returns the external port (host order) of an internal endpoint
+     * (network order), allocating one if needed.  Returns 0 if all ports
+     * of the partition are in use.
+     */
+    uint16_t map_outbound(int pidx, uint32_t int_addr, uint16_t int_port, uint32_t now)
+    {
+        uint64_t key = make_key(pidx, int_addr, int_port);
+        size_t mask = _fwd.size() - 1;
+        size_t i = slot_of(key);
+        while (_fwd[i].key != 0) {
+            if (_fwd[i].key == key) {
+                _map->touch(pidx, _fwd[i].ext_port, now);
+                return _fwd[i].ext_port;
+            }
+            i = (i + 1) & mask;
+        }
+        if (_free_count[pidx] == 0) {
+            num_exhausted ++;
+            return 0;
+        }
+        uint16_t ext_port = _free[pidx][_free_head[pidx]];
+        _free_head[pidx] = (_free_head[pidx] + 1) % _free[pidx].size();
+        _free_count[pidx] --;
+        _fwd[i].key = key;
+        _fwd[i].ext_port = ext_port;
+        _map->touch(pidx, ext_port, now);
+        _map->set(pidx, ext_port, int_addr, int_port);
+        num_mappings ++;
+        return ext_port;
+    }
+
+    /** Removes idle mappings among the next max_ports ports. */
+    unsigned expire(uint32_t now, unsigned max_ports)
+    {
+        unsigned removed = 0, n = _map->part_size();
+        for (unsigned k = 0; k < max_ports && k < n; k++) {
+            uint16_t ext_port = _map->part_lo(_part) + _cursor;
+            _cursor = (_cursor + 1) % n;
+            for (int p = 0; p < (int) NAPTPortMap::NUM_PROTOS; p++) {
+                uint32_t int_addr;
+                uint16_t int_port;
+                if (!_map->lookup(p, ext_port, int_addr, int_port))
+                    continue;
+                if ((int32_t) (now - _map->last_used(p, ext_port)) < (int32_t) _timeout_ms)
+                    continue;
+                _map->clear(p, ext_port);
+                erase(make_key(p, int_addr, int_port));
+                size_t tail = (_free_head[p] + _free_count[p]) % _free[p].size();
+                _free[p][tail] = ext_port;
+                _free_count[p] ++;
+                removed ++;
+            }
+        }
+        num_mappings -= removed;
+        num_expired += removed;
+        return removed;
+    }
+
+    uint64_t num_mappings;
+    uint64_t num_exhausted;
+    uint64_t num_expired;
+
+private:
+    struct fwd_entry {
+        uint64_t key;       /* 0 for empty slots */
+        uint16_t ext_port;
+        fwd_entry() : key(0), ext_port(0) { }
+    };
+
+    static inline uint64_t make_key(int pidx, uint32_t addr, uint16_t port)
+    {
+        return ((uint64_t) (pidx + 1) << 48) | ((uint64_t) addr << 16) | port;
+    }
+
+    inline size_t slot_of(uint64_t key) const
+    {
+        return (size_t) ((key * 0x9e3779b97f4a7c15llu) >> 32) & (_fwd.size() - 1);
+    }
+
+    /* Removes a key, shifting back the following entries. */
+    void erase(uint64_t key)
+    {
+        size_t mask = _fwd.size() - 1;
+        size_t i = slot_of(key);
+        while (_fwd[i].key != key) {
+            if (_fwd[i].key == 0)
+                return;
+            i = (i + 1) & mask;
+        }
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (_fwd[j].key == 0)
+                break;
+            size_t home = slot_of(_fwd[j].key);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                _fwd[i] = _fwd[j];
+                i = j;
+            }
+        }
+        _fwd[i].key = 0;
+    }
+
+    NAPTPortMap *_map;
+    unsigned _part;
+    unsigned _cursor;
+    uint32_t _timeout_ms;
+    std::vector<struct fwd_entry> _fwd;
+    std::vector<uint16_t> _free[NAPTPortMap::NUM_PROTOS];   /* FIFO of free ports */
+    size_t _free_head[NAPTPortMap::NUM_PROTOS];
+    size_t _free_count[NAPTPortMap::NUM_PROTOS];
+};
+
+/* Returns the L4 checksum field of an IPv4 packet, or nullptr if it has none. */
+static inline uint16_t *napt_l4_csum(struct iphdr *iph, void *l4)
+{
+    if (iph->protocol == IPPROTO_TCP)
+        return &((struct tcphdr *) l4)->check;
+    /* A zero UDP checksum means no checksum. */
+    uint16_t *csum = &((struct udphdr *) l4)->check;
+    return (*csum != 0) ? csum : nullptr;
+}
+
+static inline void napt_fix_udp_zero(struct iphdr *iph, uint16_t *csum)
+{
+    if (iph->protocol == IPPROTO_UDP && *csum == 0)
+        *csum = 0xffff;
+}
+
+/**
+ * Rewrites the source of an outbound IPv4 TCP/UDP packet to the external
+ * address and ext_port (host order), updating checksums incrementally.
+ */
+static inline void napt_rewrite_source(struct iphdr *iph, uint32_t ext_addr, uint16_t ext_port)
+{
+    uint8_t *l4 = (uint8_t *) iph + (iph->ihl << 2);
+    uint16_t *sport = (uint16_t *) l4;  /* the same offset in TCP and UDP */
+    uint16_t new_port = htons(ext_port);
+    uint16_t *csum = napt_l4_csum(iph, l4);
+    if (csum != nullptr) {
+        *csum = csum_replace4(*csum, iph->saddr, ext_addr);
+        *csum = csum_replace2(*csum, *sport, new_port);
+        napt_fix_udp_zero(iph, csum);
+    }
+    iph->check = csum_replace4(iph->check, iph->saddr, ext_addr);
+    iph->saddr = ext_addr;
+    *sport = new_port;
+}
+
+/** Rewrites the destination of an inbound packet to an internal endpoint (network order). */
+static inline void napt_rewrite_dest(struct iphdr *iph, uint32_t int_addr, uint16_t int_port)
+{
+    uint8_t *l4 = (uint8_t *) iph + (iph->ihl << 2);
+    uint16_t *dport = (uint16_t *) (l4 + 2);
+    uint16_t *csum = napt_l4_csum(iph, l4);
+    if (csum != nullptr) {
+        *csum = csum_replace4(*csum, iph->daddr, int_addr);
+        *csum = csum_replace2(*csum, *dport, int_port);
+        napt_fix_udp_zero(iph, csum);
+    }
+    iph->check = csum_replace4(iph->check, iph->daddr, int_addr);
+    iph->daddr = int_addr;
+    *dport = int_port;
+}
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
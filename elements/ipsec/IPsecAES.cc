@@ -16,21 +16,19 @@
 #include <openssl/aes.h>
 #include <openssl/sha.h>
 #include "util_esp.hh"
-#include "util_ipsec_key.hh"
 #include "util_sa_entry.hh"
+#include "IPsecSAD.hh"
 #include <rte_memory.h>
 #include <rte_ether.h>
 
 using namespace std;
 using namespace nba;
 
-/* Array which stores per-tunnel AES key for each tunnel.
+/* Array which stores per-tunnel AES key for each tunnel, indexed by the
+ * SA index in the shared SAD.
  * It is copied to each node's node local storage during per-node initialization
  * and freed in per-thread initialization.*/
 struct aes_sa_entry *aes_sa_entry_array;
-/* Map which stores (src-dst pair, tunnel index).
- * It is copied to each node's node local storage during per-node initialization*/
-unordered_map<struct ipaddr_pair, int> aes_sa_table;
 
 IPsecAES::IPsecAES(): OffloadableElement()
 {
@@ -56,15 +54,13 @@ IPsecAES::IPsecAES(): OffloadableElement()
 int IPsecAES::initialize()
 {
     // Get ptr for CPU & GPU from the node-local storage.
-
-    /* Storage for host ipsec tunnel index table */
-    h_sa_table = (unordered_map<struct ipaddr_pair, int> *)ctx->node_local_storage->get_alloc("h_aes_sa_table");
+    num_tunnels = ipsec_sad_global().size();
 
     /* Storage for host aes key array */
     flows = (struct aes_sa_entry *) ctx->node_local_storage->get_alloc("h_aes_flows");
 
     /* Get device pointer from the node local storage. */
-    flows_d = (dev_mem_t *) ctx->node_local_storage->get_alloc("d_aes_flows_ptr");
+    flows_d = (struct per_device_mem *) ctx->node_local_storage->get_alloc("d_aes_flows_ptr");
 
     if (aes_sa_entry_array != NULL) {
         free(aes_sa_entry_array);
@@ -76,22 +72,17 @@ int IPsecAES::initialize()
 
 int IPsecAES::initialize_global()
 {
-    // generate global table and array only once per element class.
-    struct ipaddr_pair pair;
+    // generate global array only once per element class.
     struct aes_sa_entry *entry;
     unsigned char fake_iv[AES_BLOCK_SIZE] = {0};
+    const IPsecSAD &sad = ipsec_sad_global();
 
-    assert(num_tunnels != 0);
+    num_tunnels = sad.size();
     aes_sa_entry_array = (struct aes_sa_entry *) malloc (sizeof(struct aes_sa_entry) *num_tunnels);
     for (int i = 0; i < num_tunnels; i++) {
-        pair.src_addr  = 0x0a000001u;
-        pair.dest_addr = 0x0a000000u | (i + 1); // (rand() % 0xffffff);
-        auto result = aes_sa_table.insert(make_pair<ipaddr_pair&, int&>(pair, i));
-        assert(result.second == true);
-
         entry = &aes_sa_entry_array[i];
         entry->entry_idx = i;
-        rte_memcpy(entry->aes_key, "1234123412341234", AES_BLOCK_SIZE);
+        rte_memcpy(entry->aes_key, sad.get(i)->aes_key, AES_BLOCK_SIZE);
 #ifdef USE_OPENSSL_EVP
         // TODO: check if copying globally initialized evpctx works okay.
         EVP_CIPHER_CTX_init(&entry->evpctx);
@@ -109,22 +100,11 @@ int IPsecAES::initialize_global()
 
 int IPsecAES::initialize_per_node()
 {
-    unordered_map<struct ipaddr_pair, int> *temp_table = NULL;
     struct aes_sa_entry *temp_array = NULL;
-    struct ipaddr_pair key;
-    int value, size;
-
-    /* Storage for host ipsec tunnel index table */
-    size = sizeof(unordered_map<struct ipaddr_pair, int>);
-    ctx->node_local_storage->alloc("h_aes_sa_table", size);
-    temp_table = (unordered_map<struct ipaddr_pair, int> *)ctx->node_local_storage->get_alloc("h_aes_sa_table");
-    new (temp_table) unordered_map<struct ipaddr_pair, int>();
-
-    for (auto iter = aes_sa_table.begin(); iter != aes_sa_table.end(); iter++) {
-        key = iter->first;
-        value = iter->second;
-        temp_table->insert(make_pair<ipaddr_pair&, int&>(key, value));
-    }
+    int size;
+
+    ipsec_sad_init_per_node(ctx);
+    num_tunnels = ipsec_sad_global().size();
 
     /* Storage for host aes key array */
     size = sizeof(struct aes_sa_entry) * num_tunnels;
@@ -134,7 +114,8 @@ int IPsecAES::initialize_per_node()
     rte_memcpy(temp_array, aes_sa_entry_array, size);
 
     /* Storage for pointer, which points aes key array in device */
-    ctx->node_local_storage->alloc("d_aes_flows_ptr", sizeof(dev_mem_t));
+    ctx->node_local_storage->alloc("d_aes_flows_ptr", sizeof(struct per_device_mem));
+    ((struct per_device_mem *) ctx->node_local_storage->get_alloc("d_aes_flows_ptr"))->clear();
 
     return 0;
 }
@@ -142,7 +123,8 @@ int IPsecAES::initialize_per_node()
 int IPsecAES::configure(comp_thread_context *ctx, std::vector<std::string> &args)
 {
     Element::configure(ctx, args);
-    num_tunnels = 1024;            // TODO: this value must be come from configuration.
+    if (ipsec_sad_configure(ctx, class_name(), args) != 0)
+        return -1;
     return 0;
 }
 
@@ -157,21 +139,14 @@ int IPsecAES::process(int input_port, Packet *pkt)
 {
     struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
     struct iphdr *iph      = (struct iphdr *) (ethh + 1);
-    struct esphdr *esph    = (struct esphdr *) (iph + 1);
-    uint8_t ecount_buf[AES_BLOCK_SIZE] = { 0 };
-
-    // TODO: support decrpytion.
-    uint8_t *encrypt_ptr = (uint8_t*) esph + sizeof(*esph);
-    int encrypted_len = ntohs(iph->tot_len) - sizeof(struct iphdr) - sizeof(struct esphdr) - SHA_DIGEST_LENGTH;
-    int pad_len = AES_BLOCK_SIZE - (encrypted_len + 2) % AES_BLOCK_SIZE;
-    int enc_size = encrypted_len + pad_len + 2;    // additional two bytes mean the "extra" part.
-    int err = 0;
     struct aes_sa_entry *sa_entry = NULL;
 
     if (likely(anno_isset(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID))) {
         sa_entry = &flows[anno_get(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID)];
-        unsigned mode = 0;
 #ifdef USE_OPENSSL_EVP
+        struct esphdr *esph = (struct esphdr *) (iph + 1);
+        uint8_t *encrypt_ptr = esp_payload(iph);
+        int encrypted_len = esp_payload_len(iph);
         int cipher_body_len = 0;
         int cipher_add_len = 0;
         memcpy(sa_entry->evpctx.iv, esph->esp_iv, AES_BLOCK_SIZE);
@@ -180,7 +155,7 @@ int IPsecAES::process(int input_port, Packet *pkt)
         if (EVP_EncryptFinal(&sa_entry->evpctx, encrypt_ptr + cipher_body_len, &cipher_add_len) != 1)
             fprintf(stderr, "IPsecAES: EVP_EncryptFinal() - %s\n", ERR_error_string(ERR_get_error(), NULL));
 #else
-        AES_ctr128_encrypt(encrypt_ptr, encrypt_ptr, enc_size, &sa_entry->aes_key_t, esph->esp_iv, ecount_buf, &mode);
+        esp_aes_ctr_crypt(iph, &sa_entry->aes_key_t);
 #endif
     } else {
         pkt->kill();
@@ -194,14 +169,16 @@ int IPsecAES::process(int input_port, Packet *pkt)
 void IPsecAES::accel_init_handler(ComputeDevice *device)
 {
     // Put key array content to device space.
+    num_tunnels = ipsec_sad_global().size();
     size_t flows_size = sizeof(struct aes_sa_entry) * num_tunnels;
     flows = (struct aes_sa_entry *) ctx->node_local_storage->get_alloc("h_aes_flows");
-    flows_d  = (dev_mem_t *) ctx->node_local_storage->get_alloc("d_aes_flows_ptr");
+    flows_d  = (struct per_device_mem *) ctx->node_local_storage->get_alloc("d_aes_flows_ptr");
+    dev_mem_t *dev_flows = flows_d->add(device);
     host_mem_t flows_h;
     flows_h  = device->alloc_host_buffer(flows_size, 0);
-    *flows_d = device->alloc_device_buffer(flows_size, 0, flows_h);
+    *dev_flows = device->alloc_device_buffer(flows_size, 0, flows_h);
     memcpy(device->unwrap_host_buffer(flows_h), flows, flows_size);
-    device->memwrite(flows_h, *flows_d, 0, flows_size);
+    device->memwrite(flows_h, *dev_flows, 0, flows_size);
 }
 
 void IPsecAES::accel_compute_handler(ComputeDevice *cdev,
@@ -210,7 +187,7 @@ void IPsecAES::accel_compute_handler(ComputeDevice *cdev,
 {
     struct kernel_arg arg;
     void *ptr_args[1];
-    ptr_args[0] = cdev->unwrap_device_buffer(*flows_d);
+    ptr_args[0] = cdev->unwrap_device_buffer(*flows_d->find(cdev));
     arg = {&ptr_args[0], sizeof(void *), alignof(void *)};
     cctx->push_kernel_arg(arg);
 
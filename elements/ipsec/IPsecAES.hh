@@ -4,7 +4,6 @@
 #include <nba/element/element.hh>
 #include <vector>
 #include <string>
-#include <unordered_map>
 #include "util_sa_entry.hh"
 #include "IPsecDatablocks.hh"
 
@@ -59,10 +58,10 @@ protected:
     /* Maximum number of IPsec tunnels */
     int num_tunnels;
 
-    /* Per-thread pointers, which points to the node local storage variables. */
-    std::unordered_map<struct ipaddr_pair, int> *h_sa_table; // tunnel lookup is done in CPU only. No need for GPU ptr.
+    /* Per-thread pointers, which points to the node local storage variables.
+     * The tunnel lookup is done by IPsecESPencap using the shared SAD. */
     struct aes_sa_entry *flows = nullptr; // used in CPU.
-    dev_mem_t *flows_d;
+    struct per_device_mem *flows_d;
 };
 
 EXPORT_ELEMENT(IPsecAES);
@@ -0,0 +1,93 @@
+#include "IPsecAESDecrypt.hh"
+#include <nba/element/annotation.hh>
+#include <nba/element/nodelocalstorage.hh>
+#include <nba/framework/threadcontext.hh>
+#include <netinet/ip.h>
+#include <openssl/aes.h>
+#include <rte_ether.h>
+#include <rte_debug.h>
+
+using namespace std;
+using namespace nba;
+
+static const char *key_nls_names[IPsecAESDecrypt::AES_NUM_MODES] = {
+    "h_aes_dec_keys.ctr",
+    "h_aes_dec_keys.cbc",
+};
+static bool node_keys_ready[NBA_MAX_NODES][IPsecAESDecrypt::AES_NUM_MODES];
+
+int IPsecAESDecrypt::initialize()
+{
+    keys = (AES_KEY *) ctx->node_local_storage->get_alloc(key_nls_names[mode]);
+    return 0;
+}
+
+int IPsecAESDecrypt::initialize_global()
+{
+    ipsec_sad_global();
+    return 0;
+}
+
+int IPsecAESDecrypt::initialize_per_node()
+{
+    ipsec_sad_init_per_node(ctx);
+    unsigned node_id = ctx->loc.node_id;
+    if (node_keys_ready[node_id][mode])
+        return 0;
+
+    /* CTR mode decrypts with the encryption key schedule. */
+    const IPsecSAD &sad = ipsec_sad_global();
+    ctx->node_local_storage->alloc(key_nls_names[mode], sizeof(AES_KEY) * sad.size());
+    AES_KEY *node_keys = (AES_KEY *) ctx->node_local_storage->get_alloc(key_nls_names[mode]);
+    for (uint32_t i = 0; i < sad.size(); i++) {
+        if (mode == AES_MODE_CBC)
+            AES_set_decrypt_key(sad.get(i)->aes_key, 128, &node_keys[i]);
+        else
+            AES_set_encrypt_key(sad.get(i)->aes_key, 128, &node_keys[i]);
+    }
+    node_keys_ready[node_id][mode] = true;
+    return 0;
+}
+
+int IPsecAESDecrypt::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    if (args.size() == 0 || args[0] == "CTR")
+        mode = AES_MODE_CTR;
+    else if (args[0] == "CBC")
+        mode = AES_MODE_CBC;
+    else
+        rte_panic("IPsecAESDecrypt: unknown mode: %s (expected: CTR | CBC)\n", args[0].c_str());
+    return 0;
+}
+
+// Input packet: authenticated by IPsecAuthVerifyHMACSHA1.
+// +----------+---------------+--------+----+------------+---------+-------+---------------------+
+// | Ethernet | IP(proto=ESP) |  ESP   | IP |  payload   | padding | extra | HMAC-SHA1 signature |
+// +----------+---------------+--------+----+------------+---------+-------+---------------------+
+// ^ethh      ^iph            ^esph    ^decrypt_ptr
+//                                     <===== to be decrypted with AES ====>
+//
+int IPsecAESDecrypt::process(int input_port, Packet *pkt)
+{
+    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
+    struct iphdr *iph      = (struct iphdr *) (ethh + 1);
+
+    if (unlikely(!anno_isset(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID))) {
+        pkt->kill();
+        return 0;
+    }
+    const AES_KEY *key = &keys[anno_get(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID)];
+    if (mode == AES_MODE_CBC) {
+        if (!esp_aes_cbc_decrypt(iph, key)) {
+            pkt->kill();
+            return 0;
+        }
+    } else {
+        esp_aes_ctr_crypt(iph, key);
+    }
+    output(0).push(pkt);
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
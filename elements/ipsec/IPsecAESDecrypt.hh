@@ -0,0 +1,56 @@
+#ifndef __NBA_ELEMENT_IPSEC_IPSECAESDECRYPT_HH__
+#define __NBA_ELEMENT_IPSEC_IPSECAESDECRYPT_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "IPsecSAD.hh"
+
+namespace nba {
+
+/*
+ * Decrypts the payload of authenticated inbound ESP packets with the
+ * AES key of the SA found by IPsecSPILookup.
+ *
+ * Arguments: [CTR | CBC] (default: CTR, which matches IPsecAES)
+ */
+class IPsecAESDecrypt : public Element {
+public:
+    enum aes_mode {
+        AES_MODE_CTR = 0,
+        AES_MODE_CBC = 1,
+        AES_NUM_MODES,
+    };
+
+    IPsecAESDecrypt(): Element(), mode(AES_MODE_CTR), keys(nullptr)
+    {
+    }
+
+    ~IPsecAESDecrypt()
+    {
+    }
+
+    const char *class_name() const { return "IPsecAESDecrypt"; }
+    const char *port_count() const { return "1/1"; }
+
+    int initialize();
+    int initialize_global();        // per-system configuration
+    int initialize_per_node();      // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+
+    int process(int input_port, Packet *pkt);
+
+protected:
+    enum aes_mode mode;
+
+    /* Per-SA key schedules for the mode in the node-local storage. */
+    AES_KEY *keys;
+};
+
+EXPORT_ELEMENT(IPsecAESDecrypt);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
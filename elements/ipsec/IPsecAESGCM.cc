@@ -0,0 +1,88 @@
+#include "IPsecAESGCM.hh"
+#include <nba/element/annotation.hh>
+#include <nba/framework/threadcontext.hh>
+#include <xmmintrin.h>
+#include <netinet/ip.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+
+using namespace std;
+using namespace nba;
+
+int IPsecAESGCM::initialize()
+{
+    sad = ipsec_sad_attach(ctx);
+    gcm.resize(sad.size());
+    for (uint32_t i = 0; i < sad.size(); i++) {
+        gcm[i] = new AESGCM128();
+        gcm[i]->set_key(sad.get(i)->aes_key);
+    }
+    return 0;
+}
+
+int IPsecAESGCM::initialize_global()
+{
+    ipsec_sad_global();
+    return 0;
+}
+
+int IPsecAESGCM::initialize_per_node()
+{
+    ipsec_sad_init_per_node(ctx);
+    return 0;
+}
+
+int IPsecAESGCM::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    if (ipsec_sad_configure(ctx, class_name(), args) != 0)
+        return -1;
+    return 0;
+}
+
+// Input packet: ESP-encapsulated by IPsecESPencap.
+// +----------+---------------+--------+----+------------+---------+-------+-----------+
+// | Ethernet | IP(proto=ESP) |  ESP   | IP |  payload   | padding | extra | ICV space |
+// +----------+---------------+--------+----+------------+---------+-------+-----------+
+//                              24 (16-byte IV)                                   20
+//
+// Output packet: RFC 4106 layout (see util_esp_gcm.hh)
+// +----------+---------------+-------------+----+------------+---------+-------+---------+
+// | Ethernet | IP(proto=ESP) | SPI+Seq+IV  | IP |  payload   | padding | extra | GCM ICV |
+// +----------+---------------+-------------+----+------------+---------+-------+---------+
+//                                   16       <========== encrypted =========>      16
+//
+int IPsecAESGCM::process(int input_port, Packet *pkt)
+{
+    if (unlikely(!anno_isset(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID))) {
+        pkt->kill();
+        return 0;
+    }
+    uint32_t sa_idx = (uint32_t) anno_get(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID);
+    const struct ipsec_sa *sa = sad.get(sa_idx);
+
+    // Hack for latency measurement experiments.
+    constexpr uintptr_t latency_offset = sizeof(struct ether_hdr)
+                                         + sizeof(struct ipv4_hdr)
+                                         + sizeof(struct udp_hdr);
+    __m128i timestamp;  // actual size: uin16 + uint64
+    if (ctx->preserve_latency)
+        timestamp = _mm_loadu_si128((__m128i *) (pkt->data() + latency_offset));
+
+    void *l3 = esp_gcm_reformat(pkt->data(), sizeof(struct ether_hdr));
+    pkt->pull(ESP_IV_LENGTH - ESP_GCM_IV_LENGTH);
+    pkt->take(SHA_DIGEST_LENGTH - ESP_GCM_ICV_LENGTH);
+
+    if (unlikely(!esp_gcm_seal(l3, *gcm[sa_idx], sa->aes_salt))) {
+        pkt->kill();
+        return 0;
+    }
+
+    if (ctx->preserve_latency)
+        _mm_storeu_si128((__m128i *) (pkt->data() + latency_offset), timestamp);
+    output(0).push(pkt);
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,54 @@
+#ifndef __NBA_ELEMENT_IPSEC_IPSECAESGCM_HH__
+#define __NBA_ELEMENT_IPSEC_IPSECAESGCM_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "IPsecSAD.hh"
+#include "util_esp_gcm.hh"
+
+namespace nba {
+
+/*
+ * Encrypts and authenticates packets from IPsecESPencap with AES-GCM
+ * (RFC 4106) in a single pass, replacing IPsecAES + IPsecAuthHMACSHA1.
+ *
+ * Arguments: [NUM_TUNNELS | SA_FILE] (see IPsecSAD.hh)
+ */
+class IPsecAESGCM : public Element {
+public:
+    IPsecAESGCM(): Element()
+    {
+    }
+
+    ~IPsecAESGCM()
+    {
+        for (AESGCM128 *g : gcm)
+            delete g;
+    }
+
+    const char *class_name() const { return "IPsecAESGCM"; }
+    const char *port_count() const { return "1/1"; }
+
+    int initialize();
+    int initialize_global();        // per-system configuration
+    int initialize_per_node();      // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+
+    int process(int input_port, Packet *pkt);
+
+protected:
+    IPsecSAD sad;
+
+    /* Per-thread GCM contexts indexed by SA, with their keys expanded
+     * once, since it costs more than sealing a small packet. */
+    std::vector<AESGCM128 *> gcm;
+};
+
+EXPORT_ELEMENT(IPsecAESGCM);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,91 @@
+#include "IPsecAESGCMDecrypt.hh"
+#include <nba/element/annotation.hh>
+#include <nba/framework/threadcontext.hh>
+#include <netinet/ip.h>
+#include <rte_ether.h>
+
+using namespace std;
+using namespace nba;
+
+int IPsecAESGCMDecrypt::initialize()
+{
+    sad = ipsec_sad_attach(ctx);
+    sa_states = ipsec_sad_state_attach(ctx);
+    gcm.resize(sad.size());
+    for (uint32_t i = 0; i < sad.size(); i++) {
+        gcm[i] = new AESGCM128();
+        gcm[i]->set_key(sad.get(i)->aes_key);
+    }
+    return 0;
+}
+
+int IPsecAESGCMDecrypt::initialize_global()
+{
+    ipsec_sad_global();
+    return 0;
+}
+
+int IPsecAESGCMDecrypt::initialize_per_node()
+{
+    ipsec_sad_init_per_node(ctx);
+    return 0;
+}
+
+int IPsecAESGCMDecrypt::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    if (ipsec_sad_configure(ctx, class_name(), args) != 0)
+        return -1;
+    return 0;
+}
+
+// Input packet: RFC 4106 layout, looked up by IPsecSPILookup.
+// +----------+---------------+-------------+----+------------+---------+-------+---------+
+// | Ethernet | IP(proto=ESP) | SPI+Seq+IV  | IP |  payload   | padding | extra | GCM ICV |
+// +----------+---------------+-------------+----+------------+---------+-------+---------+
+// ^ethh      ^l3                  16       <========== decrypted =========>      16
+//
+// Output packet:
+// +----------+----+------------+
+// | Ethernet | IP |  payload   |
+// +----------+----+------------+
+//
+int IPsecAESGCMDecrypt::process(int input_port, Packet *pkt)
+{
+    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
+    uint8_t *l3            = (uint8_t *) (ethh + 1);
+
+    if (unlikely(!anno_isset(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID))) {
+        pkt->kill();
+        return 0;
+    }
+    uint32_t sa_idx = (uint32_t) anno_get(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID);
+    const struct ipsec_sa *sa = sad.get(sa_idx);
+    if (unlikely(!esp_gcm_open(l3, *gcm[sa_idx], sa->aes_salt))) {
+        pkt->kill();
+        return 0;
+    }
+
+    /* Only authenticated packets advance the window. */
+    struct ipsec_sa_state *st = &sa_states[sa_idx];
+    rte_spinlock_lock(&st->replay_lock);
+    bool fresh = st->replay.update(ntohl(esp_gcm_header(l3)->esp_rpl));
+    rte_spinlock_unlock(&st->replay_lock);
+    if (!fresh) {
+        pkt->kill();
+        return 0;
+    }
+
+    int outer_len = esp_l3_len(l3);
+    int inner_len = esp_gcm_decap(l3);
+    if (inner_len < 0) {
+        pkt->kill();
+        return 0;
+    }
+    ethh->ether_type = htons(esp_is_ipv6(l3) ? ETHER_TYPE_IPv6 : ETHER_TYPE_IPv4);
+    pkt->take(outer_len - inner_len);
+    output(0).push(pkt);
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,56 @@
+#ifndef __NBA_ELEMENT_IPSEC_IPSECAESGCMDECRYPT_HH__
+#define __NBA_ELEMENT_IPSEC_IPSECAESGCMDECRYPT_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "IPsecSAD.hh"
+#include "util_esp_gcm.hh"
+
+namespace nba {
+
+/*
+ * Verifies and decrypts AES-GCM (RFC 4106) packets from IPsecSPILookup
+ * in a single pass, advances the anti-replay window and restores the
+ * inner IP packet.  It replaces IPsecAuthVerifyHMACSHA1, IPsecAESDecrypt
+ * and IPsecESPdecap for the packets sealed by IPsecAESGCM.
+ *
+ * Arguments: [NUM_TUNNELS | SA_FILE] (see IPsecSAD.hh)
+ */
+class IPsecAESGCMDecrypt : public Element {
+public:
+    IPsecAESGCMDecrypt(): Element(), sa_states(nullptr)
+    {
+    }
+
+    ~IPsecAESGCMDecrypt()
+    {
+        for (AESGCM128 *g : gcm)
+            delete g;
+    }
+
+    const char *class_name() const { return "IPsecAESGCMDecrypt"; }
+    const char *port_count() const { return "1/1"; }
+
+    int initialize();
+    int initialize_global();        // per-system configuration
+    int initialize_per_node();      // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+
+    int process(int input_port, Packet *pkt);
+
+protected:
+    IPsecSAD sad;
+    struct ipsec_sa_state *sa_states;
+
+    /* Per-thread GCM contexts indexed by SA (see IPsecAESGCM). */
+    std::vector<AESGCM128 *> gcm;
+};
+
+EXPORT_ELEMENT(IPsecAESGCMDecrypt);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
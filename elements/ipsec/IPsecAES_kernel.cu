@@ -704,7 +704,7 @@ __global__ void AES_ctr_encrypt_chunk_SharedMem_5(
 
     assert(item_idx < db_aes_block_info->batches[batch_idx].item_count);
 
-    uint64_t flow_id = 65536;
+    uint64_t flow_id = IPSEC_INVALID_FLOW_ID;
     const struct aes_block_info &cur_block_info = ((struct aes_block_info *)
                                                    db_aes_block_info->batches[batch_idx].buffer_bases)
                                                   [item_idx];
@@ -715,8 +715,6 @@ __global__ void AES_ctr_encrypt_chunk_SharedMem_5(
 
     if (cur_block_info.magic == 85739 && pkt_idx < 64 && length != 0) {
         flow_id = ((uint64_t *) db_flow_ids->batches[batch_idx].buffer_bases)[pkt_idx];
-        if (flow_id != 65536)
-            assert(flow_id < 1024);
     }
 
     /* Step 2. (marginal) */
@@ -739,8 +737,7 @@ __global__ void AES_ctr_encrypt_chunk_SharedMem_5(
 
     __syncthreads();
 
-    if (flow_id != 65536 && length != 0) {
-        assert(flow_id < 1024);
+    if (flow_id != IPSEC_INVALID_FLOW_ID && length != 0) {
         assert(pkt_idx < 64);
 
         const uint8_t *const aes_key = flows[flow_id].aes_key;
@@ -14,21 +14,19 @@
 #include <openssl/hmac.h>
 #include <netinet/ip.h>
 #include "util_esp.hh"
-#include "util_ipsec_key.hh"
 #include "util_sa_entry.hh"
+#include "IPsecSAD.hh"
 #include <rte_memory.h>
 #include <rte_ether.h>
 
 using namespace std;
 using namespace nba;
 
-/* Array which stores per-tunnel HMAC key for each tunnel.
+/* Array which stores per-tunnel HMAC key for each tunnel, indexed by the
+ * SA index in the shared SAD.
  * It is copied to each node's node local storage during per-node initialization
  * and freed in per-thread initialization.*/
 struct hmac_sa_entry *hmac_sa_entry_array;
-/* Map which stores (src-dst pair, tunnel index).
- * It is copied to each node's node local storage during per-node initialization*/
-unordered_map<struct ipaddr_pair, int> hmac_sa_table;
 
 IPsecAuthHMACSHA1::IPsecAuthHMACSHA1(): OffloadableElement()
 {
@@ -56,15 +54,13 @@ IPsecAuthHMACSHA1::IPsecAuthHMACSHA1(): OffloadableElement()
 int IPsecAuthHMACSHA1::initialize()
 {
     // Get ptr for CPU & GPU pkt processing from the node-local storage.
-
-    /* Storage for host ipsec tunnel index table */
-    h_sa_table = (unordered_map<struct ipaddr_pair, int> *)ctx->node_local_storage->get_alloc("h_hmac_sa_table");
+    num_tunnels = ipsec_sad_global().size();
 
     /* Storage for host hmac key array */
     flows = (struct hmac_sa_entry *) ctx->node_local_storage->get_alloc("h_hmac_flows");
 
     /* Get device pointer from the node local storage. */
-    flows_d = (dev_mem_t *) ctx->node_local_storage->get_alloc("d_hmac_flows_ptr");
+    flows_d = (struct per_device_mem *) ctx->node_local_storage->get_alloc("d_hmac_flows_ptr");
 
     if (hmac_sa_entry_array != NULL) {
         free(hmac_sa_entry_array);
@@ -76,22 +72,17 @@ int IPsecAuthHMACSHA1::initialize()
 
 int IPsecAuthHMACSHA1::initialize_global()
 {
-    // generate global table and array only once per element class.
-    struct ipaddr_pair pair;
+    // generate global array only once per element class.
     struct hmac_sa_entry *entry;
+    const IPsecSAD &sad = ipsec_sad_global();
 
-    assert(num_tunnels != 0);
+    num_tunnels = sad.size();
     hmac_sa_entry_array = (struct hmac_sa_entry *) malloc(sizeof(struct hmac_sa_entry)*num_tunnels);
 
     for (int i = 0; i < num_tunnels; i++) {
-        pair.src_addr  = 0x0a000001u;
-        pair.dest_addr = 0x0a000000u | (i + 1); // (rand() % 0xffffff);
-        auto result = hmac_sa_table.insert(make_pair<ipaddr_pair&, int&>(pair, i));
-        assert(result.second == true);
-
         entry = &hmac_sa_entry_array[i];
         entry->entry_idx = i;
-        rte_memcpy(&entry->hmac_key, "abcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcd", HMAC_KEY_SIZE);
+        rte_memcpy(&entry->hmac_key, sad.get(i)->hmac_key, HMAC_KEY_SIZE);
     }
 
     return 0;
@@ -99,22 +90,11 @@ int IPsecAuthHMACSHA1::initialize_global()
 
 int IPsecAuthHMACSHA1::initialize_per_node()
 {
-    unordered_map<struct ipaddr_pair, int> *temp_table = NULL;
     struct hmac_sa_entry *temp_array = NULL;
-    struct ipaddr_pair key;
-    int value, size;
-
-    /* Storage for host ipsec tunnel index table */
-    size = sizeof(unordered_map<struct ipaddr_pair, int>);
-    ctx->node_local_storage->alloc("h_hmac_sa_table", size);
-    temp_table = (unordered_map<struct ipaddr_pair, int> *)ctx->node_local_storage->get_alloc("h_hmac_sa_table");
-    new (temp_table) unordered_map<struct ipaddr_pair, int>();
-
-    for (auto iter = hmac_sa_table.begin(); iter != hmac_sa_table.end(); iter++) {
-        key = iter->first;
-        value = iter->second;
-        temp_table->insert(make_pair<ipaddr_pair&, int&>(key, value));
-    }
+    int size;
+
+    ipsec_sad_init_per_node(ctx);
+    num_tunnels = ipsec_sad_global().size();
 
     /* Storage for host hmac key array */
     size = sizeof(struct hmac_sa_entry) * num_tunnels;
@@ -124,7 +104,8 @@ int IPsecAuthHMACSHA1::initialize_per_node()
     rte_memcpy(temp_array, hmac_sa_entry_array, size);
 
     /* Storage for pointer, which points hmac key array in device */
-    ctx->node_local_storage->alloc("d_hmac_flows_ptr", sizeof(dev_mem_t));
+    ctx->node_local_storage->alloc("d_hmac_flows_ptr", sizeof(struct per_device_mem));
+    ((struct per_device_mem *) ctx->node_local_storage->get_alloc("d_hmac_flows_ptr"))->clear();
 
     return 0;
 }
@@ -132,7 +113,8 @@ int IPsecAuthHMACSHA1::initialize_per_node()
 int IPsecAuthHMACSHA1::configure(comp_thread_context *ctx, std::vector<std::string> &args)
 {
     Element::configure(ctx, args);
-    num_tunnels = 1024;         // TODO: this value must be come from configuration.
+    if (ipsec_sad_configure(ctx, class_name(), args) != 0)
+        return -1;
 
     return 0;
 }
@@ -152,32 +134,11 @@ int IPsecAuthHMACSHA1::process(int input_port, Packet *pkt)
     // TODO: check if input pkt is encapulated or not.
     struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
     struct iphdr *iph      = (struct iphdr *) (ethh + 1);
-    struct esphdr *esph    = (struct esphdr *) (iph + 1);
-    uint8_t *encaped_iph   = (uint8_t *) esph + sizeof(*esph);
-
-    unsigned char *payload_out = (unsigned char*) ((uint8_t*)ethh + sizeof(struct ether_hdr)
-                               + sizeof(struct iphdr));
-    int payload_len = (ntohs(iph->tot_len) - (iph->ihl * 4) - SHA_DIGEST_LENGTH);
-    uint8_t isum[SHA_DIGEST_LENGTH];
-    uint8_t hmac_buf[2048];
     struct hmac_sa_entry *sa_entry;
 
-    uint8_t *hmac_key;
     if (likely(anno_isset(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID))) {
         sa_entry = &flows[anno_get(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID)];
-        hmac_key = sa_entry->hmac_key;
-
-        rte_memcpy(hmac_buf + 64, payload_out, payload_len);
-        for (int i = 0; i < 8; i++)
-            *((uint64_t*)hmac_buf + i) = 0x3636363636363636LLU ^ *((uint64_t*)hmac_key + i);
-        SHA1(hmac_buf, 64 + payload_len, isum);
-
-        rte_memcpy(hmac_buf + 64, isum, SHA_DIGEST_LENGTH);
-        for (int i = 0; i < 8; i++) {
-            *((uint64_t*)hmac_buf + i) = 0x5c5c5c5c5c5c5c5cLLU ^ *((uint64_t*)hmac_key + i);
-        }
-        SHA1(hmac_buf, 64 + SHA_DIGEST_LENGTH, payload_out + payload_len);
-        // TODO: correctness check..
+        esp_hmac_sha1_sign(iph, sa_entry->hmac_key);
     } else {
         pkt->kill();
         return 0;
@@ -189,14 +150,16 @@ int IPsecAuthHMACSHA1::process(int input_port, Packet *pkt)
 void IPsecAuthHMACSHA1::accel_init_handler(ComputeDevice *device)
 {
     // Put key array content to device space.
+    num_tunnels = ipsec_sad_global().size();
     size_t flows_size = sizeof(struct hmac_sa_entry) * num_tunnels;
     flows = (struct hmac_sa_entry *) ctx->node_local_storage->get_alloc("h_hmac_flows");
-    flows_d  = (dev_mem_t *) ctx->node_local_storage->get_alloc("d_hmac_flows_ptr");
+    flows_d  = (struct per_device_mem *) ctx->node_local_storage->get_alloc("d_hmac_flows_ptr");
+    dev_mem_t *dev_flows = flows_d->add(device);
     host_mem_t flows_h;
     flows_h  = device->alloc_host_buffer(flows_size, 0);
-    *flows_d = device->alloc_device_buffer(flows_size, 0, flows_h);
+    *dev_flows = device->alloc_device_buffer(flows_size, 0, flows_h);
     memcpy(device->unwrap_host_buffer(flows_h), flows, flows_size);
-    device->memwrite(flows_h, *flows_d, 0, flows_size);
+    device->memwrite(flows_h, *dev_flows, 0, flows_size);
 }
 
 void IPsecAuthHMACSHA1::accel_compute_handler(ComputeDevice *cdev,
@@ -205,7 +168,7 @@ void IPsecAuthHMACSHA1::accel_compute_handler(ComputeDevice *cdev,
 {
     struct kernel_arg arg;
     void *ptr_args[1];
-    ptr_args[0] = cdev->unwrap_device_buffer(*flows_d);
+    ptr_args[0] = cdev->unwrap_device_buffer(*flows_d->find(cdev));
     arg = {&ptr_args[0], sizeof(void *), alignof(void *)};
     cctx->push_kernel_arg(arg);
 
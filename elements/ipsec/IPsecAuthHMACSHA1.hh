@@ -4,8 +4,6 @@
 #include <nba/element/element.hh>
 #include <vector>
 #include <string>
-#include <unordered_map>
-#include "util_ipsec_key.hh"
 #include "util_sa_entry.hh"
 #include "IPsecDatablocks.hh"
 
@@ -59,9 +57,9 @@ protected:
     int num_tunnels;
     int dummy_index;
 
-    std::unordered_map<struct ipaddr_pair, int> *h_sa_table; // tunnel lookup is done in CPU only. No need for GPU ptr.
+    /* The tunnel lookup is done by IPsecESPencap using the shared SAD. */
     struct hmac_sa_entry *flows = nullptr;       // used in CPU.
-    dev_mem_t *flows_d;   // points to the device buffer.
+    struct per_device_mem *flows_d;   // points to the device buffers.
 
 private:
     const int idx_pkt_offset = 0;
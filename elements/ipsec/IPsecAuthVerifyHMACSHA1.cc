@@ -0,0 +1,54 @@
+#include "IPsecAuthVerifyHMACSHA1.hh"
+#include <nba/element/annotation.hh>
+#include <nba/framework/threadcontext.hh>
+#include <netinet/ip.h>
+#include <rte_ether.h>
+
+using namespace std;
+using namespace nba;
+
+int IPsecAuthVerifyHMACSHA1::initialize()
+{
+    sad = ipsec_sad_attach(ctx);
+    return 0;
+}
+
+int IPsecAuthVerifyHMACSHA1::initialize_global()
+{
+    ipsec_sad_global();
+    return 0;
+}
+
+int IPsecAuthVerifyHMACSHA1::initialize_per_node()
+{
+    ipsec_sad_init_per_node(ctx);
+    return 0;
+}
+
+int IPsecAuthVerifyHMACSHA1::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    if (ipsec_sad_configure(ctx, class_name(), args) != 0)
+        return -1;
+    return 0;
+}
+
+int IPsecAuthVerifyHMACSHA1::process(int input_port, Packet *pkt)
+{
+    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
+    struct iphdr *iph      = (struct iphdr *) (ethh + 1);
+
+    if (unlikely(!anno_isset(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID))) {
+        pkt->kill();
+        return 0;
+    }
+    const struct ipsec_sa *sa = sad.get(anno_get(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID));
+    if (!esp_hmac_sha1_verify(iph, sa->hmac_key)) {
+        pkt->kill();
+        return 0;
+    }
+    output(0).push(pkt);
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,45 @@
+#ifndef __NBA_ELEMENT_IPSEC_IPSECAUTHVERIFYHMACSHA1_HH__
+#define __NBA_ELEMENT_IPSEC_IPSECAUTHVERIFYHMACSHA1_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "IPsecSAD.hh"
+
+namespace nba {
+
+/*
+ * Verifies the HMAC-SHA1 ICV of inbound ESP packets against the key of
+ * the SA found by IPsecSPILookup, and drops the packets that fail.
+ */
+class IPsecAuthVerifyHMACSHA1 : public Element {
+public:
+    IPsecAuthVerifyHMACSHA1(): Element()
+    {
+    }
+
+    ~IPsecAuthVerifyHMACSHA1()
+    {
+    }
+
+    const char *class_name() const { return "IPsecAuthVerifyHMACSHA1"; }
+    const char *port_count() const { return "1/1"; }
+
+    int initialize();
+    int initialize_global();        // per-system configuration
+    int initialize_per_node();      // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+
+    int process(int input_port, Packet *pkt);
+
+protected:
+    IPsecSAD sad;
+};
+
+EXPORT_ELEMENT(IPsecAuthVerifyHMACSHA1);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -36,6 +36,7 @@ public:
     void get_read_roi(struct read_roi_info *roi) const
     {
         roi->type = READ_WHOLE_PACKET;
+        /* IPsecESPencap makes only IPv4 outer headers when offloading. */
         roi->offset = sizeof(struct ether_hdr) + sizeof(struct iphdr) + sizeof(struct esphdr);
         roi->length = 0;  /* to the end of packet */
         roi->align = CACHE_LINE_SIZE;
@@ -91,8 +92,9 @@ public:
             Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
             assert(anno_isset(&pkt->anno, NBA_ANNO_IPSEC_IV1));
             assert(anno_isset(&pkt->anno, NBA_ANNO_IPSEC_IV2));
-            __m128i iv = _mm_set_epi64((__m64) anno_get(&pkt->anno, NBA_ANNO_IPSEC_IV1),
-                                    (__m64) anno_get(&pkt->anno, NBA_ANNO_IPSEC_IV2));
+            /* IV1 holds the first 8 bytes of the IV in the ESP header. */
+            __m128i iv = _mm_set_epi64((__m64) anno_get(&pkt->anno, NBA_ANNO_IPSEC_IV2),
+                                       (__m64) anno_get(&pkt->anno, NBA_ANNO_IPSEC_IV1));
             _mm_storeu_si128((__m128i *) (buf + sizeof(__m128i) * pkt_idx), iv);
         } END_FOR;
     }
@@ -144,7 +146,6 @@ public:
                 Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
                 assert(anno_isset(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID));
                 buf[pkt_idx] = anno_get(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID);
-                assert(buf[pkt_idx] < 1024);
             } else {
                 // FIXME: Quick-and-dirty.. Just put invalid value in flow id to specify invalid packet.
                 buf[pkt_idx] = invalid_value;
@@ -152,7 +153,7 @@ public:
         } END_FOR_ALL;
     }
 
-    uint64_t invalid_value = 65536;
+    uint64_t invalid_value = IPSEC_INVALID_FLOW_ID;
 };
 
 /*
@@ -210,7 +211,7 @@ public:
 
             /* Per-block loop for the packet. */
             unsigned strip_hdr_len = sizeof(struct ether_hdr) + sizeof(struct iphdr) + sizeof(struct esphdr);
-            unsigned pkt_len = rte_pktmbuf_data_len(batch->packets[pkt_idx]);
+            unsigned pkt_len = rte_pktmbuf_pkt_len(batch->packets[pkt_idx]);
             unsigned payload_len = ALIGN_CEIL(pkt_len - strip_hdr_len, AES_BLOCK_SIZE);
             unsigned pkt_local_num_blocks = (payload_len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
             for (unsigned q = 0; q < pkt_local_num_blocks; ++q) {
@@ -0,0 +1,79 @@
+#include "IPsecESPdecap.hh"
+#include <nba/element/annotation.hh>
+#include <nba/framework/threadcontext.hh>
+#include <netinet/ip.h>
+#include <rte_ether.h>
+
+using namespace std;
+using namespace nba;
+
+int IPsecESPdecap::initialize()
+{
+    sa_states = ipsec_sad_state_attach(ctx);
+    return 0;
+}
+
+int IPsecESPdecap::initialize_global()
+{
+    ipsec_sad_global();
+    return 0;
+}
+
+int IPsecESPdecap::initialize_per_node()
+{
+    ipsec_sad_init_per_node(ctx);
+    return 0;
+}
+
+int IPsecESPdecap::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    if (ipsec_sad_configure(ctx, class_name(), args) != 0)
+        return -1;
+    return 0;
+}
+
+// Input packet: (pkt_in)
+// +----------+---------------+--------+----+------------+---------+-------+---------------------+
+// | Ethernet | IP(proto=ESP) |  ESP   | IP |  payload   | padding | extra | HMAC-SHA1 signature |
+// +----------+---------------+--------+----+------------+---------+-------+---------------------+
+// ^ethh      ^l3             ^esph    ^decapped_iph
+//
+// Output packet: (pkt_out)
+// +----------+----+------------+
+// | Ethernet | IP |  payload   |
+// +----------+----+------------+
+// ^ethh      ^iph
+//
+int IPsecESPdecap::process(int input_port, Packet *pkt)
+{
+    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
+    uint8_t *l3            = (uint8_t *) (ethh + 1);
+    struct esphdr *esph    = esp_hdr(l3);
+
+    if (unlikely(!anno_isset(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID))) {
+        pkt->kill();
+        return 0;
+    }
+    struct ipsec_sa_state *st = &sa_states[anno_get(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID)];
+    rte_spinlock_lock(&st->replay_lock);
+    bool fresh = st->replay.update(ntohl(esph->esp_rpl));
+    rte_spinlock_unlock(&st->replay_lock);
+    if (!fresh) {
+        pkt->kill();
+        return 0;
+    }
+
+    int outer_len = esp_l3_len(l3);
+    int inner_len = esp_decap(l3);
+    if (inner_len < 0) {
+        pkt->kill();
+        return 0;
+    }
+    ethh->ether_type = htons(esp_is_ipv6(l3) ? ETHER_TYPE_IPv6 : ETHER_TYPE_IPv4);
+    pkt->take(outer_len - inner_len);
+    output(0).push(pkt);
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,47 @@
+#ifndef __NBA_ELEMENT_IPSEC_IPSECESPDECAP_HH__
+#define __NBA_ELEMENT_IPSEC_IPSECESPDECAP_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "IPsecSAD.hh"
+
+namespace nba {
+
+/*
+ * The last element of the inbound IPsec path.
+ * It advances the anti-replay window of the SA and restores the inner
+ * IP packet by removing the outer IP header, the ESP header, trailer
+ * and ICV of a decrypted packet.
+ */
+class IPsecESPdecap : public Element {
+public:
+    IPsecESPdecap(): Element()
+    {
+    }
+
+    ~IPsecESPdecap()
+    {
+    }
+
+    const char *class_name() const { return "IPsecESPdecap"; }
+    const char *port_count() const { return "1/1"; }
+
+    int initialize();
+    int initialize_global();        // per-system configuration
+    int initialize_per_node();      // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+
+    int process(int input_port, Packet *pkt);
+
+protected:
+    struct ipsec_sa_state *sa_states;
+};
+
+EXPORT_ELEMENT(IPsecESPdecap);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
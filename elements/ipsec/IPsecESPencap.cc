@@ -1,15 +1,16 @@
 #include "IPsecESPencap.hh"
 #include <nba/element/annotation.hh>
 #include <nba/framework/threadcontext.hh>
-#include <random>
 #include <nba/core/checksum.hh>
 #include <xmmintrin.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <openssl/aes.h>
 #include <openssl/sha.h>
 #include <rte_memory.h>
+#include <rte_cycles.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
 #include <rte_udp.h>
@@ -19,31 +20,33 @@ using namespace nba;
 
 int IPsecESPencap::initialize()
 {
-    rand = bind(uniform_int_distribution<uint64_t>{}, mt19937_64());
+    ivgen.init(ctx->loc.core_id, rte_rdtsc());
+    sad = ipsec_sad_attach(ctx);
+    sa_states = ipsec_sad_state_attach(ctx);
+    allow_ipv6 = (ctx->offload_devices == nullptr || ctx->offload_devices->empty());
+    if (!allow_ipv6 && ctx->loc.local_thread_idx == 0)
+        RTE_LOG(WARNING, ELEM, "IPsecESPencap: dropping IPv6 packets since the "
+                "offloaded IPsec elements support IPv4 tunnels only.\n");
+    return 0;
+}
 
-    // TODO: Version of ip pkt (4 or 6), src & dest addr of encapsulated pkt should be delivered from configuation.
-    assert(num_tunnels != 0);
-    for (int i = 0; i < num_tunnels; i++) {
-        struct ipaddr_pair pair;
-        pair.src_addr  = 0x0a000001u;
-        pair.dest_addr = 0x0a000000u | (i + 1); // (rand() % 0xffffff);
-        struct espencap_sa_entry *entry = new struct espencap_sa_entry;
-        entry->spi = rand() % 0xffffffffu;
-        entry->rpl = rand() % 0xffffffffu;
-        entry->gwaddr = 0x0a000001u;
-        entry->entry_idx = i;
-        auto result = sa_table.insert(make_pair<ipaddr_pair&, espencap_sa_entry*&>(pair, entry));
-        assert(result.second == true);
-        sa_table_linear[i] = entry;
-    }
+int IPsecESPencap::initialize_global()
+{
+    ipsec_sad_global();
+    return 0;
+}
 
+int IPsecESPencap::initialize_per_node()
+{
+    ipsec_sad_init_per_node(ctx);
     return 0;
 }
 
 int IPsecESPencap::configure(comp_thread_context *ctx, std::vector<std::string> &args)
 {
     Element::configure(ctx, args);
-    num_tunnels = 1024;         // TODO: this value must be come from configuration.
+    if (ipsec_sad_configure(ctx, class_name(), args) != 0)
+        return -1;
     return 0;
 }
 
@@ -64,97 +67,85 @@ int IPsecESPencap::configure(comp_thread_context *ctx, std::vector<std::string>
 // +----------+---------------+--------+----+------------+---------+-------+---------------------+
 // | Ethernet | IP(proto=ESP) |  ESP   | IP |  payload   | padding | extra | HMAC-SHA1 signature |
 // +----------+---------------+--------+----+------------+---------+-------+---------------------+
-//      14            20          16     20                pad_len     2    SHA_DIGEST_LENGTH = 20
-// ^ethh      ^iph            ^esph    ^encapped_iph     ^esp_trail
+//      14         20 / 40        24     20                pad_len     2    SHA_DIGEST_LENGTH = 20
+// ^ethh      ^outer_l3       ^esph    ^iph              ^esp_trail
+// <==== prepended in the headroom ====>                 <======= appended in the tailroom ======>
+//
+// The inner packet stays in place; only the Ethernet header is moved.
+// IPv6 packets get an IPv6 outer header, unless offload devices are used.
 //
 int IPsecESPencap::process(int input_port, Packet *pkt)
 {
-    // Temp: Assumes input packet is always IPv4 packet.
-    // TODO: make it to handle IPv6 also.
     // TODO: Set src & dest of encapped pkt to ip addrs from configuration.
-
+    /* The trailer and the encryption need the whole packet contiguous. */
+    if (unlikely(!pkt->linearize())) {
+        pkt->kill();
+        return 0;
+    }
     struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
-    if (ntohs(ethh->ether_type) != ETHER_TYPE_IPv4) {
+    uint8_t *inner = (uint8_t *) (ethh + 1);
+    uint32_t src_addr, dest_addr;
+    uint16_t ether_type = ntohs(ethh->ether_type);
+    if (ether_type == ETHER_TYPE_IPv4) {
+        struct iphdr *iph = (struct iphdr *) inner;
+        src_addr = ntohl(iph->saddr);
+        dest_addr = ntohl(iph->daddr);
+    } else if (ether_type == ETHER_TYPE_IPv6 && allow_ipv6) {
+        /* The SAD is keyed by IPv4 addresses: use the embedded IPv4
+         * addresses (the last 32 bits) of IPv6 addresses. */
+        struct ip6_hdr *ip6h = (struct ip6_hdr *) inner;
+        src_addr = ntohl(ip6h->ip6_src.s6_addr32[3]);
+        dest_addr = ntohl(ip6h->ip6_dst.s6_addr32[3]);
+    } else {
         pkt->kill();
         return 0;
     }
-    struct iphdr *iph = (struct iphdr *) (ethh + 1);
 
-    struct ipaddr_pair pair;
-    pair.src_addr = ntohl(iph->saddr);
-    pair.dest_addr = ntohl(iph->daddr);
-    auto sa_item = sa_table.find(pair);
-    struct espencap_sa_entry *sa_entry = NULL;
-    if (likely(sa_item != sa_table.end())) {
-        sa_entry = sa_item->second;
-        anno_set(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID, sa_entry->entry_idx);
-        assert(sa_entry->entry_idx < 1024u);
-    } else {
+    /* Following IPsec elements reuse the SA index from the annotation. */
+    uint32_t sa_idx = sad.lookup_outbound(src_addr, dest_addr);
+    if (unlikely(sa_idx == IPsecSAD::NOT_FOUND)) {
+        pkt->kill();
+        return 0;
+    }
+    const struct ipsec_sa *sa_entry = sad.get(sa_idx);
+
+    int ip_len = esp_l3_len(inner);
+    int hdr_len = esp_encap_hdr_len(inner);
+    int trailer_len = esp_encap_trailer_len(ip_len);
+    if (unlikely(ip_len > (int) (pkt->length() - sizeof(struct ether_hdr))
+                 || pkt->headroom() < (uint32_t) hdr_len
+                 || pkt->tailroom() < (uint32_t) trailer_len)) {
         pkt->kill();
         return 0;
-        // FIXME: this is to encrypt all traffic regardless sa_entry lookup results.
-        //        (just for worst-case performance tests)
-        //unsigned f = (tunnel_counter ++) % num_tunnels;
-        //sa_entry = sa_table_linear[f];
-        //anno_set(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID, f);
-        //assert(f < 1024u);
     }
+    anno_set(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID, sa_idx);
 
-    int ip_len = ntohs(iph->tot_len);
-    int pad_len = AES_BLOCK_SIZE - (ip_len + 2) % AES_BLOCK_SIZE;
-    int enc_size = ip_len + pad_len + 2;    // additional two bytes mean the "extra" part.
-    int extended_ip_len = (short) (sizeof(struct iphdr) + enc_size
-                         + sizeof(struct esphdr) + SHA_DIGEST_LENGTH);
-    int length_to_extend = extended_ip_len - ip_len;
-    pkt->put(length_to_extend);
-    assert(0 == (enc_size % AES_BLOCK_SIZE));
+    /* Drop the L2 padding of short frames before appending the trailer. */
+    pkt->take(pkt->length() - sizeof(struct ether_hdr) - ip_len);
+    pkt->put(trailer_len);
+    pkt->push(hdr_len);
+    memmove(pkt->data(), ethh, sizeof(struct ether_hdr));
 
-    struct esphdr *esph = (struct esphdr *) (iph + 1);
-    uint8_t *encapped_iph = (uint8_t *) esph + sizeof(*esph);
-    uint8_t *esp_trail    = encapped_iph + ip_len;
+    uint8_t iv[ESP_IV_LENGTH];
+    ivgen.generate(iv);
+    anno_set(&pkt->anno, NBA_ANNO_IPSEC_IV1, *(uint64_t *) iv);
+    anno_set(&pkt->anno, NBA_ANNO_IPSEC_IV2, *(uint64_t *) (iv + 8));
 
     // Hack for latency measurement experiments.
-    uintptr_t latency_ptr = 0;
     constexpr uintptr_t latency_offset = sizeof(struct ether_hdr)
                                          + sizeof(struct ipv4_hdr)
                                          + sizeof(struct udp_hdr);
     static_assert(sizeof(struct udp_hdr) + sizeof(uint16_t) + sizeof(uint64_t)
                   <= sizeof(struct esphdr) + sizeof(ipv4_hdr),
                   "Encryption may overwrite latency!");
-    __m128i timestamp;  // actual size: uin16 + uint64
     if (ctx->preserve_latency) {
         // latency data size: 16 bit key + 64 bit timestamp
-        latency_ptr = (uintptr_t) pkt->data() + latency_offset;
-        timestamp = _mm_loadu_si128((__m128i *) latency_ptr);
-    }
-
-    memmove(encapped_iph, iph, ip_len);         // copy the IP header and payload.
-    memset(esp_trail, 0, pad_len);              // clear the padding.
-    esp_trail[pad_len] = (uint8_t) pad_len;     // store pad_len at the second byte from last.
-    esp_trail[pad_len + 1] = 0x04;              // store IP-in-IP protocol id at the last byte.
-
-    // Fill the ESP header.
-    esph->esp_spi = sa_entry->spi;
-    esph->esp_rpl = sa_entry->rpl;
-
-    // Generate random IV.
-    uint64_t iv_first_half = rand();
-    uint64_t iv_second_half = rand();
-    __m128i new_iv = _mm_set_epi64((__m64) iv_first_half, (__m64) iv_second_half);
-    _mm_storeu_si128((__m128i *) esph->esp_iv, new_iv);
-    anno_set(&pkt->anno, NBA_ANNO_IPSEC_IV1, iv_first_half);
-    anno_set(&pkt->anno, NBA_ANNO_IPSEC_IV2, iv_second_half);
-
-    // Hack for latency measurement experiments.
-    if (ctx->preserve_latency) {
-        _mm_storeu_si128((__m128i *) latency_ptr, timestamp);
+        __m128i timestamp = _mm_loadu_si128((__m128i *) (inner + latency_offset - sizeof(struct ether_hdr)));
+        _mm_storeu_si128((__m128i *) iv, timestamp);
     }
 
-    iph->ihl = (20 >> 2);               // standard IP header size.
-    iph->tot_len = htons(extended_ip_len);
-    iph->protocol = 0x32;               // mark that this packet contains a secured payload.
-    iph->check = 0;                     // ignoring previous checksum.
-    iph->check = ip_fast_csum(iph, iph->ihl);
+    uint32_t seq = (uint32_t) rte_atomic32_add_return(&sa_states[sa_idx].seq_out, 1);
+    esp_encap(inner, sa_entry->spi, seq, iv);
     output(0).push(pkt);
     return 0;
 }
@@ -0,0 +1,76 @@
+#include "IPsecSAD.hh"
+#include <nba/framework/config.hh>
+#include <nba/framework/logging.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/element/nodelocalstorage.hh>
+
+using namespace std;
+using namespace nba;
+
+#define IPSEC_SAD_DEFAULT_TUNNELS (1024)
+#define IPSEC_SAD_NLS_KEY "ipsec.sad"
+#define IPSEC_SAD_STATE_NLS_KEY "ipsec.sad.state"
+
+static IPsecSADStore sad_store(IPSEC_SAD_DEFAULT_TUNNELS);
+static bool node_sad_ready[NBA_MAX_NODES];
+
+int nba::ipsec_sad_configure(comp_thread_context *ctx, const char *elem_name,
+                             const vector<string> &args)
+{
+    if (args.size() > 1) {
+        RTE_LOG(ERR, ELEM, "%s: too many arguments. (expected: [NUM_TUNNELS | SA_FILE])\n", elem_name);
+        return -1;
+    }
+    string err;
+    if (sad_store.configure(ctx->graph_generation, args.size() == 0 ? "" : args[0], err) != 0) {
+        RTE_LOG(ERR, ELEM, "%s: %s.\n", elem_name, err.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+const IPsecSAD &nba::ipsec_sad_global()
+{
+    if (sad_store.loaded())
+        return sad_store.load();
+    const IPsecSAD &sad = sad_store.load();
+    RTE_LOG(INFO, ELEM, "IPsecSAD: loaded %'lu SAs from %s (%'lu bytes)\n",
+            sad.size(), sad_store.get_source().c_str(), sad.get_memory_size());
+    return sad;
+}
+
+void nba::ipsec_sad_init_per_node(comp_thread_context *ctx)
+{
+    /* Per-node initialization is serialized across all elements. */
+    unsigned node_id = ctx->loc.node_id;
+    if (node_sad_ready[node_id])
+        return;
+    const IPsecSAD &g = ipsec_sad_global();
+    ctx->node_local_storage->alloc(IPSEC_SAD_NLS_KEY, g.get_memory_size());
+    void *mem = ctx->node_local_storage->get_alloc(IPSEC_SAD_NLS_KEY);
+    memcpy(mem, g.get_memory(), g.get_memory_size());
+
+    ctx->node_local_storage->alloc(IPSEC_SAD_STATE_NLS_KEY, sizeof(struct ipsec_sa_state) * g.size());
+    struct ipsec_sa_state *states = (struct ipsec_sa_state *)
+            ctx->node_local_storage->get_alloc(IPSEC_SAD_STATE_NLS_KEY);
+    for (uint32_t i = 0; i < g.size(); i++) {
+        rte_atomic32_set(&states[i].seq_out, g.get(i)->rpl);
+        rte_spinlock_init(&states[i].replay_lock);
+        states[i].replay.reset();
+    }
+    node_sad_ready[node_id] = true;
+}
+
+IPsecSAD nba::ipsec_sad_attach(comp_thread_context *ctx)
+{
+    IPsecSAD sad;
+    sad.attach(ctx->node_local_storage->get_alloc(IPSEC_SAD_NLS_KEY));
+    return sad;
+}
+
+struct ipsec_sa_state *nba::ipsec_sad_state_attach(comp_thread_context *ctx)
+{
+    return (struct ipsec_sa_state *) ctx->node_local_storage->get_alloc(IPSEC_SAD_STATE_NLS_KEY);
+}
+
+// vim: ts=8 sts=4 sw=4 et
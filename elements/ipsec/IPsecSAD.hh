@@ -0,0 +1,65 @@
+#ifndef __NBA_ELEMENT_IPSEC_IPSECSAD_HH__
+#define __NBA_ELEMENT_IPSEC_IPSECSAD_HH__
+
+#include <nba/core/intrinsic.hh>
+#include <vector>
+#include <string>
+#include <rte_atomic.h>
+#include <rte_spinlock.h>
+#include "util_sad.hh"
+#include "util_esp_ops.hh"
+
+namespace nba {
+
+class comp_thread_context;
+
+/*
+ * Helpers to share a single SAD among all IPsec elements.
+ *
+ * The IPsec elements accept an optional argument for the SAD source:
+ * the number of synthetic tunnels (default: 1024) or the path of an SA
+ * file (see IPsecSAD::load_file()).  All IPsec elements in a pipeline
+ * must use the same source; elements without the argument follow the
+ * others.  The SAD is loaded once per process (see IPsecSADStore), so
+ * graph reloads that change the source or the SA file are refused.
+ *
+ * Call them from the corresponding element initialization methods:
+ *  - ipsec_sad_configure() in configure(),
+ *  - ipsec_sad_global() in initialize_global(),
+ *  - ipsec_sad_init_per_node() in initialize_per_node(),
+ *  - ipsec_sad_attach() and ipsec_sad_state_attach() in initialize().
+ */
+
+/**
+ * The mutable per-node state of an SA, indexed by the SA index.
+ * Packets of an SA usually stay in a single thread by RSS, but the
+ * state is guarded for the case they do not.  Each SA takes its own
+ * cache line so that threads working on different SAs do not share.
+ */
+struct ipsec_sa_state {
+    rte_atomic32_t seq_out;             /* the last outbound sequence number */
+    rte_spinlock_t replay_lock;
+    struct esp_replay_window replay;    /* for inbound packets */
+} __cache_aligned;
+
+/** Returns -1 if the arguments are invalid or conflict with the SAD in use. */
+int ipsec_sad_configure(comp_thread_context *ctx, const char *elem_name,
+                        const std::vector<std::string> &args);
+
+/** Loads the SAD once and returns the global copy. */
+const IPsecSAD &ipsec_sad_global();
+
+/** Copies the global SAD into the node-local storage once per node. */
+void ipsec_sad_init_per_node(comp_thread_context *ctx);
+
+/** Returns the view of the node-local SAD. */
+IPsecSAD ipsec_sad_attach(comp_thread_context *ctx);
+
+/** Returns the node-local SA state array. */
+struct ipsec_sa_state *ipsec_sad_state_attach(comp_thread_context *ctx);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
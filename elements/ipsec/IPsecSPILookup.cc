@@ -0,0 +1,99 @@
+#include "IPsecSPILookup.hh"
+#include <nba/element/annotation.hh>
+#include <nba/framework/threadcontext.hh>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <rte_ether.h>
+
+using namespace std;
+using namespace nba;
+
+int IPsecSPILookup::initialize()
+{
+    sad = ipsec_sad_attach(ctx);
+    sa_states = ipsec_sad_state_attach(ctx);
+    return 0;
+}
+
+int IPsecSPILookup::initialize_global()
+{
+    ipsec_sad_global();
+    return 0;
+}
+
+int IPsecSPILookup::initialize_per_node()
+{
+    ipsec_sad_init_per_node(ctx);
+    return 0;
+}
+
+int IPsecSPILookup::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    if (ipsec_sad_configure(ctx, class_name(), args) != 0)
+        return -1;
+    return 0;
+}
+
+int IPsecSPILookup::process(int input_port, Packet *pkt)
+{
+    /* Decapsulation and decryption need the whole packet contiguous. */
+    if (unlikely(!pkt->linearize())) {
+        pkt->kill();
+        return 0;
+    }
+    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
+    uint8_t *l3 = (uint8_t *) (ethh + 1);
+    uint32_t dest_addr;
+    switch (ntohs(ethh->ether_type)) {
+    case ETHER_TYPE_IPv4: {
+        struct iphdr *iph = (struct iphdr *) l3;
+        if (iph->protocol != ESP_PROTO || iph->ihl != (20 >> 2)) {
+            pkt->kill();
+            return 0;
+        }
+        dest_addr = ntohl(iph->daddr);
+        break; }
+    case ETHER_TYPE_IPv6: {
+        /* The SAD is keyed by the last 32 bits of IPv6 addresses. */
+        struct ip6_hdr *ip6h = (struct ip6_hdr *) l3;
+        if (ip6h->ip6_nxt != ESP_PROTO) {
+            pkt->kill();
+            return 0;
+        }
+        dest_addr = ntohl(ip6h->ip6_dst.s6_addr32[3]);
+        break; }
+    default:
+        pkt->kill();
+        return 0;
+    }
+    if (esp_l3_len(l3) > (int) (pkt->length() - sizeof(struct ether_hdr))
+        || esp_payload_len(l3) < AES_BLOCK_SIZE) {
+        pkt->kill();
+        return 0;
+    }
+    struct esphdr *esph = esp_hdr(l3);
+
+    uint32_t sa_idx = sad.lookup_inbound(ntohl(esph->esp_spi), dest_addr);
+    if (unlikely(sa_idx == IPsecSAD::NOT_FOUND)) {
+        pkt->kill();
+        return 0;
+    }
+    /* The window is updated by IPsecESPdecap after authentication.
+     * The lock is per SA and rarely contended as RSS keeps an SA in a
+     * single thread. */
+    struct ipsec_sa_state *st = &sa_states[sa_idx];
+    rte_spinlock_lock(&st->replay_lock);
+    bool fresh = st->replay.check(ntohl(esph->esp_rpl));
+    rte_spinlock_unlock(&st->replay_lock);
+    if (!fresh) {
+        pkt->kill();
+        return 0;
+    }
+    anno_set(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID, sa_idx);
+    output(0).push(pkt);
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
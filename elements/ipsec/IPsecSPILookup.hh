@@ -0,0 +1,50 @@
+#ifndef __NBA_ELEMENT_IPSEC_IPSECSPILOOKUP_HH__
+#define __NBA_ELEMENT_IPSEC_IPSECSPILOOKUP_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "IPsecSAD.hh"
+
+namespace nba {
+
+/*
+ * The first element of the inbound IPsec path.
+ * It finds the SA of an ESP packet by its SPI and outer destination,
+ * drops replayed packets early, and stores the SA index in
+ * NBA_ANNO_IPSEC_FLOW_ID for the following inbound elements.
+ *
+ * Arguments: [NUM_TUNNELS | SA_FILE] (see IPsecSAD.hh)
+ */
+class IPsecSPILookup : public Element {
+public:
+    IPsecSPILookup(): Element()
+    {
+    }
+
+    ~IPsecSPILookup()
+    {
+    }
+
+    const char *class_name() const { return "IPsecSPILookup"; }
+    const char *port_count() const { return "1/1"; }
+
+    int initialize();
+    int initialize_global();        // per-system configuration
+    int initialize_per_node();      // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+
+    int process(int input_port, Packet *pkt);
+
+protected:
+    IPsecSAD sad;
+    struct ipsec_sa_state *sa_states;
+};
+
+EXPORT_ELEMENT(IPsecSPILookup);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
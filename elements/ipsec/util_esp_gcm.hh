@@ -0,0 +1,182 @@
+#ifndef __NBA_UTIL_IPSEC_ESP_GCM_HH__
+#define __NBA_UTIL_IPSEC_ESP_GCM_HH__
+
+/*
+ * AES-GCM ESP (RFC 4106) transforms used by IPsecAESGCM and
+ * IPsecAESGCMDecrypt.
+ *
+ * The packets have the following layout after esp_gcm_reformat():
+ *
+ * +---------------+-----+-----+----+----+------------+---------+-------+----------+
+ * | IP(proto=ESP) | SPI | Seq | IV | IP |  payload   | padding | extra | GCM ICV  |
+ * +---------------+-----+-----+----+----+------------+---------+-------+----------+
+ *      20 / 40       4     4    8  <========= encrypted ==============>     16
+ * ^l3             <= AAD ==>
+ *
+ * The nonce is the 4-byte salt of the SA followed by the 8-byte IV.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <nba/core/checksum.hh>
+#include "util_esp.hh"
+#include "util_esp_ops.hh"
+#include "util_sa_entry.hh"
+
+namespace nba {
+
+enum : int {
+    ESP_GCM_SALT_LENGTH = 4,
+    ESP_GCM_IV_LENGTH = 8,
+    ESP_GCM_NONCE_LENGTH = ESP_GCM_SALT_LENGTH + ESP_GCM_IV_LENGTH,
+    ESP_GCM_ICV_LENGTH = 16,
+};
+
+struct esp_gcm_hdr {
+    uint32_t esp_spi;
+    uint32_t esp_rpl;
+    uint8_t esp_iv[ESP_GCM_IV_LENGTH];
+};
+
+/**
+ * An AES-128-GCM context.  OpenSSL uses AES-NI and PCLMULQDQ for it
+ * when the CPU supports them, so seal() and open() take a single pass
+ * over the data for both the cipher and the MAC.
+ */
+class AESGCM128 {
+public:
+    AESGCM128() : ctx(EVP_CIPHER_CTX_new())
+    {
+        EVP_CipherInit_ex(ctx, EVP_aes_128_gcm(), nullptr, nullptr, nullptr, 1);
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, ESP_GCM_NONCE_LENGTH, nullptr);
+    }
+
+    ~AESGCM128()
+    {
+        EVP_CIPHER_CTX_free(ctx);
+    }
+
+    AESGCM128(const AESGCM128 &) = delete;
+    AESGCM128 &operator=(const AESGCM128 &) = delete;
+
+    /** Expands the key.  It is reused until the next call. */
+    void set_key(const uint8_t *key)
+    {
+        EVP_CipherInit_ex(ctx, nullptr, nullptr, key, nullptr, 1);
+    }
+
+    /** Encrypts data in place and writes the 16-byte tag. */
+    bool seal(const uint8_t *nonce, const uint8_t *aad, int aad_len,
+              uint8_t *data, int len, uint8_t *tag)
+    {
+        int outl;
+        if (EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, nonce, 1) != 1
+            || EVP_CipherUpdate(ctx, nullptr, &outl, aad, aad_len) != 1
+            || EVP_CipherUpdate(ctx, data, &outl, data, len) != 1
+            || EVP_CipherFinal_ex(ctx, data + outl, &outl) != 1)
+            return false;
+        return EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, ESP_GCM_ICV_LENGTH, tag) == 1;
+    }
+
+    /** Decrypts data in place.  Returns false if the tag does not match. */
+    bool open(const uint8_t *nonce, const uint8_t *aad, int aad_len,
+              uint8_t *data, int len, const uint8_t *tag)
+    {
+        int outl;
+        if (EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, nonce, 0) != 1
+            || EVP_CipherUpdate(ctx, nullptr, &outl, aad, aad_len) != 1
+            || EVP_CipherUpdate(ctx, data, &outl, data, len) != 1
+            || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, ESP_GCM_ICV_LENGTH,
+                                   (void *) tag) != 1)
+            return false;
+        return EVP_CipherFinal_ex(ctx, data + outl, &outl) == 1;
+    }
+
+private:
+    EVP_CIPHER_CTX *ctx;
+};
+
+/**
+ * Converts a packet built by esp_encap() into the RFC 4106 layout by
+ * moving the headers before the IV towards the payload: only the last
+ * 8 bytes of the 16-byte IV remain, and the 20-byte ICV space shrinks to
+ * 16 bytes.  frame is the start of the L2 header of l2_len bytes.
+ * The caller must drop the first 8 bytes and the last 4 bytes of the
+ * frame afterwards.  Returns the new outer IP header.
+ */
+static inline void *esp_gcm_reformat(uint8_t *frame, int l2_len)
+{
+    const int shift = ESP_IV_LENGTH - ESP_GCM_IV_LENGTH;
+    uint8_t *l3 = frame + l2_len;
+    int l3_len = esp_l3_len(l3);
+    memmove(frame + shift, frame, l2_len + esp_l3_hdr_len(l3) + 2 * sizeof(uint32_t));
+    l3 += shift;
+    esp_set_l3_len(l3, l3_len - shift - (SHA_DIGEST_LENGTH - ESP_GCM_ICV_LENGTH));
+    return l3;
+}
+
+static inline int esp_gcm_payload_len(const void *l3)
+{
+    return esp_l3_len(l3) - esp_l3_hdr_len(l3)
+           - (int) sizeof(struct esp_gcm_hdr) - ESP_GCM_ICV_LENGTH;
+}
+
+static inline struct esp_gcm_hdr *esp_gcm_header(void *l3)
+{
+    return (struct esp_gcm_hdr *) ((uint8_t *) l3 + esp_l3_hdr_len(l3));
+}
+
+static inline uint8_t *esp_gcm_payload(void *l3)
+{
+    return (uint8_t *) esp_gcm_header(l3) + sizeof(struct esp_gcm_hdr);
+}
+
+/** Encrypts and authenticates the ESP payload of a reformatted packet. */
+static inline bool esp_gcm_seal(void *l3, AESGCM128 &gcm, const uint8_t *salt)
+{
+    struct esp_gcm_hdr *esph = esp_gcm_header(l3);
+    uint8_t nonce[ESP_GCM_NONCE_LENGTH];
+    int len = esp_gcm_payload_len(l3);
+    if (len <= 0)
+        return false;
+    memcpy(nonce, salt, ESP_GCM_SALT_LENGTH);
+    memcpy(nonce + ESP_GCM_SALT_LENGTH, esph->esp_iv, ESP_GCM_IV_LENGTH);
+    uint8_t *payload = esp_gcm_payload(l3);
+    return gcm.seal(nonce, (const uint8_t *) esph, 2 * sizeof(uint32_t),
+                    payload, len, payload + len);
+}
+
+/** Verifies and decrypts the ESP payload in place. */
+static inline bool esp_gcm_open(void *l3, AESGCM128 &gcm, const uint8_t *salt)
+{
+    struct esp_gcm_hdr *esph = esp_gcm_header(l3);
+    uint8_t nonce[ESP_GCM_NONCE_LENGTH];
+    int len = esp_gcm_payload_len(l3);
+    if (len <= 0)
+        return false;
+    memcpy(nonce, salt, ESP_GCM_SALT_LENGTH);
+    memcpy(nonce + ESP_GCM_SALT_LENGTH, esph->esp_iv, ESP_GCM_IV_LENGTH);
+    uint8_t *payload = esp_gcm_payload(l3);
+    return gcm.open(nonce, (const uint8_t *) esph, 2 * sizeof(uint32_t),
+                    payload, len, payload + len);
+}
+
+/**
+ * The RFC 4106 counterpart of esp_decap(): moves the inner IP packet of
+ * an opened packet to l3.
+ * Returns the length of the inner packet, or -1 if the trailer is invalid.
+ */
+static inline int esp_gcm_decap(void *l3)
+{
+    return esp_decap_payload(l3, esp_gcm_payload(l3), esp_gcm_payload_len(l3));
+}
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,328 @@
+#ifndef __NBA_UTIL_IPSEC_ESP_OPS_HH__
+#define __NBA_UTIL_IPSEC_ESP_OPS_HH__
+
+/*
+ * Per-packet ESP transforms used by the CPU paths of the IPsec elements.
+ *
+ * All functions take the outer IPv4 or IPv6 header (without extension
+ * headers) of a tunnel-mode ESP packet laid out as below and work in place.
+ *
+ * +------------------+--------+----+------------+---------+-------+---------------------+
+ * | IP/IPv6(ESP)     |  ESP   | IP |  payload   | padding | extra | HMAC-SHA1 signature |
+ * +------------------+--------+----+------------+---------+-------+---------------------+
+ *       20 / 40          24     <===== ESP payload (encrypted) ====>  SHA_DIGEST_LENGTH
+ * ^l3                ^esph    ^esp_payload(l3)
+ *                    <=========== authenticated part ==============>
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <openssl/aes.h>
+#include <openssl/sha.h>
+#include <nba/core/checksum.hh>
+#include "util_esp.hh"
+#include "util_sa_entry.hh"
+
+namespace nba {
+
+enum : int {
+    ESP_PROTO = 0x32,
+    ESP_NEXT_HDR_IPIP = 0x04,
+    ESP_NEXT_HDR_IPV6 = 0x29,
+};
+
+static inline bool esp_is_ipv6(const void *l3)
+{
+    return (*(const uint8_t *) l3 >> 4) == 6;
+}
+
+/** The length of the IP header without options or extension headers. */
+static inline int esp_l3_hdr_len(const void *l3)
+{
+    return esp_is_ipv6(l3) ? (int) sizeof(struct ip6_hdr) : (int) sizeof(struct iphdr);
+}
+
+/** The length of the whole IP packet from its header. */
+static inline int esp_l3_len(const void *l3)
+{
+    if (esp_is_ipv6(l3))
+        return (int) sizeof(struct ip6_hdr) + ntohs(((const struct ip6_hdr *) l3)->ip6_plen);
+    return ntohs(((const struct iphdr *) l3)->tot_len);
+}
+
+/** Sets the length of the IP packet and fixes the IPv4 checksum. */
+static inline void esp_set_l3_len(void *l3, int len)
+{
+    if (esp_is_ipv6(l3)) {
+        ((struct ip6_hdr *) l3)->ip6_plen = htons(len - sizeof(struct ip6_hdr));
+    } else {
+        struct iphdr *iph = (struct iphdr *) l3;
+        iph->tot_len = htons(len);
+        iph->check = 0;
+        iph->check = ip_fast_csum(iph, iph->ihl);
+    }
+}
+
+static inline struct esphdr *esp_hdr(void *l3)
+{
+    return (struct esphdr *) ((uint8_t *) l3 + esp_l3_hdr_len(l3));
+}
+
+static inline uint8_t *esp_payload(void *l3)
+{
+    return (uint8_t *) esp_hdr(l3) + sizeof(struct esphdr);
+}
+
+/** The length of the (encrypted) ESP payload including the trailer. */
+static inline int esp_payload_len(const void *l3)
+{
+    return esp_l3_len(l3) - esp_l3_hdr_len(l3) - (int) sizeof(struct esphdr) - SHA_DIGEST_LENGTH;
+}
+
+/** The length of the padding for an inner IP packet of ip_len bytes. */
+static inline int esp_pad_len(int ip_len)
+{
+    return AES_BLOCK_SIZE - (ip_len + 2) % AES_BLOCK_SIZE;
+}
+
+/** The number of bytes esp_encap() prepends to the inner packet. */
+static inline int esp_encap_hdr_len(const void *inner)
+{
+    return esp_l3_hdr_len(inner) + (int) sizeof(struct esphdr);
+}
+
+/** The number of bytes esp_encap() appends to an inner packet of ip_len bytes. */
+static inline int esp_encap_trailer_len(int ip_len)
+{
+    return esp_pad_len(ip_len) + 2 + SHA_DIGEST_LENGTH;
+}
+
+/**
+ * Wraps the IPv4 or IPv6 packet at inner into an ESP tunnel packet
+ * without moving it.  The outer header is a copy of the inner one, so the
+ * buffer must have esp_encap_hdr_len() bytes of room before inner and
+ * esp_encap_trailer_len() bytes after it.
+ * Returns the outer IP header, which starts esp_encap_hdr_len() bytes
+ * before inner.
+ */
+static inline uint8_t *esp_encap(uint8_t *inner, uint32_t spi, uint32_t seq,
+                                 const uint8_t *iv)
+{
+    int ip_len = esp_l3_len(inner);
+    int pad_len = esp_pad_len(ip_len);
+    int l3_hdr_len = esp_l3_hdr_len(inner);
+    uint8_t *l3 = inner - esp_encap_hdr_len(inner);
+    uint8_t *esp_trail = inner + ip_len;
+
+    memset(esp_trail, 0, pad_len);              // clear the padding.
+    esp_trail[pad_len] = (uint8_t) pad_len;     // store pad_len at the second byte from last.
+    esp_trail[pad_len + 1] = esp_is_ipv6(inner) ? ESP_NEXT_HDR_IPV6 : ESP_NEXT_HDR_IPIP;
+
+    memcpy(l3, inner, l3_hdr_len);
+    struct esphdr *esph = (struct esphdr *) (l3 + l3_hdr_len);
+    esph->esp_spi = htonl(spi);
+    esph->esp_rpl = htonl(seq);
+    memcpy(esph->esp_iv, iv, ESP_IV_LENGTH);
+
+    int outer_len = l3_hdr_len + sizeof(struct esphdr) + ip_len + esp_encap_trailer_len(ip_len);
+    if (esp_is_ipv6(l3)) {
+        ((struct ip6_hdr *) l3)->ip6_nxt = ESP_PROTO;
+    } else {
+        struct iphdr *iph = (struct iphdr *) l3;
+        iph->ihl = (20 >> 2);           // standard IP header size.
+        iph->protocol = ESP_PROTO;      // mark that this packet contains a secured payload.
+    }
+    esp_set_l3_len(l3, outer_len);
+    return l3;
+}
+
+/**
+ * A per-thread generator of unique IVs.
+ * Both halves of the IV carry a 64-bit value made of the thread ID and a
+ * counter starting from a random seed: the upper half keeps the counter
+ * blocks of AES-CTR from overlapping across packets, and the lower half
+ * is unique on its own for AES-GCM, which uses only the last 8 bytes.
+ */
+struct esp_iv_generator {
+    uint64_t next_value;
+
+    void init(unsigned thread_id, uint64_t seed)
+    {
+        next_value = ((uint64_t) thread_id << 56) | (seed & ((1ull << 56) - 1));
+    }
+
+    void generate(uint8_t *iv)
+    {
+        uint64_t v = next_value;
+        next_value = (v & ~((1ull << 56) - 1)) | ((v + 1) & ((1ull << 56) - 1));
+        memcpy(iv, &v, sizeof(v));
+        memcpy(iv + sizeof(v), &v, sizeof(v));
+    }
+};
+
+/**
+ * Encrypts or decrypts the ESP payload with AES-CTR using the IV in the
+ * ESP header as the initial counter block.  The IV is left intact.
+ */
+static inline void esp_aes_ctr_crypt(void *l3, const AES_KEY *key)
+{
+    struct esphdr *esph = esp_hdr(l3);
+    uint8_t counter[AES_BLOCK_SIZE];
+    uint8_t ecount_buf[AES_BLOCK_SIZE] = { 0 };
+    unsigned num = 0;
+    uint8_t *ptr = esp_payload(l3);
+    memcpy(counter, esph->esp_iv, AES_BLOCK_SIZE);
+    AES_ctr128_encrypt(ptr, ptr, esp_payload_len(l3), key, counter, ecount_buf, &num);
+}
+
+/**
+ * Decrypts the ESP payload with AES-CBC.  dec_key must be a decryption
+ * key schedule.  Returns false if the payload is not block-aligned.
+ */
+static inline bool esp_aes_cbc_decrypt(void *l3, const AES_KEY *dec_key)
+{
+    struct esphdr *esph = esp_hdr(l3);
+    uint8_t iv[AES_BLOCK_SIZE];
+    int len = esp_payload_len(l3);
+    if (len <= 0 || len % AES_BLOCK_SIZE != 0)
+        return false;
+    uint8_t *ptr = esp_payload(l3);
+    memcpy(iv, esph->esp_iv, AES_BLOCK_SIZE);
+    AES_cbc_encrypt(ptr, ptr, len, dec_key, iv, AES_DECRYPT);
+    return true;
+}
+
+/** Computes HMAC-SHA1 with a 64-byte key. */
+static inline void esp_hmac_sha1(const uint8_t *hmac_key, const uint8_t *data, size_t len,
+                                 uint8_t *digest)
+{
+    uint8_t pad[HMAC_KEY_SIZE];
+    uint8_t isum[SHA_DIGEST_LENGTH];
+    SHA_CTX sha;
+    for (int i = 0; i < HMAC_KEY_SIZE; i++)
+        pad[i] = 0x36 ^ hmac_key[i];
+    SHA1_Init(&sha);
+    SHA1_Update(&sha, pad, HMAC_KEY_SIZE);
+    SHA1_Update(&sha, data, len);
+    SHA1_Final(isum, &sha);
+    for (int i = 0; i < HMAC_KEY_SIZE; i++)
+        pad[i] = 0x5c ^ hmac_key[i];
+    SHA1_Init(&sha);
+    SHA1_Update(&sha, pad, HMAC_KEY_SIZE);
+    SHA1_Update(&sha, isum, SHA_DIGEST_LENGTH);
+    SHA1_Final(digest, &sha);
+}
+
+/** Writes the ICV (HMAC-SHA1 of the ESP header and payload) at the end. */
+static inline void esp_hmac_sha1_sign(void *l3, const uint8_t *hmac_key)
+{
+    uint8_t *auth = (uint8_t *) esp_hdr(l3);
+    size_t auth_len = sizeof(struct esphdr) + esp_payload_len(l3);
+    esp_hmac_sha1(hmac_key, auth, auth_len, auth + auth_len);
+}
+
+/** Checks the ICV in constant time.  Returns false on mismatch. */
+static inline bool esp_hmac_sha1_verify(void *l3, const uint8_t *hmac_key)
+{
+    if (esp_payload_len(l3) <= 0)
+        return false;
+    uint8_t *auth = (uint8_t *) esp_hdr(l3);
+    size_t auth_len = sizeof(struct esphdr) + esp_payload_len(l3);
+    uint8_t digest[SHA_DIGEST_LENGTH];
+    esp_hmac_sha1(hmac_key, auth, auth_len, digest);
+    uint8_t diff = 0;
+    for (int i = 0; i < SHA_DIGEST_LENGTH; i++)
+        diff |= digest[i] ^ auth[auth_len + i];
+    return diff == 0;
+}
+
+/**
+ * Moves the inner IP packet in the decrypted ESP payload of len bytes
+ * (including the trailer) to l3.
+ * Returns the length of the inner packet, or -1 if the trailer is invalid.
+ */
+static inline int esp_decap_payload(void *l3, uint8_t *payload, int len)
+{
+    if (len < (int) sizeof(struct iphdr) + 2)
+        return -1;
+    int pad_len = payload[len - 2];
+    uint8_t next_hdr = payload[len - 1];
+    if (pad_len + 2 > len)
+        return -1;
+    int inner_len = len - 2 - pad_len;
+    if (next_hdr == ESP_NEXT_HDR_IPIP) {
+        if (inner_len < (int) sizeof(struct iphdr) || esp_is_ipv6(payload)
+            || ((const struct iphdr *) payload)->version != 4)
+            return -1;
+    } else if (next_hdr == ESP_NEXT_HDR_IPV6) {
+        if (inner_len < (int) sizeof(struct ip6_hdr) || !esp_is_ipv6(payload))
+            return -1;
+    } else {
+        return -1;
+    }
+    if (esp_l3_len(payload) > inner_len)
+        return -1;
+    inner_len = esp_l3_len(payload);
+    memmove(l3, payload, inner_len);
+    return inner_len;
+}
+
+/**
+ * Strips the outer IP header, the ESP header, trailer and ICV from a
+ * decrypted packet and moves the inner IP packet to l3.
+ * Returns the length of the inner packet, or -1 if the trailer is invalid.
+ */
+static inline int esp_decap(void *l3)
+{
+    return esp_decap_payload(l3, esp_payload(l3), esp_payload_len(l3));
+}
+
+/**
+ * The anti-replay window of an inbound SA (RFC 4303, Section 3.4.3).
+ * Sequence number 0 is never valid.
+ */
+struct esp_replay_window {
+    enum : uint32_t { SIZE = 64 };
+
+    uint32_t top;       /* the highest sequence number accepted */
+    uint64_t bitmap;    /* bit i: top - i has been accepted */
+
+    void reset() { top = 0; bitmap = 0; }
+
+    /** Checks if seq is new without updating the window. */
+    bool check(uint32_t seq) const
+    {
+        if (seq == 0)
+            return false;
+        if (seq > top)
+            return true;
+        uint32_t diff = top - seq;
+        if (diff >= SIZE)
+            return false;
+        return (bitmap & (1ull << diff)) == 0;
+    }
+
+    /** Marks seq as received.  Returns false if it is a replay or too old. */
+    bool update(uint32_t seq)
+    {
+        if (!check(seq))
+            return false;
+        if (seq > top) {
+            uint32_t shift = seq - top;
+            bitmap = (shift >= SIZE) ? 1 : ((bitmap << shift) | 1);
+            top = seq;
+        } else {
+            bitmap |= 1ull << (top - seq);
+        }
+        return true;
+    }
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -16,6 +16,10 @@ enum : int {
     HMAC_KEY_SIZE = 64,
 };
 
+/* The flow ID of packets without an SA in offloaded batches.
+ * It must be larger than any SA index. */
+#define IPSEC_INVALID_FLOW_ID (0xffffffffull)
+
 struct alignas(8) aes_block_info {
     int pkt_idx;
     int block_idx;
@@ -0,0 +1,471 @@
+#ifndef __NBA_IPSEC_SAD_HH__
+#define __NBA_IPSEC_SAD_HH__
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include "util_sa_entry.hh"
+
+namespace nba {
+
+/**
+ * A security association, as loaded from the configuration.
+ * Addresses and SPI are in host byte order.
+ */
+struct ipsec_sa {
+    uint32_t src_addr;
+    uint32_t dest_addr;
+    uint32_t spi;
+    uint32_t rpl;           /* initial replay counter */
+    uint32_t gw_addr;
+    uint8_t aes_key[AES_BLOCK_SIZE];
+    uint8_t aes_salt[4];    /* the implicit nonce part for AES-GCM (RFC 4106) */
+    uint8_t hmac_key[HMAC_KEY_SIZE];
+};
+
+/**
+ * The security association database (SAD) shared by IPsec elements.
+ *
+ * It indexes SAs by the (source, destination) address pair for outbound
+ * traffic and by the (SPI, destination) pair for inbound traffic, and
+ * the lookups return the SA index which elements pass to each other with
+ * NBA_ANNO_IPSEC_FLOW_ID so that the lookup is done only once.
+ *
+ * Both indexes are open-addressing hash tables with linear probing.
+ * Each slot is 8 bytes (a 32-bit hash tag and the SA index) so that a
+ * probe sequence mostly stays within a single cache line, and the full
+ * key is compared only against the SA entry of a matching tag.
+ *
+ * All data lives in a single position-independent memory block so that
+ * it can be built once and copied into each node's local storage.
+ * This class is a read-only view of such a block except for add().
+ */
+class IPsecSAD {
+public:
+    enum : uint32_t {
+        NOT_FOUND = 0xffffffffu,
+    };
+
+    IPsecSAD() : hdr(nullptr), slots_out(nullptr), slots_in(nullptr), sas(nullptr)
+    { }
+
+    /** The size of the memory block for the given maximum number of SAs. */
+    static size_t memory_size(size_t max_sas)
+    {
+        size_t table_size = get_table_size(max_sas);
+        return sizeof(struct sad_header)
+               + 2 * sizeof(struct sad_slot) * table_size
+               + sizeof(struct ipsec_sa) * max_sas;
+    }
+
+    /** Formats an empty SAD in the given memory of memory_size(max_sas) bytes. */
+    void init(void *mem, size_t max_sas)
+    {
+        struct sad_header *h = (struct sad_header *) mem;
+        h->num_sas = 0;
+        h->max_sas = max_sas;
+        h->table_size = get_table_size(max_sas);
+        h->mem_size = memory_size(max_sas);
+        attach(mem);
+        memset(slots_out, 0, sizeof(struct sad_slot) * hdr->table_size * 2);
+    }
+
+    /** Uses an already formatted memory block (e.g., a copy of another SAD). */
+    void attach(void *mem)
+    {
+        hdr = (struct sad_header *) mem;
+        slots_out = (struct sad_slot *) (hdr + 1);
+        slots_in  = slots_out + hdr->table_size;
+        sas = (struct ipsec_sa *) (slots_in + hdr->table_size);
+    }
+
+    void *get_memory() const { return hdr; }
+    size_t get_memory_size() const { return hdr->mem_size; }
+    size_t size() const { return hdr->num_sas; }
+
+    /**
+     * Adds an SA and returns its index, or NOT_FOUND if the SAD is full or
+     * the SA conflicts with an existing one in either index.
+     */
+    uint32_t add(const struct ipsec_sa &sa)
+    {
+        if (hdr->num_sas >= hdr->max_sas)
+            return NOT_FOUND;
+        if (lookup_outbound(sa.src_addr, sa.dest_addr) != NOT_FOUND
+            || lookup_inbound(sa.spi, sa.dest_addr) != NOT_FOUND)
+            return NOT_FOUND;
+        uint32_t idx = (uint32_t) hdr->num_sas;
+        sas[idx] = sa;
+        insert(slots_out, make_key(sa.src_addr, sa.dest_addr), idx);
+        insert(slots_in, make_key(sa.spi, sa.dest_addr), idx);
+        hdr->num_sas ++;
+        return idx;
+    }
+
+    /** Finds the SA for outgoing packets from src to dest (host byte order). */
+    inline uint32_t lookup_outbound(uint32_t src_addr, uint32_t dest_addr) const
+    {
+        uint64_t h = hash(make_key(src_addr, dest_addr));
+        uint32_t tag = make_tag(h);
+        for (uint64_t i = h & (hdr->table_size - 1); ; i = (i + 1) & (hdr->table_size - 1)) {
+            const struct sad_slot &s = slots_out[i];
+            if (s.tag == 0)
+                return NOT_FOUND;
+            if (s.tag == tag && sas[s.sa_idx].src_addr == src_addr
+                && sas[s.sa_idx].dest_addr == dest_addr)
+                return s.sa_idx;
+        }
+    }
+
+    /** Finds the SA for incoming ESP packets with the given SPI and destination. */
+    inline uint32_t lookup_inbound(uint32_t spi, uint32_t dest_addr) const
+    {
+        uint64_t h = hash(make_key(spi, dest_addr));
+        uint32_t tag = make_tag(h);
+        for (uint64_t i = h & (hdr->table_size - 1); ; i = (i + 1) & (hdr->table_size - 1)) {
+            const struct sad_slot &s = slots_in[i];
+            if (s.tag == 0)
+                return NOT_FOUND;
+            if (s.tag == tag && sas[s.sa_idx].spi == spi
+                && sas[s.sa_idx].dest_addr == dest_addr)
+                return s.sa_idx;
+        }
+    }
+
+    inline const struct ipsec_sa *get(uint32_t sa_idx) const
+    {
+        return &sas[sa_idx];
+    }
+
+    /**
+     * Generates the synthetic SAs used in the IPsec gateway experiments:
+     * tunnel i covers 10.0.0.1 -> 10.0.0.0 + (i + 1).
+     */
+    static void generate(size_t num_tunnels, std::vector<struct ipsec_sa> &out)
+    {
+        out.clear();
+        out.reserve(num_tunnels);
+        for (size_t i = 0; i < num_tunnels; i++) {
+            struct ipsec_sa sa;
+            sa.src_addr  = 0x0a000001u;
+            sa.dest_addr = 0x0a000000u + (uint32_t) (i + 1);
+            sa.spi       = 0x1000u + (uint32_t) i;
+            sa.rpl       = 0;
+            sa.gw_addr   = 0x0a000001u;
+            memcpy(sa.aes_key, "1234123412341234", AES_BLOCK_SIZE);
+            memcpy(sa.aes_salt, "5678", sizeof(sa.aes_salt));
+            memcpy(sa.hmac_key, "abcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcdabcd", HMAC_KEY_SIZE);
+            out.push_back(sa);
+        }
+    }
+
+    /**
+     * Loads SAs from a text file.  Each non-empty line not starting with
+     * '#' has the following whitespace-separated fields:
+     *
+     *   SRC_ADDR DEST_ADDR SPI AES_KEY HMAC_KEY [GW_ADDR]
+     *
+     * Addresses are dotted IPv4 addresses, SPI is a decimal or 0x-prefixed
+     * hexadecimal integer, and keys are hexadecimal strings of up to 16
+     * (AES) and 64 (HMAC) bytes, zero-padded if shorter.  An AES key of
+     * 20 bytes carries the 4-byte AES-GCM salt at its end (RFC 4106).
+     * Returns 0 on success, or -1 with the reason in err.
+     */
+    static int load_file(const char *path, std::vector<struct ipsec_sa> &out, std::string &err)
+    {
+        FILE *fp = fopen(path, "r");
+        if (fp == nullptr) {
+            err = std::string("cannot open ") + path;
+            return -1;
+        }
+        out.clear();
+        char line[512];
+        unsigned lineno = 0;
+        int ret = 0;
+        while (fgets(line, sizeof(line), fp) != nullptr) {
+            lineno ++;
+            char src[64], dst[64], spi[32], aes[256], hmac[256], gw[64];
+            char *p = line;
+            while (*p == ' ' || *p == '\t') p++;
+            if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+                continue;
+            int n = sscanf(p, "%63s %63s %31s %255s %255s %63s", src, dst, spi, aes, hmac, gw);
+            struct ipsec_sa sa;
+            memset(&sa, 0, sizeof(sa));
+            char *end = nullptr;
+            uint8_t aes_keymat[AES_BLOCK_SIZE + sizeof(sa.aes_salt)] = { 0 };
+            if (n < 5 || !parse_addr(src, &sa.src_addr) || !parse_addr(dst, &sa.dest_addr)
+                || (n == 6 && !parse_addr(gw, &sa.gw_addr))) {
+                ret = -1;
+            } else {
+                unsigned long v = strtoul(spi, &end, 0);
+                if (*end != '\0' || v > 0xffffffffUL
+                    || (strlen(aes) != 2 * sizeof(aes_keymat) && strlen(aes) > 2 * AES_BLOCK_SIZE)
+                    || !parse_hex(aes, aes_keymat, sizeof(aes_keymat))
+                    || !parse_hex(hmac, sa.hmac_key, HMAC_KEY_SIZE))
+                    ret = -1;
+                sa.spi = (uint32_t) v;
+                memcpy(sa.aes_key, aes_keymat, AES_BLOCK_SIZE);
+                memcpy(sa.aes_salt, aes_keymat + AES_BLOCK_SIZE, sizeof(sa.aes_salt));
+            }
+            if (ret != 0) {
+                err = std::string(path) + ":" + std::to_string(lineno) + ": invalid SA entry";
+                break;
+            }
+            if (n < 6)
+                sa.gw_addr = sa.src_addr;
+            out.push_back(sa);
+        }
+        fclose(fp);
+        return ret;
+    }
+
+private:
+    struct sad_header {
+        uint64_t num_sas;
+        uint64_t max_sas;
+        uint64_t table_size;    /* power of two */
+        uint64_t mem_size;
+        uint64_t _reserved[4];  /* keep the slots cache-aligned */
+    };
+
+    struct sad_slot {
+        uint32_t tag;           /* 0 means empty */
+        uint32_t sa_idx;
+    };
+
+    static size_t get_table_size(size_t max_sas)
+    {
+        /* Keep the load factor below 0.5 for short probe sequences. */
+        size_t s = 16;
+        while (s < 2 * max_sas)
+            s <<= 1;
+        return s;
+    }
+
+    static inline uint64_t make_key(uint32_t hi, uint32_t lo)
+    {
+        return ((uint64_t) hi << 32) | lo;
+    }
+
+    static inline uint64_t hash(uint64_t k)
+    {
+        /* The finalizer of MurmurHash3. */
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    static inline uint32_t make_tag(uint64_t h)
+    {
+        return (uint32_t) (h >> 32) | 1u;
+    }
+
+    void insert(struct sad_slot *slots, uint64_t key, uint32_t sa_idx)
+    {
+        uint64_t h = hash(key);
+        uint64_t i = h & (hdr->table_size - 1);
+        while (slots[i].tag != 0)
+            i = (i + 1) & (hdr->table_size - 1);
+        slots[i].tag = make_tag(h);
+        slots[i].sa_idx = sa_idx;
+    }
+
+    static bool parse_addr(const char *s, uint32_t *addr)
+    {
+        struct in_addr a;
+        if (inet_pton(AF_INET, s, &a) != 1)
+            return false;
+        *addr = ntohl(a.s_addr);
+        return true;
+    }
+
+    static bool parse_hex(const char *s, uint8_t *out, size_t max_len)
+    {
+        size_t len = strlen(s);
+        if (len % 2 != 0 || len / 2 > max_len)
+            return false;
+        memset(out, 0, max_len);
+        for (size_t i = 0; i < len / 2; i++) {
+            char byte[3] = { s[2 * i], s[2 * i + 1], '\0' };
+            char *end = nullptr;
+            out[i] = (uint8_t) strtoul(byte, &end, 16);
+            if (*end != '\0')
+                return false;
+        }
+        return true;
+    }
+
+    struct sad_header *hdr;
+    struct sad_slot *slots_out;
+    struct sad_slot *slots_in;
+    struct ipsec_sa *sas;
+};
+
+/**
+ * Keeps the SAD shared by all IPsec elements for the process lifetime.
+ *
+ * The elements pass their optional source argument (the number of
+ * synthetic tunnels or the path of an SA file) to configure() on every
+ * graph build, along with the generation of the build: 0 at startup and
+ * bumped by each graph reload.  The elements of a build must agree on
+ * the source.  load() builds the SAD once from the source of the latest
+ * build.  Since the running elements keep using it, later builds are
+ * rejected if they give another source or the SA file has changed.
+ */
+class IPsecSADStore {
+public:
+    IPsecSADStore(size_t default_tunnels)
+        : default_tunnels(default_tunnels), mem(nullptr),
+          staged_mem(nullptr), conf_generation(0)
+    { }
+
+    ~IPsecSADStore()
+    {
+        free(mem);
+        free(staged_mem);
+    }
+
+    /** Returns 0 if the source is acceptable, or -1 with the reason in err. */
+    int configure(unsigned generation, const std::string &src, std::string &err)
+    {
+        if (generation != conf_generation) {
+            /* A new build; drop what a refused one has staged. */
+            conf_generation = generation;
+            conf_source.clear();
+            free(staged_mem);
+            staged_mem = nullptr;
+        }
+        if (src.empty())
+            return 0;
+        if (!conf_source.empty()) {
+            if (src == conf_source)
+                return 0;
+            err = "the SAD source (" + src + ") differs from other IPsec elements ("
+                  + conf_source + ")";
+            return -1;
+        }
+        std::vector<struct ipsec_sa> sas;
+        if (read_source(src, sas, err) != 0)
+            return -1;
+        if (mem != nullptr) {
+            if (src != source) {
+                err = "the SAD is loaded from " + source + "; changing it to " + src
+                      + " needs a restart";
+                return -1;
+            }
+            if (!has_same_sas(sas)) {
+                err = src + " has changed since the SAD was loaded; it needs a restart";
+                return -1;
+            }
+        } else {
+            staged_mem = build(sas, err);
+            if (staged_mem == nullptr)
+                return -1;
+        }
+        conf_source = src;
+        return 0;
+    }
+
+    bool loaded() const { return mem != nullptr; }
+    const std::string &get_source() const { return source; }
+
+    /** Builds the SAD from the latest build unless loaded, and returns it. */
+    const IPsecSAD &load()
+    {
+        if (mem != nullptr)
+            return sad;
+        if (staged_mem != nullptr) {
+            mem = staged_mem;
+            staged_mem = nullptr;
+            source = conf_source;
+        } else {
+            std::vector<struct ipsec_sa> sas;
+            std::string err;
+            IPsecSAD::generate(default_tunnels, sas);
+            mem = build(sas, err);
+            source = std::to_string(default_tunnels);
+        }
+        sad.attach(mem);
+        return sad;
+    }
+
+private:
+    static int read_source(const std::string &src, std::vector<struct ipsec_sa> &sas,
+                           std::string &err)
+    {
+        bool is_count = true;
+        for (char c : src)
+            is_count = is_count && isdigit(c);
+        if (is_count) {
+            unsigned long num_tunnels = strtoul(src.c_str(), nullptr, 10);
+            if (num_tunnels == 0 || num_tunnels >= (1ul << 24)) {
+                err = "the number of tunnels must be in [1, 2^24)";
+                return -1;
+            }
+            IPsecSAD::generate(num_tunnels, sas);
+            return 0;
+        }
+        if (IPsecSAD::load_file(src.c_str(), sas, err) != 0)
+            return -1;
+        if (sas.size() == 0) {
+            err = "no SA entries in " + src;
+            return -1;
+        }
+        return 0;
+    }
+
+    static void *build(const std::vector<struct ipsec_sa> &sas, std::string &err)
+    {
+        void *m = malloc(IPsecSAD::memory_size(sas.size()));
+        if (m == nullptr) {
+            err = "cannot allocate the SAD";
+            return nullptr;
+        }
+        IPsecSAD s;
+        s.init(m, sas.size());
+        for (const struct ipsec_sa &sa : sas) {
+            if (s.add(sa) == IPsecSAD::NOT_FOUND) {
+                char buf[80];
+                snprintf(buf, sizeof(buf), "duplicate SA (spi 0x%x, %08x -> %08x)",
+                         sa.spi, sa.src_addr, sa.dest_addr);
+                err = buf;
+                free(m);
+                return nullptr;
+            }
+        }
+        return m;
+    }
+
+    bool has_same_sas(const std::vector<struct ipsec_sa> &sas) const
+    {
+        if (sas.size() != sad.size())
+            return false;
+        for (uint32_t i = 0; i < sas.size(); i++)
+            if (memcmp(sad.get(i), &sas[i], sizeof(struct ipsec_sa)) != 0)
+                return false;
+        return true;
+    }
+
+    size_t default_tunnels;
+    void *mem;              /* the loaded SAD */
+    IPsecSAD sad;
+    std::string source;
+    void *staged_mem;       /* built from conf_source until loaded */
+    unsigned conf_generation;
+    std::string conf_source;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -95,9 +95,11 @@ int LookupIP6Route::initialize_per_node()
     // Copy table for the each node..
     _original_table.copy_to(table);
 
-    /* Storage for device pointers. */
-    ctx->node_local_storage->alloc("dev_tables", sizeof(Item*) * 128);
-    ctx->node_local_storage->alloc("dev_table_sizes", sizeof(size_t) * 128);
+    /* Storage for device pointers of each device. */
+    ctx->node_local_storage->alloc("dev_tables", sizeof(struct per_device_mem));
+    ctx->node_local_storage->alloc("dev_table_sizes", sizeof(struct per_device_mem));
+    ((struct per_device_mem *) ctx->node_local_storage->get_alloc("dev_tables"))->clear();
+    ((struct per_device_mem *) ctx->node_local_storage->get_alloc("dev_table_sizes"))->clear();
 
     return 0;
 }
@@ -111,8 +113,8 @@ int LookupIP6Route::initialize()
     _rwlock_ptr = ctx->node_local_storage->get_rwlock("ipv6_table");
 
     /* Get GPU device pointers from the node-local storage. */
-    d_tables      = (dev_mem_t *) ctx->node_local_storage->get_alloc("dev_tables");
-    d_table_sizes = (dev_mem_t *) ctx->node_local_storage->get_alloc("dev_table_sizes");
+    d_tables      = (struct per_device_mem *) ctx->node_local_storage->get_alloc("dev_tables");
+    d_table_sizes = (struct per_device_mem *) ctx->node_local_storage->get_alloc("dev_table_sizes");
     return 0;
 }
 
@@ -190,10 +192,10 @@ void LookupIP6Route::accel_compute_handler(ComputeDevice *cdev,
 {
     struct kernel_arg arg;
     void *ptr_args[2];
-    ptr_args[0] = cdev->unwrap_device_buffer(*d_tables);
+    ptr_args[0] = cdev->unwrap_device_buffer(*d_tables->find(cdev));
     arg = {&ptr_args[0], sizeof(void *), alignof(void *)};
     cctx->push_kernel_arg(arg);
-    ptr_args[1] = cdev->unwrap_device_buffer(*d_table_sizes);
+    ptr_args[1] = cdev->unwrap_device_buffer(*d_table_sizes->find(cdev));
     arg = {&ptr_args[1], sizeof(void *), alignof(void *)};
     cctx->push_kernel_arg(arg);
     dev_kernel_t kern;
@@ -210,23 +212,25 @@ void LookupIP6Route::accel_init_handler(ComputeDevice *device)
 {
     size_t *table_sizes;
     void **table_ptrs;
-    host_mem_t table_ptrs_h;  // <-> d_tables
-    host_mem_t table_sizes_h; // <-> d_table_sizes
-
-    /* Store the device pointers for per-thread instances. */
-    d_tables      = (dev_mem_t *) ctx->node_local_storage->get_alloc("dev_tables");
-    d_table_sizes = (dev_mem_t *) ctx->node_local_storage->get_alloc("dev_table_sizes");
+    host_mem_t table_ptrs_h;  // <-> tables_d
+    host_mem_t table_sizes_h; // <-> table_sizes_d
+
+    /* Store the device pointers of this device for per-thread instances. */
+    d_tables      = (struct per_device_mem *) ctx->node_local_storage->get_alloc("dev_tables");
+    d_table_sizes = (struct per_device_mem *) ctx->node_local_storage->get_alloc("dev_table_sizes");
+    dev_mem_t *tables_d      = d_tables->add(device);
+    dev_mem_t *table_sizes_d = d_table_sizes->add(device);
     table_ptrs_h   = device->alloc_host_buffer(sizeof(void *) * 128, 0);
     table_sizes_h  = device->alloc_host_buffer(sizeof(size_t) * 128, 0);
-    *d_tables      = device->alloc_device_buffer(sizeof(void *) * 128, 0, table_ptrs_h);
-    *d_table_sizes = device->alloc_device_buffer(sizeof(size_t) * 128, 0, table_sizes_h);
+    *tables_d      = device->alloc_device_buffer(sizeof(void *) * 128, 0, table_ptrs_h);
+    *table_sizes_d = device->alloc_device_buffer(sizeof(size_t) * 128, 0, table_sizes_h);
 
     table_sizes = (size_t*) device->unwrap_host_buffer(table_sizes_h);
     table_ptrs  = (void **) device->unwrap_host_buffer(table_ptrs_h);
 
     /* table_ptrs_h keeps track of the temporary host-side references to tables in
      * the device for initialization and copy.
-     * d_tables is the actual device buffer to store pointers in table_ptrs_h. */
+     * tables_d is the actual device buffer to store pointers in table_ptrs_h. */
     for (int i = 0; i < 128; i++) {
         table_sizes[i] = _original_table.m_Tables[i]->m_TableSize;
         size_t copy_size = sizeof(Item) * table_sizes[i] * 2;
@@ -238,8 +242,8 @@ void LookupIP6Route::accel_init_handler(ComputeDevice *device)
         memcpy(device->unwrap_host_buffer(table_content_h), _original_table.m_Tables[i]->m_Table, copy_size);
         device->memwrite(table_content_h, table_content_d, 0, copy_size);
     }
-    device->memwrite(table_ptrs_h, *d_tables, 0, sizeof(void *) * 128);
-    device->memwrite(table_sizes_h, *d_table_sizes, 0, sizeof(size_t) * 128);
+    device->memwrite(table_ptrs_h, *tables_d, 0, sizeof(void *) * 128);
+    device->memwrite(table_sizes_h, *table_sizes_d, 0, sizeof(size_t) * 128);
 
 }
 
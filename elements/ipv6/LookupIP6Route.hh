@@ -63,8 +63,8 @@ private:
     rte_rwlock_t    *_rwlock_ptr;
 
     /* For offloaded methods */
-    dev_mem_t *d_tables;
-    dev_mem_t *d_table_sizes;
+    struct per_device_mem *d_tables;
+    struct per_device_mem *d_table_sizes;
 };
 
 EXPORT_ELEMENT(LookupIP6Route);
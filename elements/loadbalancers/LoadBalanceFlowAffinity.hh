@@ -0,0 +1,139 @@
+#ifndef __NBA_ELEMENT_LOADBALANCEFLOWAFFINITY_HH__
+#define __NBA_ELEMENT_LOADBALANCEFLOWAFFINITY_HH__
+
+#include <nba/element/element.hh>
+#include <nba/element/annotation.hh>
+#include <nba/framework/logging.hh>
+#include <vector>
+#include <string>
+#include <exception>
+#include <stdexcept>
+#include <rte_errno.h>
+#include <rte_atomic.h>
+#include "util_flow_buckets.hh"
+
+#define LB_FLOW_CPU_RATIO_MULTIPLIER (1000)
+
+namespace nba {
+
+/**
+ * A flow-affinity-preserving load balancer.
+ *
+ * It hashes each packet's flow (the NIC's RSS hash, or the IPv4 5-tuple
+ * if unavailable) into a bucket and forwards it to output port 0 (CPU
+ * path) or 1 (offload path) depending on the bucket assignment.
+ * Connect the outputs to CPUOnly() and GPUOnly() respectively.
+ * Since all packets of a flow take the same path, they are not
+ * reordered by the load balancer unless their bucket is migrated.
+ *
+ * The target CPU ratio is shared per NUMA node as
+ * "LBFlowAffinity.cpu_ratio" (x LB_FLOW_CPU_RATIO_MULTIPLIER).  It stays
+ * at CPU_RATIO unless LoadBalancePID is in the same pipeline, which then
+ * sets it to its controller output.  The buckets are rebalanced towards
+ * it periodically in dispatch().
+ *
+ * Arguments: CPU_RATIO | "from-env" [, MAX_MIGRATIONS_PER_EPOCH]
+ */
+class LoadBalanceFlowAffinity : public SchedulableElement {
+public:
+    LoadBalanceFlowAffinity() : SchedulableElement(),
+        cpu_ratio(1.0f), max_migrations(16), shared_cpu_ratio(nullptr)
+    { }
+
+    virtual ~LoadBalanceFlowAffinity()
+    { }
+
+    const char *class_name() const { return "LoadBalanceFlowAffinity"; }
+    const char *port_count() const { return "1/2"; }
+    int get_type() const { return SchedulableElement::get_type() | ELEMTYPE_PER_PACKET; }
+
+    int initialize()
+    {
+        shared_cpu_ratio = (rte_atomic64_t *) ctx->node_local_storage->get_alloc("LBFlowAffinity.cpu_ratio");
+        assert(shared_cpu_ratio != nullptr);
+        buckets.reset(cpu_ratio);
+        return 0;
+    }
+
+    int initialize_global() { return 0; }
+
+    int initialize_per_node()
+    {
+        ctx->node_local_storage->alloc("LBFlowAffinity.cpu_ratio", sizeof(rte_atomic64_t));
+        rte_atomic64_t *node_cpu_ratio = (rte_atomic64_t *)
+                ctx->node_local_storage->get_alloc("LBFlowAffinity.cpu_ratio");
+        assert(node_cpu_ratio != nullptr);
+        rte_atomic64_set(node_cpu_ratio, (int64_t) (cpu_ratio * LB_FLOW_CPU_RATIO_MULTIPLIER));
+        return 0;
+    }
+
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args)
+    {
+        Element::configure(ctx, args);
+        if (args.size() < 1 || args.size() > 2)
+            rte_panic("LoadBalanceFlowAffinity: too many or few arguments. (expected: 1 or 2)\n");
+
+        std::string num_str;
+        if (args[0] == "from-env") {
+            const char *env = getenv("NBA_LOADBALANCER_CPU_RATIO");
+            if (env == nullptr) {
+                RTE_LOG(WARNING, LB, "LoadBalanceFlowAffinity: env-var NBA_LOADBALANCER_CPU_RATIO is not set. Falling back to CPU-only...\n");
+                num_str = "1.0";
+            } else {
+                num_str = env;
+            }
+        } else {
+            num_str = args[0];
+        }
+
+        try {
+            cpu_ratio = std::stof(num_str, nullptr);
+            if (cpu_ratio < 0.0f || cpu_ratio > 1.0f)
+                throw std::out_of_range("cpu_ratio");
+            if (args.size() == 2)
+                max_migrations = (unsigned) std::stoul(args[1], nullptr);
+        } catch (std::out_of_range &e) {
+            rte_panic("LoadBalanceFlowAffinity: out of range (%s).\n", num_str.c_str());
+        } catch (std::invalid_argument &e) {
+            rte_panic("LoadBalanceFlowAffinity: invalid argument (%s).\n", num_str.c_str());
+        }
+
+        RTE_LOG(INFO, LB, "load balancer mode: Flow-affinity (CPU: %.2f, %u buckets, max %u migrations/epoch)\n",
+                cpu_ratio, FlowBucketMap::NUM_BUCKETS, max_migrations);
+        return 0;
+    }
+
+    int process(int input_port, Packet *pkt)
+    {
+        uint32_t h = pkt->has_rss_hash() ? pkt->rss_hash()
+                                         : flow_hash_ipv4(pkt->data(), pkt->length());
+        output(buckets.lookup(h)).push(pkt);
+        return 0;
+    }
+
+    int dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay)
+    {
+        next_delay = 100000; // 0.1sec
+        float target = (float) rte_atomic64_read(shared_cpu_ratio) / LB_FLOW_CPU_RATIO_MULTIPLIER;
+        unsigned migrated = buckets.rebalance(target, max_migrations);
+        if (migrated > 0)
+            RTE_LOG(DEBUG, LB, "LoadBalanceFlowAffinity@%u: migrated %u buckets (target %.3f, achieved %.3f)\n",
+                    ctx->loc.core_id, migrated, target, buckets.get_cpu_load_ratio());
+        out_batch = nullptr;
+        return 0;
+    }
+
+private:
+    FlowBucketMap buckets;
+    float cpu_ratio;
+    unsigned max_migrations;
+    rte_atomic64_t *shared_cpu_ratio;
+};
+
+EXPORT_ELEMENT(LoadBalanceFlowAffinity);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,195 @@
+#ifndef __NBA_ELEMENT_LOADBALANCEPID_HH__
+#define __NBA_ELEMENT_LOADBALANCEPID_HH__
+
+#include <nba/element/element.hh>
+#include <nba/element/annotation.hh>
+#include <nba/framework/loadbalancer.hh>
+#include <nba/framework/logging.hh>
+#include <nba/core/timing.hh>
+#include <vector>
+#include <string>
+#include <random>
+#include <new>
+#include <rte_errno.h>
+#include <rte_atomic.h>
+#include "util_pid.hh"
+#include "LoadBalanceFlowAffinity.hh"
+
+#define LB_PID_CPU_RATIO_MULTIPLIER (1000)
+#define LB_PID_MIN_SHARE (0.02f)
+
+namespace nba {
+
+/* The telemetry of each computation thread, indexed by local_thread_idx. */
+struct lb_pid_thread_stat {
+    volatile uint64_t tx_pkt_count;
+    volatile uint64_t batch_proc_time;
+    volatile double pkt_proc_cycles[2];
+} __cache_aligned;
+
+/**
+ * A load balancer driven by a PID controller.
+ *
+ * Every computation thread publishes its SystemInspector telemetry to
+ * the node-local storage, and the first one of each NUMA node runs the
+ * controller on the node-wide aggregate: the per-packet processing
+ * cycles of each path averaged with the transmitted packets of each
+ * thread as weights.  The setpoint is the ratio that equalizes them, and
+ * the controller moves the node-wide CPU ratio towards it with a bounded
+ * step per interval.  All threads in the node read the ratio from the
+ * node-local storage.
+ *
+ * The ratio is kept within [LB_PID_MIN_SHARE, 1 - LB_PID_MIN_SHARE] so
+ * that both paths keep being measured.  If LoadBalanceFlowAffinity is in
+ * the same pipeline, its node-wide target ratio follows the controller
+ * as well.
+ */
+class LoadBalancePID : public SchedulableElement, PerBatchElement {
+public:
+    LoadBalancePID() : SchedulableElement(), PerBatchElement(),
+        cpu_ratio(nullptr), flow_cpu_ratio(nullptr), controller(nullptr), thread_stats(nullptr)
+    { }
+
+    virtual ~LoadBalancePID()
+    { }
+
+    const char *class_name() const { return "LoadBalancePID"; }
+    const char *port_count() const { return "1/1"; }
+    int get_type() const { return SchedulableElement::get_type() | PerBatchElement::get_type(); }
+
+    int initialize()
+    {
+        uniform_dist = std::uniform_int_distribution<int64_t>(0, LB_PID_CPU_RATIO_MULTIPLIER - 1);
+        random_generator = std::default_random_engine();
+        cpu_ratio = (rte_atomic64_t *) ctx->node_local_storage->get_alloc("LBPID.cpu_ratio");
+        controller = (PIDRatioController *) ctx->node_local_storage->get_alloc("LBPID.controller");
+        thread_stats = (struct lb_pid_thread_stat *) ctx->node_local_storage->get_alloc("LBPID.thread_stats");
+        assert(cpu_ratio != nullptr && controller != nullptr && thread_stats != nullptr);
+        assert(ctx->loc.local_thread_idx < NBA_MAX_CORES);
+        /* Both use the same multiplier. */
+        static_assert(LB_PID_CPU_RATIO_MULTIPLIER == LB_FLOW_CPU_RATIO_MULTIPLIER,
+                      "The CPU ratios of LoadBalancePID and LoadBalanceFlowAffinity must have the same scale.");
+        if (ctx->node_local_storage->has("LBFlowAffinity.cpu_ratio"))
+            flow_cpu_ratio = (rte_atomic64_t *) ctx->node_local_storage->get_alloc("LBFlowAffinity.cpu_ratio");
+        local_cpu_ratio = rte_atomic64_read(cpu_ratio);
+        for (unsigned i = 0; i < NBA_MAX_CORES; i++)
+            last_tx_pkt_counts[i] = 0;
+        last_update = get_usec();
+        return 0;
+    }
+
+    int initialize_global() { return 0; }
+
+    int initialize_per_node()
+    {
+        ctx->node_local_storage->alloc("LBPID.cpu_ratio", sizeof(rte_atomic64_t));
+        ctx->node_local_storage->alloc("LBPID.controller", sizeof(PIDRatioController));
+        ctx->node_local_storage->alloc("LBPID.thread_stats", sizeof(struct lb_pid_thread_stat) * NBA_MAX_CORES);
+        memset(ctx->node_local_storage->get_alloc("LBPID.thread_stats"), 0,
+               sizeof(struct lb_pid_thread_stat) * NBA_MAX_CORES);
+        rte_atomic64_t *node_cpu_ratio = (rte_atomic64_t *)
+                ctx->node_local_storage->get_alloc("LBPID.cpu_ratio");
+        void *node_controller = ctx->node_local_storage->get_alloc("LBPID.controller");
+        assert(node_cpu_ratio != nullptr && node_controller != nullptr);
+        PIDRatioController *pid = new (node_controller) PIDRatioController();
+        pid->set_limits(LB_PID_MIN_SHARE, 1.0f - LB_PID_MIN_SHARE);
+        pid->reset(1.0f);
+        rte_atomic64_set(node_cpu_ratio, (int64_t) (pid->get_ratio() * LB_PID_CPU_RATIO_MULTIPLIER));
+        return 0;
+    }
+
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args)
+    {
+        Element::configure(ctx, args);
+        RTE_LOG(INFO, LB, "load balancer mode: PID\n");
+        return 0;
+    }
+
+    int process_batch(int input_port, PacketBatch *batch)
+    {
+        int64_t x = uniform_dist(random_generator);
+        int choice = (x >= local_cpu_ratio) - 1;
+        anno_set(&batch->banno, NBA_BANNO_LB_DECISION, choice);
+        return 0;
+    }
+
+    int dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay)
+    {
+        next_delay = 200000; // 0.2sec
+
+        /* Publish our own telemetry. */
+        SystemInspector *insp = ctx->inspector;
+        struct lb_pid_thread_stat *my_stat = &thread_stats[ctx->loc.local_thread_idx];
+        my_stat->pkt_proc_cycles[0] = insp->pkt_proc_cycles[0];
+        my_stat->pkt_proc_cycles[1] = insp->pkt_proc_cycles[1];
+        my_stat->batch_proc_time = insp->batch_proc_time;
+        rte_wmb();
+        my_stat->tx_pkt_count = insp->tx_pkt_count;
+
+        if (ctx->loc.local_thread_idx == 0) {
+            uint64_t now = get_usec();
+            float dt = (now - last_update) / 1e6f;
+            /* Aggregate the threads of this node, weighted by their
+             * transmitted packets in the last interval. */
+            uint64_t tx_pkts = 0;
+            double ppc_sum[2] = {0, 0}, ppc_weight[2] = {0, 0}, bpt_sum = 0;
+            for (unsigned i = 0; i < NBA_MAX_CORES; i++) {
+                uint64_t cnt = thread_stats[i].tx_pkt_count;
+                if (cnt == 0)
+                    continue;
+                rte_rmb();
+                uint64_t delta = cnt - last_tx_pkt_counts[i];
+                last_tx_pkt_counts[i] = cnt;
+                tx_pkts += delta;
+                bpt_sum += (double) thread_stats[i].batch_proc_time * delta;
+                for (int p = 0; p < 2; p++) {
+                    double ppc = thread_stats[i].pkt_proc_cycles[p];
+                    if (ppc > 0 && delta > 0) {
+                        ppc_sum[p] += ppc * delta;
+                        ppc_weight[p] += delta;
+                    }
+                }
+            }
+            const float ppc_cpu = (ppc_weight[0] > 0) ? ppc_sum[0] / ppc_weight[0] : 0;
+            const float ppc_offl = (ppc_weight[1] > 0) ? ppc_sum[1] / ppc_weight[1] : 0;
+            /* Hold the state when idle or not measured yet. */
+            if (tx_pkts > 0 && ppc_cpu > 0 && ppc_offl > 0) {
+                float c = controller->get_ratio();
+                float setpoint = lb_balanced_ratio(ppc_cpu, ppc_offl);
+                float new_c = controller->update(setpoint - c, dt);
+                rte_atomic64_set(cpu_ratio, (int64_t) (new_c * LB_PID_CPU_RATIO_MULTIPLIER));
+                if (flow_cpu_ratio != nullptr)
+                    rte_atomic64_set(flow_cpu_ratio, (int64_t) (new_c * LB_PID_CPU_RATIO_MULTIPLIER));
+                RTE_LOG(DEBUG, LB, "[PID:%u] node thruput %.0f pps, batch-proc %.0f, PPC CPU %.0f OFFL %.0f, "
+                        "setpoint %.3f, CPU ratio %.3f -> %.3f\n",
+                        ctx->loc.node_id, tx_pkts / dt, bpt_sum / tx_pkts,
+                        ppc_cpu, ppc_offl, setpoint, c, new_c);
+            }
+            last_update = now;
+        }
+        local_cpu_ratio = rte_atomic64_read(cpu_ratio);
+
+        out_batch = nullptr;
+        return 0;
+    }
+
+private:
+    rte_atomic64_t *cpu_ratio;
+    rte_atomic64_t *flow_cpu_ratio;     /* of LoadBalanceFlowAffinity, if any */
+    PIDRatioController *controller;
+    struct lb_pid_thread_stat *thread_stats;
+    int64_t local_cpu_ratio;
+    uint64_t last_tx_pkt_counts[NBA_MAX_CORES];     /* used by the controller thread */
+    uint64_t last_update;
+
+    std::uniform_int_distribution<int64_t> uniform_dist;
+    std::default_random_engine random_generator;
+};
+
+EXPORT_ELEMENT(LoadBalancePID);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,220 @@
+#ifndef __NBA_ELEMENT_LB_UTIL_FLOW_BUCKETS_HH__
+#define __NBA_ELEMENT_LB_UTIL_FLOW_BUCKETS_HH__
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <rte_ether.h>
+
+namespace nba {
+
+enum FlowBucketPath : int {
+    FLOW_PATH_CPU = 0,
+    FLOW_PATH_OFFLOAD = 1,
+};
+
+/**
+ * Computes the flow hash from the IPv4 5-tuple of an Ethernet frame.
+ * Non-IPv4 frames are hashed by their Ethernet addresses only, so that
+ * they still stay in a single bucket.
+ */
+static inline uint32_t flow_hash_ipv4(const uint8_t *frame, uint32_t len)
+{
+    uint32_t h = 2166136261u; /* FNV-1a */
+    const uint8_t *p;
+    uint32_t n;
+    const struct ether_hdr *ethh = (const struct ether_hdr *) frame;
+    if (len < sizeof(struct ether_hdr) + sizeof(struct iphdr)
+        || ntohs(ethh->ether_type) != ETHER_TYPE_IPv4) {
+        p = frame;
+        n = (len < 2 * ETHER_ADDR_LEN) ? len : 2 * ETHER_ADDR_LEN;
+        for (uint32_t i = 0; i < n; i++)
+            h = (h ^ p[i]) * 16777619u;
+        return h;
+    }
+    const struct iphdr *iph = (const struct iphdr *) (ethh + 1);
+    uint8_t key[13];
+    memcpy(&key[0], &iph->saddr, 4);
+    memcpy(&key[4], &iph->daddr, 4);
+    key[8] = iph->protocol;
+    memset(&key[9], 0, 4);
+    uint32_t l4_offset = sizeof(struct ether_hdr) + iph->ihl * 4;
+    bool is_first_frag = (ntohs(iph->frag_off) & 0x1fff) == 0;
+    if ((iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP)
+        && is_first_frag && len >= l4_offset + 4)
+        memcpy(&key[9], frame + l4_offset, 4);  /* sport and dport */
+    for (uint32_t i = 0; i < sizeof(key); i++)
+        h = (h ^ key[i]) * 16777619u;
+    return h;
+}
+
+/**
+ * A fixed number of flow buckets, each assigned to either the CPU or the
+ * offloading path.
+ *
+ * All packets of a flow fall into the same bucket and thus take the same
+ * path.  When the target ratio changes, whole buckets are migrated from
+ * one path to the other.  The per-bucket load (packets per epoch, as a
+ * moving average) is used to decide how many buckets to move, and the
+ * buckets are picked in a round-robin manner so that repeated rebalancing
+ * does not keep moving the same flows.
+ *
+ * It is used by a single computation thread, so no locks are needed.
+ */
+class FlowBucketMap {
+public:
+    static const unsigned NUM_BUCKETS = 1024;
+
+    FlowBucketMap()
+    {
+        reset(1.0f);
+    }
+
+    /** Assigns the first ratio x NUM_BUCKETS buckets to CPU and clears loads. */
+    void reset(float cpu_ratio)
+    {
+        unsigned num_cpu = (unsigned) lroundf(clamp_ratio(cpu_ratio) * NUM_BUCKETS);
+        for (unsigned b = 0; b < NUM_BUCKETS; b++) {
+            paths[b] = (b < num_cpu) ? FLOW_PATH_CPU : FLOW_PATH_OFFLOAD;
+            hits[b] = 0;
+            load[b] = 0;
+        }
+        num_cpu_buckets = num_cpu;
+        cursor = 0;
+        total_migrations = 0;
+    }
+
+    /** Returns the path of the bucket for the given flow hash. */
+    int lookup(uint32_t flow_hash)
+    {
+        unsigned b = bucket_of(flow_hash);
+        hits[b] ++;
+        return paths[b];
+    }
+
+    int get_path(uint32_t flow_hash) const
+    {
+        return paths[bucket_of(flow_hash)];
+    }
+
+    /**
+     * Ends the current epoch and migrates at most max_migrations buckets
+     * towards the target CPU ratio.  Returns the number of migrated
+     * buckets.
+     */
+    unsigned rebalance(float target_cpu_ratio, unsigned max_migrations)
+    {
+        float total = 0, cpu_load = 0;
+        for (unsigned b = 0; b < NUM_BUCKETS; b++) {
+            load[b] = (1.0f - LOAD_WEIGHT) * load[b] + LOAD_WEIGHT * hits[b];
+            hits[b] = 0;
+            total += load[b];
+            if (paths[b] == FLOW_PATH_CPU)
+                cpu_load += load[b];
+        }
+        target_cpu_ratio = clamp_ratio(target_cpu_ratio);
+
+        unsigned migrated = 0;
+        if (total == 0) {
+            /* No traffic yet: balance the number of buckets instead. */
+            int target = (int) lroundf(target_cpu_ratio * NUM_BUCKETS);
+            while (migrated < max_migrations && (int) num_cpu_buckets != target) {
+                int from = ((int) num_cpu_buckets < target) ? FLOW_PATH_OFFLOAD : FLOW_PATH_CPU;
+                unsigned b = next_bucket_on(from);
+                move_bucket(b);
+                migrated ++;
+            }
+        } else {
+            float remaining = target_cpu_ratio * total - cpu_load;
+            int from = (remaining > 0) ? FLOW_PATH_OFFLOAD : FLOW_PATH_CPU;
+            remaining = fabsf(remaining);
+            /* Move whole buckets as long as they do not overshoot the
+             * target by more than half of their load. */
+            for (unsigned scanned = 0;
+                 scanned < NUM_BUCKETS && migrated < max_migrations;
+                 scanned ++) {
+                unsigned b = cursor;
+                cursor = (cursor + 1) % NUM_BUCKETS;
+                if (paths[b] != from || load[b] == 0)
+                    continue;
+                if (load[b] > 2 * remaining)
+                    continue;
+                move_bucket(b);
+                migrated ++;
+                remaining -= load[b];
+                if (remaining <= 0)
+                    break;
+            }
+        }
+        total_migrations += migrated;
+        return migrated;
+    }
+
+    /** The fraction of the recent load assigned to the CPU path. */
+    float get_cpu_load_ratio() const
+    {
+        float total = 0, cpu_load = 0;
+        for (unsigned b = 0; b < NUM_BUCKETS; b++) {
+            total += load[b];
+            if (paths[b] == FLOW_PATH_CPU)
+                cpu_load += load[b];
+        }
+        return (total == 0) ? ((float) num_cpu_buckets / NUM_BUCKETS) : (cpu_load / total);
+    }
+
+    unsigned get_num_cpu_buckets() const { return num_cpu_buckets; }
+    uint64_t get_total_migrations() const { return total_migrations; }
+
+    /* The weight of the latest epoch in the per-bucket load average. */
+    static constexpr float LOAD_WEIGHT = 0.5f;
+
+private:
+    static inline float clamp_ratio(float r)
+    {
+        return (r < 0.0f) ? 0.0f : ((r > 1.0f) ? 1.0f : r);
+    }
+
+    static inline unsigned bucket_of(uint32_t flow_hash)
+    {
+        /* Mix the upper bits in, since RSS hashes may be weak in the
+         * lower bits for some traffic patterns. */
+        return (flow_hash ^ (flow_hash >> 16)) % NUM_BUCKETS;
+    }
+
+    unsigned next_bucket_on(int path)
+    {
+        for (unsigned i = 0; i < NUM_BUCKETS; i++) {
+            unsigned b = cursor;
+            cursor = (cursor + 1) % NUM_BUCKETS;
+            if (paths[b] == path)
+                return b;
+        }
+        return cursor;
+    }
+
+    void move_bucket(unsigned b)
+    {
+        if (paths[b] == FLOW_PATH_CPU) {
+            paths[b] = FLOW_PATH_OFFLOAD;
+            num_cpu_buckets --;
+        } else {
+            paths[b] = FLOW_PATH_CPU;
+            num_cpu_buckets ++;
+        }
+    }
+
+    uint8_t paths[NUM_BUCKETS];
+    uint32_t hits[NUM_BUCKETS];
+    float load[NUM_BUCKETS];
+    unsigned num_cpu_buckets;
+    unsigned cursor;
+    uint64_t total_migrations;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
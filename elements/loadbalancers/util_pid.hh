@@ -0,0 +1,101 @@
+#ifndef __NBA_ELEMENT_LB_UTIL_PID_HH__
+#define __NBA_ELEMENT_LB_UTIL_PID_HH__
+
+#include <cmath>
+
+namespace nba {
+
+/**
+ * Returns the CPU ratio that equalizes the processing time of the CPU and
+ * offloading paths for the given per-packet processing costs, i.e., the
+ * ratio c where c * ppc_cpu == (1 - c) * ppc_offl.
+ *
+ * Since the costs themselves change with the ratio (e.g., contention in
+ * CPU and batching efficiency in offloading), it is used as a moving
+ * setpoint for the controller rather than being applied directly.
+ */
+static inline float lb_balanced_ratio(float ppc_cpu, float ppc_offl)
+{
+    if (ppc_cpu + ppc_offl <= 0)
+        return 0.5f;
+    return ppc_offl / (ppc_cpu + ppc_offl);
+}
+
+/**
+ * A PID controller that adjusts the CPU ratio in [0, 1].
+ *
+ * It is written in the velocity (incremental) form so that clamping the
+ * output also stops the integral wind-up.  Each update is limited by
+ * max_step to bound oscillation, and errors within the deadband are
+ * treated as zero to avoid dithering in the steady state.
+ */
+class PIDRatioController {
+public:
+    PIDRatioController(float kp = 0.3f, float ki = 1.5f, float kd = 0.01f,
+                       float max_step = 0.1f, float deadband = 0.005f)
+        : kp(kp), ki(ki), kd(kd), max_step(max_step), deadband(deadband),
+          lower(0.0f), upper(1.0f)
+    {
+        reset(0.5f);
+    }
+
+    /** Restricts the output range, e.g., to keep sampling both paths. */
+    void set_limits(float lo, float hi)
+    {
+        lower = clamp(lo, 0.0f, 1.0f);
+        upper = clamp(hi, lower, 1.0f);
+        ratio = clamp(ratio, lower, upper);
+    }
+
+    void reset(float initial_ratio)
+    {
+        ratio = clamp(initial_ratio, lower, upper);
+        e_prev = e_prev2 = 0;
+        num_updates = 0;
+    }
+
+    /**
+     * Feeds the error observed in the last interval (dt in seconds) and
+     * returns the new ratio.
+     */
+    float update(float error, float dt)
+    {
+        if (fabsf(error) < deadband)
+            error = 0;
+        if (dt <= 0)
+            dt = 1.0f;
+        float delta = kp * (error - e_prev) + ki * error * dt;
+        /* Skip the derivative term until we have enough history. */
+        if (num_updates >= 2)
+            delta += kd * (error - 2 * e_prev + e_prev2) / dt;
+        delta = clamp(delta, -max_step, max_step);
+        ratio = clamp(ratio + delta, lower, upper);
+        e_prev2 = e_prev;
+        e_prev = error;
+        num_updates ++;
+        return ratio;
+    }
+
+    float get_ratio() const { return ratio; }
+
+private:
+    static inline float clamp(float x, float lo, float hi)
+    {
+        return (x < lo) ? lo : ((x > hi) ? hi : x);
+    }
+
+    float kp, ki, kd;
+    float max_step;
+    float deadband;
+    float lower, upper;
+
+    float ratio;
+    float e_prev, e_prev2;
+    unsigned num_updates;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,62 @@
+#include "PacketSizeClassifier.hh"
+#include <nba/element/annotation.hh>
+#include <nba/element/packetbatch.hh>
+#include <nba/framework/logging.hh>
+#include <cstdio>
+
+using namespace std;
+using namespace nba;
+
+int PacketSizeClassifier::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    vector<string> specs;
+    for (auto &arg : args) {
+        unsigned length;
+        if (sscanf(arg.c_str(), " LB_HINT %u", &length) == 1)
+            lb_hint_length = length;
+        else
+            specs.push_back(arg);
+    }
+    if (specs.empty())
+        specs = { "128:0", "512:1", "2048:2" };
+    for (auto &spec : specs) {
+        unsigned bound;
+        int port;
+        if (!PacketSizeBuckets::parse(spec, bound, port))
+            rte_panic("PacketSizeClassifier: invalid bucket \"%s\" (expected: <bound>:<port>)\n",
+                      spec.c_str());
+        if (port >= NBA_MAX_ELEM_NEXTS)
+            rte_panic("PacketSizeClassifier: too large port number %d\n", port);
+        if (!buckets.add(bound, port))
+            rte_panic("PacketSizeClassifier: invalid bound %u (must be an ascending multiple of %u)\n",
+                      bound, PacketSizeBuckets::GRANULARITY);
+    }
+    buckets.build();
+    return 0;
+}
+
+int PacketSizeClassifier::initialize()
+{
+    /* Outputs are not pushed with bounds checks in release builds. */
+    if ((unsigned) buckets.max_port() >= num_connected_outputs())
+        rte_panic("PacketSizeClassifier: port %d is used by a bucket but only %u outputs are connected\n",
+                  buckets.max_port(), num_connected_outputs());
+    return 0;
+}
+
+int PacketSizeClassifier::process_batch(int input_port, PacketBatch *batch)
+{
+    unsigned num_pkts = 0, num_long = 0;
+    FOR_EACH_PACKET(batch) {
+        unsigned len = rte_pktmbuf_pkt_len(batch->packets[pkt_idx]);
+        batch->results[pkt_idx] = buckets.classify(len);
+        num_pkts ++;
+        num_long += (len >= lb_hint_length);
+    } END_FOR;
+    if (lb_hint_length > 0)
+        anno_set(&batch->banno, NBA_BANNO_LB_DECISION, (2 * num_long >= num_pkts) ? 0 : -1);
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -4,54 +4,47 @@
 #include <nba/element/element.hh>
 #include <vector>
 #include <string>
+#include "util_pktsizebuckets.hh"
 
 namespace nba {
 
-class PacketSizeClassifier : public Element {
+/**
+ * Classifies packets into output ports by their lengths.
+ *
+ * Arguments are a list of "<bound>:<port>" buckets in ascending order of
+ * the bounds (see PacketSizeBuckets), defaulting to "128:0, 512:1,
+ * 2048:2", optionally followed by "LB_HINT <length>".  With LB_HINT, it
+ * also sets the load balancing decision of each batch: to offload to the
+ * first device (0) if at least half of the packets are as long as the
+ * given length, and to use the CPU (-1) otherwise.  Place it after any
+ * load balancer element, since they overwrite the decision.
+ */
+class PacketSizeClassifier : public PerBatchElement {
 public:
-    PacketSizeClassifier() : Element()
+    PacketSizeClassifier() : PerBatchElement(), lb_hint_length(0)
     {
     }
 
     ~PacketSizeClassifier()
     {
-        delete buckets;
     }
 
     const char *class_name() const { return "PacketSizeClassifier"; }
     const char *port_count() const { return "1/*"; }
 
-    int initialize() {
-        /* We use 16-byte segmented buckets to map output port number. */
-        int i;
-        buckets = new char[2048 >> 4];
-        for (i = 0; i < (128 >> 4); i++)
-            buckets[i] = 0;
-        for (; i < (512 >> 4); i++)
-            buckets[i] = 1;
-        for (; i < (2048 >> 4); i++)
-            buckets[i] = 2;
-        return 0;
-    };
+    int initialize();
     int initialize_global() { return 0; };
     int initialize_per_node() { return 0; };
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
 
-    int configure(comp_thread_context *ctx, std::vector<std::string> &args)
-    {
-        Element::configure(ctx, args);
-        // TODO: read comma-separated bucket map
-        return 0;
-    }
+    int process_batch(int input_port, PacketBatch *batch);
 
-    int process(int input_port, Packet *pkt)
-    {
-        unsigned pkt_len = pkt->length();
-        output(buckets[pkt_len >> 4]).push(pkt);
-        return 0;
-    }
+    /** The buckets with per-thread packet/byte counters. */
+    const PacketSizeBuckets &get_buckets() const { return buckets; }
 
 private:
-    char *buckets;
+    PacketSizeBuckets buckets;
+    unsigned lb_hint_length;
 };
 
 EXPORT_ELEMENT(PacketSizeClassifier);
@@ -0,0 +1,115 @@
+#include "Policer.hh"
+#include <nba/element/annotation.hh>
+#include <nba/element/packetbatch.hh>
+#include <nba/framework/logging.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/loadbalancer.hh>
+#include <cstdio>
+#include <netinet/ip.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_ring.h>
+
+using namespace std;
+using namespace nba;
+
+int Policer::initialize()
+{
+    size_t n = 1;
+    while (n < num_flows)
+        n <<= 1;
+    flow_shift = 64 - __builtin_ctzll(n);
+    uint64_t hz = rte_get_tsc_hz(), now = rte_rdtsc();
+    meters.resize(n);
+    for (auto &m : meters)
+        m.init(rate, burst, peak_rate, peak_burst, hz, now);
+    return 0;
+}
+
+int Policer::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    for (auto &arg : args) {
+        char str[64];
+        unsigned value;
+        uint64_t bytes;
+        if (sscanf(arg.c_str(), " RATE %63s", str) == 1) {
+            if (!parse_rate(str, rate))
+                rte_panic("Policer: invalid rate %s\n", str);
+        } else if (sscanf(arg.c_str(), " PEAK_RATE %63s", str) == 1) {
+            if (!parse_rate(str, peak_rate))
+                rte_panic("Policer: invalid rate %s\n", str);
+        } else if (sscanf(arg.c_str(), " BURST %lu", &bytes) == 1)
+            burst = bytes;
+        else if (sscanf(arg.c_str(), " PEAK_BURST %lu", &bytes) == 1)
+            peak_burst = bytes;
+        else if (sscanf(arg.c_str(), " FLOWS %u", &value) == 1 && value > 0)
+            num_flows = value;
+        else if (sscanf(arg.c_str(), " DROP_RED %u", &value) == 1)
+            drop_red = (value != 0);
+        else
+            rte_panic("Policer: invalid argument \"%s\"\n", arg.c_str());
+    }
+    if (rate == 0)
+        rte_panic("Policer: RATE is required.\n");
+    if (peak_rate != 0 && peak_rate < rate)
+        rte_panic("Policer: PEAK_RATE must not be less than RATE.\n");
+    /* Default to 1 msec worth of the rate. */
+    if (burst == 0)
+        burst = RTE_MAX(rate / 8000, (uint64_t) NBA_MAX_PACKET_SIZE);
+    if (peak_burst == 0)
+        peak_burst = RTE_MAX(peak_rate / 8000, burst);
+    return 0;
+}
+
+/* The flow key of a packet: its flow ID if set, otherwise its IPv4 5-tuple. */
+static inline uint64_t flow_key(Packet *pkt)
+{
+    if (anno_isset(&pkt->anno, NBA_ANNO_FLOW_ID))
+        return (uint64_t) anno_get(&pkt->anno, NBA_ANNO_FLOW_ID);
+    const struct ether_hdr *ethh = (const struct ether_hdr *) pkt->data();
+    if (ethh->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4))
+        return 0;
+    const struct iphdr *iph = (const struct iphdr *) (ethh + 1);
+    uint64_t key = ((uint64_t) iph->saddr << 32) ^ iph->daddr ^ ((uint64_t) iph->protocol << 24);
+    if ((iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP)
+        && (ntohs(iph->frag_off) & IP_OFFMASK) == 0) {
+        const uint32_t *ports = (const uint32_t *) ((const uint8_t *) iph + (iph->ihl << 2));
+        key ^= (uint64_t) *ports << 16;
+    }
+    return key;
+}
+
+int Policer::process_batch(int input_port, PacketBatch *batch)
+{
+    uint64_t now = rte_rdtsc();
+    unsigned num_dropped = 0;
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    batch->has_dropped = false;
+    #endif
+    FOR_EACH_PACKET(batch) {
+        Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+        unsigned m = 0;
+        if (flow_shift < 64)
+            m = (unsigned) ((flow_key(pkt) * 0x9e3779b97f4a7c15llu) >> flow_shift);
+        PolicerColor color = meters[m].color(now, rte_pktmbuf_pkt_len(batch->packets[pkt_idx]));
+        if (color == COLOR_RED && drop_red) {
+            #if NBA_BATCHING_SCHEME != NBA_BATCHING_CONTINUOUS
+            PacketBatch::drop_packet(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
+            #endif
+            EXCLUDE_PACKET(batch, pkt_idx);
+            num_dropped ++;
+        } else
+            anno_set(&pkt->anno, NBA_ANNO_COLOR, color);
+    } END_FOR;
+    if (num_dropped > 0) {
+        #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+        batch->collect_excluded_packets();
+        batch->clean_drops(ctx->io_ctx->drop_queue);
+        #endif
+        if (ctx->inspector) ctx->inspector->drop_pkt_count += num_dropped;
+    }
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
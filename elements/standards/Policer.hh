@@ -0,0 +1,68 @@
+#ifndef __NBA_ELEMENT_POLICER_HH__
+#define __NBA_ELEMENT_POLICER_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "util_tokenbucket.hh"
+
+namespace nba {
+
+/*
+ * Policer(RATE r, [BURST bytes], [PEAK_RATE r], [PEAK_BURST bytes],
+ *         [FLOWS n], [DROP_RED 0|1])
+ *
+ * Meters packets with token buckets and marks their colors in the
+ * NBA_ANNO_COLOR annotation.  Rates are in bits per second with optional
+ * k/M/G suffixes (e.g., "RATE 2.5G").  Without PEAK_RATE, packets within
+ * RATE and BURST (default: 1 msec worth of RATE) are green and the
+ * others are red; with it, it works as a two-rate three-color marker
+ * (RFC 2698).  Red packets are dropped unless DROP_RED is 0.
+ *
+ * By default, all packets share one meter.  With FLOWS, each flow is
+ * metered separately by one of n meters chosen by the hash of its
+ * NBA_ANNO_FLOW_ID annotation (see ConnTrack) or of its IPv4 5-tuple;
+ * flows in the same meter share the rates.  Meters are per computation
+ * thread, so the rates apply to each thread.
+ */
+class Policer : public PerBatchElement {
+public:
+    Policer() : PerBatchElement(),
+                rate(0), burst(0), peak_rate(0), peak_burst(0),
+                num_flows(0), flow_shift(0), drop_red(true)
+    {
+    }
+
+    ~Policer()
+    {
+    }
+
+    const char *class_name() const { return "Policer"; }
+    const char *port_count() const { return "1/1"; }
+
+    int initialize();
+    int initialize_global() { return 0; };      // per-system configuration
+    int initialize_per_node() { return 0; };    // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+
+    int process_batch(int input_port, PacketBatch *batch);
+
+private:
+    uint64_t rate;
+    uint64_t burst;
+    uint64_t peak_rate;
+    uint64_t peak_burst;
+    unsigned num_flows;
+    unsigned flow_shift;    // 64 - log2(meters.size())
+    bool drop_red;
+
+    std::vector<TokenBucketMeter> meters;
+};
+
+EXPORT_ELEMENT(Policer);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
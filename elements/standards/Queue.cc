@@ -0,0 +1,29 @@
+#include "Queue.hh"
+#include <nba/element/packetbatch.hh>
+#include <nba/framework/threadcontext.hh>
+#include <rte_mempool.h>
+
+using namespace std;
+using namespace nba;
+
+Queue::~Queue()
+{
+    if (queue == nullptr)
+        return;
+    /* Batches left when a graph reload retires this element. */
+    while (queue->size() > 0) {
+        PacketBatch *batch = queue->front();
+        queue->pop_front();
+        batch->drop_all(ctx->io_ctx->drop_queue);
+        rte_mempool_put(ctx->batch_pool, (void *) batch);
+    }
+    delete queue;
+}
+
+int Queue::initialize()
+{
+    queue = new FixedRing<PacketBatch*>(max_size, ctx->loc.node_id);
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -14,21 +14,16 @@ public:
     Queue() : SchedulableElement(), PerBatchElement()
     {
         max_size = 0;
+        queue = nullptr;
     }
 
-    ~Queue()
-    {
-        delete queue;
-    }
+    ~Queue();
 
     const char *class_name() const { return "Queue"; }
     const char *port_count() const { return "1/1"; }
     int get_type() const { return SchedulableElement::get_type() | PerBatchElement::get_type(); }
 
-    int initialize() {
-        queue = new FixedRing<PacketBatch*>(max_size, ctx->loc.node_id);
-        return 0;
-    };
+    int initialize();
     int initialize_global() { return 0; };
     int initialize_per_node() { return 0; };
 
@@ -1,36 +1,49 @@
 #include "RandomWeightedBranch.hh"
 #include <cassert>
-#include <nba/core/enumerate.hh>
+#include <cstdio>
+#include <nba/element/packetbatch.hh>
+#include <nba/framework/threadcontext.hh>
+#include <rte_cycles.h>
 
 using namespace std;
 using namespace nba;
 
 int RandomWeightedBranch::initialize()
 {
+    if (use_seed)
+        rng.seed(seed + ctx->loc.global_thread_idx);
+    else
+        rng.seed(rte_rdtsc() ^ ((uint64_t) ctx->loc.global_thread_idx << 48));
     return 0;
 }
 
 int RandomWeightedBranch::configure(comp_thread_context *ctx, std::vector<std::string> &args)
 {
     Element::configure(ctx, args);
-    vector<float> weights;
-    for (auto& arg : args)
-        weights.push_back(stof(arg));
-    ddist = discrete_distribution<int>(weights.begin(), weights.end());
-    assert(ddist.min() == 0);
-    assert((unsigned) (ddist.max() + 1) == args.size());
+    vector<double> weights;
+    for (auto& arg : args) {
+        unsigned long long s;
+        if (sscanf(arg.c_str(), " SEED %llu", &s) == 1) {
+            seed = s;
+            use_seed = true;
+        } else
+            weights.push_back(stod(arg));
+    }
     /* Example input: 0.3, 0.5
-     * Example discrete distribution:
+     * Example distribution:
      * (0, 0.3/(0.3+0.5))
      * (1, 0.5/(0.3+0.5))
      */
+    if (weights.size() > NBA_MAX_ELEM_NEXTS || !alias.init(weights))
+        rte_panic("RandomWeightedBranch: invalid weights (expected: up to %d non-negative "
+                  "numbers with a positive sum)\n", NBA_MAX_ELEM_NEXTS);
     return 0;
 }
 
-int RandomWeightedBranch::process(int input_port, Packet *pkt)
+int RandomWeightedBranch::process_batch(int input_port, PacketBatch *batch)
 {
-    int idx = ddist(gen);
-    output(idx).push(pkt);
+    /* Excluded packets also get ports, which are ignored. */
+    alias.sample_n(rng, batch->count, batch->results);
     return 0;
 }
 
@@ -5,13 +5,22 @@
 #include <nba/core/intrinsic.hh>
 #include <vector>
 #include <string>
-#include <random>
+#include "util_randombranch.hh"
 
 namespace nba {
 
-class RandomWeightedBranch : public Element {
+/**
+ * Sends packets to output ports randomly with the given weights.
+ *
+ * Arguments are the weights of the output ports, optionally followed by
+ * "SEED <n>" to make the choices reproducible: each thread then uses
+ * the seed plus its global thread index.  The ports of a whole batch are
+ * drawn at once from a per-thread xorshift128+ generator using an alias
+ * table.
+ */
+class RandomWeightedBranch : public PerBatchElement {
 public:
-    RandomWeightedBranch(): Element(), ddist(), gen()
+    RandomWeightedBranch(): PerBatchElement(), seed(0), use_seed(false)
     {
     }
 
@@ -27,11 +36,13 @@ public:
     int initialize_per_node() { return 0; };    // per-node configuration
     int configure(comp_thread_context *ctx, std::vector<std::string> &args);
 
-    int process(int input_port, Packet *pkt);
+    int process_batch(int input_port, PacketBatch *batch);
 
 private:
-    std::discrete_distribution<int> ddist;
-    std::default_random_engine gen;
+    AliasTable alias;
+    XorShift128Plus rng;
+    uint64_t seed;
+    bool use_seed;
 } __cache_aligned;
 
 EXPORT_ELEMENT(RandomWeightedBranch);
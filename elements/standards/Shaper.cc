@@ -0,0 +1,99 @@
+#include "Shaper.hh"
+#include <nba/element/packetbatch.hh>
+#include <nba/framework/elementgraph.hh>
+#include <nba/framework/logging.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/loadbalancer.hh>
+#include <cstdio>
+#include <cstring>
+#include <rte_cycles.h>
+#include <rte_mempool.h>
+
+using namespace std;
+using namespace nba;
+
+Shaper::~Shaper()
+{
+    /* Batches left when a graph reload retires this element. */
+    vector<PacketBatch *> batches;
+    shaper.flush(batches);
+    for (PacketBatch *batch : batches) {
+        batch->drop_all(ctx->io_ctx->drop_queue);
+        rte_mempool_put(ctx->batch_pool, (void *) batch);
+    }
+}
+
+int Shaper::initialize()
+{
+    uint64_t hz = rte_get_tsc_hz(), now = rte_rdtsc();
+    usec_per_cycle = 1e6 / hz;
+    shaper.init(rate, burst, MAX_CLASSES, queue_size, hz, now);
+    for (unsigned i = 0; i < MAX_CLASSES; i++)
+        shaper.set_class(i, class_confs[i].rate, class_confs[i].ceil, burst, now);
+    return 0;
+}
+
+int Shaper::configure(comp_thread_context *ctx, std::vector<std::string> &args)
+{
+    Element::configure(ctx, args);
+    memset(class_confs, 0, sizeof(class_confs));
+    for (auto &arg : args) {
+        char str[64], str2[64];
+        unsigned idx, value;
+        uint64_t bytes;
+        int n;
+        if (sscanf(arg.c_str(), " RATE %63s", str) == 1) {
+            if (!parse_rate(str, rate))
+                rte_panic("Shaper: invalid rate %s\n", str);
+        } else if ((n = sscanf(arg.c_str(), " CLASS %u %63s %63s", &idx, str, str2)) >= 2) {
+            if (idx >= MAX_CLASSES)
+                rte_panic("Shaper: too large class index %u (max: %u)\n", idx, MAX_CLASSES - 1);
+            struct class_conf &c = class_confs[idx];
+            if (strcmp(str, "0") != 0 && !parse_rate(str, c.rate))
+                rte_panic("Shaper: invalid rate %s\n", str);
+            if (n == 3 && strcmp(str2, "0") != 0 && !parse_rate(str2, c.ceil))
+                rte_panic("Shaper: invalid rate %s\n", str2);
+            if (c.ceil != 0 && c.ceil < c.rate)
+                rte_panic("Shaper: the ceiling of class %u is less than its rate.\n", idx);
+        } else if (sscanf(arg.c_str(), " BURST %lu", &bytes) == 1 && bytes > 0)
+            burst = bytes;
+        else if (sscanf(arg.c_str(), " QUEUE %u", &value) == 1 && value > 0)
+            queue_size = value;
+        else
+            rte_panic("Shaper: invalid argument \"%s\"\n", arg.c_str());
+    }
+    if (rate == 0)
+        rte_panic("Shaper: RATE is required.\n");
+    /* Default to 1 msec worth of the rate. */
+    if (burst == 0)
+        burst = RTE_MAX(rate / 8000, (uint64_t) NBA_MAX_PACKET_SIZE);
+    return 0;
+}
+
+int Shaper::process_batch(int input_port, PacketBatch *batch)
+{
+    uint32_t bytes = 0;
+    FOR_EACH_PACKET(batch) {
+        bytes += rte_pktmbuf_pkt_len(batch->packets[pkt_idx]);
+    } END_FOR;
+    if (!shaper.enqueue(input_port, batch, bytes)) {
+        if (ctx->inspector) ctx->inspector->drop_pkt_count += batch->count;
+        ctx->elem_graph->free_batch(batch);
+    }
+    return KEPT_BY_ELEMENT;
+}
+
+int Shaper::dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay)
+{
+    if (shaper.dequeue(rte_rdtsc(), out_batch)) {
+        next_delay = 0;
+        return 0;
+    }
+    out_batch = nullptr;
+    uint64_t wait = shaper.wait_cycles();
+    /* Poll while the queues are empty, as Queue does. */
+    next_delay = (wait == UINT64_MAX) ? 0 : (uint64_t) (wait * usec_per_cycle);
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
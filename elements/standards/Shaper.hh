@@ -0,0 +1,73 @@
+#ifndef __NBA_ELEMENT_SHAPER_HH__
+#define __NBA_ELEMENT_SHAPER_HH__
+
+#include <nba/element/element.hh>
+#include <vector>
+#include <string>
+#include "util_tokenbucket.hh"
+
+namespace nba {
+
+/*
+ * Shaper(RATE r, [BURST bytes], [CLASS i rate [ceil]]..., [QUEUE n])
+ *
+ * Shapes the batches from up to MAX_CLASSES inputs, one class per input
+ * port, to the total RATE in bits per second (with optional k/M/G
+ * suffixes).  Each class has its own queue of at most QUEUE (default:
+ * 64) batches; batches arriving at a full queue are dropped.  "CLASS i
+ * rate [ceil]" gives input i an assured rate and optionally a ceiling;
+ * the classes borrow the rest of RATE up to their ceilings (see
+ * HierarchicalShaper).  Classes not given have no assured rate.  A
+ * rate of 0 means none.  BURST (default: 1 msec worth of RATE) applies
+ * to all buckets.  Rates count frame bytes without the Ethernet
+ * preamble, gap and FCS.
+ *
+ * dispatch() releases the batches by TSC time and sleeps until the next
+ * one may go out.  As the queues are per computation thread, the rates
+ * apply to each thread.
+ */
+class Shaper : public SchedulableElement, PerBatchElement {
+public:
+    static const unsigned MAX_CLASSES = 8;
+
+    Shaper() : SchedulableElement(), PerBatchElement(),
+               rate(0), burst(0), queue_size(64), usec_per_cycle(0)
+    {
+    }
+
+    ~Shaper();
+
+    const char *class_name() const { return "Shaper"; }
+    const char *port_count() const { return "1-8/1"; }
+    int get_type() const { return SchedulableElement::get_type() | PerBatchElement::get_type(); }
+
+    int initialize();
+    int initialize_global() { return 0; };      // per-system configuration
+    int initialize_per_node() { return 0; };    // per-node configuration
+    int configure(comp_thread_context *ctx, std::vector<std::string> &args);
+
+    int process_batch(int input_port, PacketBatch *batch);
+    int dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay);
+
+private:
+    struct class_conf {
+        uint64_t rate;
+        uint64_t ceil;
+    };
+
+    uint64_t rate;
+    uint64_t burst;
+    unsigned queue_size;
+    double usec_per_cycle;
+    struct class_conf class_confs[MAX_CLASSES];
+
+    HierarchicalShaper<PacketBatch *> shaper;
+};
+
+EXPORT_ELEMENT(Shaper);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,112 @@
+#ifndef __NBA_UTIL_PKTSIZEBUCKETS_HH__
+#define __NBA_UTIL_PKTSIZEBUCKETS_HH__
+
+#include <nba/framework/config.hh>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace nba {
+
+/**
+ * Maps packet lengths to output ports by an ordered list of buckets.
+ *
+ * Each bucket is given as "<bound>:<port>" and takes the packets shorter
+ * than bound (and at least as long as the previous bound).  The last
+ * bucket also takes all longer packets.  Bounds must be multiples of
+ * GRANULARITY and strictly ascending, as the lookup uses a table indexed
+ * by (length / GRANULARITY).
+ *
+ * It also keeps the packet and byte counters of each bucket.
+ */
+class PacketSizeBuckets {
+public:
+    static const unsigned GRANULARITY_SHIFT = 4;
+    static const unsigned GRANULARITY = (1u << GRANULARITY_SHIFT);
+    static const unsigned MAX_LENGTH = NBA_MAX_JUMBO_FRAME_SIZE;
+
+    struct bucket {
+        unsigned bound;
+        int port;
+        uint64_t num_pkts;
+        uint64_t num_bytes;
+    };
+
+    PacketSizeBuckets() { }
+
+    /** Parses a "<bound>:<port>" string.  Returns false if malformed. */
+    static bool parse(const std::string &spec, unsigned &bound, int &port)
+    {
+        char tail;
+        return sscanf(spec.c_str(), " %u : %d %c", &bound, &port, &tail) == 2;
+    }
+
+    /** Appends a bucket.  Returns false if the bound is invalid. */
+    bool add(unsigned bound, int port)
+    {
+        if (bound == 0 || bound % GRANULARITY != 0 || bound > MAX_LENGTH + GRANULARITY)
+            return false;
+        if (!_buckets.empty() && bound <= _buckets.back().bound)
+            return false;
+        if (_buckets.size() == 255 || port < 0)
+            return false;
+        _buckets.push_back({bound, port, 0, 0});
+        return true;
+    }
+
+    /** Builds the lookup table after adding all buckets. */
+    bool build()
+    {
+        if (_buckets.empty())
+            return false;
+        _table.resize((MAX_LENGTH >> GRANULARITY_SHIFT) + 1);
+        unsigned b = 0;
+        for (unsigned i = 0; i < _table.size(); i++) {
+            while (b + 1 < _buckets.size() && (i << GRANULARITY_SHIFT) >= _buckets[b].bound)
+                b ++;
+            _table[i] = (uint8_t) b;
+        }
+        return true;
+    }
+
+    size_t size() const { return _buckets.size(); }
+
+    const struct bucket &get(unsigned b) const { return _buckets[b]; }
+
+    /** Returns the bucket index of the given length. */
+    unsigned find(unsigned len) const
+    {
+        unsigned i = len >> GRANULARITY_SHIFT;
+        if (i >= _table.size())
+            return _buckets.size() - 1;
+        return _table[i];
+    }
+
+    /** Returns the output port of the given length, updating counters. */
+    int classify(unsigned len)
+    {
+        struct bucket &bkt = _buckets[find(len)];
+        bkt.num_pkts ++;
+        bkt.num_bytes += len;
+        return bkt.port;
+    }
+
+    int max_port() const
+    {
+        int m = -1;
+        for (auto &bkt : _buckets)
+            m = (bkt.port > m) ? bkt.port : m;
+        return m;
+    }
+
+private:
+    std::vector<struct bucket> _buckets;
+    std::vector<uint8_t> _table;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,135 @@
+#ifndef __NBA_UTIL_RANDOMBRANCH_HH__
+#define __NBA_UTIL_RANDOMBRANCH_HH__
+
+#include <cstdint>
+#include <vector>
+
+namespace nba {
+
+/**
+ * The xorshift128+ generator: two 64-bit words of state, a handful of
+ * shifts and xors per 64-bit output.  Not cryptographically secure.
+ */
+class XorShift128Plus {
+public:
+    XorShift128Plus() { seed(1); }
+
+    explicit XorShift128Plus(uint64_t s) { seed(s); }
+
+    /* Expands the seed with splitmix64 so that similar seeds (e.g.,
+     * base + thread index) give unrelated streams. */
+    void seed(uint64_t s)
+    {
+        for (int i = 0; i < 2; i++) {
+            uint64_t z = (s += 0x9e3779b97f4a7c15llu);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9llu;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebllu;
+            _s[i] = z ^ (z >> 31);
+        }
+        if (_s[0] == 0 && _s[1] == 0)
+            _s[0] = 1;
+    }
+
+    uint64_t next()
+    {
+        uint64_t s1 = _s[0];
+        const uint64_t s0 = _s[1];
+        _s[0] = s0;
+        s1 ^= s1 << 23;
+        _s[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+        return _s[1] + s0;
+    }
+
+private:
+    uint64_t _s[2];
+};
+
+/**
+ * Samples indices with given weights in O(1) per sample using Walker's
+ * alias method (with Vose's construction).
+ *
+ * Each sample takes one 64-bit random number: the upper 32 bits pick a
+ * column and the lower 32 bits are compared with its threshold.
+ */
+class AliasTable {
+public:
+    AliasTable() { }
+
+    /** Returns false if there is no positive weight or a negative one. */
+    bool init(const std::vector<double> &weights)
+    {
+        size_t n = weights.size();
+        double sum = 0;
+        for (double w : weights) {
+            if (w < 0)
+                return false;
+            sum += w;
+        }
+        if (n == 0 || !(sum > 0))
+            return false;
+        _threshold.assign(n, 0);
+        _alias.assign(n, 0);
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (size_t i = 0; i < n; i++) {
+            scaled[i] = weights[i] * n / sum;
+            if (scaled[i] < 1.0)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back(), l = large.back();
+            small.pop_back();
+            _threshold[s] = (uint64_t) (scaled[s] * 4294967296.0);
+            _alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        /* The rest are 1.0 up to rounding errors. */
+        for (uint32_t i : large) {
+            _threshold[i] = (1llu << 32);
+            _alias[i] = i;
+        }
+        for (uint32_t i : small) {
+            _threshold[i] = (1llu << 32);
+            _alias[i] = i;
+        }
+        return true;
+    }
+
+    size_t size() const { return _threshold.size(); }
+
+    int sample(uint64_t r) const
+    {
+        uint32_t col = (uint32_t) (((r >> 32) * _threshold.size()) >> 32);
+        return ((r & 0xffffffffu) < _threshold[col]) ? (int) col : (int) _alias[col];
+    }
+
+    /** Fills out[0..count-1] with samples. */
+    template<typename RNG>
+    void sample_n(RNG &rng, unsigned count, int *out) const
+    {
+        const uint64_t *threshold = _threshold.data();
+        const uint32_t *alias = _alias.data();
+        const uint64_t n = _threshold.size();
+        for (unsigned i = 0; i < count; i++) {
+            uint64_t r = rng.next();
+            uint32_t col = (uint32_t) (((r >> 32) * n) >> 32);
+            out[i] = ((r & 0xffffffffu) < threshold[col]) ? (int) col : (int) alias[col];
+        }
+    }
+
+private:
+    std::vector<uint64_t> _threshold;   /* scaled by 2^32 */
+    std::vector<uint32_t> _alias;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,303 @@
+#ifndef __NBA_UTIL_TOKENBUCKET_HH__
+#define __NBA_UTIL_TOKENBUCKET_HH__
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace nba {
+
+/**
+ * Parses a rate in bits per second such as "800k", "2.5G" or "10Gbps".
+ * Returns false if malformed or zero.
+ */
+static inline bool parse_rate(const char *str, uint64_t &bps)
+{
+    char *end;
+    double value = strtod(str, &end);
+    switch (*end) {
+    case 'k': case 'K': value *= 1e3; end ++; break;
+    case 'm': case 'M': value *= 1e6; end ++; break;
+    case 'g': case 'G': value *= 1e9; end ++; break;
+    }
+    if (strcmp(end, "bps") == 0)
+        end += 3;
+    if (end == str || *end != '\0' || !(value >= 1.0) || value > 1e13)
+        return false;
+    bps = (uint64_t) value;
+    return true;
+}
+
+/**
+ * A token bucket driven by TSC timestamps.
+ *
+ * Tokens are bytes in 32.32 fixed point and refilled by the elapsed
+ * cycles times a per-cycle rate, so there is no division in the fast
+ * path.  The truncation error of the rate is below 1e-5 for 1 Mbps and
+ * above on a 1 GHz or faster clock.  Tokens may go negative with
+ * charge(), which lets a whole batch go out and pays it back later.
+ */
+class TokenBucket {
+public:
+    static const unsigned FRAC_BITS = 32;
+
+    TokenBucket() : _tokens(0), _depth(0), _rate(0), _max_elapsed(0), _last(0) { }
+
+    /** rate_bps is in bits per second and hz is the clock rate of now. */
+    void init(uint64_t rate_bps, uint64_t burst_bytes, uint64_t hz, uint64_t now)
+    {
+        unsigned __int128 r = ((unsigned __int128) rate_bps << FRAC_BITS) / (8 * (unsigned __int128) hz);
+        _rate = (r == 0) ? 1 : (int64_t) r;
+        _depth = (int64_t) burst_bytes << FRAC_BITS;
+        _tokens = _depth;
+        /* Keeps elapsed * _rate below 2^62. */
+        _max_elapsed = (1llu << 62) / (uint64_t) _rate;
+        _last = now;
+    }
+
+    inline void refill(uint64_t now)
+    {
+        uint64_t elapsed = now - _last;
+        _last = now;
+        if (elapsed > _max_elapsed)
+            elapsed = _max_elapsed;
+        int64_t t = _tokens + (int64_t) elapsed * _rate;
+        _tokens = (t > _depth) ? _depth : t;
+    }
+
+    /** Whether bytes can go out now (after refill()). */
+    inline bool conforms(uint32_t bytes) const { return _tokens >= ((int64_t) bytes << FRAC_BITS); }
+
+    /** Whether any token is left (after refill()). */
+    inline bool positive() const { return _tokens > 0; }
+
+    inline void charge(uint32_t bytes) { _tokens -= (int64_t) bytes << FRAC_BITS; }
+
+    /** The cycles since the last refill() until positive() becomes true. */
+    inline uint64_t wait_cycles() const
+    {
+        return (_tokens > 0) ? 0 : (uint64_t) (-_tokens / _rate + 1);
+    }
+
+    /** The current tokens in bytes (rounded down). */
+    int64_t tokens() const { return _tokens >> FRAC_BITS; }
+
+private:
+    int64_t _tokens;
+    int64_t _depth;
+    int64_t _rate;          /* per cycle */
+    uint64_t _max_elapsed;
+    uint64_t _last;
+};
+
+enum PolicerColor : int {
+    COLOR_GREEN = 0,
+    COLOR_YELLOW = 1,
+    COLOR_RED = 2,
+};
+
+/**
+ * A color-blind two-rate three-color marker (RFC 2698).  Without a peak
+ * rate, it works as a single-rate two-color marker: packets exceeding
+ * the committed rate are red.
+ */
+class TokenBucketMeter {
+public:
+    TokenBucketMeter() : _has_peak(false) { }
+
+    /** peak_bps = 0 disables the peak bucket. */
+    void init(uint64_t cir_bps, uint64_t cbs, uint64_t pir_bps, uint64_t pbs, uint64_t hz, uint64_t now)
+    {
+        _committed.init(cir_bps, cbs, hz, now);
+        _has_peak = (pir_bps > 0);
+        if (_has_peak)
+            _peak.init(pir_bps, pbs, hz, now);
+    }
+
+    inline PolicerColor color(uint64_t now, uint32_t bytes)
+    {
+        _committed.refill(now);
+        if (_has_peak) {
+            _peak.refill(now);
+            if (!_peak.conforms(bytes))
+                return COLOR_RED;
+            _peak.charge(bytes);
+        }
+        if (!_committed.conforms(bytes))
+            return _has_peak ? COLOR_YELLOW : COLOR_RED;
+        _committed.charge(bytes);
+        return COLOR_GREEN;
+    }
+
+private:
+    TokenBucket _committed;
+    TokenBucket _peak;
+    bool _has_peak;
+};
+
+/**
+ * A two-level hierarchical shaper of items (e.g., batches) in per-class
+ * FIFO queues, similar to HTB with a single parent.
+ *
+ * The root bucket limits the total rate.  Each class has an assured rate
+ * and optionally a ceiling.  dequeue() first serves the classes within
+ * their assured rates in round-robin, then lets the others borrow the
+ * rest of the root rate up to their ceilings.  Borrowing does not count
+ * against the assured rate of a class.  An item goes out when the
+ * buckets have any token left and is charged in full afterwards, so
+ * items larger than the bursts still keep the long-term rates.
+ */
+template<typename T>
+class HierarchicalShaper {
+public:
+    HierarchicalShaper() : _rr(0) { }
+
+    void init(uint64_t rate_bps, uint64_t burst_bytes, unsigned num_classes,
+              unsigned queue_size, uint64_t hz, uint64_t now)
+    {
+        _hz = hz;
+        _root.init(rate_bps, burst_bytes, hz, now);
+        _classes.assign(num_classes, shaper_class());
+        for (auto &c : _classes) {
+            c.items.resize(queue_size);
+            c.bytes.resize(queue_size);
+        }
+        _rr = 0;
+    }
+
+    /**
+     * rate_bps = 0 means no assured rate (only borrowing) and ceil_bps
+     * = 0 means no ceiling other than the root rate.
+     */
+    void set_class(unsigned cls, uint64_t rate_bps, uint64_t ceil_bps, uint64_t burst_bytes, uint64_t now)
+    {
+        shaper_class &c = _classes[cls];
+        c.has_rate = (rate_bps > 0);
+        c.has_ceil = (ceil_bps > 0);
+        if (c.has_rate)
+            c.rate.init(rate_bps, burst_bytes, _hz, now);
+        if (c.has_ceil)
+            c.ceil.init(ceil_bps, burst_bytes, _hz, now);
+    }
+
+    unsigned num_classes() const { return _classes.size(); }
+
+    size_t queued(unsigned cls) const { return _classes[cls].count; }
+
+    /** Returns false if the queue of the class is full. */
+    bool enqueue(unsigned cls, T item, uint32_t bytes)
+    {
+        shaper_class &c = _classes[cls];
+        size_t cap = c.items.size();
+        if (c.count == cap)
+            return false;
+        size_t tail = c.head + c.count;
+        if (tail >= cap)
+            tail -= cap;
+        c.items[tail] = item;
+        c.bytes[tail] = bytes;
+        c.count ++;
+        return true;
+    }
+
+    /** Takes out an item that may go out now.  Returns false if none. */
+    bool dequeue(uint64_t now, T &item)
+    {
+        _root.refill(now);
+        if (!_root.positive())
+            return false;
+        unsigned n = _classes.size();
+        for (int borrow = 0; borrow < 2; borrow++) {
+            for (unsigned k = 0; k < n; k++) {
+                unsigned i = _rr + k;
+                if (i >= n)
+                    i -= n;
+                shaper_class &c = _classes[i];
+                if (c.count == 0)
+                    continue;
+                if (!borrow) {
+                    if (!c.has_rate)
+                        continue;
+                    c.rate.refill(now);
+                    if (!c.rate.positive())
+                        continue;
+                }
+                if (c.has_ceil) {
+                    c.ceil.refill(now);
+                    if (!c.ceil.positive())
+                        continue;
+                }
+                uint32_t bytes = c.bytes[c.head];
+                item = c.items[c.head];
+                if (++ c.head == c.items.size())
+                    c.head = 0;
+                c.count --;
+                _root.charge(bytes);
+                if (!borrow)
+                    c.rate.charge(bytes);
+                if (c.has_ceil)
+                    c.ceil.charge(bytes);
+                _rr = (i + 1 == n) ? 0 : i + 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Takes out all queued items regardless of the rates. */
+    void flush(std::vector<T> &items)
+    {
+        for (auto &c : _classes) {
+            for (; c.count > 0; c.count --) {
+                items.push_back(c.items[c.head]);
+                if (++ c.head == c.items.size())
+                    c.head = 0;
+            }
+        }
+    }
+
+    /**
+     * The cycles to wait after a failed dequeue() at the same time, or
+     * UINT64_MAX if all queues are empty.
+     */
+    uint64_t wait_cycles() const
+    {
+        uint64_t wait = UINT64_MAX;
+        for (auto &c : _classes) {
+            if (c.count == 0)
+                continue;
+            uint64_t w = c.has_ceil ? c.ceil.wait_cycles() : 0;
+            if (w < wait)
+                wait = w;
+        }
+        if (wait == UINT64_MAX)
+            return wait;
+        uint64_t root_wait = _root.wait_cycles();
+        return (root_wait > wait) ? root_wait : wait;
+    }
+
+private:
+    struct shaper_class {
+        TokenBucket rate;
+        TokenBucket ceil;
+        bool has_rate;
+        bool has_ceil;
+        std::vector<T> items;           /* a ring of queued items */
+        std::vector<uint32_t> bytes;
+        size_t head;
+        size_t count;
+        shaper_class() : has_rate(false), has_ceil(false), head(0), count(0) { }
+    };
+
+    uint64_t _hz;
+    TokenBucket _root;
+    std::vector<shaper_class> _classes;
+    unsigned _rr;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -35,6 +35,30 @@ static inline uint16_t ip_fast_csum(const void *iph, unsigned int ihl)
     return (uint16_t)sum;
 }
 
+/**
+ * Returns the checksum updated for a 16-bit word changed from old_val to
+ * new_val (RFC 1624, Eqn. 3).  All values are in the same byte order as
+ * in the packet.
+ */
+static inline uint16_t csum_replace2(uint16_t csum, uint16_t old_val, uint16_t new_val)
+{
+    uint32_t sum = (uint16_t) ~csum + (uint32_t) (uint16_t) ~old_val + new_val;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+/** The same as csum_replace2() for a 32-bit field (e.g., an IPv4 address). */
+static inline uint16_t csum_replace4(uint16_t csum, uint32_t old_val, uint32_t new_val)
+{
+    uint32_t sum = (uint16_t) ~csum
+                   + (uint32_t) (uint16_t) ~(old_val >> 16) + (uint32_t) (uint16_t) ~old_val
+                   + (new_val >> 16) + (new_val & 0xffff);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
 }
 
 #endif
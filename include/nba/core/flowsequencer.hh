@@ -0,0 +1,93 @@
+#ifndef __NBA_FLOWSEQUENCER_HH__
+#define __NBA_FLOWSEQUENCER_HH__
+
+#include <cstdint>
+#include <nba/core/intrinsic.hh>
+
+namespace nba {
+
+/* The tickets of a batch, one per flow group present in it. */
+struct flow_tickets {
+    uint16_t mask;
+    uint16_t seq[16];
+};
+
+/**
+ * Keeps the per-flow order of batches from a queue when multiple threads
+ * take batches from it (e.g., with work stealing).
+ *
+ * Flows are hashed into NUM_GROUPS groups.  The single producer of the
+ * queue issues a ticket for each group present in a batch before
+ * enqueueing it.  A consumer may process the batch only when ready(),
+ * i.e., after all earlier batches sharing any of its groups are done(),
+ * so that the batches of a group are processed one at a time in the
+ * queue order while those of different groups run in parallel.
+ *
+ * As long as the queue is FIFO and each consumer waits for only one
+ * batch at a time, the earliest unfinished batch is always ready.
+ */
+class FlowSequencer {
+public:
+    static const unsigned NUM_GROUPS = 16;
+
+    FlowSequencer()
+    {
+        for (unsigned g = 0; g < NUM_GROUPS; g++) {
+            _issued[g] = 0;
+            _served[g] = 0;
+        }
+    }
+
+    /** Returns the group of a flow hash (e.g., the RSS hash). */
+    static inline unsigned group_of(uint32_t flow_hash)
+    {
+        /* The RSS redirection table uses the lower bits, so all flows
+         * of an RX queue may share them.  Mix in the upper bits. */
+        return (flow_hash * 0x9e3779b1u) >> 28;
+    }
+
+    /** Issues the tickets of the groups in mask (producer only). */
+    void issue(uint16_t mask, struct flow_tickets &t)
+    {
+        t.mask = mask;
+        for (unsigned g = 0; g < NUM_GROUPS; g++)
+            if (mask & (1u << g))
+                t.seq[g] = _issued[g] ++;
+    }
+
+    /** Takes back the tickets of a batch not enqueued (producer only). */
+    void cancel(const struct flow_tickets &t)
+    {
+        for (unsigned g = 0; g < NUM_GROUPS; g++)
+            if (t.mask & (1u << g))
+                _issued[g] --;
+    }
+
+    bool ready(const struct flow_tickets &t) const
+    {
+        for (unsigned g = 0; g < NUM_GROUPS; g++) {
+            if ((t.mask & (1u << g))
+                    && __atomic_load_n(&_served[g], __ATOMIC_ACQUIRE) != t.seq[g])
+                return false;
+        }
+        return true;
+    }
+
+    /** Lets the next batches of the same groups proceed. */
+    void done(const struct flow_tickets &t)
+    {
+        for (unsigned g = 0; g < NUM_GROUPS; g++)
+            if (t.mask & (1u << g))
+                __atomic_store_n(&_served[g], (uint16_t) (t.seq[g] + 1), __ATOMIC_RELEASE);
+    }
+
+private:
+    uint16_t _issued[NUM_GROUPS];
+    uint16_t _served[NUM_GROUPS] __cache_aligned;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
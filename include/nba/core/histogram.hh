@@ -0,0 +1,125 @@
+#ifndef __NBA_CORE_HISTOGRAM_HH__
+#define __NBA_CORE_HISTOGRAM_HH__
+
+#include <cstdint>
+#include <cstring>
+
+namespace nba {
+
+/**
+ * A fixed-size logarithmic histogram (in the style of HdrHistogram) for
+ * latency values such as TSC cycles.
+ *
+ * Values below 2^SUB_BUCKET_BITS are counted exactly.  Above that, each
+ * power-of-two range [2^m, 2^(m+1)) is split into NUM_SUB_BUCKETS linear
+ * sub-buckets, so the relative error of a reported value is bounded by
+ * 1 / NUM_SUB_BUCKETS (6.25%).  Values at or above 2^MAX_MAGNITUDE are
+ * clamped into the last bucket.
+ *
+ * It has no internal synchronization: each thread should record into its
+ * own instance and publish the counts periodically.
+ */
+class LatencyHistogram {
+public:
+    enum : unsigned {
+        SUB_BUCKET_BITS = 4,
+        NUM_SUB_BUCKETS = (1u << SUB_BUCKET_BITS),
+        MAX_MAGNITUDE   = 40,  /* ~6 minutes in cycles of a 3 GHz CPU */
+        NUM_BUCKETS     = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 1) * NUM_SUB_BUCKETS,
+    };
+
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+    }
+
+    static inline unsigned bucket_of(uint64_t value)
+    {
+        if (value < NUM_SUB_BUCKETS)
+            return (unsigned) value;
+        unsigned m = 63 - __builtin_clzll(value);
+        if (m >= MAX_MAGNITUDE)
+            return NUM_BUCKETS - 1;
+        unsigned sub = (unsigned) (value >> (m - SUB_BUCKET_BITS)) & (NUM_SUB_BUCKETS - 1);
+        return (m - SUB_BUCKET_BITS + 1) * NUM_SUB_BUCKETS + sub;
+    }
+
+    /** The smallest value that falls into the given bucket. */
+    static inline uint64_t bucket_lower(unsigned b)
+    {
+        if (b < NUM_SUB_BUCKETS)
+            return b;
+        unsigned m = b / NUM_SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        uint64_t sub = b % NUM_SUB_BUCKETS;
+        return (NUM_SUB_BUCKETS + sub) << (m - SUB_BUCKET_BITS);
+    }
+
+    /** The largest value that falls into the given bucket. */
+    static inline uint64_t bucket_upper(unsigned b)
+    {
+        if (b < NUM_SUB_BUCKETS)
+            return b;
+        unsigned m = b / NUM_SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        return bucket_lower(b) + (1ull << (m - SUB_BUCKET_BITS)) - 1;
+    }
+
+    inline void record(uint64_t value)
+    {
+        counts[bucket_of(value)] ++;
+        total ++;
+    }
+
+    inline void add_bucket(unsigned b, uint64_t n)
+    {
+        counts[b] += n;
+        total += n;
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (unsigned b = 0; b < NUM_BUCKETS; b++)
+            counts[b] += other.counts[b];
+        total += other.total;
+    }
+
+    uint64_t get_bucket(unsigned b) const { return counts[b]; }
+    uint64_t count() const { return total; }
+
+    /**
+     * Returns the value at the given percentile (0 < p <= 100), reported
+     * as the upper bound of the bucket holding it.  Returns 0 if empty.
+     */
+    uint64_t percentile(double p) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t) (p / 100.0 * total + 0.5);
+        if (rank < 1)
+            rank = 1;
+        if (rank > total)
+            rank = total;
+        uint64_t seen = 0;
+        for (unsigned b = 0; b < NUM_BUCKETS; b++) {
+            seen += counts[b];
+            if (seen >= rank)
+                return bucket_upper(b);
+        }
+        return bucket_upper(NUM_BUCKETS - 1);
+    }
+
+private:
+    uint64_t counts[NUM_BUCKETS];
+    uint64_t total;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
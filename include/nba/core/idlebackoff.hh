@@ -0,0 +1,134 @@
+#ifndef __NBA_IDLEBACKOFF_HH__
+#define __NBA_IDLEBACKOFF_HH__
+
+#include <cstdint>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_atomic.h>
+#include <rte_branch_prediction.h>
+
+namespace nba {
+
+/**
+ * The idle strategy of a polling loop.
+ *
+ * After every poll, the loop reports the number of received items.
+ * Consecutive empty polls escalate from plain busy-polling (the first
+ * spin_polls), through rte_pause() (the next pause_polls), to sleeping.
+ * Sleeps start at 1 usec and double up to max_sleep_usec, which bounds
+ * the added wakeup latency.  Any non-empty poll resets the strategy.
+ *
+ * If wakeup_fd (an eventfd, e.g., of UserEvent) is given, sleeps wait on
+ * it with ppoll() so that other threads can end them early by writing to
+ * it while is_sleeping() is true; the wakeup consumes the event.
+ * Otherwise, sleeps use nanosleep().
+ *
+ * To avoid lost wakeups, producers must publish their work and then issue
+ * a full barrier (rte_mb()) before checking is_sleeping().  Conversely,
+ * the loop passes a pending() check of its queues, which is called after
+ * the sleeping flag is set and a barrier; a sleep is skipped if it
+ * returns true.
+ *
+ * max_sleep_usec == 0 disables it, keeping the loop busy-polling.
+ */
+class IdleBackoff {
+public:
+    IdleBackoff()
+        : _spin_polls(0), _pause_polls(0), _max_sleep_usec(0), _wakeup_fd(-1),
+          _empty_polls(0), _sleep_usec(1), _sleeping(false),
+          num_sleeps(0), num_wakeups(0), slept_usec(0)
+    { }
+
+    void init(unsigned spin_polls, unsigned pause_polls, unsigned max_sleep_usec,
+              int wakeup_fd = -1)
+    {
+        _spin_polls = spin_polls;
+        _pause_polls = pause_polls;
+        _max_sleep_usec = max_sleep_usec;
+        _wakeup_fd = wakeup_fd;
+        _empty_polls = 0;
+        _sleep_usec = 1;
+    }
+
+    bool enabled() const { return _max_sleep_usec > 0; }
+
+    bool is_sleeping() const { return _sleeping; }
+
+    template <typename Pending>
+    void poll_done(unsigned count, Pending pending)
+    {
+        if (likely(count > 0)) {
+            _empty_polls = 0;
+            _sleep_usec = 1;
+            return;
+        }
+        if (_max_sleep_usec > 0)
+            idle(pending);
+    }
+
+    void poll_done(unsigned count)
+    {
+        poll_done(count, [] { return false; });
+    }
+
+private:
+    unsigned _spin_polls;
+    unsigned _pause_polls;
+    unsigned _max_sleep_usec;
+    int _wakeup_fd;
+
+    unsigned _empty_polls;
+    unsigned _sleep_usec;
+    volatile bool _sleeping;
+
+    template <typename Pending>
+    void idle(Pending pending)
+    {
+        if (_empty_polls < _spin_polls + _pause_polls) {
+            if (_empty_polls >= _spin_polls)
+                rte_pause();
+            _empty_polls ++;
+            return;
+        }
+        unsigned usec = (_sleep_usec < _max_sleep_usec) ? _sleep_usec : _max_sleep_usec;
+        struct timespec ts = { (time_t) (usec / 1000000u), (long) (usec % 1000000u) * 1000L };
+        _sleeping = true;
+        rte_mb();
+        if (pending()) {
+            /* Work arrived before the producer could see the flag. */
+            _sleeping = false;
+            _empty_polls = 0;
+            _sleep_usec = 1;
+            return;
+        }
+        if (_wakeup_fd >= 0) {
+            struct pollfd pfd = { _wakeup_fd, POLLIN, 0 };
+            if (ppoll(&pfd, 1, &ts, nullptr) > 0) {
+                uint64_t v;
+                if (read(_wakeup_fd, &v, sizeof(v)) == sizeof(v))
+                    num_wakeups ++;
+            }
+        } else
+            nanosleep(&ts, nullptr);
+        _sleeping = false;
+        num_sleeps ++;
+        slept_usec += usec;
+        if (_sleep_usec < _max_sleep_usec)
+            _sleep_usec <<= 1;
+    }
+
+public:
+    /* Statistics. slept_usec is the requested (not the actual) time. */
+    uint64_t num_sleeps;
+    uint64_t num_wakeups;
+    uint64_t slept_usec;
+};
+
+} // endns(nba)
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
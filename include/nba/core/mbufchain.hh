@@ -0,0 +1,88 @@
+#ifndef __NBA_MBUFCHAIN_HH__
+#define __NBA_MBUFCHAIN_HH__
+
+#include <cstdint>
+#include <rte_config.h>
+#include <rte_branch_prediction.h>
+#include <rte_memcpy.h>
+#include <rte_mbuf.h>
+
+namespace nba {
+
+/*
+ * Copy helpers for packets that may span chained mbufs (e.g., jumbo
+ * frames received with scattered RX).
+ *
+ * Single-segment packets take a single rte_memcpy(), exactly as the
+ * contiguous-only code did; the check uses nb_segs which lives in the
+ * first cache line of rte_mbuf.  As with the contiguous case, the last
+ * segment's tailroom is accessible after the end of the packet, so that
+ * ROIs with a size delta (e.g., a digest to be appended) keep working.
+ */
+
+namespace detail {
+
+static inline uint32_t mbuf_seg_room(const struct rte_mbuf *seg)
+{
+    if (seg->next == nullptr)
+        return rte_pktmbuf_data_len(seg) + rte_pktmbuf_tailroom(seg);
+    return rte_pktmbuf_data_len(seg);
+}
+
+static __attribute__((noinline)) uint32_t
+mbuf_chain_copy(struct rte_mbuf *m, uint32_t off, uint32_t len, char *buf, bool to_mbuf)
+{
+    struct rte_mbuf *seg = m;
+    while (seg != nullptr && off >= mbuf_seg_room(seg)) {
+        off -= rte_pktmbuf_data_len(seg);
+        seg = seg->next;
+    }
+    uint32_t copied = 0;
+    while (seg != nullptr && copied < len) {
+        uint32_t n = RTE_MIN(mbuf_seg_room(seg) - off, len - copied);
+        char *p = rte_pktmbuf_mtod(seg, char *) + off;
+        if (to_mbuf)
+            rte_memcpy(p, buf + copied, n);
+        else
+            rte_memcpy(buf + copied, p, n);
+        copied += n;
+        off = 0;
+        seg = seg->next;
+    }
+    return copied;
+}
+
+} // endns(detail)
+
+/**
+ * Copies len bytes at offset off of the packet m into buf.
+ * Returns the number of bytes copied, which is less than len only if
+ * the packet (plus the tailroom of its last segment) is shorter.
+ */
+static inline uint32_t mbuf_copy_out(const struct rte_mbuf *m, uint32_t off, uint32_t len, void *buf)
+{
+    if (likely(m->nb_segs == 1)) {
+        rte_memcpy(buf, rte_pktmbuf_mtod(m, char *) + off, len);
+        return len;
+    }
+    return detail::mbuf_chain_copy(const_cast<struct rte_mbuf *>(m), off, len, (char *) buf, false);
+}
+
+/**
+ * Copies len bytes from buf into the packet m at offset off.
+ * The return value is the same as mbuf_copy_out().
+ */
+static inline uint32_t mbuf_copy_in(struct rte_mbuf *m, uint32_t off, const void *buf, uint32_t len)
+{
+    if (likely(m->nb_segs == 1)) {
+        rte_memcpy(rte_pktmbuf_mtod(m, char *) + off, buf, len);
+        return len;
+    }
+    return detail::mbuf_chain_copy(m, off, len, (char *) buf, true);
+}
+
+} // endns(nba)
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
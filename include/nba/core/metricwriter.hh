@@ -0,0 +1,87 @@
+#ifndef __NBA_CORE_METRICWRITER_HH__
+#define __NBA_CORE_METRICWRITER_HH__
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <initializer_list>
+
+namespace nba {
+
+/**
+ * Formats metric samples in the Prometheus text exposition format.
+ *
+ * Samples of a metric family must be written consecutively after a
+ * family() call, which emits the HELP and TYPE lines.
+ */
+class PrometheusWriter {
+public:
+    typedef std::pair<const char *, std::string> Label;
+
+    PrometheusWriter(std::string &out) : out(out)
+    { }
+
+    void family(const char *name, const char *type, const char *help)
+    {
+        out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+        out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    }
+
+    void sample(const char *name, std::initializer_list<Label> labels, uint64_t value)
+    {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%lu", (unsigned long) value);
+        write_sample(name, labels, buf);
+    }
+
+    void sample(const char *name, std::initializer_list<Label> labels, double value)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.6g", value);
+        write_sample(name, labels, buf);
+    }
+
+    /** Escapes backslashes, double quotes, and newlines in label values. */
+    static std::string escape(const std::string &value)
+    {
+        std::string escaped;
+        escaped.reserve(value.size());
+        for (char c : value) {
+            switch (c) {
+            case '\\': escaped.append("\\\\"); break;
+            case '"':  escaped.append("\\\""); break;
+            case '\n': escaped.append("\\n"); break;
+            default:   escaped.push_back(c);
+            }
+        }
+        return escaped;
+    }
+
+private:
+    void write_sample(const char *name, std::initializer_list<Label> labels, const char *value)
+    {
+        out.append(name);
+        if (labels.size() > 0) {
+            out.push_back('{');
+            bool first = true;
+            for (const Label &l : labels) {
+                if (!first)
+                    out.push_back(',');
+                first = false;
+                out.append(l.first).append("=\"").append(escape(l.second)).append("\"");
+            }
+            out.push_back('}');
+        }
+        out.push_back(' ');
+        out.append(value).append("\n");
+    }
+
+    std::string &out;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,268 @@
+#ifndef __NBA_TIMERWHEEL_HH__
+#define __NBA_TIMERWHEEL_HH__
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+
+namespace nba {
+
+/*
+ * A hierarchical timer wheel for per-thread timers.
+ *
+ * Time is measured in abstract ticks (see TSCTicker for the conversion
+ * from TSC readings).  There are NUM_LEVELS levels of SLOTS slots each;
+ * level L covers delays up to SLOTS^(L+1) ticks with a resolution of
+ * SLOTS^L ticks, and its entries are cascaded down to lower levels as the
+ * wheel turns, as in the classic Linux kernel timers.  Scheduling and
+ * cancellation are O(1), and advance() skips runs of empty level-0 slots
+ * using an occupancy bitmap so that idle timers cost nothing per call.
+ *
+ * Entries are intrusive: the owner embeds a timer_entry and the wheel
+ * only links it.  It is not thread-safe.
+ */
+
+struct timer_entry {
+    struct timer_entry *next;
+    struct timer_entry **pprev;     /* nullptr if not scheduled */
+    uint64_t expiry;                /* in ticks */
+    void *arg;
+    uint16_t slot;
+
+    timer_entry() : next(nullptr), pprev(nullptr), expiry(0), arg(nullptr), slot(0) { }
+
+    bool pending() const { return pprev != nullptr; }
+};
+
+class TimerWheel {
+public:
+    static const unsigned LEVEL_BITS = 8;
+    static const unsigned SLOTS = (1u << LEVEL_BITS);
+    static const unsigned SLOT_MASK = SLOTS - 1;
+    static const unsigned NUM_LEVELS = 4;
+    /* Longer delays are placed at the horizon and re-inserted from there. */
+    static const uint64_t MAX_DELTA = (1llu << (LEVEL_BITS * NUM_LEVELS)) - 1;
+
+    TimerWheel() : _now(0), _count(0)
+    {
+        memset(_slots, 0, sizeof(_slots));
+        memset(_bits, 0, sizeof(_bits));
+    }
+
+    virtual ~TimerWheel() { }
+
+    /** Sets the current time.  The wheel must be empty. */
+    void init(uint64_t now_tick)
+    {
+        assert(_count == 0);
+        _now = now_tick;
+    }
+
+    /** The next tick that advance() will process. */
+    uint64_t now() const { return _now; }
+
+    size_t size() const { return _count; }
+
+    bool empty() const { return _count == 0; }
+
+    /**
+     * Schedules (or re-schedules) the entry to fire at expiry_tick.
+     * Expiries in the past fire at the next advance().
+     */
+    void schedule(struct timer_entry *e, uint64_t expiry_tick)
+    {
+        if (e->pending())
+            unlink(e);
+        else
+            _count ++;
+        e->expiry = expiry_tick;
+        link(e);
+    }
+
+    void cancel(struct timer_entry *e)
+    {
+        if (!e->pending())
+            return;
+        unlink(e);
+        _count --;
+    }
+
+    /**
+     * Fires all entries whose expiry is at or before now_tick by calling
+     * fire(entry) after unlinking them, in the order of expiry.
+     * The callback may schedule or cancel any entry.
+     * Returns the number of fired entries.
+     */
+    template<typename F>
+    unsigned advance(uint64_t now_tick, F fire)
+    {
+        unsigned fired = 0;
+        while (_now <= now_tick) {
+            if (_count == 0) {
+                /* Nothing to cascade or fire. */
+                _now = now_tick + 1;
+                break;
+            }
+            unsigned idx = _now & SLOT_MASK;
+            if (idx == 0)
+                cascade(1);
+            int next = find_slot(idx);
+            if (next < 0) {
+                /* Jump to the next cascade point. */
+                uint64_t block_end = (_now | SLOT_MASK) + 1;
+                _now = (block_end <= now_tick) ? block_end : now_tick + 1;
+                continue;
+            }
+            uint64_t tick = (_now & ~(uint64_t) SLOT_MASK) + next;
+            if (tick > now_tick) {
+                _now = now_tick + 1;
+                break;
+            }
+            /* Keep the due list linked so that callbacks may cancel its
+             * entries, and insert the callbacks' timers after this tick. */
+            struct timer_entry *due = detach(0, next);
+            if (due != nullptr)
+                due->pprev = &due;
+            _now = tick + 1;
+            while (due != nullptr) {
+                struct timer_entry *e = due;
+                unlink(e);
+                if ((int64_t) (e->expiry - tick) > 0) {
+                    /* Clamped to the horizon; not yet due. */
+                    link(e);
+                } else {
+                    _count --;
+                    fire(e);
+                    fired ++;
+                }
+            }
+        }
+        return fired;
+    }
+
+private:
+    uint64_t _now;
+    size_t _count;
+    struct timer_entry *_slots[NUM_LEVELS][SLOTS];
+    uint64_t _bits[SLOTS / 64];     /* occupancy of level 0 */
+
+    void link(struct timer_entry *e)
+    {
+        uint64_t expiry = e->expiry;
+        if ((int64_t) (expiry - _now) < 0)
+            expiry = _now;
+        uint64_t delta = expiry - _now;
+        if (delta > MAX_DELTA) {
+            expiry = _now + MAX_DELTA;
+            delta = MAX_DELTA;
+        }
+        unsigned level = (delta == 0) ? 0
+                       : (63 - __builtin_clzll(delta)) / LEVEL_BITS;
+        unsigned idx = (expiry >> (level * LEVEL_BITS)) & SLOT_MASK;
+        struct timer_entry **head = &_slots[level][idx];
+        e->next = *head;
+        if (*head != nullptr)
+            (*head)->pprev = &e->next;
+        *head = e;
+        e->pprev = head;
+        e->slot = (uint16_t) (level * SLOTS + idx);
+        if (level == 0)
+            _bits[idx >> 6] |= (1llu << (idx & 63));
+    }
+
+    void unlink(struct timer_entry *e)
+    {
+        *e->pprev = e->next;
+        if (e->next != nullptr)
+            e->next->pprev = e->pprev;
+        e->next = nullptr;
+        e->pprev = nullptr;
+        if (e->slot < SLOTS && _slots[0][e->slot] == nullptr)
+            _bits[e->slot >> 6] &= ~(1llu << (e->slot & 63));
+    }
+
+    /* Takes the whole list of a slot. */
+    struct timer_entry *detach(unsigned level, unsigned idx)
+    {
+        struct timer_entry *e = _slots[level][idx];
+        _slots[level][idx] = nullptr;
+        if (level == 0)
+            _bits[idx >> 6] &= ~(1llu << (idx & 63));
+        return e;
+    }
+
+    /* Moves the entries of the current slot of the level to lower levels. */
+    void cascade(unsigned level)
+    {
+        unsigned idx = (_now >> (level * LEVEL_BITS)) & SLOT_MASK;
+        struct timer_entry *e = detach(level, idx);
+        while (e != nullptr) {
+            struct timer_entry *e_next = e->next;
+            link(e);
+            e = e_next;
+        }
+        if (idx == 0 && level + 1 < NUM_LEVELS)
+            cascade(level + 1);
+    }
+
+    /* Returns the first occupied level-0 slot at or after idx, or -1. */
+    int find_slot(unsigned idx) const
+    {
+        unsigned w = idx >> 6;
+        uint64_t bits = _bits[w] & (~0llu << (idx & 63));
+        while (true) {
+            if (bits != 0)
+                return (int) (w * 64 + __builtin_ctzll(bits));
+            if (++ w == SLOTS / 64)
+                return -1;
+            bits = _bits[w];
+        }
+    }
+};
+
+/**
+ * Converts TSC readings and microsecond delays into timer wheel ticks.
+ * A tick is the power-of-two number of TSC cycles closest to (but not
+ * longer than) the requested resolution, so that the conversion of a TSC
+ * reading is a single shift.
+ */
+class TSCTicker {
+public:
+    TSCTicker() : _shift(0), _cycles_per_usec(1) { }
+
+    void init(uint64_t tsc_hz, uint64_t tick_nsec = 1000)
+    {
+        uint64_t cycles_per_tick = tsc_hz * tick_nsec / 1000000000llu;
+        _shift = (cycles_per_tick <= 1) ? 0 : (63 - __builtin_clzll(cycles_per_tick));
+        _cycles_per_usec = tsc_hz / 1000000llu;
+        if (_cycles_per_usec == 0)
+            _cycles_per_usec = 1;
+    }
+
+    uint64_t ticks(uint64_t tsc) const { return tsc >> _shift; }
+
+    /**
+     * Rounds up.  As ticks() rounds down, a timer scheduled at
+     * ticks(now) + usec_to_ticks(usec) fires at most one tick early.
+     */
+    uint64_t usec_to_ticks(uint64_t usec) const
+    {
+        const uint64_t max_usec = (1llu << 40);
+        if (usec > max_usec)
+            usec = max_usec;
+        return (usec * _cycles_per_usec + (1llu << _shift) - 1) >> _shift;
+    }
+
+    uint64_t cycles_per_tick() const { return 1llu << _shift; }
+
+private:
+    unsigned _shift;
+    uint64_t _cycles_per_usec;
+};
+
+} // endns(nba)
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
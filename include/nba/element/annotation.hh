@@ -17,6 +17,10 @@ enum PacketAnnotationKind : unsigned
     NBA_ANNO_IPSEC_FLOW_ID,
     NBA_ANNO_IPSEC_IV1,
     NBA_ANNO_IPSEC_IV2,
+    NBA_ANNO_FLOW_ID,       /* set by ConnTrack: (core id << 32) | per-thread id */
+    NBA_ANNO_CONN_STATE,    /* set by ConnTrack: ConnState */
+    NBA_ANNO_COLOR,         /* set by Policer: PolicerColor */
+    NBA_ANNO_IDS_MATCH,     /* set by PatternMatch: the matched pattern ID */
 
     //End of PacketAnnotationKind
     NBA_MAX_ANNOTATION_SET_SIZE
@@ -4,6 +4,7 @@
 #include <nba/core/intrinsic.hh>
 #include <nba/core/queue.hh>
 #include <nba/core/offloadtypes.hh>
+#include <nba/core/timerwheel.hh>
 #include <nba/core/vector.hh>
 #include <nba/framework/config.hh>
 #include <nba/framework/graphanalysis.hh>
@@ -33,6 +34,39 @@ typedef std::function<void(ComputeDevice *dev,
 typedef std::function<void(ComputeDevice *dev)>
     offload_init_handler;
 
+/**
+ * A device buffer that the offload init handlers set up on each device
+ * of a node.  Elements keep it in the node-local storage so that the
+ * compute handlers find the copy of the device they run on, and clear()
+ * it in initialize_per_node() before the init handlers run.
+ */
+struct per_device_mem {
+    unsigned num_devices;
+    ComputeDevice *devices[NBA_MAX_COPROCESSORS];
+    dev_mem_t mems[NBA_MAX_COPROCESSORS];
+
+    void clear() { num_devices = 0; }
+
+    /** Returns the slot to store the buffer of the given device. */
+    dev_mem_t *add(ComputeDevice *dev)
+    {
+        dev_mem_t *m = find(dev);
+        if (m != nullptr)
+            return m;
+        assert(num_devices < NBA_MAX_COPROCESSORS);
+        devices[num_devices] = dev;
+        return &mems[num_devices ++];
+    }
+
+    dev_mem_t *find(const ComputeDevice *dev)
+    {
+        for (unsigned i = 0; i < num_devices; i++)
+            if (devices[i] == dev)
+                return &mems[i];
+        return nullptr;
+    }
+};
+
 enum ElementType {
     /* PER_PACKET and PER_BATCH are exclusive to each other. */
     ELEMTYPE_PER_PACKET = 1,
@@ -44,6 +78,15 @@ enum ElementType {
     ELEMTYPE_VECTOR = 64,
 };
 
+/* Per-thread element counters maintained by ElementGraph.
+ * They are written only by the owner computation thread. */
+struct element_stat {
+    uint64_t num_batches;
+    uint64_t num_pkts;
+    uint64_t num_offloaded_pkts;
+    uint64_t num_cycles;    /* spent in the CPU handlers, if COMP_ELEMENT_CYCLES */
+};
+
 struct element_info {
     int idx;
     /* NOTE: Non-mutable lambda expression of the same type is
@@ -101,11 +144,27 @@ public:
     virtual const char *port_count() const = 0;
     virtual int get_type() const { return ELEMTYPE_PER_PACKET; }
 
+    /* Returning non-zero fails the graph build, which refuses a reload. */
     virtual int configure(comp_thread_context *ctx, std::vector<std::string> &args);
     virtual int initialize() = 0;       // per-thread configuration. Called after coprocessor threads are initialized.
     virtual int initialize_global();    // thread-global configuration. Called before coprocessor threads are initialized.
     virtual int initialize_per_node();  // per-node configuration. Called before coprocessor threads are initialized.
 
+    /**
+     * Called by graph reloads before initialize(), when this element
+     * replaces prev of the same signature in the running graph of the
+     * same thread.  Both run in that thread until prev is drained, so
+     * they may share the per-thread state, but only one must free it.
+     */
+    virtual void adopt_state(Element *prev) { }
+
+    /**
+     * Whether initialize_global() rewrites process-wide state that the
+     * running instances of the class use.  Graph reloads refuse new
+     * ones while the class is running.
+     */
+    virtual bool has_global_state() const { return false; }
+
     /** User-define function to process a packet. */
     virtual int process(int input_port, Packet *pkt) = 0;
 
@@ -116,8 +175,19 @@ public:
 
     virtual void get_datablocks(std::vector<int> &datablock_ids){}; //TODO fill here...
 
+    /** The counters of input batches and packets processed so far. */
+    const struct element_stat &get_stat() const { return stat; }
+
+    /** The number of connected output ports, valid from initialize(). */
+    unsigned num_connected_outputs() const { return next_elems.size(); }
+
     comp_thread_context *ctx;
 
+    /** The class name and arguments given in the configuration.
+     * Graph reloads skip the global and per-node initialization of
+     * elements whose signature is already in the running graph. */
+    std::string conf_signature;
+
 protected:
     /* Subclasses use below to manage node-local storage. */
     int num_nodes;
@@ -130,6 +200,7 @@ private:
     uint64_t branch_total = 0;
     uint64_t branch_miss = 0;
     uint64_t branch_count[NBA_MAX_ELEM_NEXTS];
+    struct element_stat stat;
 
     FixedArray<Element*, NBA_MAX_ELEM_NEXTS> next_elems;
     FixedArray<int, NBA_MAX_ELEM_NEXTS> next_connected_inputs;
@@ -200,13 +271,17 @@ public:
      * from the internal vector.
      *
      * If next_delay value is set to larger than zero, it is interpreted as
-     * a delay before the next scheduling, in microseconds.
+     * a delay before the next scheduling, in microseconds.  The element
+     * graph keeps such elements in a per-thread timer wheel and does not
+     * look at them until the delay passes.  Otherwise, dispatch() is
+     * called on every loop.
      */
     virtual int dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay) = 0;
 
     uint64_t _last_call_ts;
     uint64_t _last_delay;
     uint64_t _last_check_tick;
+    struct timer_entry _timer;
 };
 
 class OffloadableElement : virtual public SchedulableElement {
@@ -231,6 +306,7 @@ public:
         NEW(0, finished_batches, FixedRing<PacketBatch*>,
             MAX_FINBATCH_QLEN, finished_batches_arrbuf);
         memzero(tasks, NBA_MAX_COPROCESSOR_TYPES);
+        no_device_warned = false;
     }
     virtual ~OffloadableElement() {}
     int get_type() const { return ELEMTYPE_OFFLOADABLE | ELEMTYPE_SCHEDULABLE; }
@@ -263,6 +339,7 @@ private:
     OffloadTask *tasks[NBA_MAX_COPROCESSOR_TYPES];
     FixedRing<PacketBatch*> *finished_batches;
     PacketBatch *finished_batches_arrbuf[MAX_FINBATCH_QLEN];
+    bool no_device_warned;
     void dummy_compute_handler(ComputeDevice *cdev,
                                ComputeContext *ctx,
                                struct resource_param *res);
@@ -4,6 +4,8 @@
 #include <nba/framework/logging.hh>
 #include <unordered_map>
 #include <string>
+#include <vector>
+#include <rte_debug.h>
 #include <rte_memory.h>
 #include <rte_malloc.h>
 #include <rte_rwlock.h>
@@ -33,11 +35,19 @@ class NodeLocalStorage {
      * of elements, and get_alloc() / get_rwlock() methods should be
      * called inside configure() method which is called per thread ( =
      * per element instance).
+     *
+     * alloc() with an existing key takes a new entry and rebinds the
+     * key to it, so that a graph built by a reload gets fresh tables
+     * while the elements of the running graph keep using the pointers
+     * they already have.  The replaced entries are retired until
+     * free_retired() is called after no graph uses them, and their
+     * slots are reused.
      */
 public:
     NodeLocalStorage(unsigned node_id)
     {
         _node_id = node_id;
+        _num_entries = 0;
         for (int i = 0; i < NBA_MAX_NODELOCALSTORAGE_ENTRIES; i++) {
             _pointers[i] = NULL;
             //_rwlocks[i] = NULL;
@@ -53,9 +63,20 @@ public:
     int alloc(const char *key, size_t size)
     {
         rte_spinlock_lock(&_node_lock);
-        size_t kid = _keys.size();
-        assert(kid < NBA_MAX_NODELOCALSTORAGE_ENTRIES);
-        _keys.insert(std::pair<std::string, int>(key, kid));
+        auto it = _keys.find(key);
+        if (it != _keys.end())
+            _retired.push_back(it->second);
+        size_t kid;
+        if (!_free_slots.empty()) {
+            kid = _free_slots.back();
+            _free_slots.pop_back();
+        } else {
+            if (_num_entries == NBA_MAX_NODELOCALSTORAGE_ENTRIES)
+                rte_panic("NLS[%u]: no more than %d entries are allowed.\n",
+                          _node_id, NBA_MAX_NODELOCALSTORAGE_ENTRIES);
+            kid = _num_entries ++;
+        }
+        _keys[key] = kid;
 
         void *ptr = rte_malloc_socket("nls_alloc", size, CACHE_LINE_SIZE, _node_id);
         //void *ptr = new char*[size];
@@ -75,6 +96,14 @@ public:
         return kid;
     }
 
+    bool has(const char *key)
+    {
+        rte_spinlock_lock(&_node_lock);
+        bool found = (_keys.find(key) != _keys.end());
+        rte_spinlock_unlock(&_node_lock);
+        return found;
+    }
+
     void* get_alloc(const char *key)
     {
         rte_spinlock_lock(&_node_lock);
@@ -96,6 +125,19 @@ public:
         return nullptr;
     }
 
+    /** Frees the entries replaced by alloc() so far. */
+    void free_retired()
+    {
+        rte_spinlock_lock(&_node_lock);
+        for (int kid : _retired) {
+            rte_free(_pointers[kid]);
+            _pointers[kid] = NULL;
+            _free_slots.push_back(kid);
+        }
+        _retired.clear();
+        rte_spinlock_unlock(&_node_lock);
+    }
+
     void free(const char *key)
     {
         rte_spinlock_lock(&_node_lock);
@@ -117,7 +159,10 @@ protected:
     unsigned _node_id;
     //rte_rwlock_t *_rwlocks[NBA_MAX_NODELOCALSTORAGE_ENTRIES];
     void *_pointers[NBA_MAX_NODELOCALSTORAGE_ENTRIES];
+    size_t _num_entries;
     std::unordered_map<std::string, int> _keys;
+    std::vector<int> _retired;      // replaced entries still in use
+    std::vector<int> _free_slots;
     rte_spinlock_t _node_lock;
 };
 }
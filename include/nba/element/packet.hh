@@ -6,6 +6,7 @@
 #include <cassert>
 #include <rte_config.h>
 #include <rte_eal.h>
+#include <rte_branch_prediction.h>
 #include <rte_memcpy.h>
 #include <rte_mbuf.h>
 #include <rte_mempool.h>
@@ -13,6 +14,7 @@
 namespace nba {
 
 extern thread_local struct rte_mempool *packet_pool;
+extern thread_local struct rte_mempool *jumbo_pool;
 
 enum PacketDisposition {
     /**
@@ -107,8 +109,35 @@ public:
 
     void kill();
 
+    /**
+     * Takes the packet out of its batch without freeing it.
+     * The calling element owns the packet afterwards and must either
+     * put it into a new batch or free its base mbuf.
+     */
+    void pend();
+
+    inline struct rte_mbuf *get_base() { return base; }
+
     inline unsigned char *data() { return rte_pktmbuf_mtod(base, unsigned char *); }
+    /* The length of the first segment, which is the whole packet unless it is chained. */
     inline uint32_t length() { return rte_pktmbuf_data_len(base); }
+    /* The length of the whole packet across all segments. */
+    inline uint32_t pkt_length() { return rte_pktmbuf_pkt_len(base); }
+    inline unsigned nb_segs() { return base->nb_segs; }
+    inline bool is_contiguous() { return base->nb_segs == 1; }
+
+    /**
+     * Makes the whole packet accessible from data() as a single segment.
+     * Elements that touch the payload beyond the first segment (e.g.,
+     * IPsec encapsulation) call this first; header-only elements need
+     * not.  Returns false if there is no room for it, leaving the packet
+     * unchanged.
+     */
+    inline bool linearize() {
+        if (likely(base->nb_segs == 1))
+            return true;
+        return linearize_chain();
+    }
     inline uint32_t headroom() { return rte_pktmbuf_headroom(base); }
     inline uint32_t tailroom() { return rte_pktmbuf_tailroom(base); }
 
@@ -118,10 +147,18 @@ public:
 
     inline bool shared() { return rte_mbuf_refcnt_read(base) > 1; }
 
+    /* The RSS hash computed by the NIC, if available. */
+    inline bool has_rss_hash() { return (base->ol_flags & PKT_RX_RSS_HASH) != 0; }
+    inline uint32_t rss_hash() { return base->hash.rss; }
+
     inline void pull(uint32_t len) { rte_pktmbuf_adj(base, (uint16_t) len); }
     inline void put(uint32_t len) { rte_pktmbuf_append(base, (uint16_t) len); }
     inline void take(uint32_t len) { rte_pktmbuf_trim(base, (uint16_t) len); }
 
+private:
+    bool linearize_chain();
+
+public:
     Packet *clone() {
         Packet *q;
         struct rte_mbuf *q_base = rte_pktmbuf_clone(this->base, packet_pool);
@@ -220,6 +257,7 @@ public:
 static_assert(sizeof(struct Packet) <= RTE_PKTMBUF_HEADROOM, "struct Packet must fit in headroom.");
 
 struct rte_mempool *packet_create_mempool(size_t size, int node_id, int core_id);
+struct rte_mempool *jumbo_create_mempool(size_t size, size_t frame_size, int node_id, int core_id);
 
 }
 
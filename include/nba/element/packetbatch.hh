@@ -1,6 +1,7 @@
 #ifndef __NBA_PACKETBATCH_HH__
 #define __NBA_PACKETBATCH_HH__
 #include <nba/core/intrinsic.hh>
+#include <nba/core/flowsequencer.hh>
 #include <nba/framework/config.hh>
 #include <nba/framework/datablock.hh>
 #include <nba/framework/task.hh>
@@ -425,6 +426,7 @@ public:
           #endif
           delay_start(0), compute_time(0)
     {
+        flow_tickets.mask = 0;
         #ifdef DEBUG
         memset(&results[0], 0xdd, sizeof(int) * NBA_MAX_COMP_BATCH_SIZE);
         #if (NBA_BATCHING_SCHEME == NBA_BATCHING_TRADITIONAL) \
@@ -463,6 +465,18 @@ public:
     void clean_drops(struct rte_ring *drop_queue);
     #endif
 
+    /**
+     * Hands over a dropped packet to the IO thread via drop_queue.
+     * The packet is freed here if the queue is full.
+     */
+    static void drop_packet(struct rte_ring *drop_queue, struct rte_mbuf *pkt);
+
+    /**
+     * Drops all packets left in the batch, e.g., when an element holding
+     * it is destroyed.  The caller puts the batch back to its pool.
+     */
+    void drop_all(struct rte_ring *drop_queue);
+
     unsigned count;
     #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
     unsigned drop_count;
@@ -479,6 +493,7 @@ public:
     uint64_t recv_timestamp;
     uint64_t generation;
     uint64_t batch_id;
+    struct flow_tickets flow_tickets;   /* set by IO threads for ordered work stealing */
     struct task_tracker tracker;
     #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
     bool has_dropped;
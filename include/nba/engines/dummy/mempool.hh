@@ -0,0 +1,75 @@
+#ifndef __NBA_DUMMY_MEMPOOL_HH__
+#define __NBA_DUMMY_MEMPOOL_HH__
+
+#include <nba/core/intrinsic.hh>
+#include <nba/core/mempool.hh>
+#include <nba/core/offloadtypes.hh>
+#include <cstdint>
+#include <cstdlib>
+#include <cassert>
+
+namespace nba {
+
+/**
+ * A bump allocator on plain host memory.
+ * The dummy device shares the same memory for both host and device sides.
+ */
+class DummyHostMemoryPool : public MemoryPool<host_mem_t>
+{
+public:
+    explicit DummyHostMemoryPool(size_t max_size, size_t align)
+        : MemoryPool(max_size, align), base(nullptr), use_external(false)
+    { }
+
+    virtual ~DummyHostMemoryPool()
+    {
+        destroy();
+    }
+
+    bool init()
+    {
+        return init_with_base(nullptr);
+    }
+
+    bool init_with_base(void *ext_ptr)
+    {
+        if (ext_ptr != nullptr) {
+            base = ext_ptr;
+            use_external = true;
+        } else {
+            if (0 != posix_memalign(&base, CACHE_LINE_SIZE, max_size))
+                return false;
+        }
+        return true;
+    }
+
+    host_mem_t get_base_ptr() const
+    {
+        return { (void *) ((uintptr_t) base + shifts) };
+    }
+
+    int alloc(size_t size, host_mem_t &m)
+    {
+        size_t offset;
+        int ret = _alloc(size, &offset);
+        if (ret == 0)
+            m.ptr = (void *) ((uintptr_t) base + shifts + offset);
+        return ret;
+    }
+
+    void destroy()
+    {
+        if (base != nullptr && !use_external)
+            free(base);
+        base = nullptr;
+    }
+
+private:
+    void *base;
+    bool use_external;
+};
+
+}
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
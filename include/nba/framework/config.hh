@@ -9,8 +9,8 @@
 #define NBA_MAX_CORES               (64)
 #define NBA_MAX_PORTS               (16)
 #define NBA_MAX_QUEUES_PER_PORT     (128)
-#define NBA_MAX_COPROCESSORS        (2)     // Max number of coprocessor devices
-#define NBA_MAX_COPROCESSOR_TYPES   (1)     // Max number of coprocessor types
+#define NBA_MAX_COPROCESSORS        (4)     // Max number of coprocessor devices
+#define NBA_MAX_COPROCESSOR_TYPES   (4)     // Max number of coprocessor types
 
 
 #define NBA_BATCHING_TRADITIONAL    (0)
@@ -41,6 +41,8 @@
 
 
 #define NBA_MAX_PACKET_SIZE         (2048)
+/* Frames longer than NBA_MAX_PACKET_SIZE are received as chained mbufs. */
+#define NBA_MAX_JUMBO_FRAME_SIZE    (9728)
 #ifdef NBA_NO_HUGE
   #define NBA_MAX_IO_BATCH_SIZE      (4u)
   #define NBA_MAX_COMP_BATCH_SIZE    (4u)
@@ -54,6 +56,13 @@
   #endif
 #endif
 #define NBA_MAX_COMP_PREPKTQ_LENGTH (256u)
+/* Running computation threads on their own cores (see comp_loop()). */
+#define NBA_MAX_COMP_DECOUPLED      (1)
+#define NBA_MAX_COMPTHREADS_PER_IOTHREAD (8)
+/* Stealing batches between comp threads: 1 for any order, 2 per-flow ordered. */
+#define NBA_MAX_COMP_WORK_STEALING  (2)
+/* Counting the CPU cycles of each element (element_stat.num_cycles). */
+#define NBA_MAX_COMP_ELEMENT_CYCLES (1)
 #if defined(NBA_PMD_MLX4) || defined(NBA_PMD_MLNX_UIO)
 #define NBA_MAX_IO_DESC_PER_HWRXQ      (8192)
 #define NBA_MAX_IO_DESC_PER_HWTXQ      (8192)
@@ -62,6 +71,11 @@
 #define NBA_MAX_IO_DESC_PER_HWTXQ      (1024)
 #endif
 
+/* Adaptive polling of IO threads (see IdleBackoff). */
+#define NBA_MAX_IO_IDLE_SPIN_POLLS  (1 << 20)
+#define NBA_MAX_IO_IDLE_PAUSE_POLLS (1 << 20)
+#define NBA_MAX_IO_IDLE_SLEEP_USEC  (100000)
+
 #define NBA_MAX_COPROC_PPDEPTH      (64u)
 #define NBA_MAX_COPROC_INPUTQ_LENGTH       (64)
 #define NBA_MAX_COPROC_COMPLETIONQ_LENGTH  (64)
@@ -112,14 +126,16 @@ struct io_thread_conf {
     int core_id;
     std::vector<struct hwrxq> attached_rxqs;
     int mode;
-    int swrxq_idx;
+    int swrxq_idx;                  /* the first one in swrxq_idxs */
+    std::vector<int> swrxq_idxs;    /* one per connected comp thread */
     void *priv;
 };
 
 struct comp_thread_conf {
     int core_id;
     int swrxq_idx;
-    int taskinq_idx;
+    int taskinq_idx;                /* the first one in taskinq_idxs */
+    std::vector<int> taskinq_idxs;  /* one per connected coproc thread */
     int taskoutq_idx;
     void *priv;
 };
@@ -127,6 +143,7 @@ struct comp_thread_conf {
 struct coproc_thread_conf {
     int core_id;
     int device_id;
+    std::string driver;             /* registered in ComputeDeviceFactory */
     int taskinq_idx;
     int taskoutq_idx;
     void *priv;
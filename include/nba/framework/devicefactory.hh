@@ -0,0 +1,65 @@
+#ifndef __NBA_DEVICEFACTORY_HH__
+#define __NBA_DEVICEFACTORY_HH__
+
+#include <nba/framework/computedevice.hh>
+#include <new>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace nba {
+
+/**
+ * The ComputeDevice factory.
+ *
+ * Each device engine registers its ComputeDevice subclass under its
+ * driver name (e.g., "cuda", "knapp.phi", "phi", "dummy") using
+ * EXPORT_COMPUTEDEVICE() in its translation unit.  The framework then
+ * allocates and constructs devices by the driver name given in the
+ * system configuration, without knowing the concrete classes.
+ */
+class ComputeDeviceFactory {
+public:
+    typedef ComputeDevice *(*device_ctor_t)(void *buf, unsigned node_id,
+                                            unsigned device_id, size_t num_contexts);
+
+    struct device_info {
+        size_t size;
+        device_ctor_t ctor;
+    };
+
+    static bool register_device(const char *driver_name, size_t size, device_ctor_t ctor);
+
+    static bool exists(const std::string &driver_name);
+
+    /** Returns the registered driver names in the registration order. */
+    static const std::vector<std::string> &get_driver_names();
+
+    /** Returns the driver used when the configuration does not specify one. */
+    static std::string get_default_driver();
+
+    /** Allocates NUMA-local memory large enough to hold the device object. */
+    static ComputeDevice *alloc(const std::string &driver_name, unsigned node_id);
+
+    /** Calls the constructor of the device subclass on the given memory. */
+    static ComputeDevice *construct(const std::string &driver_name, ComputeDevice *buf,
+                                    unsigned node_id, unsigned device_id,
+                                    size_t num_contexts);
+
+private:
+    static std::unordered_map<std::string, struct device_info> &registry();
+    static std::vector<std::string> &driver_names();
+};
+
+}
+
+#define EXPORT_COMPUTEDEVICE(driver_name, cls) \
+    static bool __nba_computedevice_registered_##cls = \
+        nba::ComputeDeviceFactory::register_device((driver_name), sizeof(cls), \
+            [] (void *buf, unsigned node_id, unsigned device_id, size_t num_contexts) -> nba::ComputeDevice* { \
+                return new (buf) cls(node_id, device_id, num_contexts); \
+            })
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -2,9 +2,11 @@
 #define __NBA_ELEMGRAPH_HH__
 
 #include <nba/core/queue.hh>
+#include <nba/core/timerwheel.hh>
 #include <nba/framework/computation.hh>
 #include <nba/framework/threadcontext.hh>
 #include <nba/framework/task.hh>
+#include <nba/framework/offloaddispatcher.hh>
 #include <nba/element/element.hh>
 #include <nba/element/packetbatch.hh>
 #include <vector>
@@ -36,7 +38,8 @@ struct offload_action_key {
 class ElementGraph {
 public:
     ElementGraph(comp_thread_context *ctx);
-    virtual ~ElementGraph() {}
+    /* Also destroys the elements. */
+    virtual ~ElementGraph();
 
     int count()
     {
@@ -52,7 +55,9 @@ public:
     /* Tries to run all pending computation tasks. */
     void flush_tasks();
 
-    /* Scans and executes dispatch() handlers of schedulable elements.
+    /* Executes dispatch() handlers of schedulable elements that are due:
+     * those that returned zero next_delay on every call, and the others
+     * when their timers in sched_timers expire.
      * This implies scan_offloadable_elements() since offloadable elements
      * inherits schedulable elements. */
     void scan_schedulable_elements(uint64_t loop_count);
@@ -66,6 +71,14 @@ public:
     /* Start processing with the given batch and the entry point. */
     void feed_input(int entry_point_idx, PacketBatch *batch, uint64_t loop_count);
 
+    /* Runs the remaining work of a graph replaced by a reload: sends the
+     * partially accumulated offload tasks and processes the batches still
+     * queued or coming back from devices and schedulable elements.
+     * Returns true when nothing is left in flight.  Batches that
+     * schedulable elements keep beyond this point (e.g., a backlogged
+     * Shaper waiting on its timer) are lost with the graph. */
+    bool drain(uint64_t loop_count);
+
     void add_offload_action(struct offload_action_key *key);
     bool check_preproc(OffloadableElement *oel, int dbid);
     bool check_postproc(OffloadableElement *oel, int dbid);
@@ -99,6 +112,12 @@ public:
      */
     void free_batch(PacketBatch *batch, bool free_pkts = true);
 
+    /**
+     * Records the completion of an offload task sent to the given device,
+     * so that the dispatcher can update its device latency estimates.
+     */
+    void notify_offload_completion(int dev_idx, float elapsed_sec);
+
     /* TODO: calculate from the actual graph */
     static const int num_max_outputs = NBA_MAX_ELEM_NEXTS;
 
@@ -114,6 +133,14 @@ private:
     FixedRing<SchedulableElement *> sched_elements;
     FixedRing<OffloadableElement *> offl_elements;
 
+    /**
+     * Schedulable elements (except the input) to call on the next loop,
+     * and the timers of those waiting for their next_delay.
+     */
+    FixedRing<SchedulableElement *> busy_sched_elements;
+    TimerWheel sched_timers;
+    TSCTicker sched_ticker;
+
     /**
      * Used to pass context objects when calling element handlers.
      */
@@ -129,10 +156,22 @@ private:
      * the batch to the delayed_batches queue. */
     void process_batch(PacketBatch *batch);
     void process_offload_task(OffloadTask *otask);
+    void dispatch_schedulable(SchedulableElement *selem, uint64_t loop_count, uint64_t now);
     void send_offload_task_to_device(OffloadTask *task);
+    /* Passes a batch at the output to the IO thread and frees it,
+     * either directly (inline) or via ctx->tx_return_queue (decoupled). */
+    void transmit_batch(PacketBatch *batch);
 
     struct rte_hash *offl_actions;
 
+    /* Offload tasks sent to devices and not completed yet. */
+    unsigned num_inflight_tasks;
+    /* Batches returned by dispatch() of schedulable elements. */
+    uint64_t num_dispatched_batches;
+
+    /* Chooses the device for each new offload task. */
+    OffloadDispatcher offl_dispatcher;
+
     /* The entry point of packet processing pipeline (graph). */
     SchedulableElement *input_elem;
 };
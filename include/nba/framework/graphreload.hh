@@ -0,0 +1,93 @@
+#ifndef __NBA_GRAPHRELOAD_HH__
+#define __NBA_GRAPHRELOAD_HH__
+
+#include <nba/core/threading.hh>
+#include <nba/framework/io.hh>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+namespace nba {
+
+struct io_thread_context;
+class comp_thread_context;
+
+/**
+ * Replaces the element graphs of running computation threads with ones
+ * built from a new pipeline configuration, without restarting them.
+ *
+ * The next graphs are built and initialized in the reloader thread.
+ * Elements whose class name and arguments are also in the running graph
+ * skip initialize_global() and initialize_per_node(), so that their
+ * initialize() picks up the node-local tables of the running ones, and
+ * take over the per-thread states of the running ones via adopt_state().
+ * New elements whose initialize_global() would overwrite the global
+ * state of a running element of the same class are refused.
+ * Each computation thread switches to its next graph between batches
+ * and keeps draining the old one until no batches or offload tasks are
+ * left in it; then the reloader destroys it, and frees the node-local
+ * entries replaced by the new elements.
+ *
+ * Offloadable elements may be reused, but new ones are refused when
+ * there are offload devices since they need device-side initialization.
+ * Elements can also refuse a reload by failing configure(); they see
+ * which build it is in comp_thread_context::graph_generation.
+ *
+ * Example: kill -HUP `pidof main`
+ */
+class GraphReloader {
+public:
+    GraphReloader(const std::string &config_path);
+    virtual ~GraphReloader();
+
+    /* Registration must be done before start(). */
+    void add_comp_thread(comp_thread_context *ctx);
+    /* Only used to report the port counters during reloads. */
+    void add_io_thread(struct io_thread_context *ctx);
+
+    /** Spawns the reloader thread. */
+    int start();
+
+    /** Stops the reloader thread. */
+    void stop();
+
+    /** Asks the reloader thread to reload.  It is async-signal-safe. */
+    void request() { event.trigger(); }
+
+    /**
+     * Builds the next graphs and publishes them to the computation
+     * threads.  Returns -1 if it is refused; the running graphs are
+     * kept in that case.
+     */
+    int begin_reload(const char *path);
+
+    /** Destroys the drained graphs.  Returns true if no reload is in progress. */
+    bool poll_reload();
+
+private:
+    static void *thread_main(void *arg);
+    void serve();
+
+    void collect_port_stats(struct io_port_stat &total) const;
+
+    std::string config_path;
+    std::vector<comp_thread_context *> comp_ctxs;
+    std::vector<struct io_thread_context *> io_ctxs;
+
+    UserEvent event;
+    pthread_t tid;
+    volatile bool running;
+
+    bool reloading;
+    unsigned generation;    /* the number of reloads begun so far */
+    unsigned num_retired;
+    uint64_t reload_begin_tsc;
+    struct io_port_stat stats_before;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -2,12 +2,16 @@
 #define __NBA_IO_HH__
 
 #include <nba/core/intrinsic.hh>
+#include <nba/core/histogram.hh>
 #include <nba/framework/config.hh>
+#include <cstring>
 #include <rte_atomic.h>
+#include <rte_mbuf.h>
 
 namespace nba {
 
 struct io_thread_context;
+class comp_thread_context;
 class PacketBatch;
 
 struct io_port_stat {
@@ -21,16 +25,41 @@ struct io_port_stat {
     uint64_t num_sent_bytes;
 } __cache_aligned;
 
-struct io_port_stat_atomic {
-    rte_atomic64_t num_recv_pkts;
-    rte_atomic64_t num_sent_pkts;
-    rte_atomic64_t num_sw_drop_pkts;
-    rte_atomic64_t num_rx_drop_pkts;
-    rte_atomic64_t num_tx_drop_pkts;
-    rte_atomic64_t num_invalid_pkts;
-    rte_atomic64_t num_recv_bytes;
-    rte_atomic64_t num_sent_bytes;
-} __cache_aligned;
+/**
+ * Adds the cumulative counters of another thread into dst.
+ * The counters are written only by their owner thread, so we only need
+ * untorn 64-bit reads here instead of atomic operations.
+ */
+static inline void io_port_stat_accumulate(struct io_port_stat *dst, const struct io_port_stat *src)
+{
+    const volatile struct io_port_stat *s = src;
+    dst->num_recv_pkts    += s->num_recv_pkts;
+    dst->num_sent_pkts    += s->num_sent_pkts;
+    dst->num_sw_drop_pkts += s->num_sw_drop_pkts;
+    dst->num_rx_drop_pkts += s->num_rx_drop_pkts;
+    dst->num_tx_drop_pkts += s->num_tx_drop_pkts;
+    dst->num_invalid_pkts += s->num_invalid_pkts;
+    dst->num_recv_bytes   += s->num_recv_bytes;
+    dst->num_sent_bytes   += s->num_sent_bytes;
+}
+
+/* Pipeline paths distinguished in latency statistics. */
+enum io_latency_path : unsigned {
+    IO_LATENCY_PATH_CPU = 0,
+    IO_LATENCY_PATH_OFFLOAD = 1,
+    IO_NUM_LATENCY_PATHS = 2,
+};
+
+/* Per-thread latency histograms, recorded without synchronization. */
+struct io_thread_latency_stat {
+    LatencyHistogram pkt_latency[NBA_MAX_PORTS][IO_NUM_LATENCY_PATHS];
+    LatencyHistogram offload_rtt;
+};
+
+/* Node-wide histogram counts that threads add to and the master drains. */
+struct io_latency_hist_atomic {
+    rte_atomic64_t counts[LatencyHistogram::NUM_BUCKETS];
+};
 
 struct io_thread_stat {
     unsigned num_ports;
@@ -43,12 +72,77 @@ struct io_node_stat {
     struct io_thread_stat last_total;
     unsigned num_threads;
     unsigned num_ports;
-    struct io_port_stat_atomic port_stats[NBA_MAX_PORTS];
+    /* The IO threads in this node, whose port_stats are cumulative. */
+    struct io_thread_context *thread_ctxs[NBA_MAX_CORES];
+    struct io_latency_hist_atomic pkt_latency[NBA_MAX_PORTS][IO_NUM_LATENCY_PATHS];
+    struct io_latency_hist_atomic offload_rtt;
+    uint64_t last_stolen_batches;
+    uint64_t last_stolen_pkts;
 } __cache_aligned;
 
+/* A frame requested by comp_thread_context::io_tx_new(). */
+struct new_packet
+{
+    char buf[NBA_MAX_PACKET_SIZE];
+    size_t len;
+    int out_port;
+};
+
+/**
+ * Sends up to NBA_MAX_IO_BATCH_SIZE requested frames, grouped by their
+ * output ports.  alloc() returns an mbuf or nullptr, tx(port, pkts,
+ * count) returns how many packets the port took, and the rest are
+ * freed by drop().  Only the packets taken are counted as sent.
+ * Returns the number of them.
+ */
+template<typename Alloc, typename Tx, typename Drop>
+unsigned io_send_new_packets(struct new_packet *const *reqs, unsigned count,
+                             unsigned num_ports, struct io_port_stat *port_stats,
+                             Alloc alloc, Tx tx, Drop drop)
+{
+    struct rte_mbuf *pkts[NBA_MAX_PORTS][NBA_MAX_IO_BATCH_SIZE];
+    unsigned pkts_cnt[NBA_MAX_PORTS] = {0,};
+    for (unsigned i = 0; i < count && i < NBA_MAX_IO_BATCH_SIZE; i++) {
+        const struct new_packet *req = reqs[i];
+        if (req->out_port < 0 || (unsigned) req->out_port >= num_ports)
+            continue;
+        struct rte_mbuf *m = alloc();
+        if (m == nullptr) {
+            port_stats[req->out_port].num_tx_drop_pkts ++;
+            continue;
+        }
+        rte_pktmbuf_pkt_len(m)  = req->len;
+        rte_pktmbuf_data_len(m) = req->len;
+        memcpy(rte_pktmbuf_mtod(m, void *), req->buf, req->len);
+        pkts[req->out_port][pkts_cnt[req->out_port] ++] = m;
+    }
+    unsigned total_sent = 0;
+    for (unsigned o = 0; o < num_ports; o++) {
+        if (pkts_cnt[o] == 0)
+            continue;
+        unsigned sent = tx(o, pkts[o], pkts_cnt[o]);
+        for (unsigned k = 0; k < pkts_cnt[o]; k++) {
+            if (k < sent)
+                port_stats[o].num_sent_bytes += rte_pktmbuf_pkt_len(pkts[o][k]) + 24;
+            else
+                drop(pkts[o][k]);
+        }
+        port_stats[o].num_sent_pkts += sent;
+        port_stats[o].num_tx_drop_pkts += pkts_cnt[o] - sent;
+        total_sent += sent;
+    }
+    return total_sent;
+}
+
 void io_tx_batch(struct io_thread_context *ctx, PacketBatch *batch);
+/* Creates the per-thread pools of ctx and registers comp events to ctx->loop. */
+void comp_init_loop(comp_thread_context *ctx);
+/* Initializes the packets of a batch whose packets, count, and
+ * recv_timestamp are set, and runs the element graph on it. */
+void comp_feed_batch(comp_thread_context *ctx, PacketBatch *batch, uint64_t loop_count);
 //void *io_loop(void *arg);
 int io_loop(void *arg);
+int comp_loop(void *arg);
 
 }
 
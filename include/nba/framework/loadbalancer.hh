@@ -20,12 +20,15 @@ public:
             tx_batch_count(0), tx_pkt_count(0),
             drop_pkt_count(0), batch_proc_time(0)
     {
-        for (unsigned i = 0; i < NBA_MAX_COPROCESSOR_TYPES; i++) {
+        for (unsigned i = 0; i < NBA_MAX_COPROCESSORS; i++) {
             dev_sent_batch_count[i] = 0;
             dev_finished_batch_count[i] = 0;
             dev_finished_task_count[i] = 0;
             avg_task_completion_sec[i] = 0;
+        }
+        for (unsigned i = 0; i < NBA_MAX_COPROCESSOR_TYPES + 1; i++) {
             pkt_proc_cycles[i] = 0;
+            PPC_HISTORY_SIZES[i] = 512;
         }
     }
 
@@ -47,10 +50,11 @@ public:
     /* We do not use wrapper methods to write/read these values, since
      * there is no race condition as all fields are accessed
      * exclusively by a single computation thread. */
-    uint64_t dev_sent_batch_count[NBA_MAX_COPROCESSOR_TYPES];
-    uint64_t dev_finished_batch_count[NBA_MAX_COPROCESSOR_TYPES];
-    uint64_t dev_finished_task_count[NBA_MAX_COPROCESSOR_TYPES];
-    float avg_task_completion_sec[NBA_MAX_COPROCESSOR_TYPES];
+    /* Per-device statistics indexed by the local device index. */
+    uint64_t dev_sent_batch_count[NBA_MAX_COPROCESSORS];
+    uint64_t dev_finished_batch_count[NBA_MAX_COPROCESSORS];
+    uint64_t dev_finished_task_count[NBA_MAX_COPROCESSORS];
+    float avg_task_completion_sec[NBA_MAX_COPROCESSORS];
     uint64_t rx_batch_count;
     uint64_t rx_pkt_count;
     uint64_t tx_batch_count;
@@ -60,7 +64,7 @@ public:
     double pkt_proc_cycles[NBA_MAX_COPROCESSOR_TYPES + 1];
 
     //const unsigned PPC_HISTORY_SIZES[2] = {128, 2048};
-    const unsigned PPC_HISTORY_SIZES[2] = {512, 512};
+    unsigned PPC_HISTORY_SIZES[NBA_MAX_COPROCESSOR_TYPES + 1];
 };
 
 }
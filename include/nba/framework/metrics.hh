@@ -0,0 +1,66 @@
+#ifndef __NBA_METRICS_HH__
+#define __NBA_METRICS_HH__
+
+#include <nba/core/metricwriter.hh>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+namespace nba {
+
+struct io_thread_context;
+struct coproc_thread_context;
+
+/**
+ * Exports runtime statistics on a local Unix domain socket.
+ *
+ * It runs in its own (non-DPDK) thread.  Whenever a client connects, it
+ * aggregates the cumulative per-thread counters of the registered
+ * threads and writes a snapshot in the Prometheus text format, then
+ * closes the connection.  Worker threads never synchronize with it:
+ * all counters are owned and written by a single thread and are read
+ * here without atomics, so the snapshot is only approximately
+ * consistent across counters.
+ *
+ * Example: socat - UNIX-CONNECT:/tmp/nba.sock
+ */
+class MetricsExporter {
+public:
+    MetricsExporter(const std::string &socket_path);
+    virtual ~MetricsExporter();
+
+    /* Registration must be done before start(). */
+    void add_io_thread(struct io_thread_context *ctx);
+    void add_coproc_thread(struct coproc_thread_context *ctx);
+
+    /** Binds the socket and spawns the exporter thread. */
+    int start();
+
+    /** Stops the exporter thread and removes the socket file. */
+    void stop();
+
+    /** Renders the current snapshot. */
+    void render(std::string &out) const;
+
+private:
+    static void *thread_main(void *arg);
+    void serve();
+
+    void render_ports(PrometheusWriter &w) const;
+    void render_elements(PrometheusWriter &w) const;
+    void render_queues(PrometheusWriter &w) const;
+
+    std::string socket_path;
+    std::vector<struct io_thread_context *> io_ctxs;
+    std::vector<struct coproc_thread_context *> coproc_ctxs;
+
+    int listen_fd;
+    pthread_t tid;
+    volatile bool running;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,119 @@
+#ifndef __NBA_OFFLOADDISPATCHER_HH__
+#define __NBA_OFFLOADDISPATCHER_HH__
+
+#include <nba/framework/config.hh>
+#include <cstdint>
+#include <cassert>
+
+namespace nba {
+
+/**
+ * The Offload Dispatcher.
+ *
+ * When a computation thread is connected to multiple offloading devices
+ * (possibly of different types), it decides which device runs the next
+ * offload task.  It estimates the time to finish a new task on each device
+ * as (queue depth + 1) x (moving average of task completion time), where
+ * the queue depth is the sum of the device input queue length and the
+ * number of tasks that this thread has sent but not yet completed.
+ * Devices without any completion history are tried first so that every
+ * device gets measured.
+ *
+ * An instance is owned by each ElementGraph and accessed only by its
+ * computation thread, so no synchronization is needed.
+ */
+class OffloadDispatcher {
+public:
+    OffloadDispatcher() : num_devices(0)
+    {
+        for (unsigned i = 0; i < NBA_MAX_COPROCESSORS; i++) {
+            inflight[i] = 0;
+            num_samples[i] = 0;
+            avg_completion_sec[i] = 0;
+        }
+    }
+
+    virtual ~OffloadDispatcher() { }
+
+    void set_num_devices(unsigned n)
+    {
+        assert(n <= NBA_MAX_COPROCESSORS);
+        num_devices = n;
+    }
+
+    unsigned get_num_devices() const { return num_devices; }
+
+    /**
+     * Returns the index of the device to send a new task, or -1 if none
+     * of the devices in candidate_mask (bit i for device i) is usable.
+     * queue_lens[i] is the current length of device i's input queue.
+     */
+    int select(uint64_t candidate_mask, const unsigned *queue_lens) const
+    {
+        int best = -1;
+        bool best_unmeasured = false;
+        float best_cost = 0;
+        unsigned best_depth = 0;
+        for (unsigned i = 0; i < num_devices; i++) {
+            if (0 == (candidate_mask & (1lu << i)))
+                continue;
+            unsigned depth = queue_lens[i] + inflight[i];
+            bool unmeasured = (num_samples[i] == 0);
+            float cost = (depth + 1) * avg_completion_sec[i];
+            bool better;
+            if (best == -1)
+                better = true;
+            else if (unmeasured != best_unmeasured)
+                better = unmeasured;
+            else if (unmeasured)
+                better = (depth < best_depth);
+            else
+                better = (cost < best_cost) || (cost == best_cost && depth < best_depth);
+            if (better) {
+                best = (int) i;
+                best_unmeasured = unmeasured;
+                best_cost = cost;
+                best_depth = depth;
+            }
+        }
+        return best;
+    }
+
+    void task_sent(int dev_idx)
+    {
+        assert(dev_idx >= 0 && (unsigned) dev_idx < num_devices);
+        inflight[dev_idx] ++;
+    }
+
+    void task_completed(int dev_idx, float elapsed_sec)
+    {
+        assert(dev_idx >= 0 && (unsigned) dev_idx < num_devices);
+        if (inflight[dev_idx] > 0)
+            inflight[dev_idx] --;
+        if (num_samples[dev_idx] == 0)
+            avg_completion_sec[dev_idx] = elapsed_sec;
+        else
+            avg_completion_sec[dev_idx] = HISTORY_WEIGHT * elapsed_sec
+                                          + (1.0f - HISTORY_WEIGHT) * avg_completion_sec[dev_idx];
+        num_samples[dev_idx] ++;
+    }
+
+    unsigned get_inflight(int dev_idx) const { return inflight[dev_idx]; }
+
+    float get_avg_completion_sec(int dev_idx) const { return avg_completion_sec[dev_idx]; }
+
+    /* The weight of the latest sample in the moving average. */
+    static constexpr float HISTORY_WEIGHT = 0.1f;
+
+private:
+    unsigned num_devices;
+    unsigned inflight[NBA_MAX_COPROCESSORS];
+    uint64_t num_samples[NBA_MAX_COPROCESSORS];
+    float avg_completion_sec[NBA_MAX_COPROCESSORS];
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
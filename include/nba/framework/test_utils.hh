@@ -19,6 +19,14 @@ typedef std::function<void(size_t pkt_idx, struct Packet *p)>
 extern PacketBatch *create_batch(size_t num_pkts, size_t pkt_size,
                                  pkt_init_callback_t init_cb);
 
+/**
+ * Creates a batch of packets chained in segments of seg_size bytes,
+ * like jumbo frames received with scattered RX.  The payload is zeroed;
+ * init_cb sees only the first segment via Packet::data().
+ */
+extern PacketBatch *create_chained_batch(size_t num_pkts, size_t pkt_size, size_t seg_size,
+                                         pkt_init_callback_t init_cb);
+
 extern void free_batch(PacketBatch *batch);
 
 } // endns(testing)
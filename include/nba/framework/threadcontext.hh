@@ -3,6 +3,7 @@
 
 #include <nba/core/intrinsic.hh>
 #include <nba/core/queue.hh>
+#include <nba/core/histogram.hh>
 #include <nba/framework/config.hh>
 #include <cstdint>
 #include <cstdbool>
@@ -16,6 +17,7 @@
 #include <ev.h>
 #include <rte_config.h>
 #include <rte_atomic.h>
+#include <rte_branch_prediction.h>
 #include <rte_ring.h>
 #include <rte_ether.h>
 
@@ -25,6 +27,8 @@ namespace nba {
 class CondVar;
 class CountedBarrier;
 class Lock;
+class UserEvent;
+class IdleBackoff;
 class Element;
 class PacketBatch;
 class DataBlock;
@@ -32,10 +36,12 @@ class SystemInspector;
 class ElementGraph;
 class ComputeDevice;
 class ComputeContext;
+class FlowSequencer;
 class NodeLocalStorage;
 class OffloadTask;
 class comp_thread_context;
 struct io_port_stat;
+struct new_packet;
 
 struct core_location {
     unsigned node_id;
@@ -49,13 +55,6 @@ struct port_info {
     struct ether_addr addr;
 } __cache_aligned;
 
-struct new_packet
-{
-    char buf[NBA_MAX_PACKET_SIZE];
-    size_t len;
-    int out_port;
-};
-
 /* Thread arguments for each types of thread */
 
 struct io_thread_context {
@@ -76,6 +75,7 @@ struct io_thread_context {
     uint64_t last_tx_tick;
     uint64_t global_tx_cnt;
     uint64_t tx_pkt_thruput;
+    uint64_t last_tx_pkt_count;
     uint64_t LB_THRUPUT_WINDOW_SIZE;
     int emul_packet_size;
     int emul_ip_version;
@@ -83,6 +83,8 @@ struct io_thread_context {
     struct hwrxq rx_hwrings[NBA_MAX_PORTS * NBA_MAX_QUEUES_PER_PORT];
     struct ev_timer *stat_timer;
     struct io_port_stat *port_stats;
+    struct io_thread_latency_stat *latency_stats;
+    volatile bool stats_ready;  /* set when the stats above are allocated */
     struct io_thread_context *node_master_ctx;
 #ifdef NBA_CPU_MICROBENCH
     int papi_evset_rx;
@@ -98,7 +100,11 @@ struct io_thread_context {
     struct rte_ring *rx_queue;
     struct ev_async *rx_watcher;
     struct port_info tx_ports[NBA_MAX_PORTS];
-    comp_thread_context *comp_ctx;
+    comp_thread_context *comp_ctx;      /* the first one in comp_ctxs */
+    comp_thread_context *comp_ctxs[NBA_MAX_COMPTHREADS_PER_IOTHREAD];
+    unsigned num_comp_ctxs;
+    unsigned next_comp_idx;
+    bool comp_decoupled;    /* hand off batches instead of running comp_ctx inline */
 
     char _reserved2[64]; // to prevent false-sharing
 
@@ -117,6 +123,8 @@ struct io_thread_context {
     CondVar *block;
     bool is_block;
     unsigned int random_seed;
+    IdleBackoff *idle_backoff;
+    UserEvent *idle_event;      /* ends idle sleeps early */
 
     char _reserved4[64]; /* prevent false-sharing */
 
@@ -137,8 +145,24 @@ public:
     void initialize_graph_global();
     void initialize_graph_per_node();
     void initialize_graph_per_thread();
+    /* Also used by graph reloads for the next graph. */
+    void initialize_graph_per_thread(ElementGraph *graph);
     void initialize_offloadables_per_node(ComputeDevice *device);
     void io_tx_new(void* data, size_t len, int out_port);
+
+    /* Builds a graph for a reload without touching the running one.
+     * Returns nullptr if the config file cannot be opened or an element
+     * rejects its configuration. */
+    ElementGraph *build_next_element_graph(const char *config);
+
+    /* Called by the owner thread between batches.  It switches to the
+     * graph published in next_elem_graph and drains the replaced one. */
+    inline void check_graph_reload(uint64_t loop_count)
+    {
+        if (unlikely(next_elem_graph != nullptr || retiring_elem_graph != nullptr))
+            switch_element_graph(loop_count);
+    }
+    void switch_element_graph(uint64_t loop_count);
 public:
     struct ev_async *terminate_watcher;
     CountedBarrier *thread_init_barrier;
@@ -150,6 +174,8 @@ public:
     char _reserved1[64]; /* prevent false-sharing */
 
     struct ev_loop *loop;
+    bool loop_broken;
+    volatile bool loop_ready;   /* set when the pools are ready (decoupled mode) */
     struct core_location loc;
     unsigned num_tx_ports;
     unsigned num_nodes;
@@ -158,21 +184,37 @@ public:
     unsigned num_batchpool_size;
     unsigned num_taskpool_size;
     unsigned task_completion_queue_size;
+    unsigned jumbo_frame_size;
     bool preserve_latency;
+    bool count_elem_cycles;     /* COMP_ELEMENT_CYCLES */
 
     struct rte_mempool *batch_pool;
     struct rte_mempool *dbstate_pool;
     struct rte_mempool *task_pool;
     struct rte_mempool *packet_pool;
+    struct rte_mempool *jumbo_pool;
     ElementGraph *elem_graph;
+    ElementGraph *volatile next_elem_graph;     /* published by GraphReloader */
+    ElementGraph *retiring_elem_graph;          /* replaced and being drained */
+    ElementGraph *volatile retired_elem_graph;  /* drained, freed by GraphReloader */
+    unsigned graph_generation;      /* of the graph being built; 0 at startup */
+    uint64_t num_graph_swaps;
+    uint64_t graph_swap_tsc;        /* when the last switch happened */
+    uint64_t graph_drain_cycles;    /* how long the last replaced graph took to drain */
     SystemInspector *inspector;
-    FixedRing<ComputeContext *> *cctx_list;
+    FixedRing<ComputeContext *> *cctx_lists[NBA_MAX_COPROCESSORS]; /* per-device compute contexts */
     PacketBatch *input_batch;
     DataBlock *datablock_registry[NBA_MAX_DATABLOCKS];
 
     bool stop_task_batching;
-    struct rte_ring *rx_queue;
+    struct rte_ring *rx_queue;          /* batches handed off from io_ctx */
     struct ev_async *rx_watcher;
+    struct rte_ring *tx_return_queue;   /* processed batches back to io_ctx */
+    FlowSequencer *flow_seq;            /* orders the batches of rx_queue per flow group */
+    std::vector<comp_thread_context *> *steal_victims;  /* node-local siblings, if stealing */
+    uint64_t num_stolen_batches;
+    uint64_t num_stolen_pkts;
+    LatencyHistogram offload_rtt;       /* published to the node stats (decoupled mode) */
     struct coproc_thread_context *coproc_ctx;
 
     char _reserved2[64]; /* prevent false-sharing */
@@ -181,6 +223,7 @@ public:
     std::unordered_map<std::string, ComputeDevice *> *named_offload_devices;
     std::vector<ComputeDevice*> *offload_devices;
     struct rte_ring *offload_input_queues[NBA_MAX_COPROCESSORS]; /* ptr to per-device task input queue */
+    struct coproc_thread_context *offload_coproc_ctxs[NBA_MAX_COPROCESSORS]; /* per-device coproc thread */
 
     char _reserved3[64]; /* prevent false-sharing */
 
@@ -204,6 +247,7 @@ struct coproc_thread_context {
     struct ev_loop *loop;
     bool loop_broken;
     unsigned device_id;
+    const char *driver;     /* name registered in ComputeDeviceFactory */
     unsigned num_comp_threads_per_node;
     unsigned task_input_queue_size;
     ComputeDevice *device;
@@ -235,6 +279,8 @@ struct spawned_thread {
 struct thread_collection {
     struct spawned_thread *io_threads;
     unsigned num_io_threads;
+    struct spawned_thread *comp_threads;    /* only in the decoupled mode */
+    unsigned num_comp_threads;
 } __cache_aligned;
 
 }
@@ -0,0 +1,53 @@
+#! /usr/bin/env python3
+'''
+Reads the metrics exported by "main --metrics-socket=PATH".
+
+Example (using a software packet source instead of real NICs):
+  sudo ./bin/main --vdev=eth_null0 --vdev=eth_null1 ... -- \
+       --metrics-socket=/tmp/nba.sock configs/rss-singlecore.py configs/ipv4-router.click
+  ./scripts/nba_metrics.py /tmp/nba.sock --watch 1 --grep nba_port_tx
+'''
+
+import sys, time
+import argparse
+import socket
+
+
+def fetch(path):
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        sock.connect(path)
+        chunks = []
+        while True:
+            data = sock.recv(65536)
+            if not data:
+                break
+            chunks.append(data)
+    finally:
+        sock.close()
+    return b''.join(chunks).decode('utf-8')
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('path', help='The path of the metrics socket.')
+    parser.add_argument('--watch', type=float, default=0,
+                        help='Repeat every given seconds.')
+    parser.add_argument('--grep', default=None,
+                        help='Show only the samples containing the given string.')
+    args = parser.parse_args()
+    while True:
+        text = fetch(args.path)
+        for line in text.splitlines():
+            if args.grep is not None and (line.startswith('#') or args.grep not in line):
+                continue
+            print(line)
+        sys.stdout.flush()
+        if args.watch <= 0:
+            break
+        time.sleep(args.watch)
+        print()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,539 @@
+/**
+ * NBA's pipeline benchmark without NICs.
+ *
+ * It builds the element graph of a pipeline configuration on a single
+ * computation context, feeds it with synthetic packets from an
+ * in-memory mbuf pool, and reports the cycles spent per packet in
+ * total and in each element.  Only the CPU paths are measured, so
+ * pipelines that offload to coprocessors are not supported.
+ *
+ * With --reload, it also replaces the graph in the middle of the run as
+ * the graph reloader does on SIGHUP, and reports how long the switch
+ * took and how many packets were lost with the replaced graph.
+ */
+
+#include <nba/core/intrinsic.hh>
+#include <nba/core/threading.hh>
+#include <nba/core/idlebackoff.hh>
+#include <nba/core/checksum.hh>
+#include <nba/framework/config.hh>
+#include <nba/framework/io.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/computation.hh>
+#include <nba/framework/elementgraph.hh>
+#include <nba/framework/graphreload.hh>
+#include <nba/framework/logging.hh>
+#include <nba/element/element.hh>
+#include <nba/element/packet.hh>
+#include <nba/element/packetbatch.hh>
+#include <nba/element/annotation.hh>
+#include <nba/element/nodelocalstorage.hh>
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <random>
+
+#include <unistd.h>
+#include <limits.h>
+#include <locale.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+#include <rte_errno.h>
+#include <rte_log.h>
+#include <rte_malloc.h>
+#include <rte_memcpy.h>
+#include <rte_mempool.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+
+using namespace std;
+using namespace nba;
+
+struct bench_options {
+    unsigned batch_size = 64;
+    unsigned num_batches = 100000;
+    unsigned num_warmup_batches = 1000;
+    unsigned packet_size = 64;      /* including the 4-byte FCS as pspgen does */
+    unsigned num_flows = 1024;
+    unsigned num_ports = 4;
+    unsigned num_mbufs = 16383;
+    bool ipv6 = false;
+    bool json = false;
+    const char *reload_config = nullptr;
+    unsigned reload_at = 0;         /* 0 for the middle of the measured batches */
+};
+
+/* Fills frame with an Ethernet/IP/UDP packet of a random flow. */
+static void build_template(char *frame, unsigned len, bool ipv6, mt19937 &rng)
+{
+    for (unsigned i = 0; i < len; i++)
+        frame[i] = (char) (rng() & 0xff);
+    struct ether_hdr *ethh = (struct ether_hdr *) frame;
+    ethh->d_addr.addr_bytes[0] &= 0xfe;     /* unicast */
+    ethh->s_addr.addr_bytes[0] &= 0xfe;
+    struct udp_hdr *udph;
+    if (ipv6) {
+        ethh->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv6);
+        struct ipv6_hdr *ip6h = (struct ipv6_hdr *) (ethh + 1);
+        ip6h->vtc_flow = rte_cpu_to_be_32(6u << 28);
+        ip6h->payload_len = rte_cpu_to_be_16(len - sizeof(*ethh) - sizeof(*ip6h));
+        ip6h->proto = IPPROTO_UDP;
+        ip6h->hop_limits = 64;
+        /* Keep the addresses global unicast (2000::/3). */
+        ip6h->src_addr[0] = 0x20 | (ip6h->src_addr[0] & 0x1f);
+        ip6h->dst_addr[0] = 0x20 | (ip6h->dst_addr[0] & 0x1f);
+        udph = (struct udp_hdr *) (ip6h + 1);
+        udph->dgram_len = ip6h->payload_len;
+        udph->dgram_cksum = 0;
+        udph->dgram_cksum = rte_ipv6_udptcp_cksum(ip6h, udph);
+    } else {
+        ethh->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+        struct ipv4_hdr *iph = (struct ipv4_hdr *) (ethh + 1);
+        iph->version_ihl = 0x45;
+        iph->type_of_service = 0;
+        iph->total_length = rte_cpu_to_be_16(len - sizeof(*ethh));
+        iph->fragment_offset = 0;
+        iph->time_to_live = 64;
+        iph->next_proto_id = IPPROTO_UDP;
+        /* Avoid the multicast and reserved ranges. */
+        iph->src_addr = rte_cpu_to_be_32(0x01000000u | (rng() % 0xdf000000u));
+        iph->dst_addr = rte_cpu_to_be_32(0x01000000u | (rng() % 0xdf000000u));
+        iph->hdr_checksum = 0;
+        iph->hdr_checksum = ip_fast_csum(iph, 5);
+        udph = (struct udp_hdr *) (iph + 1);
+        udph->dgram_len = rte_cpu_to_be_16(len - sizeof(*ethh) - sizeof(*iph));
+        udph->dgram_cksum = 0;      /* optional in IPv4 */
+    }
+}
+
+/* Adds the counters of elements since their base snapshots (zero if none). */
+static uint64_t sum_element_cycles(const FixedRing<Element*> &elements,
+                                   const unordered_map<Element *, struct element_stat> &base_stats)
+{
+    uint64_t sum = 0;
+    for (Element *el : elements) {
+        auto it = base_stats.find(el);
+        sum += el->get_stat().num_cycles - ((it != base_stats.end()) ? it->second.num_cycles : 0);
+    }
+    return sum;
+}
+
+/* Returns the freed batches and packets that left the pipeline. */
+static void drain_sinks(comp_thread_context *ctx, uint64_t &num_tx_pkts, uint64_t &num_dropped_pkts,
+                        uint64_t *port_tx_pkts)
+{
+    void *objs[NBA_MAX_COMP_BATCH_SIZE];
+    unsigned cnt;
+    while ((cnt = rte_ring_sc_dequeue_burst(ctx->tx_return_queue, objs, NBA_MAX_COMP_BATCH_SIZE)) > 0) {
+        for (unsigned i = 0; i < cnt; i++) {
+            PacketBatch *batch = (PacketBatch *) objs[i];
+            FOR_EACH_PACKET(batch) {
+                Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+                port_tx_pkts[anno_get(&pkt->anno, NBA_ANNO_IFACE_OUT) % NBA_MAX_PORTS] ++;
+                num_tx_pkts ++;
+                rte_pktmbuf_free(batch->packets[pkt_idx]);
+            } END_FOR;
+        }
+        rte_mempool_put_bulk(ctx->batch_pool, objs, cnt);
+    }
+    while ((cnt = rte_ring_sc_dequeue_burst(ctx->io_ctx->drop_queue, objs, NBA_MAX_COMP_BATCH_SIZE)) > 0) {
+        for (unsigned i = 0; i < cnt; i++)
+            rte_pktmbuf_free((struct rte_mbuf *) objs[i]);
+        num_dropped_pkts += cnt;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+    struct bench_options opts;
+
+    setlocale(LC_NUMERIC, "");
+    rte_set_application_usage_hook([] (const char *prgname) {
+        printf("Usage: %s [EAL options] -- [options] <pipeline-config-path>\n\n", prgname);
+        printf("Benchmark options:\n");
+        printf("  -b, --batch-size=[N]       : The number of packets per batch. (default: 64)\n"
+               "  -n, --num-batches=[N]      : The number of measured batches. (default: 100000)\n"
+               "  -w, --warmup=[N]           : The number of batches fed before measurement. (default: 1000)\n"
+               "  -s, --packet-size=[N]      : The frame size including FCS. (default: 64)\n"
+               "  -f, --flows=[N]            : The number of distinct flows. (default: 1024)\n"
+               "  -p, --ports=[N]            : The number of emulated ports. (default: 4)\n"
+               "  --ipv6                     : Generate IPv6 instead of IPv4 packets.\n"
+               "  --json                     : Print the result as a JSON object.\n"
+               "  --reload=[PATH]            : Replace the graph with the given configuration during the run.\n"
+               "  --reload-at=[N]            : The measured batch index to start the reload at. (default: the middle)\n");
+    });
+    rte_set_log_level(RTE_LOG_WARNING);
+    ret = rte_eal_init(argc, argv);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "Invalid EAL parameters.\n");
+    argc -= ret;
+    argv += ret;
+
+    struct option long_opts[] = {
+        {"batch-size", required_argument, NULL, 'b'},
+        {"num-batches", required_argument, NULL, 'n'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"packet-size", required_argument, NULL, 's'},
+        {"flows", required_argument, NULL, 'f'},
+        {"ports", required_argument, NULL, 'p'},
+        {"ipv6", no_argument, NULL, 0},
+        {"json", no_argument, NULL, 0},
+        {"reload", required_argument, NULL, 0},
+        {"reload-at", required_argument, NULL, 0},
+        {0, 0, 0, 0}
+    };
+    while (true) {
+        int optidx = 0;
+        int c = getopt_long(argc, argv, "b:n:w:s:f:p:", long_opts, &optidx);
+        if (c == -1) break;
+        switch (c) {
+        case 0:
+            if (!strcmp("ipv6", long_opts[optidx].name))
+                opts.ipv6 = true;
+            else if (!strcmp("json", long_opts[optidx].name))
+                opts.json = true;
+            else if (!strcmp("reload", long_opts[optidx].name))
+                opts.reload_config = optarg;
+            else if (!strcmp("reload-at", long_opts[optidx].name))
+                opts.reload_at = atoi(optarg);
+            break;
+        case 'b':
+            opts.batch_size = atoi(optarg);
+            break;
+        case 'n':
+            opts.num_batches = atoi(optarg);
+            break;
+        case 'w':
+            opts.num_warmup_batches = atoi(optarg);
+            break;
+        case 's':
+            opts.packet_size = atoi(optarg);
+            break;
+        case 'f':
+            opts.num_flows = atoi(optarg);
+            break;
+        case 'p':
+            opts.num_ports = atoi(optarg);
+            break;
+        default:
+            rte_exit(EXIT_FAILURE, "Invalid benchmark arguments.\n");
+        }
+    }
+    if (optind != argc - 1)
+        rte_exit(EXIT_FAILURE, "You need one positional argument: <pipeline-config-path>\n");
+    const char *pipeline_config = argv[optind];
+    if (access(pipeline_config, R_OK) != 0)
+        rte_exit(EXIT_FAILURE, "Cannot read the pipeline configuration \"%s\".\n", pipeline_config);
+    if (opts.batch_size == 0 || opts.batch_size > NBA_MAX_COMP_BATCH_SIZE)
+        rte_exit(EXIT_FAILURE, "The batch size must be between 1 and %u.\n", NBA_MAX_COMP_BATCH_SIZE);
+    if (opts.num_batches == 0)
+        rte_exit(EXIT_FAILURE, "The number of batches must be positive.\n");
+    if (opts.num_ports == 0 || opts.num_ports > NBA_MAX_PORTS)
+        rte_exit(EXIT_FAILURE, "The number of ports must be between 1 and %u.\n", NBA_MAX_PORTS);
+    if (opts.num_flows == 0)
+        rte_exit(EXIT_FAILURE, "The number of flows must be positive.\n");
+    if (opts.reload_config != nullptr) {
+        if (access(opts.reload_config, R_OK) != 0)
+            rte_exit(EXIT_FAILURE, "Cannot read the pipeline configuration \"%s\".\n", opts.reload_config);
+        if (opts.reload_at == 0)
+            opts.reload_at = opts.num_batches / 2;
+        if (opts.reload_at >= opts.num_batches)
+            rte_exit(EXIT_FAILURE, "The reload must start before the last measured batch.\n");
+    }
+    const unsigned min_size = (opts.ipv6 ? sizeof(struct ipv6_hdr) : sizeof(struct ipv4_hdr))
+                              + sizeof(struct ether_hdr) + sizeof(struct udp_hdr) + ETHER_CRC_LEN;
+    if (opts.packet_size < RTE_MAX(min_size, (unsigned) ETHER_MIN_LEN)
+        || opts.packet_size - ETHER_CRC_LEN > NBA_MAX_PACKET_SIZE)
+        rte_exit(EXIT_FAILURE, "The packet size must be between %u and %u.\n",
+                 RTE_MAX(min_size, (unsigned) ETHER_MIN_LEN), NBA_MAX_PACKET_SIZE + ETHER_CRC_LEN);
+    const unsigned frame_len = opts.packet_size - ETHER_CRC_LEN;
+
+    /* Set up a computation context on this lcore in the same way as main
+     * does for the decoupled mode, with the default system parameters. */
+    const unsigned core_id = rte_lcore_id();
+    const unsigned node_id = rte_socket_id();
+    threading::bind_cpu(core_id);
+    comp_thread_context *ctx = nullptr;
+    NEW(node_id, ctx, comp_thread_context);
+    ctx->loc.core_id = core_id;
+    ctx->loc.local_thread_idx = 0;
+    ctx->loc.global_thread_idx = 0;
+    ctx->loc.node_id = node_id;
+    ctx->num_combatch_size = opts.batch_size;
+    ctx->num_coproc_ppdepth = 64;
+    ctx->num_batchpool_size = 512;
+    ctx->num_taskpool_size = 256;
+    ctx->task_completion_queue_size = 64;
+    ctx->jumbo_frame_size = 0;
+    ctx->num_tx_ports = opts.num_ports;
+    ctx->num_nodes = node_id + 1;
+    ctx->count_elem_cycles = true;
+    /* Elements size their per-thread partitions by the comp threads. */
+    struct comp_thread_conf conf;
+    conf.core_id = core_id;
+    conf.swrxq_idx = -1;
+    conf.taskinq_idx = -1;
+    conf.taskoutq_idx = -1;
+    conf.priv = nullptr;
+    comp_thread_confs.push_back(conf);
+    NEW(node_id, ctx->elemgraph_lock, Lock);
+    NEW(node_id, ctx->node_local_storage, NodeLocalStorage, node_id);
+    NEW(node_id, ctx->elem_graph, ElementGraph, ctx);
+    NEW(node_id, ctx->named_offload_devices, TARG(unordered_map<string, ComputeDevice*>));
+    NEW(node_id, ctx->offload_devices, vector<ComputeDevice*>);
+    ctx->coproc_ctx = nullptr;
+    ctx->task_completion_queue = nullptr;
+    ctx->task_completion_watcher = nullptr;
+    ctx->tx_return_queue = rte_ring_create("bench.txret", rte_align32pow2(ctx->num_batchpool_size + 1),
+                                           node_id, RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (ctx->tx_return_queue == nullptr)
+        rte_exit(EXIT_FAILURE, "Cannot create the tx return queue: %s\n", rte_strerror(rte_errno));
+
+    /* An IO context without NICs to hold the drop queue and port addresses. */
+    io_thread_context *io_ctx = (io_thread_context *) rte_zmalloc_socket("bench.io_ctx",
+                                                                         sizeof(*io_ctx),
+                                                                         CACHE_LINE_SIZE, node_id);
+    assert(io_ctx != nullptr);
+    io_ctx->loc = ctx->loc;
+    io_ctx->num_io_threads = 1;
+    io_ctx->num_tx_ports = opts.num_ports;
+    io_ctx->comp_ctx = ctx;
+    io_ctx->comp_ctxs[0] = ctx;
+    io_ctx->num_comp_ctxs = 1;
+    io_ctx->comp_decoupled = true;
+    NEW(node_id, io_ctx->idle_backoff, IdleBackoff);
+    NEW(node_id, io_ctx->idle_event, UserEvent);
+    io_ctx->drop_queue = rte_ring_create("bench.dropq", rte_align32pow2(opts.num_mbufs + 1),
+                                         node_id, RING_F_SC_DEQ);
+    if (io_ctx->drop_queue == nullptr)
+        rte_exit(EXIT_FAILURE, "Cannot create the drop queue: %s\n", rte_strerror(rte_errno));
+    mt19937 rng(1);
+    for (unsigned p = 0; p < opts.num_ports; p++) {
+        io_ctx->tx_ports[p].port_idx = p;
+        for (unsigned k = 0; k < ETHER_ADDR_LEN; k++)
+            io_ctx->tx_ports[p].addr.addr_bytes[k] = (uint8_t) rng();
+        io_ctx->tx_ports[p].addr.addr_bytes[0] = 0x02;     /* locally administered */
+    }
+    ctx->io_ctx = io_ctx;
+
+    ctx->loop = ev_loop_new(EVFLAG_AUTO | EVFLAG_NOSIGMASK);
+    ev_set_userdata(ctx->loop, ctx);
+    comp_init_loop(ctx);
+
+    ctx->build_element_graph(pipeline_config);
+    ctx->initialize_graph_global();
+    ctx->initialize_graph_per_node();
+    ctx->initialize_graph_per_thread();
+
+    /* Prepare the packets. */
+    struct rte_mempool *pktpool = rte_pktmbuf_pool_create("bench.pkts", opts.num_mbufs, 256, sizeof(Packet),
+                                                          RTE_PKTMBUF_HEADROOM + NBA_MAX_PACKET_SIZE,
+                                                          node_id);
+    if (pktpool == nullptr)
+        rte_exit(EXIT_FAILURE, "Cannot create the packet pool: %s\n", rte_strerror(rte_errno));
+    vector<string> templates(opts.num_flows, string(frame_len, '\0'));
+    for (auto &t : templates)
+        build_template(&t[0], frame_len, opts.ipv6, rng);
+
+    GraphReloader reloader(pipeline_config);
+    reloader.add_comp_thread(ctx);
+    const unsigned reload_iter = opts.num_warmup_batches + opts.reload_at;
+    uint64_t reload_build_cycles = 0, retired_cycles = 0;
+    unsigned reload_done_iter = 0;
+    bool reloading = false;
+
+    const unsigned num_total = opts.num_warmup_batches + opts.num_batches;
+    unordered_map<Element *, struct element_stat> base_stats;
+    uint64_t measured_cycles = 0, measured_pkts = 0, measured_tx_pkts = 0, measured_dropped_pkts = 0;
+    uint64_t num_tx_pkts = 0, num_dropped_pkts = 0;
+    uint64_t port_tx_pkts[NBA_MAX_PORTS] = {0,};
+    uint64_t base_tx_pkts = 0, base_dropped_pkts = 0;
+    uint64_t loop_count = 0;
+    struct rte_mbuf *pkts[NBA_MAX_COMP_BATCH_SIZE];
+
+    for (unsigned iter = 0; iter < num_total; iter++) {
+        if (iter == opts.num_warmup_batches) {
+            base_stats.clear();
+            for (Element *el : ctx->elem_graph->get_elements())
+                base_stats[el] = el->get_stat();
+            base_tx_pkts = num_tx_pkts;
+            base_dropped_pkts = num_dropped_pkts;
+            memset(port_tx_pkts, 0, sizeof(port_tx_pkts));
+        }
+
+        if (opts.reload_config != nullptr && iter == reload_iter) {
+            /* Building and initializing the next graph is done by the
+             * reloader thread in main, so it is not measured. */
+            uint64_t b0 = rdtscp();
+            if (reloader.begin_reload(opts.reload_config) != 0)
+                rte_exit(EXIT_FAILURE, "Could not reload the pipeline.\n");
+            reload_build_cycles = rdtscp() - b0;
+            reloading = true;
+        }
+
+        /* Prepare a batch outside the measured section. */
+        for (unsigned i = 0; i < opts.batch_size; i++) {
+            pkts[i] = rte_pktmbuf_alloc(pktpool);
+            if (pkts[i] == nullptr)
+                rte_exit(EXIT_FAILURE, "The packet pool is exhausted; "
+                         "elements in the pipeline may be holding too many packets.\n");
+            unsigned flow = rng() % opts.num_flows;
+            rte_memcpy(rte_pktmbuf_append(pkts[i], frame_len), templates[flow].data(), frame_len);
+            pkts[i]->port = flow % opts.num_ports;
+        }
+        PacketBatch *batch = nullptr;
+        if (rte_mempool_get(ctx->batch_pool, (void **) &batch) != 0)
+            rte_exit(EXIT_FAILURE, "The batch pool is exhausted; "
+                     "elements in the pipeline may be holding too many batches.\n");
+
+        uint64_t t0 = rdtscp();
+        new (batch) PacketBatch();
+        memcpy((void **) &batch->packets[0], (void **) pkts, opts.batch_size * sizeof(void*));
+        batch->count = opts.batch_size;
+        batch->recv_timestamp = t0;
+        comp_feed_batch(ctx, batch, loop_count);
+        ctx->elem_graph->flush_tasks();
+        ctx->elem_graph->scan_schedulable_elements(loop_count);
+        ctx->elem_graph->flush_tasks();
+        ctx->check_graph_reload(loop_count);
+        uint64_t t1 = rdtscp();
+
+        if (iter >= opts.num_warmup_batches) {
+            measured_cycles += t1 - t0;
+            measured_pkts += opts.batch_size;
+        }
+        drain_sinks(ctx, num_tx_pkts, num_dropped_pkts, port_tx_pkts);
+        if (reloading && ctx->retired_elem_graph != nullptr) {
+            retired_cycles = sum_element_cycles(ctx->retired_elem_graph->get_elements(), base_stats);
+            for (Element *el : ctx->retired_elem_graph->get_elements())
+                base_stats.erase(el);
+            reloader.poll_reload();
+            reload_done_iter = iter;
+            reloading = false;
+        }
+        loop_count ++;
+    }
+
+    if (reloading)
+        rte_exit(EXIT_FAILURE, "The replaced graph did not drain until the end of the run.\n");
+
+    /* Let the elements holding batches (e.g., queues) release them so
+     * that the remaining mbufs are the ones lost in the pipeline. */
+    for (unsigned i = 0; i < 1000 && rte_mempool_count(pktpool) < opts.num_mbufs; i++) {
+        ctx->elem_graph->flush_tasks();
+        ctx->elem_graph->scan_schedulable_elements(loop_count);
+        ctx->elem_graph->flush_tasks();
+        drain_sinks(ctx, num_tx_pkts, num_dropped_pkts, port_tx_pkts);
+        loop_count ++;
+    }
+    const unsigned num_lost_pkts = opts.num_mbufs - rte_mempool_count(pktpool);
+    measured_tx_pkts = num_tx_pkts - base_tx_pkts;
+    measured_dropped_pkts = num_dropped_pkts - base_dropped_pkts;
+
+    /* Report the results. */
+    const double hz = rte_get_tsc_hz();
+    const double cycles_per_pkt = (double) measured_cycles / measured_pkts;
+    const double mpps = measured_pkts / (measured_cycles / hz) / 1e6;
+    /* Preamble, SFD, and IFG take 20 bytes on the wire. */
+    const double gbps = mpps * (opts.packet_size + 20) * 8 / 1e3;
+    /* Elements of a reloaded graph count from the switch. */
+    const FixedRing<Element*> &elements = ctx->elem_graph->get_elements();
+    uint64_t elem_cycles_sum = retired_cycles;
+    vector<struct element_stat> stats;
+    unsigned idx = 0;
+    for (Element *el : elements) {
+        struct element_stat s = el->get_stat();
+        auto it = base_stats.find(el);
+        if (it != base_stats.end()) {
+            s.num_batches -= it->second.num_batches;
+            s.num_pkts -= it->second.num_pkts;
+            s.num_offloaded_pkts -= it->second.num_offloaded_pkts;
+            s.num_cycles -= it->second.num_cycles;
+        }
+        elem_cycles_sum += s.num_cycles;
+        stats.push_back(s);
+        idx ++;
+    }
+    const double usec_per_cycle = 1e6 / hz;
+    const uint64_t overhead_cycles = (measured_cycles > elem_cycles_sum)
+                                     ? measured_cycles - elem_cycles_sum : 0;
+
+    if (opts.json) {
+        printf("{\"pipeline\": \"%s\", \"packet_size\": %u, \"batch_size\": %u, \"ip_version\": %d,\n",
+               pipeline_config, opts.packet_size, opts.batch_size, opts.ipv6 ? 6 : 4);
+        printf(" \"num_pkts\": %lu, \"num_tx_pkts\": %lu, \"num_dropped_pkts\": %lu,\n",
+               measured_pkts, measured_tx_pkts, measured_dropped_pkts);
+        printf(" \"tsc_hz\": %.0f, \"cycles_per_pkt\": %.2f, \"mpps\": %.3f, \"gbps\": %.3f,\n",
+               hz, cycles_per_pkt, mpps, gbps);
+        printf(" \"framework_cycles_per_pkt\": %.2f, \"num_lost_pkts\": %u,\n",
+               (double) overhead_cycles / measured_pkts, num_lost_pkts);
+        if (opts.reload_config != nullptr)
+            printf(" \"reload\": {\"pipeline\": \"%s\", \"at_batch\": %u, \"build_usec\": %.1f, "
+                   "\"drain_usec\": %.1f, \"drain_batches\": %u, \"replaced_graph_cycles\": %lu},\n",
+                   opts.reload_config, opts.reload_at, reload_build_cycles * usec_per_cycle,
+                   ctx->graph_drain_cycles * usec_per_cycle, reload_done_iter - reload_iter,
+                   retired_cycles);
+        printf(" \"elements\": [");
+        idx = 0;
+        for (Element *el : elements) {
+            const struct element_stat &s = stats[idx];
+            printf("%s\n  {\"index\": %u, \"name\": \"%s\", \"num_batches\": %lu, \"num_pkts\": %lu, "
+                   "\"cycles\": %lu, \"cycles_per_pkt\": %.2f}",
+                   (idx == 0) ? "" : ",", idx, el->class_name(), s.num_batches, s.num_pkts,
+                   s.num_cycles, (double) s.num_cycles / measured_pkts);
+            idx ++;
+        }
+        printf("\n ]}\n");
+    } else {
+        printf("pipeline: %s\n", pipeline_config);
+        printf("%'lu IPv%d packets of %u bytes in batches of %u (%u flows, %u ports)\n",
+               measured_pkts, opts.ipv6 ? 6 : 4, opts.packet_size, opts.batch_size,
+               opts.num_flows, opts.num_ports);
+        printf("%.2f cycles/pkt, %.3f Mpps (%.3f Gbps) at %.3f GHz\n",
+               cycles_per_pkt, mpps, gbps, hz / 1e9);
+        printf("tx %'lu pkts, dropped %'lu pkts, lost %'u pkts\n",
+               measured_tx_pkts, measured_dropped_pkts, num_lost_pkts);
+        if (opts.reload_config != nullptr)
+            printf("reloaded %s at batch %u: built in %.1f usec, "
+                   "the replaced graph drained in %.1f usec (%u batches)\n",
+                   opts.reload_config, opts.reload_at, reload_build_cycles * usec_per_cycle,
+                   ctx->graph_drain_cycles * usec_per_cycle, reload_done_iter - reload_iter);
+        for (unsigned p = 0; p < opts.num_ports; p++)
+            if (port_tx_pkts[p] > 0)
+                printf("  port %u: tx %'lu pkts\n", p, port_tx_pkts[p]);
+        printf("\n%3s %-24s %12s %14s %12s %12s %7s\n", "idx", "element", "batches", "pkts",
+               "cycles/in", "cycles/pkt", "share");
+        idx = 0;
+        for (Element *el : elements) {
+            const struct element_stat &s = stats[idx];
+            printf("%3u %-24s %'12lu %'14lu %12.2f %12.2f %6.1f%%\n",
+                   idx, el->class_name(), s.num_batches, s.num_pkts,
+                   (s.num_pkts > 0) ? (double) s.num_cycles / s.num_pkts : 0.0,
+                   (double) s.num_cycles / measured_pkts,
+                   100.0 * s.num_cycles / measured_cycles);
+            idx ++;
+        }
+        if (retired_cycles > 0)
+            printf("%3s %-24s %12s %14s %12s %12.2f %6.1f%%\n", "", "(replaced graph)", "", "", "",
+                   (double) retired_cycles / measured_pkts, 100.0 * retired_cycles / measured_cycles);
+        printf("%3s %-24s %12s %14s %12s %12.2f %6.1f%%\n", "", "(framework)", "", "", "",
+               (double) overhead_cycles / measured_pkts, 100.0 * overhead_cycles / measured_cycles);
+        printf("\ncycles/in: per packet the element has processed, "
+               "cycles/pkt: per packet fed to the pipeline\n");
+    }
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -1,11 +1,14 @@
 #include <nba/core/intrinsic.hh>
 #include <nba/framework/logging.hh>
+#include <nba/framework/devicefactory.hh>
 #include <nba/engines/cuda/computedevice.hh>
 #include <nba/engines/cuda/computecontext.hh>
 
 using namespace std;
 using namespace nba;
 
+EXPORT_COMPUTEDEVICE("cuda", CUDAComputeDevice);
+
 CUDAComputeDevice::CUDAComputeDevice(
         unsigned node_id, unsigned device_id, size_t num_contexts
 ) : ComputeDevice(node_id, device_id, num_contexts)
@@ -0,0 +1,252 @@
+#include <nba/core/intrinsic.hh>
+#include <nba/engines/dummy/computecontext.hh>
+#include <nba/engines/dummy/mempool.hh>
+#include <unistd.h>
+#include <rte_debug.h>
+#include <cstring>
+
+using namespace std;
+using namespace nba;
+
+#define IO_BASE_SIZE (16 * 1024 * 1024)
+#define IO_MEMPOOL_ALIGN (8lu)
+
+DummyComputeContext::DummyComputeContext(unsigned ctx_id, ComputeDevice *mother)
+ : ComputeContext(ctx_id, mother), num_kernel_args(0)
+{
+    type_name = "dummy";
+    size_t io_base_size = ALIGN_CEIL(IO_BASE_SIZE, getpagesize());
+    /* We use the external storage for the ring and the plain heap for
+     * the pools so that this device works without DPDK's memory. */
+    io_base_ring = new FixedRing<unsigned>(NBA_MAX_IO_BASES, io_base_ring_buf);
+    next_task_id = 0;
+    for (unsigned i = 0; i < NBA_MAX_IO_BASES; i++) {
+        io_base_ring->push_back(i);
+        _mempool_in[i]    = new DummyHostMemoryPool(io_base_size, IO_MEMPOOL_ALIGN);
+        _mempool_inout[i] = new DummyHostMemoryPool(io_base_size, IO_MEMPOOL_ALIGN);
+        _mempool_out[i]   = new DummyHostMemoryPool(io_base_size, IO_MEMPOOL_ALIGN);
+        bool ok = _mempool_in[i]->init()
+                  && _mempool_inout[i]->init_with_base(_mempool_in[i]->get_base_ptr().ptr)
+                  && _mempool_out[i]->init();
+        if (!ok)
+            rte_panic("DummyComputeContext: failed to allocate IO buffers.\n");
+    }
+}
+
+DummyComputeContext::~DummyComputeContext()
+{
+    for (unsigned i = 0; i < NBA_MAX_IO_BASES; i++) {
+        delete _mempool_inout[i];
+        delete _mempool_in[i];
+        delete _mempool_out[i];
+    }
+    delete io_base_ring;
+}
+
+uint32_t DummyComputeContext::alloc_task_id()
+{
+    unsigned t = next_task_id;
+    next_task_id = (next_task_id + 1) % NBA_MAX_IO_BASES;
+    return t;
+}
+
+void DummyComputeContext::release_task_id(uint32_t task_id)
+{
+    // do nothing
+}
+
+io_base_t DummyComputeContext::alloc_io_base()
+{
+    if (io_base_ring->empty()) return INVALID_IO_BASE;
+    unsigned i = io_base_ring->front();
+    io_base_ring->pop_front();
+    return (io_base_t) i;
+}
+
+int DummyComputeContext::alloc_input_buffer(io_base_t io_base, size_t size,
+                                            host_mem_t &host_mem, dev_mem_t &dev_mem)
+{
+    unsigned i = io_base;
+    int ret = _mempool_in[i]->alloc(size, host_mem);
+    assert(ret == 0);
+    /* The host and device sides share the same memory. */
+    dev_mem.ptr = host_mem.ptr;
+    return 0;
+}
+
+int DummyComputeContext::alloc_inout_buffer(io_base_t io_base, size_t size,
+                                            host_mem_t &host_mem, dev_mem_t &dev_mem)
+{
+    unsigned i = io_base;
+    host_mem_t hi, hio;
+    int ret;
+    ret = _mempool_in[i]->alloc(size, hi);
+    assert(ret == 0);
+    ret = _mempool_inout[i]->alloc(size, hio);
+    assert(ret == 0);
+    assert(hi.ptr == hio.ptr);
+    host_mem = hi;
+    dev_mem.ptr = hi.ptr;
+    return 0;
+}
+
+int DummyComputeContext::alloc_output_buffer(io_base_t io_base, size_t size,
+                                             host_mem_t &host_mem, dev_mem_t &dev_mem)
+{
+    unsigned i = io_base;
+    int ret = _mempool_out[i]->alloc(size, host_mem);
+    assert(ret == 0);
+    dev_mem.ptr = host_mem.ptr;
+    return 0;
+}
+
+void DummyComputeContext::get_input_buffer(io_base_t io_base,
+                                           host_mem_t &hbuf, dev_mem_t &dbuf) const
+{
+    unsigned i = io_base;
+    hbuf = _mempool_in[i]->get_base_ptr();
+    dbuf.ptr = hbuf.ptr;
+}
+
+void DummyComputeContext::get_inout_buffer(io_base_t io_base,
+                                           host_mem_t &hbuf, dev_mem_t &dbuf) const
+{
+    unsigned i = io_base;
+    hbuf = _mempool_inout[i]->get_base_ptr();
+    dbuf.ptr = hbuf.ptr;
+}
+
+void DummyComputeContext::get_output_buffer(io_base_t io_base,
+                                            host_mem_t &hbuf, dev_mem_t &dbuf) const
+{
+    unsigned i = io_base;
+    hbuf = _mempool_out[i]->get_base_ptr();
+    dbuf.ptr = hbuf.ptr;
+}
+
+void *DummyComputeContext::unwrap_host_buffer(const host_mem_t hbuf) const
+{
+    return hbuf.ptr;
+}
+
+void *DummyComputeContext::unwrap_device_buffer(const dev_mem_t dbuf) const
+{
+    return dbuf.ptr;
+}
+
+size_t DummyComputeContext::get_input_size(io_base_t io_base) const
+{
+    unsigned i = io_base;
+    return _mempool_in[i]->get_alloc_size();
+}
+
+size_t DummyComputeContext::get_inout_size(io_base_t io_base) const
+{
+    unsigned i = io_base;
+    return _mempool_inout[i]->get_alloc_size();
+}
+
+size_t DummyComputeContext::get_output_size(io_base_t io_base) const
+{
+    unsigned i = io_base;
+    return _mempool_out[i]->get_alloc_size();
+}
+
+void DummyComputeContext::shift_inout_base(io_base_t io_base, size_t len)
+{
+    unsigned i = io_base;
+    _mempool_inout[i]->shift_base(len);
+}
+
+void DummyComputeContext::clear_io_buffers(io_base_t io_base)
+{
+    unsigned i = io_base;
+    _mempool_in[i]->reset();
+    _mempool_out[i]->reset();
+    _mempool_inout[i]->reset();
+    io_base_ring->push_back(i);
+}
+
+int DummyComputeContext::enqueue_memwrite_op(uint32_t task_id,
+                                             const host_mem_t host_buf,
+                                             const dev_mem_t dev_buf,
+                                             size_t offset, size_t size)
+{
+    void *hptr = (void *) ((uintptr_t) host_buf.ptr + offset);
+    void *dptr = (void *) ((uintptr_t) dev_buf.ptr + offset);
+    if (hptr != dptr)
+        memcpy(dptr, hptr, size);
+    return 0;
+}
+
+int DummyComputeContext::enqueue_memread_op(uint32_t task_id,
+                                            const host_mem_t host_buf,
+                                            const dev_mem_t dev_buf,
+                                            size_t offset, size_t size)
+{
+    void *hptr = (void *) ((uintptr_t) host_buf.ptr + offset);
+    void *dptr = (void *) ((uintptr_t) dev_buf.ptr + offset);
+    if (hptr != dptr)
+        memcpy(hptr, dptr, size);
+    return 0;
+}
+
+void DummyComputeContext::h2d_done(uint32_t task_id)
+{
+    return;
+}
+
+void DummyComputeContext::d2h_done(uint32_t task_id)
+{
+    return;
+}
+
+void DummyComputeContext::clear_kernel_args()
+{
+    num_kernel_args = 0;
+}
+
+void DummyComputeContext::push_kernel_arg(struct kernel_arg &arg)
+{
+    assert(num_kernel_args < DUMMY_MAX_KERNEL_ARGS);
+    kernel_args[num_kernel_args ++] = arg;  /* Copied to the array. */
+}
+
+void DummyComputeContext::push_common_kernel_args()
+{
+    return;
+}
+
+int DummyComputeContext::enqueue_kernel_launch(dev_kernel_t kernel, struct resource_param *res)
+{
+    /* The compute handler has already done the job in the caller's thread. */
+    state = ComputeContext::RUNNING;
+    return 0;
+}
+
+bool DummyComputeContext::poll_input_finished(uint32_t task_id)
+{
+    return true;
+}
+
+bool DummyComputeContext::poll_kernel_finished(uint32_t task_id)
+{
+    return true;
+}
+
+bool DummyComputeContext::poll_output_finished(uint32_t task_id)
+{
+    return true;
+}
+
+int DummyComputeContext::enqueue_event_callback(
+        uint32_t task_id,
+        void (*func_ptr)(ComputeContext *ctx, void *user_arg),
+        void *user_arg)
+{
+    /* Everything enqueued before is already finished. */
+    func_ptr(this, user_arg);
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -1224,8 +1224,7 @@ static void nba::knapp::ipsec_hmacsha1(
         const uintptr_t length = (uintptr_t) db_enc_payloads->batches[batch_idx].item_sizes[item_idx];
         if (enc_payload_base != nullptr && length != 0) {
             const uint64_t flow_id = ((uint64_t *) db_flow_ids->batches[batch_idx].buffer_bases)[item_idx];
-            if (flow_id != 65536) {
-                assert(flow_id < 1024);
+            if (flow_id != IPSEC_INVALID_FLOW_ID) {
                 const char *hmac_key = (char *) hmac_key_array[flow_id].hmac_key;
                 HMAC_SHA1((uint32_t *) (enc_payload_base + offset),
                           (uint32_t *) (enc_payload_base + offset + length),
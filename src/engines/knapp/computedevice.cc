@@ -1,5 +1,6 @@
 #include <nba/core/intrinsic.hh>
 #include <nba/framework/logging.hh>
+#include <nba/framework/devicefactory.hh>
 #include <nba/engines/knapp/defs.hh>
 #include <nba/engines/knapp/hosttypes.hh>
 #include <nba/engines/knapp/hostutils.hh>
@@ -14,6 +15,8 @@ using namespace std;
 using namespace nba;
 using namespace nba::knapp;
 
+EXPORT_COMPUTEDEVICE("knapp.phi", KnappComputeDevice);
+
 KnappComputeDevice::KnappComputeDevice(
         unsigned node_id, unsigned device_id, size_t num_contexts
 ) : ComputeDevice(node_id, device_id, num_contexts)
@@ -1,14 +1,17 @@
 #include <nba/framework/logging.hh>
+#include <nba/framework/devicefactory.hh>
 #include <nba/engines/phi/computedevice.hh>
 
 using namespace std;
 using namespace nba;
 
+EXPORT_COMPUTEDEVICE("phi", PhiComputeDevice);
+
 PhiComputeDevice::PhiComputeDevice(
         unsigned node_id, unsigned device_id, size_t num_contexts
 ) : ComputeDevice(node_id, device_id, num_contexts)
 {
-    type_name = "cuda";
+    type_name = "phi";
     assert(num_contexts > 0);
 
     cl_int err_ret;
@@ -14,6 +14,7 @@
 #include <nba/framework/computecontext.hh>
 #include <nba/framework/graphanalysis.hh>
 #include <nba/framework/elementgraph.hh>
+#include <nba/framework/io.hh>
 #include <nba/element/element.hh>
 #include <nba/element/element_map.hh>
 #include <nba/element/annotation.hh>
@@ -36,6 +37,8 @@ extern "C" {
 #include <click_parser.h>
 }
 
+#include <cerrno>
+#include <cstring>
 #include <algorithm>
 #include <exception>
 #include <stdexcept>
@@ -64,17 +67,41 @@ comp_thread_context::comp_thread_context()
     num_batchpool_size = 0;
     num_taskpool_size = 0;
     num_coproc_ppdepth = 0;
+    jumbo_frame_size = 0;
+    count_elem_cycles = false;
+
+    loop = nullptr;
+    loop_broken = false;
+    loop_ready = false;
 
     batch_pool = nullptr;
     task_pool = nullptr;
+    jumbo_pool = nullptr;
     elem_graph = nullptr;
+    next_elem_graph = nullptr;
+    retiring_elem_graph = nullptr;
+    retired_elem_graph = nullptr;
+    graph_generation = 0;
+    num_graph_swaps = 0;
+    graph_swap_tsc = 0;
+    graph_drain_cycles = 0;
     input_batch = nullptr;
 
+    rx_queue = nullptr;
+    rx_watcher = nullptr;
+    tx_return_queue = nullptr;
+    flow_seq = nullptr;
+    steal_victims = nullptr;
+    num_stolen_batches = 0;
+    num_stolen_pkts = 0;
+
     io_ctx = nullptr;
     named_offload_devices = nullptr;
     offload_devices = nullptr;
     for (unsigned i = 0; i < NBA_MAX_COPROCESSORS; i++) {
         offload_input_queues[i] = nullptr;
+        offload_coproc_ctxs[i] = nullptr;
+        cctx_lists[i] = nullptr;
     }
 
     task_completion_queue   = nullptr;
@@ -101,9 +128,37 @@ void comp_thread_context::resume_rx()
     ev_async_start(loop, rx_watcher);
 }
 
+void comp_thread_context::switch_element_graph(uint64_t loop_count)
+{
+    if (next_elem_graph != nullptr && retiring_elem_graph == nullptr) {
+        /* Everything queued so far has been processed by the running
+         * graph, so new batches go to the next one from here. */
+        rte_rmb();
+        retiring_elem_graph = elem_graph;
+        elem_graph = next_elem_graph;
+        next_elem_graph = nullptr;
+        graph_swap_tsc = rte_rdtsc();
+        num_graph_swaps ++;
+    }
+    if (retiring_elem_graph != nullptr && retiring_elem_graph->drain(loop_count)) {
+        graph_drain_cycles = rte_rdtsc() - graph_swap_tsc;
+        ElementGraph *retired = retiring_elem_graph;
+        retiring_elem_graph = nullptr;
+        rte_wmb();
+        retired_elem_graph = retired;
+    }
+}
+
+struct click_build_info {
+    comp_thread_context *ctx;
+    ElementGraph *graph;
+    bool failed;
+};
+
 static void *click_module_handler(int global_idx, const char* name, int argc, char **argv, void *priv)
 {
-    comp_thread_context *ctx = (comp_thread_context *) priv;
+    struct click_build_info *info = (struct click_build_info *) priv;
+    comp_thread_context *ctx = info->ctx;
     string elem_name(name);
     if (element_registry.find(elem_name) == element_registry.end()) {
         rte_panic("click_module_handler(): element with name \"%s\" does not exist.\n", name);
@@ -111,11 +166,18 @@ static void *click_module_handler(int global_idx, const char* name, int argc, ch
     Element *module = element_registry[elem_name].instantiate();
 
     vector<string> args;
-    for (int i = 0; i < argc; i++)
+    module->conf_signature = elem_name + "(";
+    for (int i = 0; i < argc; i++) {
         args.push_back(string(argv[i]));
-    module->configure(ctx, args);
+        module->conf_signature += (i > 0 ? ", " : "") + args.back();
+    }
+    module->conf_signature += ")";
+    if (module->configure(ctx, args) != 0) {
+        RTE_LOG(ERR, COMP, "%s: invalid configuration.\n", module->conf_signature.c_str());
+        info->failed = true;
+    }
 
-    ctx->elem_graph->add_element(module);
+    info->graph->add_element(module);
     #if 0
     std::vector<int> my_datablocks;
     module->get_datablocks(my_datablocks);
@@ -153,21 +215,30 @@ static void *click_module_handler(int global_idx, const char* name, int argc, ch
 
 static void click_module_linker(void *from, int from_output, void *to, int to_input, void *priv)
 {
-    comp_thread_context *ctx = (comp_thread_context *) priv;
+    struct click_build_info *info = (struct click_build_info *) priv;
     Element *from_module = (Element *) from;
     Element *to_module   = (Element *) to;
-    ctx->elem_graph->link_element(to_module, to_input, from_module, from_output);
+    info->graph->link_element(to_module, to_input, from_module, from_output);
     from_module->link(to_module);
 }
 
-void comp_thread_context::build_element_graph(const char* config_file)
+static bool parse_element_graph(comp_thread_context *ctx, ElementGraph *elem_graph, const char *config_file)
 {
-    elemgraph_lock->acquire();
-
     FILE* input = fopen(config_file, "r");
+    if (input == nullptr) {
+        RTE_LOG(ERR, COMP, "Cannot open the pipeline configuration %s: %s\n",
+                config_file, strerror(errno));
+        return false;
+    }
 
     /* Parse the config file and build the element graph object. */
-    ParseInfo *pi = click_parse_configuration(input, click_module_handler, click_module_linker, this);
+    struct click_build_info info = { ctx, elem_graph, false };
+    ParseInfo *pi = click_parse_configuration(input, click_module_handler, click_module_linker, &info);
+    if (info.failed) {
+        click_destroy_configuration(pi);
+        fclose(input);
+        return false;
+    }
     int num_modules = click_num_module(pi);
 
     /* Schedulable elements will be automatically detected during addition.
@@ -258,9 +329,32 @@ void comp_thread_context::build_element_graph(const char* config_file)
     #endif
     click_destroy_configuration(pi);
     fclose(input);
+    return true;
+}
+
+void comp_thread_context::build_element_graph(const char* config_file)
+{
+    elemgraph_lock->acquire();
+    if (!parse_element_graph(this, elem_graph, config_file))
+        rte_panic("Could not build the element graph.\n");
     elemgraph_lock->release();
 }
 
+ElementGraph *comp_thread_context::build_next_element_graph(const char *config_file)
+{
+    ElementGraph *graph = nullptr;
+    NEW(loc.node_id, graph, ElementGraph, this);
+    elemgraph_lock->acquire();
+    bool built = parse_element_graph(this, graph, config_file);
+    elemgraph_lock->release();
+    if (!built) {
+        graph->~ElementGraph();
+        rte_free(graph);
+        return nullptr;
+    }
+    return graph;
+}
+
 void comp_thread_context::initialize_graph_global()
 {
     elemgraph_lock->acquire();
@@ -301,9 +395,14 @@ void comp_thread_context::initialize_offloadables_per_node(ComputeDevice *device
 
 
 void comp_thread_context::initialize_graph_per_thread()
+{
+    initialize_graph_per_thread(elem_graph);
+}
+
+void comp_thread_context::initialize_graph_per_thread(ElementGraph *graph)
 {
     // per-element configuration
-    for (Element *el : elem_graph->get_elements()) {
+    for (Element *el : graph->get_elements()) {
         el->initialize();
     }
 }
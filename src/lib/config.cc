@@ -1,6 +1,7 @@
 #include <nba/core/strutils.hh>
 #include <nba/framework/config.hh>
 #include <nba/framework/logging.hh>
+#include <nba/framework/devicefactory.hh>
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
@@ -382,14 +383,14 @@ nba_get_coprocessors(PyObject *self, PyObject *args)
 
             PyObject *po;
             char buf[16];
-            po = PyUnicode_FromString("dummy");
+            po = PyLong_FromLong(i);
             PyStructSequence_SetItem(pnamedtuple, 0, po);
 
-            sprintf(buf, "xxxx:00:00.%d", i);
-            po = PyUnicode_FromString(buf);
+            po = PyUnicode_FromString("dummy");
             PyStructSequence_SetItem(pnamedtuple, 1, po);
 
-            po = PyLong_FromLong(i);
+            sprintf(buf, "xxxx:00:00.%d", i);
+            po = PyUnicode_FromString(buf);
             PyStructSequence_SetItem(pnamedtuple, 2, po);
 
             po = PyLong_FromLong(i);
@@ -526,7 +527,17 @@ PyInit_nba(void)
     Py_INCREF(ntclass);
     comp_thread_type = ntclass;
 
-    ntclass = nba_create_namedtuple(nt, "CoprocThread", "core_id device_id");
+    ntclass = nba_create_namedtuple(nt, "CoprocThread", "core_id device_id driver");
+    {
+        /* Make "driver" optional for backward compatibility. */
+        PyObject *pnew = PyObject_GetAttrString(ntclass, "__new__");
+        PyObject *pdefaults = PyTuple_New(1);
+        Py_INCREF(Py_None);
+        PyTuple_SetItem(pdefaults, 0, Py_None);
+        PyObject_SetAttrString(pnew, "__defaults__", pdefaults);
+        Py_DECREF(pdefaults);
+        Py_DECREF(pnew);
+    }
     PyModule_AddObject(mod, "CoprocThread", ntclass);
     Py_INCREF(ntclass);
     coproc_thread_type = ntclass;
@@ -617,9 +628,16 @@ bool load_config(const char *pyfilename)
     LOAD_PARAM(IO_BATCH_SIZE,       64);
     LOAD_PARAM(IO_DESC_PER_HWRXQ, 1024);
     LOAD_PARAM(IO_DESC_PER_HWTXQ, 1024);
+    LOAD_PARAM(JUMBO_FRAME_SIZE,     0);    /* 0 disables jumbo frames. */
+    LOAD_PARAM(IO_IDLE_SPIN_POLLS,  64);
+    LOAD_PARAM(IO_IDLE_PAUSE_POLLS, 1024);
+    LOAD_PARAM(IO_IDLE_SLEEP_USEC,   0);    /* 0 keeps busy-polling. */
 
     LOAD_PARAM(COMP_BATCH_SIZE,     64);
     LOAD_PARAM(COMP_PREPKTQ_LENGTH, 32);
+    LOAD_PARAM(COMP_DECOUPLED,       0);    /* 0 runs the element graph inline in IO threads. */
+    LOAD_PARAM(COMP_WORK_STEALING,   0);    /* 0 disables stealing batches between comp threads. */
+    LOAD_PARAM(COMP_ELEMENT_CYCLES,  0);    /* 1 counts the CPU cycles of each element. */
 
     LOAD_PARAM(COPROC_PPDEPTH,              64);
     LOAD_PARAM(COPROC_INPUTQ_LENGTH,        64);
@@ -733,6 +751,19 @@ bool load_config(const char *pyfilename)
         conf.device_id = PyLong_AsLong(p_device_id);
         Py_DECREF(p_device_id);
 
+        PyObject *p_driver = PyObject_GetAttrString(p_item, "driver");
+        if (p_driver == Py_None)
+            conf.driver = ComputeDeviceFactory::get_default_driver();
+        else
+            conf.driver = string(PyUnicode_AsUTF8(p_driver));
+        Py_DECREF(p_driver);
+        if (!ComputeDeviceFactory::exists(conf.driver)) {
+            RTE_LOG(ERR, MAIN, "Coprocessor driver \"%s\" is not available in this build.\n",
+                    conf.driver.c_str());
+            Py_DECREF(p_item);
+            goto exit_load_config;
+        }
+
         conf.taskinq_idx = -1;
         conf.taskoutq_idx = -1;
         conf.priv = NULL;
@@ -820,11 +851,17 @@ bool load_config(const char *pyfilename)
 
         if (PyObject_IsInstance(p_from_thread, io_thread_type)
                 && PyObject_IsInstance(p_to_thread, comp_thread_type)) {
-            io_thread_confs[io_thread_idx_map[p_from_thread]].swrxq_idx = qidx;
+            struct io_thread_conf &io_conf = io_thread_confs[io_thread_idx_map[p_from_thread]];
+            if (io_conf.swrxq_idx == -1)
+                io_conf.swrxq_idx = qidx;
+            io_conf.swrxq_idxs.push_back(qidx);
             comp_thread_confs[comp_thread_idx_map[p_to_thread]].swrxq_idx = qidx;
         } else if (PyObject_IsInstance(p_from_thread, comp_thread_type)
                 && PyObject_IsInstance(p_to_thread, coproc_thread_type)) {
-            comp_thread_confs[comp_thread_idx_map[p_from_thread]].taskinq_idx = qidx;
+            struct comp_thread_conf &comp_conf = comp_thread_confs[comp_thread_idx_map[p_from_thread]];
+            if (comp_conf.taskinq_idx == -1)
+                comp_conf.taskinq_idx = qidx;
+            comp_conf.taskinq_idxs.push_back(qidx);
             coproc_thread_confs[coproc_thread_idx_map[p_to_thread]].taskinq_idx = qidx;
         } else if (PyObject_IsInstance(p_from_thread, coproc_thread_type)
                 && PyObject_IsInstance(p_to_thread, comp_thread_type)) {
@@ -14,15 +14,7 @@
 #include <nba/framework/coprocessor.hh>
 #include <nba/framework/offloadtask.hh>
 #include <nba/framework/computedevice.hh>
-#ifdef USE_CUDA
-#include <nba/engines/cuda/computedevice.hh>
-#endif
-#ifdef USE_KNAPP
-#include <nba/engines/knapp/computedevice.hh>
-#endif
-#ifdef USE_PHI
-#include <nba/engines/phi/computedevice.hh>
-#endif
+#include <nba/framework/devicefactory.hh>
 
 #include <unistd.h>
 #include <numa.h>
@@ -189,16 +181,9 @@ void *coproc_loop(void *arg)
     #if defined(USE_CUDA) && (defined(USE_KNAPP) || defined(USE_PHI))
         #error "Simultaneous running of CUDA and Phi is not supported yet."
     #endif
-    // TODO: replace here with factory pattern
-    #ifdef USE_CUDA
-    new (ctx->device) CUDAComputeDevice(ctx->loc.node_id, ctx->device_id, num_ctx_per_device);
-    #endif
-    #ifdef USE_KNAPP
-    new (ctx->device) KnappComputeDevice(ctx->loc.node_id, ctx->device_id, num_ctx_per_device);
-    #endif
-    #ifdef USE_PHI
-    new (ctx->device) PhiComputeDevice(ctx->loc.node_id, ctx->device_id, num_ctx_per_device);
-    #endif
+    /* The memory is allocated by the main thread using the same factory. */
+    ComputeDeviceFactory::construct(ctx->driver, ctx->device, ctx->loc.node_id,
+                                    ctx->device_id, num_ctx_per_device);
 
     /* Register the task input watcher. */
     ctx->task_done_watcher = new struct ev_async;
@@ -2,6 +2,7 @@
 #include <nba/framework/datablock.hh>
 #include <nba/element/element.hh>
 #include <nba/element/packetbatch.hh>
+#include <nba/core/mbufchain.hh>
 #include <vector>
 #include <string>
 #include <cstring>
@@ -83,7 +84,7 @@ tuple<size_t, size_t> DataBlock::calc_read_buffer_size(PacketBatch *batch)
                 t->aligned_item_sizes->sizes[pkt_idx]   = 0;
             } else {
             #endif
-                unsigned exact_len   = rte_pktmbuf_data_len(batch->packets[pkt_idx]) - read_roi.offset
+                unsigned exact_len   = rte_pktmbuf_pkt_len(batch->packets[pkt_idx]) - read_roi.offset
                                        + read_roi.length + read_roi.size_delta;
                 unsigned aligned_len = RTE_ALIGN_CEIL(exact_len, align);
                 t->aligned_item_sizes->offsets[pkt_idx] = read_buffer_size;
@@ -188,9 +189,8 @@ void DataBlock::preprocess(PacketBatch *batch, void *host_in_buffer) {
                     rte_memcpy((char *) host_in_buffer + offset, invalid_value, aligned_elemsz);
                 }
             } else {
-                rte_memcpy((char*) host_in_buffer + offset,
-                           rte_pktmbuf_mtod(batch->packets[pkt_idx], char*) + read_roi.offset,
-                           aligned_elemsz);
+                mbuf_copy_out(batch->packets[pkt_idx], read_roi.offset, aligned_elemsz,
+                              (char*) host_in_buffer + offset);
             }
         } END_FOR_ALL_PREFETCH;
 
@@ -203,9 +203,8 @@ void DataBlock::preprocess(PacketBatch *batch, void *host_in_buffer) {
                 continue;
             size_t aligned_elemsz = t->aligned_item_sizes->sizes[pkt_idx];
             size_t offset         = t->aligned_item_sizes->offsets[pkt_idx].as_value<size_t>();
-            rte_memcpy((char*) host_in_buffer + offset,
-                       rte_pktmbuf_mtod(batch->packets[pkt_idx], char*) + read_roi.offset,
-                       aligned_elemsz);
+            mbuf_copy_out(batch->packets[pkt_idx], read_roi.offset, aligned_elemsz,
+                          (char*) host_in_buffer + offset);
         } END_FOR_ALL_PREFETCH;
 
         break; }
@@ -251,9 +250,8 @@ void DataBlock::postprocess(OffloadableElement *elem, int input_port, PacketBatc
             size_t offset = bitselect<size_t>(write_roi.type == WRITE_PARTIAL_PACKET,
                                               t->aligned_item_sizes->size * pkt_idx,
                                               t->aligned_item_sizes->offsets[pkt_idx].as_value<size_t>());
-            rte_memcpy(rte_pktmbuf_mtod(batch->packets[pkt_idx], char*) + write_roi.offset,
-                       (char*) host_out_ptr + offset,
-                       elemsz);
+            mbuf_copy_in(batch->packets[pkt_idx], write_roi.offset,
+                         (char*) host_out_ptr + offset, elemsz);
             Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
             pkt->bidx = pkt_idx;
             elem->postproc(input_port, nullptr, pkt);
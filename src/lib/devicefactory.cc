@@ -0,0 +1,82 @@
+#include <nba/core/intrinsic.hh>
+#include <nba/framework/devicefactory.hh>
+#include <nba/framework/config.hh>
+#include <nba/framework/logging.hh>
+#include <cassert>
+#include <rte_config.h>
+#include <rte_malloc.h>
+
+using namespace std;
+using namespace nba;
+
+unordered_map<string, struct ComputeDeviceFactory::device_info> &ComputeDeviceFactory::registry()
+{
+    /* Construct-on-first-use to avoid the static initialization order
+     * problem with EXPORT_COMPUTEDEVICE() in other translation units. */
+    static unordered_map<string, struct device_info> _registry;
+    return _registry;
+}
+
+vector<string> &ComputeDeviceFactory::driver_names()
+{
+    static vector<string> _names;
+    return _names;
+}
+
+bool ComputeDeviceFactory::register_device(const char *driver_name, size_t size, device_ctor_t ctor)
+{
+    string name(driver_name);
+    if (registry().find(name) != registry().end())
+        return false;
+    registry().insert({{name, {size, ctor}}});
+    driver_names().push_back(name);
+    return true;
+}
+
+bool ComputeDeviceFactory::exists(const string &driver_name)
+{
+    return registry().find(driver_name) != registry().end();
+}
+
+const vector<string> &ComputeDeviceFactory::get_driver_names()
+{
+    return driver_names();
+}
+
+string ComputeDeviceFactory::get_default_driver()
+{
+    /* Prefer real hardware over the CPU-backed dummy device. */
+    for (const string &name : driver_names()) {
+        if (name != "dummy")
+            return name;
+    }
+    if (exists("dummy"))
+        return "dummy";
+    return "";
+}
+
+ComputeDevice *ComputeDeviceFactory::alloc(const string &driver_name, unsigned node_id)
+{
+    auto search = registry().find(driver_name);
+    if (search == registry().end()) {
+        RTE_LOG(ERR, COPROC, "ComputeDeviceFactory: unknown device driver \"%s\"\n",
+                driver_name.c_str());
+        return nullptr;
+    }
+    /* WARNING: subclasses are usually LARGER than their base
+     * classes and malloc should use the subclass' size! */
+    return (ComputeDevice *) rte_malloc_socket(nullptr, (*search).second.size,
+                                               CACHE_LINE_SIZE, node_id);
+}
+
+ComputeDevice *ComputeDeviceFactory::construct(const string &driver_name, ComputeDevice *buf,
+                                               unsigned node_id, unsigned device_id,
+                                               size_t num_contexts)
+{
+    auto search = registry().find(driver_name);
+    assert(search != registry().end());
+    assert(buf != nullptr);
+    return (*search).second.ctor((void *) buf, node_id, device_id, num_contexts);
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -31,6 +31,7 @@ Element::Element() : next_elems(), next_connected_inputs()
     num_min_inputs = num_max_inputs = 0;
     num_min_outputs = num_max_outputs = 0;
     memzero(branch_count, ElementGraph::num_max_outputs);
+    memzero(&stat, 1);
     for (int i = 0; i < ElementGraph::num_max_outputs; i++)
         outputs[i] = OutputPort(this, i);
 }
@@ -137,7 +138,7 @@ void Element::update_port_count()
         assert(num_min_inputs >= 0);
     } else {
         string range_left = input_spec.substr(0, range_delim_idx);
-        string range_right = input_spec.substr(range_delim_idx, input_spec.length() - range_delim_idx);
+        string range_right = input_spec.substr(range_delim_idx + 1);
         num_min_inputs = atoi(range_left.c_str());
         num_max_inputs = atoi(range_right.c_str());
     }
@@ -152,7 +153,7 @@ void Element::update_port_count()
         }
     } else {
         string range_left = output_spec.substr(0, range_delim_idx);
-        string range_right = output_spec.substr(range_delim_idx, output_spec.length() - range_delim_idx);
+        string range_right = output_spec.substr(range_delim_idx + 1);
         num_min_outputs = atoi(range_left.c_str());
         num_max_outputs = atoi(range_right.c_str());
     }
@@ -182,6 +183,8 @@ int Element::configure(comp_thread_context *ctx, vector<string> &args) {
 
 int OffloadableElement::offload(ElementGraph *mother, PacketBatch *batch, int input_port)
 {
+    /* Batches are accumulated in a single slot and the actual device is
+     * chosen by the element graph when the task is sent. */
     int dev_idx = 0;
     OffloadTask *otask = nullptr;
     /* Create a new OffloadTask or accumulate to pending OffloadTask. */
@@ -11,6 +11,8 @@
 #include <nba/element/packetbatch.hh>
 #include <nba/core/logging.hh>
 #include <nba/core/enumerate.hh>
+#include <nba/core/idlebackoff.hh>
+#include <nba/core/threading.hh>
 #include <nba/core/timing.hh>
 #include <cassert>
 #include <rte_cycles.h>
@@ -34,18 +36,26 @@ ElementGraph::ElementGraph(comp_thread_context *ctx)
     : elements(128, ctx->loc.node_id),
       sched_elements(16, ctx->loc.node_id),
       offl_elements(16, ctx->loc.node_id),
+      busy_sched_elements(16, ctx->loc.node_id),
       queue(2048, ctx->loc.node_id)
 {
     const size_t ready_task_qlen = 256;
     this->ctx = ctx;
     input_elem = nullptr;
+    num_inflight_tasks = 0;
+    num_dispatched_batches = 0;
     assert(0 == rte_malloc_validate(ctx, NULL));
+    sched_ticker.init(rte_get_tsc_hz());
+    sched_timers.init(sched_ticker.ticks(rte_rdtsc()));
 
 #if NBA_REUSE_DATABLOCKS == 1
+    /* Graph reloads create more graphs per thread, so the names are
+     * numbered to be unique. */
+    static unsigned num_graphs = 0;
     struct rte_hash_parameters hparams;
     char namebuf[RTE_HASH_NAMESIZE];
-    snprintf(namebuf, RTE_HASH_NAMESIZE, "elemgraph@%u.%u:offl_actions",
-             ctx->loc.node_id, ctx->loc.local_thread_idx);
+    snprintf(namebuf, RTE_HASH_NAMESIZE, "eg%u@%u.%u:offl_actions",
+             __sync_fetch_and_add(&num_graphs, 1), ctx->loc.node_id, ctx->loc.local_thread_idx);
     hparams.name = namebuf;
     hparams.entries = 64;
     hparams.key_len = sizeof(struct offload_action_key);
@@ -59,15 +69,52 @@ ElementGraph::ElementGraph(comp_thread_context *ctx)
 #endif
 }
 
+ElementGraph::~ElementGraph()
+{
+    for (Element *el : elements)
+        delete el;
+    if (offl_actions != nullptr)
+        rte_hash_free(offl_actions);
+}
+
 void ElementGraph::send_offload_task_to_device(OffloadTask *task)
 {
-    if (unlikely(ctx->io_ctx->loop_broken))
+    if (unlikely(ctx->loop_broken))
         return;
 
     /* Start offloading! */
-    // TODO: create multiple cctx_list and access them via dev_idx for hetero-device systems.
-    const int dev_idx = 0;
-    ComputeContext *cctx = ctx->cctx_list->front();
+    ComputeContext *cctx = task->cctx;
+    if (cctx == nullptr) {
+        /* Choose the device for a fresh task.  Reused tasks stay in
+         * the device where their datablocks reside. */
+        unsigned num_devices = ctx->offload_devices->size();
+        if (unlikely(num_devices == 0))
+            rte_panic("%s chose to offload, but there are no offload devices.\n",
+                      task->elem->class_name());
+        if (offl_dispatcher.get_num_devices() != num_devices)
+            offl_dispatcher.set_num_devices(num_devices);
+        uint64_t candidate_mask = 0;
+        unsigned queue_lens[NBA_MAX_COPROCESSORS];
+        for (unsigned i = 0; i < num_devices; i++) {
+            ComputeDevice *device = ctx->offload_devices->at(i);
+            queue_lens[i] = rte_ring_count(ctx->offload_input_queues[i]);
+            if (task->elem->offload_compute_handlers.find(device->type_name)
+                    != task->elem->offload_compute_handlers.end())
+                candidate_mask |= (1lu << i);
+        }
+        int dev_idx = offl_dispatcher.select(candidate_mask, queue_lens);
+        if (unlikely(dev_idx == -1)) {
+            if (!task->elem->no_device_warned) {
+                RTE_LOG(WARNING, COMP, "No offload device supports %s; using device 0.\n",
+                        task->elem->class_name());
+                task->elem->no_device_warned = true;
+            }
+            dev_idx = 0;
+        }
+        task->local_dev_idx = dev_idx;
+        cctx = ctx->cctx_lists[dev_idx]->front();
+    }
+    const int dev_idx = task->local_dev_idx;
     assert(cctx != nullptr);
     #ifdef USE_NVPROF
     nvtxRangePush("offl_prepare");
@@ -101,21 +148,21 @@ void ElementGraph::send_offload_task_to_device(OffloadTask *task)
 
         task->task_id = INVALID_TASK_ID;
         do {
-            if (unlikely(ctx->io_ctx->loop_broken)) return;
+            if (unlikely(ctx->loop_broken)) return;
             task->task_id = cctx->alloc_task_id();
             if (task->task_id == INVALID_TASK_ID) {
                 /* If not available now, wait. */
-                ev_run(ctx->io_ctx->loop, 0);
+                ev_run(ctx->loop, 0);
             }
         } while (task->task_id == INVALID_TASK_ID);
 
         /* Allocate the host-device IO buffer pool. */
         while (task->io_base == INVALID_IO_BASE) {
-            if (unlikely(ctx->io_ctx->loop_broken)) return;
+            if (unlikely(ctx->loop_broken)) return;
             task->io_base = cctx->alloc_io_base();
             if (task->io_base == INVALID_IO_BASE) {
                 /* If not available now, wait. */
-                ev_run(ctx->io_ctx->loop, 0);
+                ev_run(ctx->loop, 0);
             }
         }
 
@@ -136,8 +183,11 @@ void ElementGraph::send_offload_task_to_device(OffloadTask *task)
     } else {
         /* It may return -EDQUOT, but here we ignore this HWM signal.
          * Even for that case, the task is enqueued successfully. */
-        ev_async_send(ctx->coproc_ctx->loop, ctx->offload_devices->at(dev_idx)->input_watcher);
-        if (ctx->inspector) ctx->inspector->dev_sent_batch_count[0] += task->batches.size();
+        ev_async_send(ctx->offload_coproc_ctxs[dev_idx]->loop,
+                      ctx->offload_devices->at(dev_idx)->input_watcher);
+        offl_dispatcher.task_sent(dev_idx);
+        num_inflight_tasks ++;
+        if (ctx->inspector) ctx->inspector->dev_sent_batch_count[dev_idx] += task->batches.size();
     }
     #ifdef USE_NVPROF
     nvtxRangePop();
@@ -145,6 +195,13 @@ void ElementGraph::send_offload_task_to_device(OffloadTask *task)
     return;
 }
 
+void ElementGraph::notify_offload_completion(int dev_idx, float elapsed_sec)
+{
+    offl_dispatcher.task_completed(dev_idx, elapsed_sec);
+    assert(num_inflight_tasks > 0);
+    num_inflight_tasks --;
+}
+
 void ElementGraph::free_batch(PacketBatch *batch, bool free_pkts)
 {
     if (free_pkts) {
@@ -159,33 +216,64 @@ void ElementGraph::free_batch(PacketBatch *batch, bool free_pkts)
     }
     rte_mempool_put(ctx->batch_pool, (void *) batch);
     /* Make any blocking call to ev_run() to break. */
-    ev_break(ctx->io_ctx->loop, EVBREAK_ALL);
+    ev_break(ctx->loop, EVBREAK_ALL);
+}
+
+void ElementGraph::transmit_batch(PacketBatch *batch)
+{
+    uint64_t t = rdtscp();
+    int64_t proc_id = anno_get(&batch->banno, NBA_BANNO_LB_DECISION) + 1; // adjust range to be positive
+    if (ctx->inspector) {
+        ctx->inspector->update_batch_proc_time(t - batch->recv_timestamp);
+        ctx->inspector->update_pkt_proc_cycles(batch->compute_time, proc_id);
+    }
+    if (ctx->tx_return_queue != nullptr) {
+        /* The IO thread transmits it and puts it back to batch_pool.
+         * The queue is longer than batch_pool so it never overflows. */
+        if (unlikely(rte_ring_sp_enqueue(ctx->tx_return_queue, (void *) batch) == -ENOBUFS)) {
+            free_batch(batch);
+            return;
+        }
+        /* Order the enqueue before reading the flag (see IdleBackoff). */
+        rte_mb();
+        if (ctx->io_ctx->idle_backoff->is_sleeping())
+            ctx->io_ctx->idle_event->trigger();
+        return;
+    }
+    io_tx_batch(ctx->io_ctx, batch);
+    free_batch(batch, false);
 }
 
 void ElementGraph::scan_schedulable_elements(uint64_t loop_count)
 {
-    uint64_t now = 0;
-    if ((loop_count & 0x3ff) == 0)
-        now = get_usec();
-    for (SchedulableElement *selem : sched_elements) {
-        /* FromInput is handled by feed_input() invoked by comp_process_batch(). */
-        if (0 == (selem->get_type() & ELEMTYPE_INPUT)) {
-            PacketBatch *next_batch = nullptr;
-            if (now > 0 && selem->_last_delay != 0 && now >= selem->_last_call_ts + selem->_last_delay) {
-                selem->dispatch(loop_count, next_batch, selem->_last_delay);
-                selem->_last_call_ts = now;
-            }
-            if (selem->_last_delay == 0) {
-                selem->dispatch(loop_count, next_batch, selem->_last_delay);
-            }
-            /* Try to "drain" internally stored batches. */
-            while (next_batch != nullptr) {
-                next_batch->tracker.has_results = true; // skip processing
-                enqueue_batch(next_batch, selem, 0);
-                selem->dispatch(loop_count, next_batch, selem->_last_delay);
-            };
-        } /* endif(!ELEMTYPE_INPUT) */
-    } /* endfor(selems) */
+    uint64_t now = sched_ticker.ticks(rte_rdtsc());
+    /* Elements with zero next_delay are re-queued by dispatch_schedulable(). */
+    for (size_t n = busy_sched_elements.size(); n > 0; n--) {
+        SchedulableElement *selem = busy_sched_elements.front();
+        busy_sched_elements.pop_front();
+        dispatch_schedulable(selem, loop_count, now);
+    }
+    sched_timers.advance(now, [&](struct timer_entry *t) {
+        dispatch_schedulable((SchedulableElement *) t->arg, loop_count, now);
+    });
+}
+
+void ElementGraph::dispatch_schedulable(SchedulableElement *selem, uint64_t loop_count, uint64_t now)
+{
+    PacketBatch *next_batch = nullptr;
+    selem->dispatch(loop_count, next_batch, selem->_last_delay);
+    selem->_last_call_ts = now;
+    /* Try to "drain" internally stored batches. */
+    while (next_batch != nullptr) {
+        next_batch->tracker.has_results = true; // skip processing
+        enqueue_batch(next_batch, selem, 0);
+        num_dispatched_batches ++;
+        selem->dispatch(loop_count, next_batch, selem->_last_delay);
+    };
+    if (selem->_last_delay == 0)
+        busy_sched_elements.push_back(selem);
+    else
+        sched_timers.schedule(&selem->_timer, now + sched_ticker.usec_to_ticks(selem->_last_delay));
 }
 
 void ElementGraph::scan_offloadable_elements(uint64_t loop_count)
@@ -198,6 +286,7 @@ void ElementGraph::scan_offloadable_elements(uint64_t loop_count)
             if (next_batch != nullptr) {
                 next_batch->tracker.has_results = true;
                 enqueue_batch(next_batch, oelem, 0);
+                num_dispatched_batches ++;
             }
         } while (next_batch != nullptr);
     } /* endfor(oelems) */
@@ -221,6 +310,29 @@ void ElementGraph::feed_input(int entry_point_idx, PacketBatch *batch, uint64_t
     }
 }
 
+bool ElementGraph::drain(uint64_t loop_count)
+{
+    for (OffloadableElement *oelem : offl_elements) {
+        for (unsigned i = 0; i < NBA_MAX_COPROCESSOR_TYPES; i++) {
+            OffloadTask *otask = oelem->tasks[i];
+            if (otask == nullptr)
+                continue;
+            /* Send it without waiting for more batches, as offload()
+             * does when the task is full. */
+            oelem->tasks[i] = nullptr;
+            otask->offload_start = rte_rdtsc();
+            otask->state = TASK_INITIALIZED;
+            enqueue_offload_task(otask, oelem, otask->tracker.input_port);
+        }
+    }
+    uint64_t last_dispatched = num_dispatched_batches;
+    flush_tasks();
+    scan_schedulable_elements(loop_count);
+    flush_tasks();
+    return queue.empty() && num_inflight_tasks == 0
+           && num_dispatched_batches == last_dispatched;
+}
+
 void ElementGraph::enqueue_batch(PacketBatch *batch, Element *start_elem, int input_port)
 {
     assert(start_elem != nullptr);
@@ -266,23 +378,37 @@ void ElementGraph::process_batch(PacketBatch *batch)
                 /* Get or initialize the task object.
                  * This step is always executed for every input batch
                  * passing every offloadable element. */
+                unsigned count = batch->count;
                 if (offloadable->offload(this, batch, input_port) != 0) {
                     /* We have no room for batch in the preparing task.
                      * Keep the current batch for later processing. */
                     batch->delay_start = rte_rdtsc();
                     queue.push_back(Task::to_task(batch));
+                } else {
+                    current_elem->stat.num_batches ++;
+                    current_elem->stat.num_pkts += count;
+                    current_elem->stat.num_offloaded_pkts += count;
                 }
                 /* At this point, the batch is already consumed to the task
                  * or delayed. */
                 return;
             } else {
                 /* If not offloaded, run the element's CPU-version handler. */
+                current_elem->stat.num_batches ++;
+                current_elem->stat.num_pkts += batch->count;
                 batch_disposition = current_elem->_process_batch(input_port, batch);
-                batch->compute_time += (rdtscp() - now) / batch->count;
+                uint64_t cycles = rdtscp() - now;
+                if (unlikely(ctx->count_elem_cycles))
+                    current_elem->stat.num_cycles += cycles;
+                batch->compute_time += cycles / batch->count;
             }
         } else {
             /* If not offloadable, run the element's CPU-version handler. */
+            current_elem->stat.num_batches ++;
+            current_elem->stat.num_pkts += batch->count;
             batch_disposition = current_elem->_process_batch(input_port, batch);
+            if (unlikely(ctx->count_elem_cycles))
+                current_elem->stat.num_cycles += rdtscp() - now;
         }
     }
 
@@ -329,7 +455,7 @@ void ElementGraph::process_batch(PacketBatch *batch)
                     break;
                 case DROP:
                     #if NBA_BATCHING_SCHEME != NBA_BATCHING_CONTINUOUS
-                    rte_ring_enqueue(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
+                    PacketBatch::drop_packet(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
                     #endif
                     EXCLUDE_PACKET(batch, pkt_idx);
                     break;
@@ -357,8 +483,7 @@ void ElementGraph::process_batch(PacketBatch *batch)
                 ctx->inspector->tx_batch_count ++;;
                 ctx->inspector->tx_pkt_count += batch->count;
             }
-            io_tx_batch(ctx->io_ctx, batch);
-            free_batch(batch, false);
+            transmit_batch(batch);
         } else {
             /* Recurse into the next element, reusing the batch. */
             Element *next_el = current_elem->next_elems[0];
@@ -401,9 +526,9 @@ void ElementGraph::process_batch(PacketBatch *batch)
             while (rte_mempool_get_bulk(ctx->batch_pool,
                                         (void **) &out_batches,
                                         num_outputs) == -ENOENT
-                   && !ctx->io_ctx->loop_broken)
+                   && !ctx->loop_broken)
             {
-                ev_run(ctx->io_ctx->loop, 0);
+                ev_run(ctx->loop, 0);
             }
             bool out_batches_used[num_outputs];
             memzero(out_batches_used, num_outputs);
@@ -454,7 +579,7 @@ void ElementGraph::process_batch(PacketBatch *batch)
                         break; }
                     case DROP: {
                         #if NBA_BATCHING_SCHEME != NBA_BATCHING_CONTINUOUS
-                        rte_ring_enqueue(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
+                        PacketBatch::drop_packet(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
                         #endif
                         break; }
                     case PENDING: {
@@ -500,8 +625,7 @@ void ElementGraph::process_batch(PacketBatch *batch)
                         }
 
                         /* We are at the end leaf of the pipeline. */
-                        io_tx_batch(ctx->io_ctx, out_batches[o]);
-                        free_batch(out_batches[o], false);
+                        transmit_batch(out_batches[o]);
 
                     } else {
 
@@ -535,9 +659,9 @@ void ElementGraph::process_batch(PacketBatch *batch)
             while (rte_mempool_get_bulk(ctx->batch_pool,
                                         (void **) out_batches,
                                         num_outputs) == -ENOENT
-                   && !ctx->io_ctx->loop_broken)
+                   && !ctx->loop_broken)
             {
-                ev_run(ctx->io_ctx->loop, 0);
+                ev_run(ctx->loop, 0);
             }
             for (unsigned o = 0; o < num_outputs; o++) {
                 new (out_batches[o]) PacketBatch();
@@ -568,7 +692,7 @@ void ElementGraph::process_batch(PacketBatch *batch)
                     break; }
                 case DROP: {
                     #if NBA_BATCHING_SCHEME != NBA_BATCHING_CONTINUOUS
-                    rte_ring_enqueue(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
+                    PacketBatch::drop_packet(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
                     #endif
                     break; }
                 case PENDING: {
@@ -602,8 +726,7 @@ void ElementGraph::process_batch(PacketBatch *batch)
                         }
 
                         /* We are at the end leaf of the pipeline. */
-                        io_tx_batch(ctx->io_ctx, out_batches[o]);
-                        free_batch(out_batches[o], false);
+                        transmit_batch(out_batches[o]);
 
                     } else {
 
@@ -647,7 +770,7 @@ void ElementGraph::flush_tasks()
 
     /* When the queue becomes empty, the processing path started from
      * the start_elem is finished.  The unit of a job is an element. */
-    while (!queue.empty() && !ctx->io_ctx->loop_broken) {
+    while (!queue.empty() && !ctx->loop_broken) {
         void *raw_task = queue.front();
         queue.pop_front();
         switch (Task::get_task_type(raw_task)) {
@@ -724,6 +847,11 @@ int ElementGraph::add_element(Element *new_elem)
         auto selem = dynamic_cast<SchedulableElement*> (new_elem);
         assert(selem != nullptr);
         sched_elements.push_back(selem);
+        /* FromInput is handled by feed_input() invoked by comp_process_batch(). */
+        if (0 == (new_elem->get_type() & ELEMTYPE_INPUT)) {
+            selem->_timer.arg = selem;
+            busy_sched_elements.push_back(selem);
+        }
     }
     if (new_elem->get_type() & ELEMTYPE_OFFLOADABLE) {
         auto oelem = dynamic_cast<OffloadableElement*> (new_elem);
@@ -0,0 +1,265 @@
+#include <nba/core/intrinsic.hh>
+#include <nba/core/threading.hh>
+#include <nba/framework/graphreload.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/elementgraph.hh>
+#include <nba/framework/io.hh>
+#include <nba/framework/logging.hh>
+#include <nba/element/element.hh>
+#include <nba/element/nodelocalstorage.hh>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <deque>
+#include <algorithm>
+#include <cstring>
+#include <poll.h>
+#include <rte_config.h>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+
+using namespace std;
+using namespace nba;
+
+/* How often the reloader thread checks for termination and drained graphs. */
+#define GRAPHRELOAD_POLL_TIMEOUT_MS (200)
+#define GRAPHRELOAD_DRAIN_POLL_TIMEOUT_MS (1)
+
+static void destroy_graph(ElementGraph *graph)
+{
+    graph->~ElementGraph();
+    rte_free(graph);
+}
+
+GraphReloader::GraphReloader(const string &config_path)
+    : config_path(config_path), running(false),
+      reloading(false), generation(0), num_retired(0), reload_begin_tsc(0)
+{
+    memzero(&stats_before, 1);
+}
+
+GraphReloader::~GraphReloader()
+{
+    stop();
+}
+
+void GraphReloader::add_comp_thread(comp_thread_context *ctx)
+{
+    comp_ctxs.push_back(ctx);
+}
+
+void GraphReloader::add_io_thread(struct io_thread_context *ctx)
+{
+    io_ctxs.push_back(ctx);
+}
+
+int GraphReloader::start()
+{
+    running = true;
+    if (pthread_create(&tid, nullptr, GraphReloader::thread_main, this) != 0) {
+        RTE_LOG(ERR, MAIN, "reload: cannot spawn the reloader thread.\n");
+        running = false;
+        return -1;
+    }
+    RTE_LOG(INFO, MAIN, "reload: send SIGHUP to reload %s\n", config_path.c_str());
+    return 0;
+}
+
+void GraphReloader::stop()
+{
+    if (!running)
+        return;
+    running = false;
+    pthread_join(tid, nullptr);
+}
+
+void *GraphReloader::thread_main(void *arg)
+{
+    GraphReloader *self = (GraphReloader *) arg;
+    self->serve();
+    return nullptr;
+}
+
+void GraphReloader::serve()
+{
+    while (running) {
+        struct pollfd pfd;
+        pfd.fd = event.getfd();
+        pfd.events = POLLIN;
+        int ret = poll(&pfd, 1, reloading ? GRAPHRELOAD_DRAIN_POLL_TIMEOUT_MS
+                                          : GRAPHRELOAD_POLL_TIMEOUT_MS);
+        if (ret > 0 && event.is_triggered())
+            begin_reload(config_path.c_str());
+        poll_reload();
+    }
+}
+
+void GraphReloader::collect_port_stats(struct io_port_stat &total) const
+{
+    memzero(&total, 1);
+    for (struct io_thread_context *ctx : io_ctxs) {
+        if (!ctx->stats_ready)
+            continue;
+        rte_rmb();
+        for (unsigned j = 0; j < ctx->node_stat->num_ports; j++)
+            io_port_stat_accumulate(&total, &ctx->port_stats[j]);
+    }
+}
+
+int GraphReloader::begin_reload(const char *path)
+{
+    if (comp_ctxs.empty())
+        return -1;
+    if (reloading) {
+        RTE_LOG(WARNING, MAIN, "reload: the previous reload is still in progress.\n");
+        return -1;
+    }
+    RTE_LOG(NOTICE, MAIN, "reload: building the element graphs from %s\n", path);
+
+    vector<ElementGraph *> next_graphs;
+    generation ++;
+    for (comp_thread_context *ctx : comp_ctxs) {
+        ctx->graph_generation = generation;
+        ElementGraph *graph = ctx->build_next_element_graph(path);
+        if (graph == nullptr) {
+            for (ElementGraph *g : next_graphs)
+                destroy_graph(g);
+            RTE_LOG(ERR, MAIN, "reload: refused; keeping the running graphs.\n");
+            return -1;
+        }
+        next_graphs.push_back(graph);
+    }
+
+    /* Find the elements that need their global and per-node states,
+     * which are all the same across threads. */
+    Lock *elemgraph_lock = comp_ctxs[0]->elemgraph_lock;
+    unordered_set<string> running_sigs, running_classes;
+    elemgraph_lock->acquire();
+    for (comp_thread_context *ctx : comp_ctxs) {
+        for (Element *el : ctx->elem_graph->get_elements()) {
+            running_sigs.insert(el->conf_signature);
+            running_classes.insert(el->class_name());
+        }
+    }
+    elemgraph_lock->release();
+    auto is_new = [&](Element *el) {
+        return running_sigs.find(el->conf_signature) == running_sigs.end();
+    };
+
+    unsigned num_new = 0;
+    for (Element *el : next_graphs[0]->get_elements()) {
+        if (!is_new(el))
+            continue;
+        num_new ++;
+        const char *refusal = nullptr;
+        if (el->has_global_state()
+            && running_classes.find(el->class_name()) != running_classes.end())
+            refusal = "would overwrite the global state of the running ones";
+        else if (dynamic_cast<OffloadableElement *>(el) != nullptr
+            && comp_ctxs[0]->offload_devices != nullptr
+            && !comp_ctxs[0]->offload_devices->empty())
+            refusal = "needs device initialization";
+        if (refusal != nullptr) {
+            RTE_LOG(ERR, MAIN, "reload: refused; the new element %s %s.\n",
+                    el->conf_signature.c_str(), refusal);
+            for (ElementGraph *g : next_graphs)
+                destroy_graph(g);
+            return -1;
+        }
+    }
+    RTE_LOG(INFO, MAIN, "reload: %u new elements, %u reused ones.\n",
+            num_new, next_graphs[0]->count() - num_new);
+
+    /* Follow the initialization order of main.cc. */
+    for (Element *el : next_graphs[0]->get_elements())
+        if (is_new(el))
+            el->initialize_global();
+    bool node_done[NBA_MAX_NODES] = {false,};
+    for (unsigned i = 0; i < comp_ctxs.size(); i++) {
+        unsigned node_id = comp_ctxs[i]->loc.node_id;
+        if (node_done[node_id])
+            continue;
+        node_done[node_id] = true;
+        for (Element *el : next_graphs[i]->get_elements())
+            if (is_new(el))
+                el->initialize_per_node();
+    }
+
+    /* Reused elements take over the per-thread states of the running
+     * ones with the same signature, matched in the graph order. */
+    elemgraph_lock->acquire();
+    for (unsigned i = 0; i < comp_ctxs.size(); i++) {
+        unordered_map<string, deque<Element *>> prevs;
+        for (Element *el : comp_ctxs[i]->elem_graph->get_elements())
+            prevs[el->conf_signature].push_back(el);
+        for (Element *el : next_graphs[i]->get_elements()) {
+            auto it = prevs.find(el->conf_signature);
+            if (it == prevs.end() || it->second.empty())
+                continue;
+            el->adopt_state(it->second.front());
+            it->second.pop_front();
+        }
+    }
+    elemgraph_lock->release();
+    for (unsigned i = 0; i < comp_ctxs.size(); i++)
+        comp_ctxs[i]->initialize_graph_per_thread(next_graphs[i]);
+
+    collect_port_stats(stats_before);
+    num_retired = 0;
+    reloading = true;
+    reload_begin_tsc = rte_rdtsc();
+    rte_wmb();
+    for (unsigned i = 0; i < comp_ctxs.size(); i++)
+        comp_ctxs[i]->next_elem_graph = next_graphs[i];
+    return 0;
+}
+
+bool GraphReloader::poll_reload()
+{
+    if (!reloading)
+        return true;
+
+    Lock *elemgraph_lock = comp_ctxs[0]->elemgraph_lock;
+    elemgraph_lock->acquire();
+    for (comp_thread_context *ctx : comp_ctxs) {
+        ElementGraph *graph = ctx->retired_elem_graph;
+        if (graph == nullptr)
+            continue;
+        rte_rmb();
+        ctx->retired_elem_graph = nullptr;
+        destroy_graph(graph);
+        num_retired ++;
+    }
+    elemgraph_lock->release();
+    if (num_retired < comp_ctxs.size())
+        return false;
+
+    /* No graph uses the node-local entries replaced by the reload now. */
+    unordered_set<NodeLocalStorage *> nls_done;
+    for (comp_thread_context *ctx : comp_ctxs)
+        if (nls_done.insert(ctx->node_local_storage).second)
+            ctx->node_local_storage->free_retired();
+
+    uint64_t max_swap_cycles = 0, max_drain_cycles = 0;
+    for (comp_thread_context *ctx : comp_ctxs) {
+        max_swap_cycles  = std::max(max_swap_cycles, ctx->graph_swap_tsc - reload_begin_tsc);
+        max_drain_cycles = std::max(max_drain_cycles, ctx->graph_drain_cycles);
+    }
+    struct io_port_stat stats_after;
+    collect_port_stats(stats_after);
+    double usec_per_cycle = 1e6 / rte_get_tsc_hz();
+    RTE_LOG(NOTICE, MAIN, "reload: done; switched in %.1f usec, drained in %.1f usec (max of threads)\n",
+            max_swap_cycles * usec_per_cycle, max_drain_cycles * usec_per_cycle);
+    if (!io_ctxs.empty())
+        RTE_LOG(NOTICE, MAIN, "reload: rx %lu, tx %lu, sw-drop %lu, rx-drop %lu packets during the reload\n",
+                stats_after.num_recv_pkts - stats_before.num_recv_pkts,
+                stats_after.num_sent_pkts - stats_before.num_sent_pkts,
+                stats_after.num_sw_drop_pkts - stats_before.num_sw_drop_pkts,
+                stats_after.num_rx_drop_pkts - stats_before.num_rx_drop_pkts);
+    reloading = false;
+    return true;
+}
+
+// vim: ts=8 sts=4 sw=4 et
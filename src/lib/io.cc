@@ -5,9 +5,11 @@
  */
 
 #include <nba/core/intrinsic.hh>
+#include <nba/core/idlebackoff.hh>
 #include <nba/core/threading.hh>
 #include <nba/core/timing.hh>
 #include <nba/core/logging.hh>
+#include <nba/core/flowsequencer.hh>
 #include <nba/framework/config.hh>
 #include <nba/framework/logging.hh>
 #include <nba/framework/io.hh>
@@ -102,8 +104,7 @@ static void comp_prepare_cb(struct ev_loop *loop, struct ev_check *watcher, int
      * Calling this there allows to check any pending tasks so that
      * we could eventually release any resources such as batch objects
      * and allow other routines waiting for their releases to continue. */
-    io_thread_context *io_ctx = (io_thread_context *) ev_userdata(loop);
-    comp_thread_context *ctx = io_ctx->comp_ctx;
+    comp_thread_context *ctx = (comp_thread_context *) watcher->data;
     ctx->elem_graph->flush_tasks();
     ctx->elem_graph->scan_offloadable_elements(0);
 }
@@ -113,15 +114,15 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
     #ifdef USE_NVPROF
     nvtxRangePush("task_completion_cb");
     #endif
-    io_thread_context *io_ctx = (io_thread_context *) ev_userdata(loop);
-    comp_thread_context *ctx = io_ctx->comp_ctx;
+    comp_thread_context *ctx = (comp_thread_context *) watcher->data;
+    io_thread_context *io_ctx = ctx->io_ctx;
     OffloadTask *tasks[ctx->task_completion_queue_size];
     unsigned nr_tasks = rte_ring_sc_dequeue_burst(ctx->task_completion_queue,
                                                   (void **) tasks,
                                                   ctx->task_completion_queue_size);
     print_ratelimit("# done tasks", nr_tasks, 100);
 
-    for (unsigned t = 0; t < nr_tasks && !io_ctx->loop_broken; t++) {
+    for (unsigned t = 0; t < nr_tasks && !ctx->loop_broken; t++) {
         /* We already finished postprocessing.
          * Retrieve the task and results. */
         uint64_t now = rdtscp();
@@ -134,7 +135,11 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
         /* Run postprocessing handlers. */
         task->postprocess();
 
-        if (ctx->elem_graph->check_postproc_all(task->elem)) {
+        /* The task may come from a graph replaced by a reload after it
+         * was sent, so it goes back to its own graph. */
+        ElementGraph *elemgraph = task->elemgraph;
+
+        if (elemgraph->check_postproc_all(task->elem)) {
             /* Reset all datablock trackers. */
             for (PacketBatch *batch : task->batches) {
                 if (batch->datablock_states != nullptr) {
@@ -145,7 +150,7 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
             }
             /* Release per-task io_base. */
             task->cctx->clear_io_buffers(task->io_base);
-            ev_break(ctx->io_ctx->loop, EVBREAK_ALL);
+            ev_break(ctx->loop, EVBREAK_ALL);
         }
 
         /* Update statistics. */
@@ -156,13 +161,19 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
               = (ctx->inspector->avg_task_completion_sec[task->local_dev_idx] * task_count + time_spent) / (task_count + 1);
         ctx->inspector->dev_finished_task_count[task->local_dev_idx] ++;
         ctx->inspector->dev_finished_batch_count[task->local_dev_idx] += task->batches.size();
+        elemgraph->notify_offload_completion(task->local_dev_idx, time_spent);
+        if (io_ctx->comp_decoupled) {
+            /* latency_stats belongs to the IO thread. */
+            ctx->offload_rtt.record(task_cycles);
+        } else
+            io_ctx->latency_stats->offload_rtt.record(task_cycles);
 
         /* Enqueue batches for later processing. */
         uint64_t total_batch_size = 0;
         for (PacketBatch *batch : task->batches)
             total_batch_size += batch->count;
         #if NBA_REUSE_DATABLOCKS == 1
-        if (ctx->elem_graph->check_next_offloadable(task->elem)) {
+        if (elemgraph->check_next_offloadable(task->elem)) {
             for (PacketBatch *batch : task->batches) {
                 batch->compute_time += (uint64_t)
                         ((float) task_cycles / total_batch_size
@@ -174,12 +185,12 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
 
             /* Release the task ID and let ElemGraph to get another. */
             task->cctx->release_task_id(task->task_id);
-            ev_break(ctx->io_ctx->loop, EVBREAK_ALL);
+            ev_break(ctx->loop, EVBREAK_ALL);
 
             /* Enqueue it to ElemGraph. */
-            ctx->elem_graph->enqueue_offload_task(task,
-                                                  ctx->elem_graph->get_first_next(task->elem),
-                                                  0);
+            elemgraph->enqueue_offload_task(task,
+                                            elemgraph->get_first_next(task->elem),
+                                            0);
             /* This task is reused. We keep them intact. */
         } else {
         #else
@@ -197,7 +208,7 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
             task->cctx = nullptr;
             task->~OffloadTask();
             rte_mempool_put(ctx->task_pool, (void *) task);
-            ev_break(ctx->io_ctx->loop, EVBREAK_ALL);
+            ev_break(ctx->loop, EVBREAK_ALL);
         }
 
         /* Free the resources used for this offload task. */
@@ -213,37 +224,15 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
     #endif
 }
 
-static size_t comp_process_batch(io_thread_context *ctx, void *pkts, size_t count, uint64_t loop_count)
+/* Initializes the packets of a batch whose packets, count, and
+ * recv_timestamp are set, and runs the element graph on it. */
+void comp_feed_batch(comp_thread_context *ctx, PacketBatch *batch, uint64_t loop_count)
 {
-    assert(count <= ctx->comp_ctx->num_combatch_size);
-    if (count == 0) return 0;
-    int ret;
-    PacketBatch *batch = nullptr;
-    while (true) {
-        ret = rte_mempool_get(ctx->comp_ctx->batch_pool, (void **) &batch);
-        if (unlikely(ctx->loop_broken)) return 0;
-        if (ret == -ENOENT) {
-            /* Wait until some batches are freed. */
-            ev_run(ctx->loop, 0);
-        } else
-            break;
-    }
-
-    /* Okay, let's initialize a new packet batch. */
-    assert(batch != nullptr);
-    new (batch) PacketBatch();
-    memcpy((void **) &batch->packets[0], (void **) pkts, count * sizeof(void*));
     batch->banno.bitmask = 0;
     anno_set(&batch->banno, NBA_BANNO_LB_DECISION, -1);
 
-    /* t is NOT the actual receive timestamp but a
-     * "start-of-processing" timestamp.
-     * However its ordering is same as we do FIFO here.
-     */
-    uint64_t t = rdtscp();
-    batch->count = count;
+    uint64_t t = batch->recv_timestamp;
     INIT_BATCH_MASK(batch);
-    batch->recv_timestamp = t;
     batch->batch_id = recv_batch_cnt;
     #if NBA_BATCHING_SCHEME == NBA_BATCHING_LINKEDLIST
     batch->first_idx = 0;
@@ -274,9 +263,171 @@ static size_t comp_process_batch(io_thread_context *ctx, void *pkts, size_t coun
 
     /* Run the element graph's schedulable elements.
      * FIXME: allow multiple FromInput elements depending on the flow groups. */
-    ctx->comp_ctx->elem_graph->feed_input(0, batch, loop_count);
+    ctx->elem_graph->feed_input(0, batch, loop_count);
+}
+
+static size_t comp_process_batch(io_thread_context *ctx, void *pkts, size_t count, uint64_t loop_count)
+{
+    assert(count <= ctx->comp_ctx->num_combatch_size);
+    if (count == 0) return 0;
+    int ret;
+    PacketBatch *batch = nullptr;
+    while (true) {
+        ret = rte_mempool_get(ctx->comp_ctx->batch_pool, (void **) &batch);
+        if (unlikely(ctx->loop_broken)) return 0;
+        if (ret == -ENOENT) {
+            /* Wait until some batches are freed. */
+            ev_run(ctx->loop, 0);
+        } else
+            break;
+    }
+
+    /* Okay, let's initialize a new packet batch. */
+    assert(batch != nullptr);
+    new (batch) PacketBatch();
+    memcpy((void **) &batch->packets[0], (void **) pkts, count * sizeof(void*));
+    batch->count = count;
+
+    /* t is NOT the actual receive timestamp but a
+     * "start-of-processing" timestamp.
+     * However its ordering is same as we do FIFO here.
+     */
+    batch->recv_timestamp = rdtscp();
+    comp_feed_batch(ctx->comp_ctx, batch, loop_count);
     return count;
 }
+
+/**
+ * Hands off received packets as a batch to the comp threads in
+ * round-robin (the decoupled mode).  When a comp thread lags so much that
+ * its batch_pool runs out, we drop the packets instead of waiting.
+ */
+static size_t io_handoff_batch(io_thread_context *ctx, struct rte_mbuf **pkts, size_t count)
+{
+    if (count == 0) return 0;
+    comp_thread_context *comp_ctx = ctx->comp_ctxs[ctx->next_comp_idx];
+    if (++ ctx->next_comp_idx == ctx->num_comp_ctxs)
+        ctx->next_comp_idx = 0;
+    assert(count <= comp_ctx->num_combatch_size);
+
+    PacketBatch *batch = nullptr;
+    if (likely(rte_mempool_get(comp_ctx->batch_pool, (void **) &batch) == 0)) {
+        new (batch) PacketBatch();
+        memcpy((void **) &batch->packets[0], (void **) pkts, count * sizeof(void*));
+        batch->count = count;
+        batch->recv_timestamp = rdtscp();
+        if (comp_ctx->flow_seq != nullptr) {
+            uint16_t groups = 0;
+            for (unsigned i = 0; i < count; i++) {
+                uint32_t h = (pkts[i]->ol_flags & PKT_RX_RSS_HASH) ? pkts[i]->hash.rss : 0;
+                groups |= (uint16_t) (1u << FlowSequencer::group_of(h));
+            }
+            comp_ctx->flow_seq->issue(groups, batch->flow_tickets);
+        }
+        /* It may return -EDQUOT, but the batch is enqueued anyway. */
+        if (likely(rte_ring_sp_enqueue(comp_ctx->rx_queue, (void *) batch) != -ENOBUFS))
+            return count;
+        if (comp_ctx->flow_seq != nullptr)
+            comp_ctx->flow_seq->cancel(batch->flow_tickets);
+        rte_mempool_put(comp_ctx->batch_pool, (void *) batch);
+    }
+    for (unsigned i = 0; i < count; i++) {
+        ctx->port_stats[pkts[i]->port].num_sw_drop_pkts ++;
+        rte_pktmbuf_free(pkts[i]);
+    }
+    return 0;
+}
+
+/**
+ * Transmits the batches that the comp threads have finished and returns
+ * them to their batch_pool (the decoupled mode).
+ */
+static unsigned io_tx_returned_batches(io_thread_context *ctx)
+{
+    PacketBatch *batches[NBA_MAX_IO_BATCH_SIZE];
+    unsigned total_cnt = 0;
+    for (unsigned c = 0; c < ctx->num_comp_ctxs; c++) {
+        comp_thread_context *comp_ctx = ctx->comp_ctxs[c];
+        unsigned cnt = rte_ring_sc_dequeue_burst(comp_ctx->tx_return_queue, (void **) batches,
+                                                 NBA_MAX_IO_BATCH_SIZE);
+        if (cnt == 0)
+            continue;
+        for (unsigned b = 0; b < cnt; b++)
+            io_tx_batch(ctx, batches[b]);
+        rte_mempool_put_bulk(comp_ctx->batch_pool, (void **) batches, cnt);
+        /* Wake up the comp thread if it waits for free batches. */
+        ev_async_send(comp_ctx->loop, comp_ctx->rx_watcher);
+        total_cnt += cnt;
+    }
+    return total_cnt;
+}
+
+/* Creates per-thread pools and registers comp events to ctx->loop. */
+void comp_init_loop(comp_thread_context *ctx)
+{
+    char temp[RTE_MEMPOOL_NAMESIZE];
+    snprintf(temp, RTE_MEMPOOL_NAMESIZE,
+         "comp.batch.%u:%u@%u", ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
+    ctx->batch_pool = rte_mempool_create(temp, ctx->num_batchpool_size + 1,
+                                         sizeof(PacketBatch), CACHE_LINE_SIZE,
+                                         0, nullptr, nullptr,
+                                         comp_packetbatch_init, nullptr,
+                                         ctx->loc.node_id, 0);
+    if (ctx->batch_pool == nullptr)
+        rte_panic("RTE_ERROR while creating comp_ctx->batch_pool: %s\n", rte_strerror(rte_errno));
+
+    snprintf(temp, RTE_MEMPOOL_NAMESIZE,
+        "comp.dbstate.%u:%u@%u", ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
+    size_t dbstate_pool_size = NBA_MAX_COPROC_PPDEPTH * 16;
+    size_t dbstate_item_size = sizeof(struct datablock_tracker) * NBA_MAX_DATABLOCKS;
+    ctx->dbstate_pool = rte_mempool_create(temp, dbstate_pool_size + 1,
+                                           dbstate_item_size, 32,
+                                           0, nullptr, nullptr,
+                                           comp_dbstate_init, nullptr,
+                                           ctx->loc.node_id, 0);
+    if (ctx->dbstate_pool == nullptr) {
+        //printf("sizeof(struct datablock_tracker) = %'lu\n", sizeof(struct datablock_tracker));
+        rte_panic("RTE_ERROR while creating comp_ctx->dbstate_pool: %s\n", rte_strerror(rte_errno));
+    }
+
+    snprintf(temp, RTE_MEMPOOL_NAMESIZE,
+         "comp.task.%u:%u@%u", ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
+    ctx->task_pool = rte_mempool_create(temp, ctx->num_taskpool_size + 1,
+                                        sizeof(OffloadTask), 32,
+                                        0, nullptr, nullptr,
+                                        comp_task_init, nullptr,
+                                        ctx->loc.node_id, 0);
+    if (ctx->task_pool == nullptr)
+        rte_panic("RTE_ERROR while creating comp_ctx->task pool: %s\n", rte_strerror(rte_errno));
+
+    ctx->packet_pool = packet_create_mempool(128, ctx->loc.node_id, ctx->loc.core_id);
+    assert(ctx->packet_pool != nullptr);
+    if (ctx->jumbo_frame_size > NBA_MAX_PACKET_SIZE) {
+        /* Buffers to linearize chained jumbo frames (see Packet::linearize()),
+         * enough for the batches in flight to coprocessors. */
+        ctx->jumbo_pool = jumbo_create_mempool(2 * ctx->num_coproc_ppdepth
+                                               * ctx->num_combatch_size,
+                                               ctx->jumbo_frame_size,
+                                               ctx->loc.node_id, ctx->loc.core_id);
+    }
+
+    NEW(ctx->loc.node_id, ctx->inspector, SystemInspector);
+
+    /* Register the offload completion event. */
+    if (ctx->coproc_ctx != nullptr) {
+        ev_async_init(ctx->task_completion_watcher, comp_offload_task_completion_cb);
+        ctx->task_completion_watcher->data = ctx;
+        // TODO: remove this event and just check the completion queue on every iteration.
+        ev_async_start(ctx->loop, ctx->task_completion_watcher);
+    }
+
+    /* Register per-iteration check event. */
+    ctx->check_watcher = (struct ev_check *) rte_malloc_socket(nullptr, sizeof(struct ev_check),
+                                                               CACHE_LINE_SIZE, ctx->loc.node_id);
+    ev_check_init(ctx->check_watcher, comp_prepare_cb);
+    ctx->check_watcher->data = ctx;
+    ev_check_start(ctx->loop, ctx->check_watcher);
+}
 /* ===== END_OF_COMP ===== */
 
 /* Taken from PSIO */
@@ -315,23 +466,58 @@ static inline uint32_t io_myrand(uint64_t *seed) /*{{{*/
     return (uint32_t)(*seed >> 32);
 }/*}}}*/
 
+static void io_publish_latency_hist(struct io_latency_hist_atomic *shared, LatencyHistogram *local)/*{{{*/
+{
+    if (local->count() == 0)
+        return;
+    for (unsigned b = 0; b < LatencyHistogram::NUM_BUCKETS; b++) {
+        uint64_t n = local->get_bucket(b);
+        if (n > 0)
+            rte_atomic64_add(&shared->counts[b], n);
+    }
+    local->reset();
+}/*}}}*/
+
+static void io_drain_latency_hist(struct io_latency_hist_atomic *shared, LatencyHistogram *hist)/*{{{*/
+{
+    /* Subtract what we have read so that concurrent additions from
+     * threads already in the next interval are preserved. */
+    hist->reset();
+    for (unsigned b = 0; b < LatencyHistogram::NUM_BUCKETS; b++) {
+        int64_t n = rte_atomic64_read(&shared->counts[b]);
+        if (n > 0) {
+            rte_atomic64_sub(&shared->counts[b], n);
+            hist->add_bucket(b, (uint64_t) n);
+        }
+    }
+}/*}}}*/
+
+static void io_print_latency_hist(const char *label, const LatencyHistogram *hist)/*{{{*/
+{
+    double usec_per_cycle = 1e6 / rte_get_tsc_hz();
+    printf(" %s p50 %.1f p99 %.1f p999 %.1f us (%'lu)", label,
+           hist->percentile(50.0) * usec_per_cycle,
+           hist->percentile(99.0) * usec_per_cycle,
+           hist->percentile(99.9) * usec_per_cycle,
+           hist->count());
+}/*}}}*/
+
 static void io_local_stat_timer_cb(struct ev_loop *loop, struct ev_timer *watcher, int revents)/*{{{*/
 {
     io_thread_context *ctx = (io_thread_context *) ev_userdata(loop);
-    ctx->tx_pkt_thruput = 0;
-    /* Atomically update the counters in the master. */
-    for (unsigned j = 0; j < ctx->node_stat->num_ports; j++) {
-        rte_atomic64_add(&ctx->node_stat->port_stats[j].num_recv_pkts, ctx->port_stats[j].num_recv_pkts);
-        rte_atomic64_add(&ctx->node_stat->port_stats[j].num_sent_pkts, ctx->port_stats[j].num_sent_pkts);
-        rte_atomic64_add(&ctx->node_stat->port_stats[j].num_sw_drop_pkts, ctx->port_stats[j].num_sw_drop_pkts);
-        rte_atomic64_add(&ctx->node_stat->port_stats[j].num_rx_drop_pkts, ctx->port_stats[j].num_rx_drop_pkts);
-        rte_atomic64_add(&ctx->node_stat->port_stats[j].num_tx_drop_pkts, ctx->port_stats[j].num_tx_drop_pkts);
-        rte_atomic64_add(&ctx->node_stat->port_stats[j].num_invalid_pkts, ctx->port_stats[j].num_invalid_pkts);
-        rte_atomic64_add(&ctx->node_stat->port_stats[j].num_recv_bytes, ctx->port_stats[j].num_recv_bytes);
-        rte_atomic64_add(&ctx->node_stat->port_stats[j].num_sent_bytes, ctx->port_stats[j].num_sent_bytes);
-        ctx->tx_pkt_thruput += ctx->port_stats[j].num_sent_pkts;
-        memzero(&ctx->port_stats[j], 1);
-    }
+    /* The port counters are cumulative and read lazily by the master
+     * and the metrics exporter, so we only derive the local throughput. */
+    uint64_t tx_pkt_count = 0;
+    for (unsigned j = 0; j < ctx->node_stat->num_ports; j++)
+        tx_pkt_count += ctx->port_stats[j].num_sent_pkts;
+    ctx->tx_pkt_thruput = tx_pkt_count - ctx->last_tx_pkt_count;
+    ctx->last_tx_pkt_count = tx_pkt_count;
+    /* Publish the latency histograms, skipping empty buckets. */
+    for (unsigned j = 0; j < ctx->node_stat->num_ports; j++)
+        for (unsigned p = 0; p < IO_NUM_LATENCY_PATHS; p++)
+            io_publish_latency_hist(&ctx->node_stat->pkt_latency[j][p],
+                                    &ctx->latency_stats->pkt_latency[j][p]);
+    io_publish_latency_hist(&ctx->node_stat->offload_rtt, &ctx->latency_stats->offload_rtt);
  #ifdef NBA_CPU_MICROBENCH
     char buf[2048];
     char *bufp = &buf[0];
@@ -363,20 +549,16 @@ static void io_node_stat_cb(struct ev_loop *loop, struct ev_async *watcher, int
         memzero(&total, 1);
         struct io_thread_stat *last_total = &node_stat->last_total;
         struct rte_eth_stats s;
+        for (unsigned t = 0; t < node_stat->num_threads; t++) {
+            struct io_thread_context *tctx = node_stat->thread_ctxs[t];
+            for (j = 0; j < node_stat->num_ports; j++)
+                io_port_stat_accumulate(&total.port_stats[j], &tctx->port_stats[j]);
+        }
         for (j = 0; j < node_stat->num_ports; j++) {
-            struct rte_eth_dev_info info;
-            rte_eth_dev_info_get((uint8_t) j, &info);
-            total.port_stats[j].num_recv_pkts = rte_atomic64_read(&node_stat->port_stats[j].num_recv_pkts);
-            total.port_stats[j].num_sent_pkts = rte_atomic64_read(&node_stat->port_stats[j].num_sent_pkts);
-            total.port_stats[j].num_recv_bytes = rte_atomic64_read(&node_stat->port_stats[j].num_recv_bytes);
-            total.port_stats[j].num_sent_bytes = rte_atomic64_read(&node_stat->port_stats[j].num_sent_bytes);
-            total.port_stats[j].num_invalid_pkts = rte_atomic64_read(&node_stat->port_stats[j].num_invalid_pkts);
-            total.port_stats[j].num_sw_drop_pkts = rte_atomic64_read(&node_stat->port_stats[j].num_sw_drop_pkts);
             if ((unsigned) rte_eth_dev_socket_id(j) == ctx->loc.node_id) {
                 rte_eth_stats_get((uint8_t) j, &s);
                 total.port_stats[j].num_rx_drop_pkts = s.ierrors;
             }
-            total.port_stats[j].num_tx_drop_pkts = rte_atomic64_read(&node_stat->port_stats[j].num_tx_drop_pkts);
         }
         uint64_t cur_time = get_usec();
         double total_thruput_mpps = 0;
@@ -400,6 +582,47 @@ static void io_node_stat_cb(struct ev_loop *loop, struct ev_async *watcher, int
             total_thruput_mpps += port_thruput_mpps;
             total_thruput_gbps += port_thruput_gbps;
         }
+        /* Report the latency distributions of the last interval. */
+        LatencyHistogram hist;
+        static const char *path_labels[IO_NUM_LATENCY_PATHS] = { "CPU", "OFFL" };
+        for (j = 0; j < node_stat->num_ports; j++) {
+            bool has_samples = false;
+            for (unsigned p = 0; p < IO_NUM_LATENCY_PATHS; p++) {
+                io_drain_latency_hist(&node_stat->pkt_latency[j][p], &hist);
+                if (hist.count() == 0)
+                    continue;
+                if (!has_samples)
+                    printf("port[%u:%u] latency:", node_stat->node_id, j);
+                has_samples = true;
+                io_print_latency_hist(path_labels[p], &hist);
+            }
+            if (has_samples)
+                printf("\n");
+        }
+        io_drain_latency_hist(&node_stat->offload_rtt, &hist);
+        if (hist.count() > 0) {
+            printf("offload round-trip in node %u:", node_stat->node_id);
+            io_print_latency_hist("task", &hist);
+            printf("\n");
+        }
+        uint64_t stolen_batches = 0, stolen_pkts = 0;
+        bool stealing = false;
+        for (unsigned t = 0; t < node_stat->num_threads; t++) {
+            struct io_thread_context *tctx = node_stat->thread_ctxs[t];
+            for (unsigned c = 0; c < tctx->num_comp_ctxs; c++) {
+                comp_thread_context *comp_ctx = tctx->comp_ctxs[c];
+                stealing |= (comp_ctx->steal_victims != nullptr);
+                stolen_batches += *(volatile uint64_t *) &comp_ctx->num_stolen_batches;
+                stolen_pkts += *(volatile uint64_t *) &comp_ctx->num_stolen_pkts;
+            }
+        }
+        if (stealing) {
+            printf("stolen in node %u: %'lu batches, %'lu pkts\n", node_stat->node_id,
+                   stolen_batches - node_stat->last_stolen_batches,
+                   stolen_pkts - node_stat->last_stolen_pkts);
+            node_stat->last_stolen_batches = stolen_batches;
+            node_stat->last_stolen_pkts = stolen_pkts;
+        }
         printf("Total forwarded pkts: %.2f Mpps, %.2f Gbps in node %d\n", total_thruput_mpps, total_thruput_gbps, node_stat->node_id);
         rte_memcpy(last_total, &total, sizeof(total));
         node_stat->last_time = get_usec();
@@ -411,12 +634,28 @@ static void io_terminate_cb(struct ev_loop *loop, struct ev_async *watcher, int
 {
     struct io_thread_context *ctx = (struct io_thread_context *) ev_userdata(loop);
     ctx->loop_broken = true;
+    if (!ctx->comp_decoupled)
+        ctx->comp_ctx->loop_broken = true;
+    ev_break(loop, EVBREAK_ALL);
+}
+
+static void comp_terminate_cb(struct ev_loop *loop, struct ev_async *watcher, int revents)
+{
+    comp_thread_context *ctx = (comp_thread_context *) watcher->data;
+    ctx->loop_broken = true;
+    ev_break(loop, EVBREAK_ALL);
+}
+
+static void comp_rx_wakeup_cb(struct ev_loop *loop, struct ev_async *watcher, int revents)
+{
+    /* Only to return from a blocking ev_run() waiting for free batches. */
     ev_break(loop, EVBREAK_ALL);
 }
 
 /**
  * The TXCommonComponent implementation.
- * This function is directly called from the computation thread.
+ * This function is directly called from the computation thread, or from
+ * the IO thread for the batches returned in the decoupled mode.
  */
 void io_tx_batch(struct io_thread_context *ctx, PacketBatch *batch)
 {
@@ -425,8 +664,7 @@ void io_tx_batch(struct io_thread_context *ctx, PacketBatch *batch)
     memzero(out_batches_cnt, NBA_MAX_PORTS);
     uint64_t t = rdtscp();
     int64_t proc_id = anno_get(&batch->banno, NBA_BANNO_LB_DECISION) + 1; // adjust range to be positive
-    ctx->comp_ctx->inspector->update_batch_proc_time(t - batch->recv_timestamp);
-    ctx->comp_ctx->inspector->update_pkt_proc_cycles(batch->compute_time, proc_id);
+    unsigned lat_path = (proc_id > 0) ? IO_LATENCY_PATH_OFFLOAD : IO_LATENCY_PATH_CPU;
 //#ifdef NBA_CPU_MICROBENCH
 //    PAPI_start(ctx->papi_evset_tx);
 //#endif
@@ -438,6 +676,9 @@ void io_tx_batch(struct io_thread_context *ctx, PacketBatch *batch)
         Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
         struct ether_hdr *ethh = rte_pktmbuf_mtod(batch->packets[pkt_idx], struct ether_hdr *);
         uint64_t o = anno_get(&pkt->anno, NBA_ANNO_IFACE_OUT);
+        /* Packets generated by elements have no RX timestamps. */
+        if (anno_isset(&pkt->anno, NBA_ANNO_TIMESTAMP))
+            ctx->latency_stats->pkt_latency[o][lat_path].record(t - anno_get(&pkt->anno, NBA_ANNO_TIMESTAMP));
 
         /* Update source/dest MAC addresses. */
         ether_addr_copy(&ethh->s_addr, &ethh->d_addr);
@@ -578,59 +819,15 @@ int io_loop(void *arg)
     ev_set_userdata(ctx->loop, ctx);
 
     /* ==== COMP ====*/
-    ctx->comp_ctx->loop = ctx->loop;
-    snprintf(temp, RTE_MEMPOOL_NAMESIZE,
-         "comp.batch.%u:%u@%u", ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
-    ctx->comp_ctx->batch_pool = rte_mempool_create(temp, ctx->comp_ctx->num_batchpool_size + 1,
-                                                   sizeof(PacketBatch), CACHE_LINE_SIZE,
-                                                   0, nullptr, nullptr,
-                                                   comp_packetbatch_init, nullptr,
-                                                   ctx->loc.node_id, 0);
-    if (ctx->comp_ctx->batch_pool == nullptr)
-        rte_panic("RTE_ERROR while creating comp_ctx->batch_pool: %s\n", rte_strerror(rte_errno));
-
-    snprintf(temp, RTE_MEMPOOL_NAMESIZE,
-        "comp.dbstate.%u:%u@%u", ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
-    size_t dbstate_pool_size = NBA_MAX_COPROC_PPDEPTH * 16;
-    size_t dbstate_item_size = sizeof(struct datablock_tracker) * NBA_MAX_DATABLOCKS;
-    ctx->comp_ctx->dbstate_pool = rte_mempool_create(temp, dbstate_pool_size + 1,
-                                                     dbstate_item_size, 32,
-                                                     0, nullptr, nullptr,
-                                                     comp_dbstate_init, nullptr,
-                                                     ctx->loc.node_id, 0);
-    if (ctx->comp_ctx->dbstate_pool == nullptr) {
-        //printf("sizeof(struct datablock_tracker) = %'lu\n", sizeof(struct datablock_tracker));
-        rte_panic("RTE_ERROR while creating comp_ctx->dbstate_pool: %s\n", rte_strerror(rte_errno));
-    }
-
-    snprintf(temp, RTE_MEMPOOL_NAMESIZE,
-         "comp.task.%u:%u@%u", ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
-    ctx->comp_ctx->task_pool = rte_mempool_create(temp, ctx->comp_ctx->num_taskpool_size + 1,
-                                                  sizeof(OffloadTask), 32,
-                                                  0, nullptr, nullptr,
-                                                  comp_task_init, nullptr,
-                                                  ctx->loc.node_id, 0);
-    if (ctx->comp_ctx->task_pool == nullptr)
-        rte_panic("RTE_ERROR while creating comp_ctx->task pool: %s\n", rte_strerror(rte_errno));
-
-    ctx->comp_ctx->packet_pool = packet_create_mempool(128, ctx->loc.node_id, ctx->loc.core_id);
-    assert(ctx->comp_ctx->packet_pool != nullptr);
-
-    NEW(ctx->loc.node_id, ctx->comp_ctx->inspector, SystemInspector);
-
-    /* Register the offload completion event. */
-    if (ctx->comp_ctx->coproc_ctx != nullptr) {
-        ev_async_init(ctx->comp_ctx->task_completion_watcher, comp_offload_task_completion_cb);
-        // TODO: remove this event and just check the completion queue on every iteration.
-        ev_async_start(ctx->loop, ctx->comp_ctx->task_completion_watcher);
+    if (ctx->comp_decoupled) {
+        /* The comp threads create their pools in comp_loop(). */
+        for (i = 0; i < ctx->num_comp_ctxs; i++)
+            while (!ctx->comp_ctxs[i]->loop_ready)
+                rte_pause();
+    } else {
+        ctx->comp_ctx->loop = ctx->loop;
+        comp_init_loop(ctx->comp_ctx);
     }
-
-    /* Register per-iteration check event. */
-    ctx->comp_ctx->check_watcher = (struct ev_check *) rte_malloc_socket(nullptr, sizeof(struct ev_check),
-                                                                         CACHE_LINE_SIZE, ctx->loc.node_id);
-    ev_check_init(ctx->comp_ctx->check_watcher, comp_prepare_cb);
-    ev_check_start(ctx->loop, ctx->comp_ctx->check_watcher);
-
     /* ==== END_OF_COMP ====*/
 
     /* Register the termination event. */
@@ -642,6 +839,10 @@ int io_loop(void *arg)
                                                                 sizeof(struct io_port_stat) * ctx->node_stat->num_ports,
                                                                 CACHE_LINE_SIZE, ctx->loc.node_id);
     memzero(ctx->port_stats, ctx->node_stat->num_ports);
+    ctx->latency_stats = (struct io_thread_latency_stat *) rte_malloc_socket("io_latency_stat",
+                                                                           sizeof(struct io_thread_latency_stat),
+                                                                           CACHE_LINE_SIZE, ctx->loc.node_id);
+    memzero(ctx->latency_stats, 1);
 
     /* Initialize statistics timer. */
     if (ctx->loc.local_thread_idx == 0) {
@@ -666,6 +867,9 @@ int io_loop(void *arg)
     ev_init(ctx->stat_timer, io_local_stat_timer_cb);
     ctx->stat_timer->repeat = 1.;
     ev_timer_again(ctx->loop, ctx->stat_timer);
+    ctx->last_tx_pkt_count = 0;
+    rte_wmb();
+    ctx->stats_ready = true;
 
 #ifdef TEST_MINIMAL_L2FWD
     unsigned txq = (ctx->loc.node_id * (ctx->num_tx_ports / num_nodes)) + ctx->loc.local_thread_idx;
@@ -690,6 +894,32 @@ int io_loop(void *arg)
     // ctx->num_iobatch_size = 1; // FOR TESTING
     uint64_t loop_count = 0;
 
+    /* Back off when the RX queues stay empty.  Offload completions and
+     * termination end the sleeps early through idle_event. */
+    IdleBackoff *idle_backoff = ctx->idle_backoff;
+#if !defined(TEST_RXONLY) && !defined(TEST_MINIMAL_L2FWD)
+    idle_backoff->init(system_params["IO_IDLE_SPIN_POLLS"],
+                       system_params["IO_IDLE_PAUSE_POLLS"],
+                       system_params["IO_IDLE_SLEEP_USEC"],
+                       ctx->idle_event->getfd());
+#endif
+    if (idle_backoff->enabled()) {
+        /* Keep the default 50 usec slack from dominating short sleeps. */
+        prctl(PR_SET_TIMERSLACK, 1000, 0, 0, 0);
+    }
+    /* Re-checks the queues whose producers wake us up, after the
+     * sleeping flag is set. */
+    auto has_pending_work = [ctx] {
+        if (ctx->comp_decoupled) {
+            for (unsigned c = 0; c < ctx->num_comp_ctxs; c++)
+                if (!rte_ring_empty(ctx->comp_ctxs[c]->tx_return_queue))
+                    return true;
+            return false;
+        }
+        struct rte_ring *q = ctx->comp_ctx->task_completion_queue;
+        return q != nullptr && !rte_ring_empty(q);
+    };
+
     /* The IO thread runs in polling mode. */
     while (likely(!ctx->loop_broken)) {
         unsigned total_recv_cnt = 0;
@@ -792,7 +1022,10 @@ int io_loop(void *arg)
         }
 
         /* Scan and execute schedulable elements. */
-        ctx->comp_ctx->elem_graph->scan_schedulable_elements(loop_count);
+        if (!ctx->comp_decoupled) {
+            ctx->comp_ctx->elem_graph->scan_schedulable_elements(loop_count);
+            ctx->comp_ctx->check_graph_reload(loop_count);
+        }
 
         #ifdef NBA_CPU_MICROBENCH/*{{{*/
         {
@@ -803,25 +1036,21 @@ int io_loop(void *arg)
         }
         #endif/*}}}*/
 
-        while (!rte_ring_empty(ctx->new_packet_request_ring))/*{{{*/
+        /* Transmit the frames requested by io_tx_new(), e.g., ARP requests. *//*{{{*/
         {
-            struct new_packet* new_packet = 0;
-            int ret = rte_ring_dequeue(ctx->new_packet_request_ring, (void**) &new_packet);
-            assert(ret == 0);
-
-            struct rte_mbuf* pktbuf = rte_pktmbuf_alloc(ctx->new_packet_pool);
-            assert(pktbuf != nullptr);
-
-            rte_pktmbuf_pkt_len(pktbuf)  = new_packet->len;
-            rte_pktmbuf_data_len(pktbuf) = new_packet->len;
-            memcpy(rte_pktmbuf_mtod(pktbuf, void *), new_packet->buf, new_packet->len);
-
+            struct new_packet *reqs[NBA_MAX_IO_BATCH_SIZE];
+            unsigned num_reqs;
             unsigned txq = ctx->loc.global_thread_idx;
-            rte_pktmbuf_free(pktbuf);
-            ctx->port_stats[new_packet->out_port].num_sent_pkts++;
-            ctx->port_stats[new_packet->out_port].num_sent_bytes += new_packet->len + 24;
-
-            rte_mempool_put(ctx->new_packet_request_pool, new_packet);
+            while ((num_reqs = rte_ring_sc_dequeue_burst(ctx->new_packet_request_ring,
+                                                         (void **) reqs, NBA_MAX_IO_BATCH_SIZE)) > 0) {
+                ctx->global_tx_cnt += io_send_new_packets(reqs, num_reqs, ctx->num_tx_ports, ctx->port_stats,
+                    [ctx]() { return rte_pktmbuf_alloc(ctx->new_packet_pool); },
+                    [txq](unsigned port, struct rte_mbuf **pkts, unsigned cnt) {
+                        return (unsigned) rte_eth_tx_burst((uint8_t) port, txq, pkts, cnt);
+                    },
+                    [](struct rte_mbuf *m) { rte_pktmbuf_free(m); });
+                rte_mempool_put_bulk(ctx->new_packet_request_pool, (void **) reqs, num_reqs);
+            }
         }/*}}}*/
 
         /* Process received packets. */
@@ -830,16 +1059,31 @@ int io_loop(void *arg)
         PAPI_start(ctx->papi_evset_comp);
         #endif/*}}}*/
         unsigned comp_batch_size = ctx->comp_ctx->num_combatch_size;
-        for (unsigned pidx = 0; pidx < total_recv_cnt; pidx += comp_batch_size) {
-            comp_process_batch(ctx, &pkts[pidx], RTE_MIN(comp_batch_size, total_recv_cnt - pidx), loop_count);
+        unsigned num_returned = 0;
+        if (ctx->comp_decoupled) {
+            for (unsigned pidx = 0; pidx < total_recv_cnt; pidx += comp_batch_size) {
+                io_handoff_batch(ctx, &pkts[pidx], RTE_MIN(comp_batch_size, total_recv_cnt - pidx));
+            }
+            num_returned = io_tx_returned_batches(ctx);
+        } else {
+            for (unsigned pidx = 0; pidx < total_recv_cnt; pidx += comp_batch_size) {
+                comp_process_batch(ctx, &pkts[pidx], RTE_MIN(comp_batch_size, total_recv_cnt - pidx), loop_count);
+            }
         }
 
         /* The io event loop. */
         if (likely(!ctx->loop_broken))
             ev_run(ctx->loop, EVRUN_NOWAIT);
 
+        if (likely(!ctx->loop_broken))
+            idle_backoff->poll_done(total_recv_cnt + num_returned, has_pending_work);
+
         loop_count ++;
     }
+    if (idle_backoff->enabled())
+        RTE_LOG(INFO, IO, "@%u: slept %lu times (%.3f sec requested, %lu woken up) while idle\n",
+                ctx->loc.core_id, idle_backoff->num_sleeps, idle_backoff->slept_usec / 1e6,
+                idle_backoff->num_wakeups);
     if (ctx->loc.local_thread_idx == 0) {
         ctx->init_cond->~CondVar();
         rte_free(ctx->init_cond);
@@ -848,7 +1092,150 @@ int io_loop(void *arg)
 #ifdef TEST_MINIMAL_L2FWD
     rte_free(batch);
 #endif
-    rte_free(ctx);
+    /* Decoupled comp threads may still refer to ctx until they exit;
+     * the main thread frees it after joining them. */
+    if (!ctx->comp_decoupled)
+        rte_free(ctx);
+    return 0;
+}
+
+/**
+ * Runs the element graph on a batch taken from the rx_queue ordered by
+ * seq, after all earlier batches sharing its flow groups.  The wait ends
+ * when another thread finishes them (or we are terminated).
+ */
+static void comp_feed_batch_ordered(comp_thread_context *ctx, FlowSequencer *seq,
+                                    PacketBatch *batch, uint64_t loop_count)
+{
+    if (seq == nullptr) {
+        comp_feed_batch(ctx, batch, loop_count);
+        return;
+    }
+    while (!seq->ready(batch->flow_tickets)) {
+        if (unlikely(ev_async_pending(ctx->terminate_watcher))) {
+            ctx->loop_broken = true;
+            return;
+        }
+        rte_pause();
+    }
+    struct flow_tickets tickets = batch->flow_tickets;
+    comp_feed_batch(ctx, batch, loop_count);
+    /* Offloaded batches may still be reordered after this. */
+    seq->done(tickets);
+}
+
+/* Steal only from those having more batches than this. */
+static const unsigned COMP_STEAL_MIN_BACKLOG = 1;
+
+/**
+ * Takes a batch queued for the most backlogged comp thread in the same
+ * node and processes it as ours, so that it returns via our IO thread.
+ * Returns false if there was nothing to steal.
+ */
+static bool comp_steal_batch(comp_thread_context *ctx, uint64_t loop_count)
+{
+    std::vector<comp_thread_context *> &victims = *ctx->steal_victims;
+    comp_thread_context *victim = nullptr;
+    unsigned max_backlog = COMP_STEAL_MIN_BACKLOG;
+    for (unsigned v = 0; v < victims.size(); v++) {
+        /* Rotate the start to spread contention among thieves. */
+        comp_thread_context *c = victims[(v + loop_count) % victims.size()];
+        unsigned backlog = rte_ring_count(c->rx_queue);
+        if (backlog > max_backlog) {
+            max_backlog = backlog;
+            victim = c;
+        }
+    }
+    if (victim == nullptr)
+        return false;
+
+    PacketBatch *batch = nullptr, *stolen = nullptr;
+    if (rte_mempool_get(ctx->batch_pool, (void **) &batch) != 0)
+        return false;
+    if (rte_ring_mc_dequeue(victim->rx_queue, (void **) &stolen) != 0) {
+        rte_mempool_put(ctx->batch_pool, (void *) batch);
+        return false;
+    }
+    new (batch) PacketBatch();
+    memcpy((void **) &batch->packets[0], (void **) &stolen->packets[0],
+           stolen->count * sizeof(void*));
+    batch->count = stolen->count;
+    batch->recv_timestamp = stolen->recv_timestamp;
+    batch->flow_tickets = stolen->flow_tickets;
+    rte_mempool_put(victim->batch_pool, (void *) stolen);
+
+    ctx->num_stolen_batches ++;
+    ctx->num_stolen_pkts += batch->count;
+    comp_feed_batch_ordered(ctx, victim->flow_seq, batch, loop_count);
+    return true;
+}
+
+static void comp_stat_timer_cb(struct ev_loop *loop, struct ev_timer *watcher, int revents)
+{
+    comp_thread_context *ctx = (comp_thread_context *) ev_userdata(loop);
+    io_publish_latency_hist(&ctx->io_ctx->node_stat->offload_rtt, &ctx->offload_rtt);
+}
+
+/**
+ * The loop of computation threads in the decoupled mode.
+ * It runs the element graph on the batches handed off by its IO thread
+ * and passes the processed ones back via tx_return_queue.
+ */
+int comp_loop(void *arg)
+{
+    comp_thread_context *const ctx = (comp_thread_context *) arg;
+    PacketBatch *batches[NBA_MAX_IO_BATCH_SIZE];
+    char temp[64];
+
+    assert(rte_lcore_id() == ctx->loc.core_id);
+    snprintf(temp, 64, "comp.%u:%u@%u", ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
+    prctl(PR_SET_NAME, temp, 0, 0, 0);
+    threading::bind_cpu(ctx->loc.core_id);
+    #ifdef USE_NVPROF
+    nvtxNameOsThread(pthread_self(), temp);
+    #endif
+
+    ctx->loop = ev_loop_new(EVFLAG_AUTO | EVFLAG_NOSIGMASK);
+    ctx->loop_broken = false;
+    ev_set_userdata(ctx->loop, ctx);
+    comp_init_loop(ctx);
+
+    ev_set_cb(ctx->rx_watcher, comp_rx_wakeup_cb);
+    ev_async_start(ctx->loop, ctx->rx_watcher);
+    ev_set_cb(ctx->terminate_watcher, comp_terminate_cb);
+    ctx->terminate_watcher->data = ctx;
+    ev_async_start(ctx->loop, ctx->terminate_watcher);
+    /* Publish the task latencies at the same interval as IO threads. */
+    struct ev_timer stat_timer;
+    ev_init(&stat_timer, comp_stat_timer_cb);
+    stat_timer.repeat = 1.;
+    ev_timer_again(ctx->loop, &stat_timer);
+
+    /* Let the IO thread start handing off batches. */
+    rte_wmb();
+    ctx->loop_ready = true;
+    RTE_LOG(DEBUG, COMP, "@%u: starting to process batches from io thread @%u\n",
+            ctx->loc.core_id, ctx->io_ctx->loc.core_id);
+
+    /* With stealing, take one batch at a time and leave the backlog
+     * in rx_queue where the others can see it. */
+    const unsigned burst_size = (ctx->steal_victims != nullptr) ? 1 : NBA_MAX_IO_BATCH_SIZE;
+    uint64_t loop_count = 0;
+    while (likely(!ctx->loop_broken)) {
+        unsigned cnt = rte_ring_dequeue_burst(ctx->rx_queue, (void **) batches, burst_size);
+        for (unsigned b = 0; b < cnt && !ctx->loop_broken; b++)
+            comp_feed_batch_ordered(ctx, ctx->flow_seq, batches[b], loop_count);
+        if (cnt == 0 && ctx->steal_victims != nullptr)
+            comp_steal_batch(ctx, loop_count);
+
+        /* Scan and execute schedulable elements. */
+        ctx->elem_graph->scan_schedulable_elements(loop_count);
+        ctx->check_graph_reload(loop_count);
+
+        if (likely(!ctx->loop_broken))
+            ev_run(ctx->loop, EVRUN_NOWAIT);
+        loop_count ++;
+    }
     return 0;
 }
 
@@ -0,0 +1,322 @@
+#include <nba/core/intrinsic.hh>
+#include <nba/framework/metrics.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/elementgraph.hh>
+#include <nba/framework/io.hh>
+#include <nba/framework/logging.hh>
+#include <nba/element/element.hh>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <rte_config.h>
+#include <rte_ethdev.h>
+#include <rte_ring.h>
+
+using namespace std;
+using namespace nba;
+
+/* How often the exporter thread checks for termination. */
+#define METRICS_POLL_TIMEOUT_MS (200)
+
+MetricsExporter::MetricsExporter(const string &socket_path)
+    : socket_path(socket_path), listen_fd(-1), running(false)
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+void MetricsExporter::add_io_thread(struct io_thread_context *ctx)
+{
+    io_ctxs.push_back(ctx);
+}
+
+void MetricsExporter::add_coproc_thread(struct coproc_thread_context *ctx)
+{
+    coproc_ctxs.push_back(ctx);
+}
+
+int MetricsExporter::start()
+{
+    struct sockaddr_un addr;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        RTE_LOG(ERR, MAIN, "metrics: socket path is too long: %s\n", socket_path.c_str());
+        return -1;
+    }
+    memzero(&addr, 1);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        RTE_LOG(ERR, MAIN, "metrics: socket() failed: %s\n", strerror(errno));
+        return -1;
+    }
+    unlink(socket_path.c_str());  /* Remove the stale one from previous runs. */
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || listen(listen_fd, 8) != 0) {
+        RTE_LOG(ERR, MAIN, "metrics: cannot listen on %s: %s\n", socket_path.c_str(), strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    running = true;
+    if (pthread_create(&tid, nullptr, MetricsExporter::thread_main, this) != 0) {
+        RTE_LOG(ERR, MAIN, "metrics: cannot spawn the exporter thread.\n");
+        running = false;
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(socket_path.c_str());
+        return -1;
+    }
+    RTE_LOG(INFO, MAIN, "metrics: exporting on unix:%s\n", socket_path.c_str());
+    return 0;
+}
+
+void MetricsExporter::stop()
+{
+    if (!running)
+        return;
+    running = false;
+    pthread_join(tid, nullptr);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path.c_str());
+}
+
+void *MetricsExporter::thread_main(void *arg)
+{
+    MetricsExporter *self = (MetricsExporter *) arg;
+    self->serve();
+    return nullptr;
+}
+
+void MetricsExporter::serve()
+{
+    string buf;
+    while (running) {
+        struct pollfd pfd;
+        pfd.fd = listen_fd;
+        pfd.events = POLLIN;
+        int ret = poll(&pfd, 1, METRICS_POLL_TIMEOUT_MS);
+        if (ret <= 0)
+            continue;
+        int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd < 0)
+            continue;
+        buf.clear();
+        render(buf);
+        size_t written = 0;
+        while (written < buf.size()) {
+            ssize_t n = send(client_fd, buf.data() + written, buf.size() - written, MSG_NOSIGNAL);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR)
+                    continue;
+                break;
+            }
+            written += n;
+        }
+        close(client_fd);
+    }
+}
+
+void MetricsExporter::render(string &out) const
+{
+    PrometheusWriter w(out);
+    render_ports(w);
+    render_elements(w);
+    render_queues(w);
+}
+
+void MetricsExporter::render_ports(PrometheusWriter &w) const
+{
+    struct io_thread_stat totals[NBA_MAX_NODES];
+    unsigned num_ports = 0;
+    bool node_active[NBA_MAX_NODES] = {false,};
+    memzero(totals, NBA_MAX_NODES);
+    for (struct io_thread_context *ctx : io_ctxs) {
+        if (!ctx->stats_ready)
+            continue;
+        rte_rmb();
+        unsigned node_id = ctx->loc.node_id;
+        num_ports = ctx->node_stat->num_ports;
+        node_active[node_id] = true;
+        for (unsigned j = 0; j < num_ports; j++)
+            io_port_stat_accumulate(&totals[node_id].port_stats[j], &ctx->port_stats[j]);
+    }
+
+    struct {
+        const char *name;
+        const char *help;
+        size_t offset;
+    } port_metrics[] = {
+        {"nba_port_rx_packets_total", "Packets received by IO threads.",
+         offsetof(struct io_port_stat, num_recv_pkts)},
+        {"nba_port_rx_bytes_total", "Bytes received by IO threads, including Ethernet overheads.",
+         offsetof(struct io_port_stat, num_recv_bytes)},
+        {"nba_port_tx_packets_total", "Packets transmitted by IO threads.",
+         offsetof(struct io_port_stat, num_sent_pkts)},
+        {"nba_port_tx_bytes_total", "Bytes transmitted by IO threads, including Ethernet overheads.",
+         offsetof(struct io_port_stat, num_sent_bytes)},
+        {"nba_port_sw_drop_packets_total", "Packets dropped in software.",
+         offsetof(struct io_port_stat, num_sw_drop_pkts)},
+        {"nba_port_tx_drop_packets_total", "Packets dropped due to TX failures.",
+         offsetof(struct io_port_stat, num_tx_drop_pkts)},
+        {"nba_port_invalid_packets_total", "Invalid packets received.",
+         offsetof(struct io_port_stat, num_invalid_pkts)},
+    };
+    for (auto &m : port_metrics) {
+        w.family(m.name, "counter", m.help);
+        for (unsigned node_id = 0; node_id < NBA_MAX_NODES; node_id++) {
+            if (!node_active[node_id])
+                continue;
+            for (unsigned j = 0; j < num_ports; j++) {
+                const char *p = (const char *) &totals[node_id].port_stats[j];
+                w.sample(m.name, {{"node", to_string(node_id)}, {"port", to_string(j)}},
+                         *(const uint64_t *) (p + m.offset));
+            }
+        }
+    }
+
+    /* NIC-level drops are shared by all nodes. */
+    w.family("nba_port_rx_hw_drop_packets_total", "counter",
+             "Packets dropped by the NIC (RX errors and missed).");
+    for (unsigned j = 0; j < num_ports; j++) {
+        struct rte_eth_stats s;
+        if (rte_eth_stats_get((uint8_t) j, &s) != 0)
+            continue;
+        w.sample("nba_port_rx_hw_drop_packets_total", {{"port", to_string(j)}},
+                 (uint64_t) (s.ierrors + s.imissed));
+    }
+}
+
+void MetricsExporter::render_elements(PrometheusWriter &w) const
+{
+    struct {
+        const char *name;
+        const char *help;
+        size_t offset;
+    } elem_metrics[] = {
+        {"nba_element_batches_total", "Batches processed by the element.",
+         offsetof(struct element_stat, num_batches)},
+        {"nba_element_packets_total", "Packets processed by the element.",
+         offsetof(struct element_stat, num_pkts)},
+        {"nba_element_offloaded_packets_total", "Packets offloaded by the element.",
+         offsetof(struct element_stat, num_offloaded_pkts)},
+        {"nba_element_cpu_cycles_total", "TSC cycles spent in the CPU handlers of the element "
+         "(only with COMP_ELEMENT_CYCLES).",
+         offsetof(struct element_stat, num_cycles)},
+    };
+    for (auto &m : elem_metrics) {
+        w.family(m.name, "counter", m.help);
+        for (struct io_thread_context *ctx : io_ctxs) {
+            if (!ctx->stats_ready)
+                continue;
+            rte_rmb();
+            for (unsigned c = 0; c < ctx->num_comp_ctxs; c++) {
+                comp_thread_context *comp_ctx = ctx->comp_ctxs[c];
+                /* Graph reloads destroy the replaced graphs under this lock. */
+                comp_ctx->elemgraph_lock->acquire();
+                const FixedRing<Element *> &elements = comp_ctx->elem_graph->get_elements();
+                unsigned i = 0;
+                for (Element *el : elements) {
+                    const volatile char *p = (const volatile char *) &el->get_stat();
+                    w.sample(m.name, {{"node", to_string(comp_ctx->loc.node_id)},
+                                      {"thread", to_string(comp_ctx->loc.local_thread_idx)},
+                                      {"element", el->class_name()},
+                                      {"index", to_string(i)}},
+                             (uint64_t) *(const volatile uint64_t *) (p + m.offset));
+                    i ++;
+                }
+                comp_ctx->elemgraph_lock->release();
+            }
+        }
+    }
+    w.family("nba_graph_reloads_total", "counter",
+             "Element graphs replaced by reloads.");
+    for (struct io_thread_context *ctx : io_ctxs) {
+        if (!ctx->stats_ready)
+            continue;
+        rte_rmb();
+        for (unsigned c = 0; c < ctx->num_comp_ctxs; c++) {
+            comp_thread_context *comp_ctx = ctx->comp_ctxs[c];
+            w.sample("nba_graph_reloads_total", {{"node", to_string(comp_ctx->loc.node_id)},
+                                                 {"thread", to_string(comp_ctx->loc.local_thread_idx)}},
+                     (uint64_t) *(const volatile uint64_t *) &comp_ctx->num_graph_swaps);
+        }
+    }
+}
+
+void MetricsExporter::render_queues(PrometheusWriter &w) const
+{
+    w.family("nba_offload_input_queue_depth", "gauge",
+             "Offload tasks waiting in the coprocessor input queue.");
+    for (struct coproc_thread_context *ctx : coproc_ctxs) {
+        if (ctx->task_input_queue == nullptr)
+            continue;
+        w.sample("nba_offload_input_queue_depth",
+                 {{"node", to_string(ctx->loc.node_id)},
+                  {"device", to_string(ctx->device_id)},
+                  {"driver", ctx->driver}},
+                 (uint64_t) rte_ring_count(ctx->task_input_queue));
+    }
+    w.family("nba_offload_completion_queue_depth", "gauge",
+             "Completed offload tasks waiting for the computation thread.");
+    for (struct io_thread_context *ctx : io_ctxs) {
+        for (unsigned c = 0; c < ctx->num_comp_ctxs; c++) {
+            comp_thread_context *comp_ctx = ctx->comp_ctxs[c];
+            if (comp_ctx->task_completion_queue == nullptr)
+                continue;
+            w.sample("nba_offload_completion_queue_depth",
+                     {{"node", to_string(comp_ctx->loc.node_id)},
+                      {"thread", to_string(comp_ctx->loc.local_thread_idx)}},
+                     (uint64_t) rte_ring_count(comp_ctx->task_completion_queue));
+        }
+    }
+    w.family("nba_comp_input_queue_depth", "gauge",
+             "Packet batches waiting in the computation thread input queue.");
+    for (struct io_thread_context *ctx : io_ctxs) {
+        for (unsigned c = 0; c < ctx->num_comp_ctxs; c++) {
+            comp_thread_context *comp_ctx = ctx->comp_ctxs[c];
+            if (comp_ctx->rx_queue == nullptr)
+                continue;
+            w.sample("nba_comp_input_queue_depth",
+                     {{"node", to_string(comp_ctx->loc.node_id)},
+                      {"thread", to_string(comp_ctx->loc.local_thread_idx)}},
+                     (uint64_t) rte_ring_count(comp_ctx->rx_queue));
+        }
+    }
+    struct {
+        const char *name;
+        const char *help;
+        uint64_t comp_thread_context::*field;
+    } steal_metrics[] = {
+        {"nba_comp_stolen_batches_total", "Packet batches stolen from other computation threads.",
+         &comp_thread_context::num_stolen_batches},
+        {"nba_comp_stolen_packets_total", "Packets in the stolen batches.",
+         &comp_thread_context::num_stolen_pkts},
+    };
+    for (auto &m : steal_metrics) {
+        w.family(m.name, "counter", m.help);
+        for (struct io_thread_context *ctx : io_ctxs) {
+            for (unsigned c = 0; c < ctx->num_comp_ctxs; c++) {
+                comp_thread_context *comp_ctx = ctx->comp_ctxs[c];
+                if (comp_ctx->steal_victims == nullptr)
+                    continue;
+                w.sample(m.name, {{"node", to_string(comp_ctx->loc.node_id)},
+                                  {"thread", to_string(comp_ctx->loc.local_thread_idx)}},
+                         *(const volatile uint64_t *) &(comp_ctx->*m.field));
+            }
+        }
+    }
+}
+
+// vim: ts=8 sts=4 sw=4 et
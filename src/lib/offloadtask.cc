@@ -1,5 +1,7 @@
 #include <nba/core/intrinsic.hh>
 #include <nba/core/enumerate.hh>
+#include <nba/core/threading.hh>
+#include <nba/core/idlebackoff.hh>
 #include <nba/framework/logging.hh>
 #include <nba/framework/datablock.hh>
 #include <nba/framework/elementgraph.hh>
@@ -428,6 +430,11 @@ void OffloadTask::notify_completion()
     state = TASK_FINISHED;
     assert(0 == rte_ring_sp_enqueue(completion_queue, (void *) this));
     ev_async_send(src_loop, completion_watcher);
+    io_thread_context *io_ctx = comp_ctx->io_ctx;
+    /* Order the enqueue before reading the flag (see IdleBackoff). */
+    rte_mb();
+    if (io_ctx->idle_backoff->is_sleeping())
+        io_ctx->idle_event->trigger();
 }
 
 void OffloadTask::postprocess()
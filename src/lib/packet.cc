@@ -1,5 +1,6 @@
 #include <nba/element/packet.hh>
 #include <nba/element/packetbatch.hh>
+#include <nba/core/mbufchain.hh>
 #include <cstring>
 #include <rte_mbuf.h>
 #include <rte_mempool.h>
@@ -8,6 +9,7 @@ using namespace nba;
 
 namespace nba {
 thread_local struct rte_mempool *packet_pool = nullptr;
+thread_local struct rte_mempool *jumbo_pool = nullptr;
 
 static void packet_init_packet(struct rte_mempool *mp, void *arg, void *obj, unsigned idx)
 {
@@ -27,6 +29,72 @@ struct rte_mempool *packet_create_mempool(size_t size, int node_id, int core_id)
     return packet_pool;
 }
 
+struct rte_mempool *jumbo_create_mempool(size_t size, size_t frame_size, int node_id, int core_id)
+{
+    char temp[RTE_MEMPOOL_NAMESIZE];
+    snprintf(temp, RTE_MEMPOOL_NAMESIZE, "jumbo@%u:%u", node_id, core_id);
+    assert(jumbo_pool == nullptr);
+    /* The private area must match the RX mbufs since they are attached
+     * to these buffers as indirect mbufs. */
+    jumbo_pool = rte_pktmbuf_pool_create(temp, size, 32, sizeof(Packet),
+                                         RTE_PKTMBUF_HEADROOM + frame_size, node_id);
+    assert(jumbo_pool != nullptr);
+    return jumbo_pool;
+}
+
+bool Packet::linearize_chain()
+{
+    uint32_t len = rte_pktmbuf_pkt_len(base);
+    if (rte_mbuf_refcnt_read(base) > 1 || RTE_MBUF_INDIRECT(base))
+        return false;
+    if (len <= rte_pktmbuf_data_len(base) + rte_pktmbuf_tailroom(base)) {
+        /* The rest of the chain fits in the tailroom of the first segment. */
+        uint32_t off = rte_pktmbuf_data_len(base);
+        mbuf_copy_out(base->next, 0, len - off, rte_pktmbuf_mtod(base, char *) + off);
+        rte_pktmbuf_free(base->next);
+        base->next = nullptr;
+        base->nb_segs = 1;
+        base->data_len = len;
+        return true;
+    }
+
+    /* Move the data to a jumbo buffer and attach it to the first
+     * segment, which keeps this Packet object and its annotations. */
+    if (jumbo_pool == nullptr)
+        return false;
+    struct rte_mbuf *m = rte_pktmbuf_alloc(jumbo_pool);
+    if (m == nullptr)
+        return false;
+    uint16_t headroom = rte_pktmbuf_headroom(base);
+    if (headroom + len > m->buf_len) {
+        rte_pktmbuf_free(m);
+        return false;
+    }
+    m->data_off = headroom;
+    mbuf_copy_out(base, 0, len, rte_pktmbuf_mtod(m, char *));
+    m->data_len = len;
+    m->pkt_len = len;
+
+    /* Attaching copies the RX metadata from m; preserve ours. */
+    uint8_t port = base->port;
+    uint64_t ol_flags = base->ol_flags;
+    uint32_t packet_type = base->packet_type;
+    uint16_t vlan_tci = base->vlan_tci;
+    auto hash = base->hash;
+    struct rte_mbuf *rest = base->next;
+    base->next = nullptr;
+    base->nb_segs = 1;
+    rte_pktmbuf_attach(base, m);
+    rte_pktmbuf_free(m);    /* base now holds the only reference. */
+    base->port = port;
+    base->ol_flags = ol_flags | IND_ATTACHED_MBUF;
+    base->packet_type = packet_type;
+    base->vlan_tci = vlan_tci;
+    base->hash = hash;
+    rte_pktmbuf_free(rest);
+    return true;
+}
+
 void Packet::kill()
 {
     mother->results[bidx] = PacketDisposition::DROP;
@@ -36,6 +104,11 @@ void Packet::kill()
     #endif
 }
 
+void Packet::pend()
+{
+    mother->results[bidx] = PacketDisposition::PENDING;
+}
+
 }
 
 // vim: ts=8 sts=4 sw=4 et
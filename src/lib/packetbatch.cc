@@ -3,6 +3,7 @@
 #include <rte_memory.h>
 #include <rte_mempool.h>
 #include <rte_mbuf.h>
+#include <rte_ring.h>
 #include <rte_branch_prediction.h>
 
 using namespace std;
@@ -35,14 +36,34 @@ void PacketBatch::collect_excluded_packets()
 void PacketBatch::clean_drops(struct rte_ring *drop_queue)
 {
     if (this->drop_count > 0) {
-        rte_ring_enqueue_bulk(drop_queue,
-                              (void **) &this->packets[this->count],
-                              this->drop_count);
+        if (unlikely(rte_ring_enqueue_bulk(drop_queue,
+                                           (void **) &this->packets[this->count],
+                                           this->drop_count) == -ENOBUFS)) {
+            for (unsigned i = 0; i < this->drop_count; i++)
+                rte_pktmbuf_free(this->packets[this->count + i]);
+        }
         this->drop_count = 0;
     }
 }
 #endif
 
+void PacketBatch::drop_packet(struct rte_ring *drop_queue, struct rte_mbuf *pkt)
+{
+    if (unlikely(rte_ring_enqueue(drop_queue, pkt) == -ENOBUFS))
+        rte_pktmbuf_free(pkt);
+}
+
+void PacketBatch::drop_all(struct rte_ring *drop_queue)
+{
+    PacketBatch *batch = this;
+    FOR_EACH_PACKET(batch) {
+        drop_packet(drop_queue, batch->packets[pkt_idx]);
+    } END_FOR;
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    clean_drops(drop_queue);
+    #endif
+}
+
 }
 
 // vim: ts=8 sts=4 sw=4 et
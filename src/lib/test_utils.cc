@@ -9,6 +9,17 @@
 using namespace std;
 using namespace nba;
 
+/* rte_mbuf is cache-aligned; malloc() alone may misalign it. */
+static struct rte_mbuf *alloc_test_mbuf()
+{
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, CACHE_LINE_SIZE, sizeof(struct rte_mbuf)
+                                              + RTE_PKTMBUF_HEADROOM
+                                              + NBA_MAX_PACKET_SIZE) != 0)
+        return nullptr;
+    return (struct rte_mbuf *) ptr;
+}
+
 PacketBatch *nba::testing::create_batch
 (size_t num_pkts, size_t pkt_size, pkt_init_callback_t init_cb)
 {
@@ -24,16 +35,16 @@ PacketBatch *nba::testing::create_batch
     Packet *prev_pkt = nullptr;
     #endif
     for (unsigned pkt_idx = 0; pkt_idx < num_pkts; pkt_idx++) {
-        batch->packets[pkt_idx] = (struct rte_mbuf *) malloc(sizeof(struct rte_mbuf)
-                                                             + RTE_PKTMBUF_HEADROOM
-                                                             + NBA_MAX_PACKET_SIZE);
+        batch->packets[pkt_idx] = alloc_test_mbuf();
     }
     FOR_EACH_PACKET_ALL_INIT_PREFETCH(batch, 8u) {
         assert(pkt_idx < num_pkts);
         assert(nullptr != batch->packets[pkt_idx]);
         batch->packets[pkt_idx]->nb_segs = 1;
+        batch->packets[pkt_idx]->next = nullptr;
         batch->packets[pkt_idx]->buf_addr = (void *) ((uintptr_t) batch->packets[pkt_idx]
                                                       + sizeof(struct rte_mbuf));
+        batch->packets[pkt_idx]->buf_len = RTE_PKTMBUF_HEADROOM + NBA_MAX_PACKET_SIZE;
         batch->packets[pkt_idx]->data_off = RTE_PKTMBUF_HEADROOM;
         batch->packets[pkt_idx]->port = 0;
         batch->packets[pkt_idx]->pkt_len = pkt_size;
@@ -59,6 +70,41 @@ PacketBatch *nba::testing::create_batch
     return batch;
 }
 
+PacketBatch *nba::testing::create_chained_batch
+(size_t num_pkts, size_t pkt_size, size_t seg_size, pkt_init_callback_t init_cb)
+{
+    assert(seg_size > 0 && seg_size <= NBA_MAX_PACKET_SIZE);
+    PacketBatch *batch = create_batch(num_pkts, RTE_MIN(pkt_size, seg_size),
+                                      [](size_t, struct Packet *) { });
+    for (unsigned pkt_idx = 0; pkt_idx < num_pkts; pkt_idx++) {
+        struct rte_mbuf *head = batch->packets[pkt_idx];
+        struct rte_mbuf *last = head;
+        size_t remaining = pkt_size - head->data_len;
+        while (remaining > 0) {
+            struct rte_mbuf *seg = alloc_test_mbuf();
+            assert(nullptr != seg);
+            seg->nb_segs = 1;
+            seg->next = nullptr;
+            seg->buf_addr = (void *) ((uintptr_t) seg + sizeof(struct rte_mbuf));
+            seg->buf_len = RTE_PKTMBUF_HEADROOM + NBA_MAX_PACKET_SIZE;
+            seg->data_off = RTE_PKTMBUF_HEADROOM;
+            seg->port = head->port;
+            seg->data_len = RTE_MIN(remaining, seg_size);
+            seg->pkt_len = seg->data_len;
+            memset(rte_pktmbuf_mtod(seg, void *), 0, seg->data_len);
+            remaining -= seg->data_len;
+            last->next = seg;
+            last = seg;
+            head->nb_segs ++;
+        }
+        head->pkt_len = pkt_size;
+    }
+    FOR_EACH_PACKET_ALL(batch) {
+        init_cb(pkt_idx, Packet::from_base(batch->packets[pkt_idx]));
+    } END_FOR_ALL;
+    return batch;
+}
+
 void nba::testing::free_batch(PacketBatch *batch)
 {
     if (batch->datablock_states != nullptr) {
@@ -67,7 +113,12 @@ void nba::testing::free_batch(PacketBatch *batch)
         delete batch->datablock_states;
     }
     for (unsigned pkt_idx = 0; pkt_idx < batch->count; pkt_idx++) {
-        free(batch->packets[pkt_idx]);
+        struct rte_mbuf *seg = batch->packets[pkt_idx];
+        while (seg != nullptr) {
+            struct rte_mbuf *next = seg->next;
+            free(seg);
+            seg = next;
+        }
     }
     delete batch;
 }
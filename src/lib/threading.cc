@@ -35,6 +35,11 @@ int nba::thread_wrapper(void *arg) {
     }
 
     if (found == -1) {
+        /* Computation threads have their own cores in the decoupled mode. */
+        for (i = 0; i < col->num_comp_threads; i++) {
+            if (core_id == col->comp_threads[i].comp_ctx->loc.core_id)
+                return comp_loop(col->comp_threads[i].comp_ctx);
+        }
         /* Corresponding IO thread is not found.
          * Exit silently. */
         return 0;
@@ -9,34 +9,25 @@
 #include <nba/core/intrinsic.hh>
 #include <nba/core/timing.hh>
 #include <nba/core/threading.hh>
+#include <nba/core/idlebackoff.hh>
 #include <nba/core/strutils.hh>
 #include <nba/core/singleton.hh>
 #include <nba/core/queue.hh>
+#include <nba/core/flowsequencer.hh>
 #include <nba/framework/config.hh>
 #include <nba/framework/io.hh>
 #include <nba/framework/computedevice.hh>
+#include <nba/framework/devicefactory.hh>
 #include <nba/framework/computation.hh>
 #include <nba/framework/coprocessor.hh>
 #include <nba/framework/datablock.hh>
 #include <nba/framework/elementgraph.hh>
 #include <nba/framework/logging.hh>
+#include <nba/framework/metrics.hh>
+#include <nba/framework/graphreload.hh>
 #include <nba/element/packet.hh>
 #include <nba/element/annotation.hh>
 #include <nba/element/nodelocalstorage.hh>
-#ifdef USE_CUDA
-#include <nba/engines/cuda/utils.hh>
-#include <nba/engines/cuda/computedevice.hh>
-#include <nba/engines/cuda/computecontext.hh>
-#endif
-#ifdef USE_KNAPP
-#include <nba/engines/knapp/computedevice.hh>
-#include <nba/engines/knapp/computecontext.hh>
-#endif
-#ifdef USE_PHI
-#include <nba/engines/phi/utils.hh>
-#include <nba/engines/phi/computedevice.hh>
-#include <nba/engines/phi/computecontext.hh>
-#endif
 
 #include <set>
 #include <string>
@@ -61,6 +52,7 @@
 #include <rte_config.h>
 #include <rte_common.h>
 #include <rte_eal.h>
+#include <rte_lcore.h>
 #include <rte_errno.h>
 #include <rte_log.h>
 #include <rte_memory.h>
@@ -88,9 +80,12 @@ static struct spawned_thread *io_threads;
 
 static CondVar _exit_cond;
 static bool _terminated = false;
+static MetricsExporter *metrics_exporter = nullptr;
+static GraphReloader *graph_reloader = nullptr;
 static thread_id_t main_thread_id;
 
 static void handle_signal(int signum);
+static void handle_reload_signal(int signum);
 
 static void invalid_cb(struct ev_loop *loop, struct ev_async *w, int revents)
 {
@@ -147,6 +142,9 @@ int main(int argc, char **argv)
         printf("  -l, --loglevel=[LEVEL]     : The log level to control output verbosity.\n"
                "                               The default is \"info\".  Available values are:\n"
                "                               debug, info, notice, warning, error, critical, alert, emergency.\n");
+        printf("  --dummy-device             : Add a CPU-backed dummy coprocessor to each NUMA node.\n");
+        printf("  --metrics-socket=[PATH]    : Export runtime statistics in the Prometheus text format\n"
+               "                               on the given Unix domain socket.\n");
     });
     /* At this moment, we cannot customize log level because we haven't
      * parsed the arguments yet. */
@@ -159,11 +157,14 @@ int main(int argc, char **argv)
 
     /* Parse command-line arguments. */
     bool preserve_latency = false;
+    std::string metrics_socket;
     char *system_config = new char[PATH_MAX];
     char *pipeline_config = new char[PATH_MAX];
 
     struct option long_opts[] = {
         {"preserve-latency", no_argument, NULL, 0},
+        {"dummy-device", no_argument, NULL, 0},
+        {"metrics-socket", required_argument, NULL, 0},
         {"loglevel", required_argument, NULL, 'l'},
         {0, 0, 0, 0}
     };
@@ -176,6 +177,11 @@ int main(int argc, char **argv)
             /* Process {long_opts[optidx].name}:{optarg} kv pairs. */
             if (!strcmp("preserve-latency", long_opts[optidx].name)) {
                 preserve_latency = true;
+            } else if (!strcmp("dummy-device", long_opts[optidx].name)) {
+                dummy_device = true;
+            } else if (!strcmp("metrics-socket", long_opts[optidx].name)) {
+                assert(optarg != NULL);
+                metrics_socket = optarg;
             }
             break;
         case 'l':
@@ -308,6 +314,15 @@ int main(int argc, char **argv)
     port_conf.fdir_conf.flex_conf.nb_payloads = 0;
     port_conf.fdir_conf.drop_queue       = 0;
 
+    /* Jumbo frames span multiple RX buffers (scattered RX) so that
+     * the buffer size stays the same for the ordinary frames. */
+    const unsigned jumbo_frame_size = system_params["JUMBO_FRAME_SIZE"];
+    if (jumbo_frame_size > ETHER_MAX_LEN) {
+        port_conf.rxmode.jumbo_frame    = true;
+        port_conf.rxmode.max_rx_pkt_len = jumbo_frame_size;
+        port_conf.rxmode.enable_scatter = (jumbo_frame_size > NBA_MAX_PACKET_SIZE);
+    }
+
     /* Per RX-queue configuration */
     struct rte_eth_rxconf rx_conf;
     memzero(&rx_conf, 1);
@@ -328,6 +343,8 @@ int main(int argc, char **argv)
     tx_conf.tx_rs_thresh   = 32;
     tx_conf.tx_free_thresh = 0; /* use PMD default value */
     tx_conf.txq_flags      = ETH_TXQ_FLAGS_NOMULTSEGS | ETH_TXQ_FLAGS_NOOFFLOADS;
+    if (port_conf.rxmode.enable_scatter)
+        tx_conf.txq_flags &= ~ETH_TXQ_FLAGS_NOMULTSEGS; /* forward chained mbufs as they are */
     const unsigned num_tx_desc = system_params["IO_DESC_PER_HWTXQ"];
 
     /* According to dpdk-dev mailing list,
@@ -448,9 +465,17 @@ int main(int argc, char **argv)
         for (struct queue_conf &conf : queue_confs) {
             char ring_name[RTE_RING_NAMESIZE];
             unsigned queue_length = 0;
+            unsigned ring_flags = 0;
             switch (conf.template_) {
             case SWRXQ:
-                queue_length = 32; // FIXME: unsued
+                /* Batch handoffs in the decoupled mode.  It holds all
+                 * batches of the consumer's batch_pool so that it never
+                 * overflows. */
+                queue_length = rte_align32pow2(system_params["BATCHPOOL_SIZE"] + 1);
+                ring_flags = (conf.mp_enq ? 0 : RING_F_SP_ENQ) | (conf.mc_deq ? 0 : RING_F_SC_DEQ);
+                /* Other comp threads steal from it. */
+                if (system_params["COMP_WORK_STEALING"] != 0)
+                    ring_flags &= ~RING_F_SC_DEQ;
                 break;
             case TASKINQ:
                 queue_length = system_params["COPROC_INPUTQ_LENGTH"];
@@ -464,7 +489,7 @@ int main(int argc, char **argv)
             snprintf(ring_name, RTE_RING_NAMESIZE,
                      "queue%u@%u/%u", qidx, conf.node_id, conf.template_);
             queues[qidx]  = rte_ring_create(ring_name, queue_length, conf.node_id,
-                                            0); //(conf.mp_enq ? 0 : RING_F_SP_ENQ) | (conf.mc_deq ? 0 : RING_F_SC_DEQ));
+                                            ring_flags); //(conf.mp_enq ? 0 : RING_F_SP_ENQ) | (conf.mc_deq ? 0 : RING_F_SC_DEQ));
             assert(queues[qidx] != NULL);
             assert(0 == rte_ring_set_water_mark(queues[qidx], queue_length - 8));
             qwatchers[qidx] = (struct ev_async *) rte_malloc_socket("ev_async", sizeof(struct ev_async),
@@ -484,6 +509,7 @@ int main(int argc, char **argv)
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
     signal(SIGUSR1, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);    /* until the graph reloader starts */
 
     /* Now we need to spawn IO, computation, corprocessor threads.
      * They have interdependencies of element graphs and device initialization steps as follows.
@@ -521,9 +547,9 @@ int main(int argc, char **argv)
 
     /* Spawn the coprocessor handler threads. */
     num_coprocessors = coproc_thread_confs.size();
-    coprocessor_threads = new struct spawned_thread[num_nodes];
-    for (unsigned node_id = 0; node_id < num_nodes; ++node_id)
-        coprocessor_threads[node_id].coproc_ctx = nullptr;
+    coprocessor_threads = new struct spawned_thread[num_coprocessors];
+    for (i = 0; i < num_coprocessors; i++)
+        coprocessor_threads[i].coproc_ctx = nullptr;
     {
         /* per-node data structures */
         unsigned per_node_counts[NBA_MAX_NODES] = {0,};
@@ -543,8 +569,8 @@ int main(int argc, char **argv)
 
             ctx->terminate_watcher = (struct ev_async *) rte_malloc_socket(NULL, sizeof(struct ev_async), CACHE_LINE_SIZE, node_id);
             ev_async_init(ctx->terminate_watcher, NULL);
-            coprocessor_threads[node_id].terminate_watcher = ctx->terminate_watcher;
-            coprocessor_threads[node_id].coproc_ctx = ctx;
+            coprocessor_threads[i].terminate_watcher = ctx->terminate_watcher;
+            coprocessor_threads[i].coproc_ctx = ctx;
             ctx->thread_init_done_barrier = new CountedBarrier(1);
             ctx->offloadable_init_barrier = new CountedBarrier(1);
             ctx->offloadable_init_done_barrier = new CountedBarrier(1);
@@ -552,6 +578,7 @@ int main(int argc, char **argv)
             ctx->comp_ctx_to_init_offloadable = NULL;
             ctx->task_input_queue_size = system_params["COPROC_INPUTQ_LENGTH"];
             ctx->device_id = conf.device_id;
+            ctx->driver = conf.driver.c_str();
             unsigned cnt = 0;
             for (unsigned j = 0; j < comp_thread_confs.size(); j++) {
                 if (numa_node_of_cpu(comp_thread_confs[j].core_id) == (signed) ctx->loc.node_id)
@@ -568,32 +595,17 @@ int main(int argc, char **argv)
             ctx->task_done_queue   = nullptr;
             ctx->task_done_watcher = nullptr;
 
-            /* WARNING: subclasses are usually LARGER than their base
-             * classes and malloc should use the subclass' size! */
-            // TODO: (generalization) apply factory pattern for arbitrary device.
-            ctx->device = nullptr;
-            #ifdef USE_CUDA
-            ctx->device = (ComputeDevice *) rte_malloc_socket(nullptr,
-                    sizeof(CUDAComputeDevice),
-                    CACHE_LINE_SIZE, ctx->loc.node_id);
-            #endif
-            #ifdef USE_KNAPP
-            ctx->device = (ComputeDevice *) rte_malloc_socket(nullptr,
-                    sizeof(KnappComputeDevice),
-                    CACHE_LINE_SIZE, ctx->loc.node_id);
-            #endif
-            #ifdef USE_PHI
-            ctx->device = (ComputeDevice *) rte_malloc_socket(nullptr,
-                    sizeof(PhiComputeDevice),
-                    CACHE_LINE_SIZE, ctx->loc.node_id);
-            #endif
-            assert(ctx->device != nullptr);
+            /* The factory knows the actual size of the device subclass. */
+            ctx->device = ComputeDeviceFactory::alloc(conf.driver, ctx->loc.node_id);
+            if (ctx->device == nullptr)
+                rte_exit(EXIT_FAILURE, "Could not allocate the coprocessor device (driver: %s).\n",
+                         conf.driver.c_str());
 
             queue_privs[conf.taskinq_idx] = ctx;
 
             threading::bind_cpu(ctx->loc.core_id); /* To ensure the thread is spawned in the node. */
             pthread_yield();
-            assert(0 == pthread_create(&coprocessor_threads[node_id].tid,
+            assert(0 == pthread_create(&coprocessor_threads[i].tid,
                                        nullptr, nba::coproc_loop, ctx));
 
             /* Initialize one-by-one. */
@@ -610,6 +622,12 @@ int main(int argc, char **argv)
     Lock *elemgraph_lock = new Lock();
 
     vector<comp_thread_context *> comp_thread_ctxs = vector<comp_thread_context*>();
+    const bool comp_decoupled = (system_params["COMP_DECOUPLED"] != 0);
+    const unsigned work_stealing = system_params["COMP_WORK_STEALING"];
+    if (work_stealing > NBA_MAX_COMP_WORK_STEALING)
+        rte_exit(EXIT_FAILURE, "Invalid COMP_WORK_STEALING: %u\n", work_stealing);
+    if (work_stealing != 0 && !comp_decoupled)
+        rte_exit(EXIT_FAILURE, "COMP_WORK_STEALING requires COMP_DECOUPLED.\n");
     {
         /* per-node data structures */
         NodeLocalStorage *nls[NBA_MAX_NODES];
@@ -646,9 +664,11 @@ int main(int argc, char **argv)
             ctx->num_batchpool_size = system_params["BATCHPOOL_SIZE"];
             ctx->num_taskpool_size = system_params["TASKPOOL_SIZE"];
             ctx->task_completion_queue_size = system_params["COPROC_COMPLETIONQ_LENGTH"];
+            ctx->jumbo_frame_size = system_params["JUMBO_FRAME_SIZE"];
             ctx->num_tx_ports = num_ports;
             ctx->num_nodes = num_nodes;
             ctx->preserve_latency = preserve_latency;
+            ctx->count_elem_cycles = (system_params["COMP_ELEMENT_CYCLES"] != 0);
 
             ctx->io_ctx = nullptr;
             ctx->coproc_ctx = nullptr;
@@ -659,67 +679,93 @@ int main(int argc, char **argv)
             NEW(node_id, ctx->elem_graph, ElementGraph, ctx);
             ctx->inspector = nullptr;
 
-            // TODO: extend to multiple devices
             NEW(node_id, ctx->named_offload_devices, TARG(unordered_map<string, ComputeDevice*>));
             NEW(node_id, ctx->offload_devices, vector<ComputeDevice*>);
-            if (num_coproc_threads > 0) {
-                struct coproc_thread_context *coproc_ctx = (coproc_thread_context *) queue_privs[conf.taskinq_idx];
-                if (coproc_ctx == nullptr) {
-                    ctx->coproc_ctx = nullptr;
-                    ctx->task_completion_queue = nullptr;
-                    ctx->task_completion_watcher = nullptr;
-                } else {
-                    ComputeDevice *device = coproc_ctx->device;
-                    device->input_watcher = qwatchers[conf.taskinq_idx];
-                    assert(coproc_ctx->task_input_watcher == device->input_watcher);
-                    #ifdef USE_CUDA
-                    ctx->named_offload_devices->insert(pair<string, ComputeDevice *>("cuda", device));
-                    #endif
-                    #ifdef USE_KNAPP
-                    ctx->named_offload_devices->insert(pair<string, ComputeDevice *>("knapp.phi", device));
-                    #endif
-                    #ifdef USE_PHI
-                    ctx->named_offload_devices->insert(pair<string, ComputeDevice *>("phi", device));
-                    #endif
-                    ctx->offload_devices->push_back(device);
-                    ctx->offload_input_queues[0] = queues[conf.taskinq_idx];
-                    ctx->task_completion_queue = queues[conf.taskoutq_idx];
-                    ctx->task_completion_watcher = qwatchers[conf.taskoutq_idx];
-                    ctx->coproc_ctx = coproc_ctx;
-                    RTE_LOG(DEBUG, MAIN, "Registering %lu datablocks...\n", num_datablocks);
-                    memzero(ctx->datablock_registry, NBA_MAX_DATABLOCKS);
-                    for (unsigned dbid = 0; dbid < num_datablocks; dbid++) {
-                        ctx->datablock_registry[dbid] = (datablock_ctors[dbid])();
-                        ctx->datablock_registry[dbid]->set_id(dbid);
-                        RTE_LOG(DEBUG, MAIN, "  [%u] %s\n", dbid, ctx->datablock_registry[dbid]->name());
-                    }
-                    NEW(ctx->loc.node_id, ctx->cctx_list, FixedRing<ComputeContext *>,
-                        2 * NBA_MAX_COPROCESSOR_TYPES, ctx->loc.node_id);
-                    for (unsigned k = 0, k_max = system_params["COPROC_CTX_PER_COMPTHREAD"]; k < k_max; k++) {
-                        ComputeContext *cctx = nullptr;
-                        cctx = device->get_available_context();
-                        assert(cctx != nullptr);
-                        assert(cctx->state == ComputeContext::READY);
-                        ctx->cctx_list->push_back(cctx);
-                    }
-                }
-            } else {
-                NEW(ctx->loc.node_id, ctx->cctx_list, FixedRing<ComputeContext *>,
+            ctx->task_completion_queue = nullptr;
+            ctx->task_completion_watcher = nullptr;
+            ctx->coproc_ctx = nullptr;
+            for (int taskinq_idx : conf.taskinq_idxs) {
+                struct coproc_thread_context *coproc_ctx = (coproc_thread_context *) queue_privs[taskinq_idx];
+                if (coproc_ctx == nullptr)
+                    continue;
+                unsigned dev_idx = ctx->offload_devices->size();
+                if (dev_idx == NBA_MAX_COPROCESSORS)
+                    rte_exit(EXIT_FAILURE, "Too many coprocessors per computation thread (max: %d).\n",
+                             NBA_MAX_COPROCESSORS);
+                ComputeDevice *device = coproc_ctx->device;
+                device->input_watcher = qwatchers[taskinq_idx];
+                assert(coproc_ctx->task_input_watcher == device->input_watcher);
+                /* Keep the first device for each type for per-type lookups. */
+                ctx->named_offload_devices->insert(pair<string, ComputeDevice *>(device->type_name, device));
+                ctx->offload_devices->push_back(device);
+                ctx->offload_input_queues[dev_idx] = queues[taskinq_idx];
+                ctx->offload_coproc_ctxs[dev_idx] = coproc_ctx;
+                NEW(ctx->loc.node_id, ctx->cctx_lists[dev_idx], FixedRing<ComputeContext *>,
                     2 * NBA_MAX_COPROCESSOR_TYPES, ctx->loc.node_id);
-                assert(ctx->cctx_list->empty());
-                ctx->task_completion_queue = NULL;
-                ctx->task_completion_watcher = NULL;
-                ctx->coproc_ctx = NULL;
+                for (unsigned k = 0, k_max = system_params["COPROC_CTX_PER_COMPTHREAD"]; k < k_max; k++) {
+                    ComputeContext *cctx = nullptr;
+                    cctx = device->get_available_context();
+                    assert(cctx != nullptr);
+                    assert(cctx->state == ComputeContext::READY);
+                    ctx->cctx_lists[dev_idx]->push_back(cctx);
+                }
+                RTE_LOG(INFO, MAIN, "comp-thread@%u: offload device[%u] = %s:%u (coproc-thread@%u)\n",
+                        ctx->loc.core_id, dev_idx, device->type_name.c_str(),
+                        device->device_id, coproc_ctx->loc.core_id);
+            }
+            if (ctx->offload_devices->size() > 0) {
+                /* All coprocessors share the same completion queue per
+                 * computation thread. */
+                ctx->task_completion_queue = queues[conf.taskoutq_idx];
+                ctx->task_completion_watcher = qwatchers[conf.taskoutq_idx];
+                ctx->coproc_ctx = ctx->offload_coproc_ctxs[0];
+                RTE_LOG(DEBUG, MAIN, "Registering %lu datablocks...\n", num_datablocks);
+                memzero(ctx->datablock_registry, NBA_MAX_DATABLOCKS);
+                for (unsigned dbid = 0; dbid < num_datablocks; dbid++) {
+                    ctx->datablock_registry[dbid] = (datablock_ctors[dbid])();
+                    ctx->datablock_registry[dbid]->set_id(dbid);
+                    RTE_LOG(DEBUG, MAIN, "  [%u] %s\n", dbid, ctx->datablock_registry[dbid]->name());
+                }
             }
 
             ctx->rx_queue = queues[conf.swrxq_idx];
             ctx->rx_watcher = qwatchers[conf.swrxq_idx];
             queue_privs[conf.swrxq_idx] = (void *) ctx;
+            if (comp_decoupled) {
+                for (auto &io_conf : io_thread_confs)
+                    if (io_conf.core_id == conf.core_id)
+                        rte_exit(EXIT_FAILURE, "comp-thread@%u shares the core with an io thread "
+                                 "in the decoupled mode.\n", conf.core_id);
+                if (!rte_lcore_is_enabled(conf.core_id))
+                    rte_exit(EXIT_FAILURE, "comp-thread@%u is not in the EAL coremask.\n", conf.core_id);
+                char ring_name[RTE_RING_NAMESIZE];
+                snprintf(ring_name, RTE_RING_NAMESIZE, "txret.%u:%u@%u",
+                         ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
+                ctx->tx_return_queue = rte_ring_create(ring_name,
+                                                       rte_align32pow2(ctx->num_batchpool_size + 1),
+                                                       node_id, RING_F_SP_ENQ | RING_F_SC_DEQ);
+                assert(ctx->tx_return_queue != nullptr);
+                if (work_stealing == 2)
+                    NEW(node_id, ctx->flow_seq, FlowSequencer);
+            }
 
             ctx->build_element_graph(pipeline_config);
             comp_thread_ctxs.push_back(ctx);
             i++;
         }
+
+        /* Let each comp thread steal from the others in the same node. */
+        if (work_stealing != 0) {
+            for (comp_thread_context *ctx : comp_thread_ctxs) {
+                NEW(ctx->loc.node_id, ctx->steal_victims, vector<comp_thread_context*>);
+                for (comp_thread_context *other : comp_thread_ctxs)
+                    if (other != ctx && other->loc.node_id == ctx->loc.node_id)
+                        ctx->steal_victims->push_back(other);
+                RTE_LOG(INFO, MAIN, "comp-thread@%u may steal batches from %lu threads%s.\n",
+                        ctx->loc.core_id, ctx->steal_victims->size(),
+                        (work_stealing == 2) ? " keeping per-flow order" : "");
+            }
+        }
     }
 
     /* Initialze elements for this system. (once per elements) */
@@ -752,26 +798,21 @@ int main(int argc, char **argv)
         }
     }
 
-    /* Initialize offloadable elements in coprocessor threads. */
-    if (num_coproc_threads > 0) {
-        for (unsigned node_id = 0; node_id < num_nodes; ++node_id) {
-            node_initialized[node_id] = false;
-        }
-        for (unsigned node_id : existing_nodes) {
-            // TODO: generalize mapping of core and coprocessors
-            for (comp_thread_context *ctx : comp_thread_ctxs) {
-                RTE_LOG(NOTICE, MAIN, "comp_thread_context at node %d core %d\n", ctx->loc.node_id, ctx->loc.core_id);
-                if (ctx->loc.node_id == node_id && !node_initialized[node_id]) {
-                    RTE_LOG(NOTICE, MAIN, "initializing offloadables in coproc-thread@%u(%u) with comp-thread@%u\n",
-                            coprocessor_threads[node_id].coproc_ctx->loc.core_id,
-                            node_id, ctx->loc.core_id);
-                    coprocessor_threads[node_id].coproc_ctx->comp_ctx_to_init_offloadable = ctx;
-                    coprocessor_threads[node_id].coproc_ctx->offloadable_init_barrier->proceed();
-                    coprocessor_threads[node_id].coproc_ctx->offloadable_init_done_barrier->wait();
-                    node_initialized[node_id] = true;
-                }
+    /* Initialize offloadable elements in coprocessor threads.
+     * Each device has its own memory, so we initialize them per device
+     * using the element graph of a computation thread in the same node. */
+    for (i = 0; i < num_coprocessors; i++) {
+        struct coproc_thread_context *coproc_ctx = coprocessor_threads[i].coproc_ctx;
+        for (comp_thread_context *ctx : comp_thread_ctxs) {
+            if (ctx->loc.node_id == coproc_ctx->loc.node_id) {
+                RTE_LOG(NOTICE, MAIN, "initializing offloadables in coproc-thread@%u(%u) with comp-thread@%u\n",
+                        coproc_ctx->loc.core_id, coproc_ctx->loc.node_id, ctx->loc.core_id);
+                coproc_ctx->comp_ctx_to_init_offloadable = ctx;
+                break;
             }
         }
+        coproc_ctx->offloadable_init_barrier->proceed();
+        coproc_ctx->offloadable_init_done_barrier->wait();
     }
 
     /* Initialize elements for each computation thread. */
@@ -782,10 +823,8 @@ int main(int argc, char **argv)
 
     /* Let the coprocessor threads to run its loop as we initialized
      * all necessary stuffs including computation threads. */
-    if (num_coprocessors > 0)
-		for (unsigned node_id : existing_nodes) {
-			coprocessor_threads[node_id].coproc_ctx->loopstart_barrier->proceed();
-		}
+    for (i = 0; i < num_coprocessors; i++)
+        coprocessor_threads[i].coproc_ctx->loopstart_barrier->proceed();
 
     /* Spawn the IO threads. */
     io_threads = new struct spawned_thread[num_io_threads];
@@ -804,15 +843,12 @@ int main(int argc, char **argv)
             node_stats[node_id]->node_id = node_id;
             node_stats[node_id]->num_ports = num_ports;
             node_stats[node_id]->last_time = 0;
-            for (j = 0; j < node_stats[node_id]->num_ports; j++) {
-                node_stats[node_id]->port_stats[j].num_recv_pkts = RTE_ATOMIC64_INIT(0);
-                node_stats[node_id]->port_stats[j].num_sent_pkts = RTE_ATOMIC64_INIT(0);
-                node_stats[node_id]->port_stats[j].num_sw_drop_pkts = RTE_ATOMIC64_INIT(0);
-                node_stats[node_id]->port_stats[j].num_rx_drop_pkts = RTE_ATOMIC64_INIT(0);
-                node_stats[node_id]->port_stats[j].num_tx_drop_pkts = RTE_ATOMIC64_INIT(0);
-                node_stats[node_id]->port_stats[j].num_invalid_pkts = RTE_ATOMIC64_INIT(0);
-            }
+            memzero(node_stats[node_id]->thread_ctxs, NBA_MAX_CORES);
             memzero(&node_stats[node_id]->last_total, 1);
+            memzero(&node_stats[node_id]->pkt_latency[0][0], NBA_MAX_PORTS * IO_NUM_LATENCY_PATHS);
+            memzero(&node_stats[node_id]->offload_rtt, 1);
+            node_stats[node_id]->last_stolen_batches = 0;
+            node_stats[node_id]->last_stolen_pkts = 0;
             unsigned num_io_threads_in_node = 0;
             for (auto it = io_thread_confs.begin(); it != io_thread_confs.end(); it++) {
                 struct io_thread_conf &conf = *it;
@@ -864,9 +900,13 @@ int main(int argc, char **argv)
                                                                            CACHE_LINE_SIZE, node_id);
             ev_async_init(ctx->terminate_watcher, NULL);
             NEW(node_id, ctx->io_lock, Lock);
+            NEW(node_id, ctx->idle_backoff, IdleBackoff);
+            NEW(node_id, ctx->idle_event, UserEvent);
             ctx->init_cond = init_conds[node_id];
             ctx->init_done = init_done_flags[node_id];
             ctx->node_stat = node_stats[node_id];
+            ctx->node_stat->thread_ctxs[ctx->loc.local_thread_idx] = ctx;
+            ctx->stats_ready = false;
             ctx->node_stat_watcher = node_stat_watchers[node_id];
             ctx->node_master_flag = node_master_flags[node_id];
             ctx->random_seed = rand();
@@ -919,12 +959,24 @@ int main(int argc, char **argv)
             io_threads[i].terminate_watcher = ctx->terminate_watcher;
             io_threads[i].io_ctx = ctx;
 
-            comp_thread_context *comp_ctx = (comp_thread_context *) queue_privs[conf.swrxq_idx];
-            assert(comp_ctx != NULL);
-            RTE_LOG(DEBUG, MAIN, "   mapping io thread %u and comp thread @%u\n",
-                    ctx->loc.core_id, comp_ctx->loc.core_id);
-            comp_ctx->io_ctx = ctx;
-            ctx->comp_ctx = comp_ctx;
+            if (!comp_decoupled && conf.swrxq_idxs.size() > 1)
+                rte_exit(EXIT_FAILURE, "io-thread@%u has multiple comp threads, "
+                         "which requires COMP_DECOUPLED.\n", ctx->loc.core_id);
+            if (conf.swrxq_idxs.size() > NBA_MAX_COMPTHREADS_PER_IOTHREAD)
+                rte_exit(EXIT_FAILURE, "Too many comp threads per io thread (max: %d).\n",
+                         NBA_MAX_COMPTHREADS_PER_IOTHREAD);
+            ctx->comp_decoupled = comp_decoupled;
+            ctx->num_comp_ctxs = 0;
+            ctx->next_comp_idx = 0;
+            for (int swrxq_idx : conf.swrxq_idxs) {
+                comp_thread_context *comp_ctx = (comp_thread_context *) queue_privs[swrxq_idx];
+                assert(comp_ctx != NULL);
+                RTE_LOG(DEBUG, MAIN, "   mapping io thread %u and comp thread @%u\n",
+                        ctx->loc.core_id, comp_ctx->loc.core_id);
+                comp_ctx->io_ctx = ctx;
+                ctx->comp_ctxs[ctx->num_comp_ctxs ++] = comp_ctx;
+            }
+            ctx->comp_ctx = ctx->comp_ctxs[0];
             i++;
         }
     }
@@ -935,9 +987,35 @@ int main(int argc, char **argv)
     ready_cond.signal_all();
     ready_cond.unlock();
 
+    /* Start the metrics exporter after all thread contexts are set up. */
+    if (!metrics_socket.empty()) {
+        metrics_exporter = new MetricsExporter(metrics_socket);
+        for (i = 0; i < num_io_threads; i++)
+            metrics_exporter->add_io_thread(io_threads[i].io_ctx);
+        for (i = 0; i < num_coprocessors; i++)
+            if (coprocessor_threads[i].coproc_ctx != nullptr)
+                metrics_exporter->add_coproc_thread(coprocessor_threads[i].coproc_ctx);
+        if (metrics_exporter->start() != 0)
+            rte_exit(EXIT_FAILURE, "Could not start the metrics exporter.\n");
+    }
+
+    /* Reload the pipeline configuration on SIGHUP. */
+    graph_reloader = new GraphReloader(pipeline_config);
+    for (i = 0; i < num_io_threads; i++) {
+        struct io_thread_context *io_ctx = io_threads[i].io_ctx;
+        graph_reloader->add_io_thread(io_ctx);
+        for (unsigned c = 0; c < io_ctx->num_comp_ctxs; c++)
+            graph_reloader->add_comp_thread(io_ctx->comp_ctxs[c]);
+    }
+    if (graph_reloader->start() != 0)
+        rte_exit(EXIT_FAILURE, "Could not start the graph reloader.\n");
+    signal(SIGHUP, handle_reload_signal);
+
     struct thread_collection col;
     col.num_io_threads = num_io_threads;
     col.io_threads     = io_threads;
+    col.num_comp_threads = comp_decoupled ? num_comp_threads : 0;
+    col.comp_threads     = computation_threads;
     RTE_LOG(INFO, MAIN, "spawned io threads.\n");
     RTE_LOG(INFO, MAIN, "running...\n");
 
@@ -964,18 +1042,32 @@ static void handle_signal(int) {
     if (threading::is_thread_equal(main_thread_id, threading::self())) {
         RTE_LOG(NOTICE, MAIN, "terminating...\n");
 
-        for (i = 0; i < num_nodes; i++) {
+        for (i = 0; i < num_coprocessors; i++) {
             if (coprocessor_threads[i].coproc_ctx != nullptr) {
                 ev_async_send(coprocessor_threads[i].coproc_ctx->loop,
                               coprocessor_threads[i].terminate_watcher);
             }
         }
+        for (i = 0; i < num_comp_threads; i++) {
+            comp_thread_context *comp_ctx = computation_threads[i].comp_ctx;
+            if (comp_ctx->tx_return_queue != nullptr && comp_ctx->loop_ready)
+                ev_async_send(comp_ctx->loop, computation_threads[i].terminate_watcher);
+        }
         for (i = 0; i < num_io_threads; i++) {
             ev_async_send(io_threads[i].io_ctx->loop,
                           io_threads[i].terminate_watcher);
             ev_break(io_threads[i].io_ctx->loop, EVBREAK_ALL);
+            io_threads[i].io_ctx->idle_event->trigger();
         }
         rte_eal_mp_wait_lcore();
+        if (metrics_exporter != nullptr)
+            metrics_exporter->stop();
+        if (graph_reloader != nullptr)
+            graph_reloader->stop();
+        /* io_loop() leaves its context to us in the decoupled mode. */
+        for (i = 0; i < num_io_threads; i++)
+            if (io_threads[i].io_ctx->comp_decoupled)
+                rte_free(io_threads[i].io_ctx);
 
         /* Set the terminated flag. */
         _exit_cond.lock();
@@ -985,4 +1077,9 @@ static void handle_signal(int) {
     }
 }
 
+static void handle_reload_signal(int) {
+    /* It only writes to an eventfd. */
+    graph_reloader->request();
+}
+
 // vim: ts=8 sts=4 sw=4 et
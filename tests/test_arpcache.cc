@@ -0,0 +1,122 @@
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <gtest/gtest.h>
+#include "../elements/ether/util_arpcache.hh"
+/*
+#require "../elements/ether/util_arptable.o"
+*/
+
+using namespace std;
+using namespace nba;
+
+static EtherAddress make_mac(uint32_t i)
+{
+    uint8_t mac[6] = { 0x02, 0x00, (uint8_t) (i >> 24), (uint8_t) (i >> 16),
+                       (uint8_t) (i >> 8), (uint8_t) i };
+    EtherAddress eth;
+    eth.set(mac);
+    return eth;
+}
+
+TEST(ARPCacheTest, Lookup) {
+    ARPTable table;
+    table.configure(2048, 0, 300);
+    ARPCache cache;
+    cache.init(&table, 16);
+    EtherAddress eth;
+    EXPECT_EQ(0, cache.lookup(0x0a000001u, &eth));
+    table.insert(0x0a000001u, make_mac(1));
+    ASSERT_EQ(1, cache.lookup(0x0a000001u, &eth));
+    EXPECT_EQ(0, memcmp(make_mac(1)._data, eth._data, 6));
+    ASSERT_EQ(1, cache.lookup(0x0a000001u, &eth));
+    EXPECT_EQ(0, memcmp(make_mac(1)._data, eth._data, 6));
+    EXPECT_EQ(0, cache.lookup(0x0a000002u, &eth));
+}
+
+TEST(ARPCacheTest, Invalidate) {
+    ARPTable table;
+    table.configure(2048, 0, 300);
+    ARPCache cache;
+    cache.init(&table, 16);
+    EtherAddress eth;
+    table.insert(0x0a000001u, make_mac(1));
+    ASSERT_EQ(1, cache.lookup(0x0a000001u, &eth));
+    uint32_t gen = table.generation();
+    table.insert(0x0a000001u, make_mac(7));
+    EXPECT_NE(gen, table.generation());
+    ASSERT_EQ(1, cache.lookup(0x0a000001u, &eth));
+    EXPECT_EQ(0, memcmp(make_mac(7)._data, eth._data, 6));
+    table.clear();
+    EXPECT_EQ(0, cache.lookup(0x0a000001u, &eth));
+}
+
+TEST(ARPCacheTest, Conflicts) {
+    ARPTable table;
+    table.configure(2048, 0, 300);
+    ARPCache cache;
+    cache.init(&table, 2);
+    for (uint32_t i = 1; i <= 64; i++)
+        table.insert(0x0a000000u + i, make_mac(i));
+    EtherAddress eth;
+    for (int round = 0; round < 2; round++) {
+        for (uint32_t i = 1; i <= 64; i++) {
+            ASSERT_EQ(1, cache.lookup(0x0a000000u + i, &eth));
+            EXPECT_EQ(0, memcmp(make_mac(i)._data, eth._data, 6));
+        }
+    }
+}
+
+/*
+ * Compares the aggregate lookup rate of the shared table (read lock per
+ * lookup) with per-thread caches in front of it as threads are added.
+ */
+TEST(ARPCacheBenchTest, Scaling) {
+    const uint32_t num_neighbors = 256;
+    const size_t lookups_per_thread = 1u << 22;
+    ARPTable table;
+    table.configure(2048, 0, 300);
+    for (uint32_t i = 0; i < num_neighbors; i++)
+        table.insert(0x0a000000u + i, make_mac(i));
+
+    unsigned max_threads = thread::hardware_concurrency();
+    if (max_threads == 0)
+        max_threads = 1;
+    for (unsigned num_threads = 1; num_threads <= 8; num_threads *= 2) {
+        double rates[2];
+        for (int use_cache = 0; use_cache < 2; use_cache++) {
+            atomic<uint64_t> found(0);
+            vector<thread> threads;
+            auto t0 = chrono::steady_clock::now();
+            for (unsigned t = 0; t < num_threads; t++) {
+                threads.emplace_back([&, t] {
+                    ARPCache cache;
+                    cache.init(&table);
+                    EtherAddress eth;
+                    uint64_t n = 0;
+                    uint32_t x = t + 1;
+                    for (size_t i = 0; i < lookups_per_thread; i++) {
+                        x = x * 1103515245u + 12345u;
+                        uint32_t ip = 0x0a000000u + (x >> 16) % num_neighbors;
+                        n += use_cache ? cache.lookup(ip, &eth) : table.lookup(ip, &eth, 0);
+                    }
+                    found += n;
+                });
+            }
+            for (thread &th : threads)
+                th.join();
+            auto t1 = chrono::steady_clock::now();
+            EXPECT_EQ((uint64_t) num_threads * lookups_per_thread, found.load());
+            rates[use_cache] = num_threads * lookups_per_thread
+                               / chrono::duration<double, micro>(t1 - t0).count();
+        }
+        printf("%u thread(s)%s: ARPTable %7.1f Mlookups/s, ARPCache %7.1f Mlookups/s\n",
+               num_threads, num_threads > max_threads ? " (oversubscribed)" : "",
+               rates[0], rates[1]);
+    }
+}
+
+// vim: ts=8 sts=4 sw=4 et
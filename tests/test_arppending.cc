@@ -0,0 +1,140 @@
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include <gtest/gtest.h>
+#include "../elements/ether/util_arpcache.hh"
+#include "../elements/ether/util_arppending.hh"
+/*
+#require "../elements/ether/util_arptable.o"
+*/
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+/* Answers an ARP request as the owner of its target address would. */
+void make_reply(const uint8_t *request, const EtherAddress &owner, uint8_t *reply)
+{
+    memcpy(reply, request, ARP_REQUEST_FRAME_LEN);
+    struct ether_hdr *ethh = (struct ether_hdr *) reply;
+    struct ether_arp *arp = (struct ether_arp *) (ethh + 1);
+    ethh->d_addr = ((const struct ether_hdr *) request)->s_addr;
+    memcpy(&ethh->s_addr, owner._data, ETHER_ADDR_LEN);
+    arp->ea_hdr.ar_op = htons(ARPOP_REPLY);
+    memcpy(arp->arp_tha, arp->arp_sha, ETHER_ADDR_LEN);
+    memcpy(arp->arp_sha, owner._data, ETHER_ADDR_LEN);
+    uint8_t tpa[4];
+    memcpy(tpa, arp->arp_tpa, 4);
+    memcpy(arp->arp_tpa, arp->arp_spa, 4);
+    memcpy(arp->arp_spa, tpa, 4);
+}
+
+/* The reply processing of ARPQuerier (input port 0). */
+uint32_t handle_reply(const uint8_t *reply, ARPTable &table, ARPPendingQueues &pending,
+                      vector<void *> &released)
+{
+    const struct ether_arp *arp = (const struct ether_arp *) (reply + sizeof(struct ether_hdr));
+    uint32_t ip;
+    memcpy(&ip, arp->arp_spa, 4);
+    ip = ntohl(ip);
+    EtherAddress eth;
+    eth.set((uint8_t *) arp->arp_sha);
+    table.insert(ip, eth);
+    pending.release(ip, released);
+    return ip;
+}
+
+}
+
+TEST(ARPPendingTest, ResolveWithReply) {
+    ARPTable table;
+    table.configure(2048, 0, 300);
+    ARPCache cache;
+    cache.init(&table, 16);
+    ARPPendingQueues pending;
+    EtherAddress mine(string("00:00:c0:3b:71:ef"));
+    EtherAddress peer(string("00:11:22:33:44:55"));
+    const uint32_t my_ip = 0x121a045c, peer_ip = 0x121a0401;
+    int pkts[4];
+
+    EtherAddress eth;
+    ASSERT_EQ(0, cache.lookup(peer_ip, &eth));
+    EXPECT_EQ(ARPPendingQueues::QUEUED_SEND_REQUEST, pending.enqueue(peer_ip, &pkts[0], 0, 1));
+    EXPECT_EQ(ARPPendingQueues::QUEUED, pending.enqueue(peer_ip, &pkts[1], 10, 1));
+    EXPECT_EQ(ARPPendingQueues::QUEUED_SEND_REQUEST, pending.enqueue(peer_ip + 1, &pkts[2], 10, 1));
+    EXPECT_EQ(ARPPendingQueues::QUEUED, pending.enqueue(peer_ip, &pkts[3], 20, 1));
+    EXPECT_EQ(4u, pending.size());
+
+    uint8_t request[ARP_REQUEST_FRAME_LEN], reply[ARP_REQUEST_FRAME_LEN];
+    arp_build_request(request, mine, my_ip, peer_ip);
+    const struct ether_arp *arp = (const struct ether_arp *) (request + sizeof(struct ether_hdr));
+    EXPECT_EQ(0xff, request[0]);
+    EXPECT_EQ(htons(ETHER_TYPE_ARP), ((struct ether_hdr *) request)->ether_type);
+    EXPECT_EQ(htons(ARPOP_REQUEST), arp->ea_hdr.ar_op);
+    EXPECT_EQ(0x01, arp->arp_tpa[3]);
+    EXPECT_EQ(0x5c, arp->arp_spa[3]);
+
+    make_reply(request, peer, reply);
+    vector<void *> released;
+    EXPECT_EQ(peer_ip, handle_reply(reply, table, pending, released));
+    ASSERT_EQ(3u, released.size());
+    EXPECT_EQ(&pkts[0], released[0]);
+    EXPECT_EQ(&pkts[1], released[1]);
+    EXPECT_EQ(&pkts[3], released[2]);
+    EXPECT_EQ(1u, pending.size());
+    ASSERT_EQ(1, cache.lookup(peer_ip, &eth));
+    EXPECT_EQ(0, memcmp(peer._data, eth._data, ETHER_ADDR_LEN));
+}
+
+TEST(ARPPendingTest, Bounds) {
+    ARPPendingQueues pending;
+    pending.configure(5, 3, 100000, 5);
+    int pkts[8];
+    EXPECT_EQ(ARPPendingQueues::QUEUED_SEND_REQUEST, pending.enqueue(1, &pkts[0], 0));
+    EXPECT_EQ(ARPPendingQueues::QUEUED, pending.enqueue(1, &pkts[1], 0));
+    EXPECT_EQ(ARPPendingQueues::QUEUED, pending.enqueue(1, &pkts[2], 0));
+    EXPECT_EQ(ARPPendingQueues::REJECTED, pending.enqueue(1, &pkts[3], 0));   /* per next hop */
+    EXPECT_EQ(ARPPendingQueues::QUEUED_SEND_REQUEST, pending.enqueue(2, &pkts[4], 0));
+    EXPECT_EQ(ARPPendingQueues::QUEUED, pending.enqueue(2, &pkts[5], 0));
+    EXPECT_EQ(ARPPendingQueues::REJECTED, pending.enqueue(3, &pkts[6], 0));   /* in total */
+    EXPECT_EQ(5u, pending.size());
+
+    vector<void *> flushed;
+    pending.flush(flushed);
+    EXPECT_EQ(5u, flushed.size());
+    EXPECT_TRUE(pending.empty());
+    EXPECT_EQ(ARPPendingQueues::QUEUED_SEND_REQUEST, pending.enqueue(1, &pkts[7], 0));
+}
+
+TEST(ARPPendingTest, RateLimitAndExpire) {
+    ARPPendingQueues pending;
+    pending.configure(2048, 64, 100000, 3);
+    int pkts[2];
+    vector<pair<uint32_t, int>> requests;
+    vector<void *> expired;
+    ASSERT_EQ(ARPPendingQueues::QUEUED_SEND_REQUEST, pending.enqueue(7, &pkts[0], 1000, 2));
+    ASSERT_EQ(ARPPendingQueues::QUEUED, pending.enqueue(7, &pkts[1], 2000, 2));
+
+    pending.poll(50000, requests, expired);     /* too early */
+    EXPECT_TRUE(requests.empty());
+    pending.poll(101000, requests, expired);    /* the 2nd request */
+    ASSERT_EQ(1u, requests.size());
+    EXPECT_EQ(7u, requests[0].first);
+    EXPECT_EQ(2, requests[0].second);
+    pending.poll(150000, requests, expired);
+    EXPECT_EQ(1u, requests.size());
+    pending.poll(201000, requests, expired);    /* the 3rd request */
+    EXPECT_EQ(2u, requests.size());
+    EXPECT_TRUE(expired.empty());
+
+    pending.poll(301000, requests, expired);    /* no reply: give up */
+    EXPECT_EQ(2u, requests.size());
+    ASSERT_EQ(2u, expired.size());
+    EXPECT_EQ(&pkts[0], expired[0]);
+    EXPECT_TRUE(pending.empty());
+    EXPECT_EQ(ARPPendingQueues::QUEUED_SEND_REQUEST, pending.enqueue(7, &pkts[0], 302000));
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,216 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include "../elements/ip/util_conntrack.hh"
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+/* A ConnTable with its own cache-aligned memory. */
+class TestConnTable : public ConnTable {
+public:
+    TestConnTable(size_t capacity) : ConnTable(), mem(nullptr)
+    {
+        if (posix_memalign(&mem, 64, memory_size(capacity)) != 0)
+            abort();
+        init(capacity, mem);
+    }
+
+    ~TestConnTable() { free(mem); }
+
+    struct conn_result track(const struct conn_tuple &t, uint32_t now)
+    {
+        struct conn_result r;
+        track_batch(&t, 1, now, &r);
+        return r;
+    }
+
+private:
+    void *mem;
+};
+
+struct conn_tuple tcp(uint32_t saddr, uint16_t sport, uint32_t daddr, uint16_t dport, uint8_t flags)
+{
+    return { saddr, daddr, sport, dport, IPPROTO_TCP, flags };
+}
+
+struct conn_tuple udp(uint32_t saddr, uint16_t sport, uint32_t daddr, uint16_t dport)
+{
+    return { saddr, daddr, sport, dport, IPPROTO_UDP, 0 };
+}
+
+/* Generates distinct UDP flows from a client network to servers. */
+void generate_flows(size_t num_flows, vector<struct conn_tuple> &flows, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    flows.resize(num_flows);
+    for (size_t i = 0; i < num_flows; i++) {
+        uint64_t r = rng();
+        flows[i] = udp(0x0a000000u + (uint32_t) (i >> 14), 1024 + (i & 0x3fff),
+                       0xc0a80000u + (uint32_t) (r & 0xffff), (uint16_t) (r >> 16));
+    }
+    shuffle(flows.begin(), flows.end(), rng);
+}
+
+}
+
+TEST(ConnTrackTest, TCPStates) {
+    TestConnTable table(1024);
+    const uint32_t c = 0x0a000001, s = 0x0a000002;
+    struct conn_result r;
+
+    r = table.track(tcp(c, 40000, s, 80, CONN_TCP_SYN), 0);
+    EXPECT_EQ(CONN_SYN_SENT, r.state);
+    EXPECT_EQ(0, r.reply);
+    uint32_t flow_id = r.flow_id;
+    r = table.track(tcp(s, 80, c, 40000, CONN_TCP_SYN | CONN_TCP_ACK), 1);
+    EXPECT_EQ(CONN_SYN_RECV, r.state);
+    EXPECT_EQ(1, r.reply);
+    EXPECT_EQ(flow_id, r.flow_id);
+    r = table.track(tcp(c, 40000, s, 80, CONN_TCP_ACK), 2);
+    EXPECT_EQ(CONN_ESTABLISHED, r.state);
+    r = table.track(tcp(s, 80, c, 40000, CONN_TCP_ACK | CONN_TCP_FIN), 3);
+    EXPECT_EQ(CONN_FIN_WAIT, r.state);
+    r = table.track(tcp(c, 40000, s, 80, CONN_TCP_ACK | CONN_TCP_FIN), 4);
+    EXPECT_EQ(CONN_TIME_WAIT, r.state);
+    EXPECT_EQ(1u, table.size());
+
+    /* The client reuses the port. */
+    r = table.track(tcp(c, 40000, s, 80, CONN_TCP_SYN), 5);
+    EXPECT_EQ(CONN_SYN_SENT, r.state);
+    r = table.track(tcp(s, 80, c, 40000, CONN_TCP_RST), 6);
+    EXPECT_EQ(CONN_CLOSED, r.state);
+    EXPECT_EQ(1u, table.size());
+
+    /* A different client port is a different connection. */
+    r = table.track(tcp(c, 40001, s, 80, CONN_TCP_SYN), 7);
+    EXPECT_NE(flow_id, r.flow_id);
+    EXPECT_EQ(2u, table.size());
+}
+
+TEST(ConnTrackTest, MidstreamAndStrict) {
+    TestConnTable loose(1024), strict(1024);
+    strict.set_strict(true);
+    const uint32_t c = 0x0a000001, s = 0x0a000002;
+    EXPECT_EQ(CONN_ESTABLISHED, loose.track(tcp(c, 1234, s, 22, CONN_TCP_ACK), 0).state);
+    EXPECT_EQ(CONN_INVALID, strict.track(tcp(c, 1234, s, 22, CONN_TCP_ACK), 0).state);
+    EXPECT_EQ(0u, strict.size());
+    /* RSTs never create connections. */
+    EXPECT_EQ(CONN_INVALID, loose.track(tcp(c, 1235, s, 22, CONN_TCP_RST), 0).state);
+    EXPECT_EQ(1u, loose.size());
+    EXPECT_EQ(2u, loose.num_invalid + strict.num_invalid);
+}
+
+TEST(ConnTrackTest, UDPAndTimeouts) {
+    TestConnTable table(1024);
+    table.set_timeouts(3600, 180);
+    const uint32_t c = 0x0a000001, s = 0x08080808;
+    EXPECT_EQ(CONN_NEW, table.track(udp(c, 5353, s, 53), 0).state);
+    /* Unreplied flows expire in 30 seconds. */
+    EXPECT_EQ(0u, table.expire(29999, table.slot_count()));
+    EXPECT_EQ(1u, table.expire(30000, table.slot_count()));
+    EXPECT_EQ(nullptr, table.find(udp(c, 5353, s, 53)));
+
+    EXPECT_EQ(CONN_NEW, table.track(udp(c, 5353, s, 53), 40000).state);
+    struct conn_result r = table.track(udp(s, 53, c, 5353), 40001);
+    EXPECT_EQ(CONN_ESTABLISHED, r.state);
+    EXPECT_EQ(1, r.reply);
+    EXPECT_EQ(0u, table.expire(40001 + 179999, table.slot_count()));
+    /* An expired but not yet swept flow starts over. */
+    r = table.track(udp(s, 53, c, 5353), 40001 + 180000);
+    EXPECT_EQ(CONN_NEW, r.state);
+    EXPECT_EQ(0, r.reply);
+    EXPECT_EQ(1u, table.size());
+}
+
+TEST(ConnTrackTest, CapacityAndSweep) {
+    const size_t capacity = 5000;
+    TestConnTable table(capacity);
+    vector<struct conn_tuple> flows;
+    generate_flows(capacity + 100, flows, 1);
+    vector<struct conn_result> results(flows.size());
+    table.track_batch(flows.data(), flows.size(), 0, results.data());
+    EXPECT_EQ(capacity, table.size());
+    EXPECT_EQ(100u, table.num_invalid);
+    for (size_t i = capacity; i < flows.size(); i++)
+        EXPECT_EQ(CONN_INVALID, results[i].state);
+    /* Half of them get replies and live longer. */
+    for (size_t i = 0; i < capacity; i += 2) {
+        struct conn_tuple t = flows[i];
+        swap(t.saddr, t.daddr);
+        swap(t.sport, t.dport);
+        EXPECT_EQ(CONN_ESTABLISHED, table.track(t, 1).state);
+    }
+
+    /* Sweep in small steps; removals must not lose the others. */
+    size_t total = 0;
+    for (unsigned k = 0; k < 1000 && table.size() > capacity / 2; k++)
+        total += table.expire(30000, 97);
+    EXPECT_EQ(capacity / 2, total);
+    EXPECT_EQ(capacity / 2, table.size());
+    for (size_t i = 0; i < capacity; i++) {
+        const ConnTable::entry *e = table.find(flows[i]);
+        if (i % 2 == 0) {
+            ASSERT_NE(nullptr, e) << i;
+            EXPECT_EQ(results[i].flow_id, e->flow_id);
+            EXPECT_EQ(2u, e->num_pkts);
+        } else
+            EXPECT_EQ(nullptr, e) << i;
+    }
+}
+
+/* It allocates about 1 GiB and takes seconds, so it runs only with
+ * --gtest_also_run_disabled_tests. */
+TEST(ConnTrackBenchTest, DISABLED_Scaling) {
+    const size_t batch_size = 64;
+    const size_t avail_bytes = (size_t) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    for (size_t num_flows : { (size_t) 1000000, (size_t) 10000000 }) {
+        size_t table_bytes = ConnTable::memory_size(num_flows);
+        size_t flow_bytes = num_flows * sizeof(struct conn_tuple);
+        if ((table_bytes + flow_bytes) * 2 > avail_bytes) {
+            printf("%'zu flows: skipped (needs %.1f MiB)\n", num_flows,
+                   (table_bytes + flow_bytes) / 1048576.0);
+            continue;
+        }
+        TestConnTable table(num_flows);
+        vector<struct conn_tuple> flows;
+        generate_flows(num_flows, flows, 2);
+        struct conn_result results[batch_size];
+
+        auto t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < num_flows; i += batch_size)
+            table.track_batch(&flows[i], min(batch_size, num_flows - i), 0, results);
+        auto t1 = chrono::steady_clock::now();
+        ASSERT_EQ(num_flows, table.size());
+
+        /* Packets of existing flows in a random order. */
+        mt19937 rng(3);
+        vector<struct conn_tuple> pkts(1u << 22);
+        for (auto &p : pkts)
+            p = flows[rng() % num_flows];
+        uint64_t num_tracked = 0;
+        auto t2 = chrono::steady_clock::now();
+        for (size_t i = 0; i < pkts.size(); i += batch_size) {
+            table.track_batch(&pkts[i], batch_size, 1, results);
+            num_tracked += (results[batch_size - 1].state != CONN_INVALID);
+        }
+        auto t3 = chrono::steady_clock::now();
+        EXPECT_EQ(pkts.size() / batch_size, num_tracked);
+        EXPECT_EQ(num_flows, table.num_inserts);
+
+        printf("%'zu flows: %.1f MiB (%.1f B/flow), insert %.2f Mflows/s, lookup %.2f Mpkts/s\n",
+               num_flows, table_bytes / 1048576.0, (double) table_bytes / num_flows,
+               num_flows / chrono::duration<double, micro>(t1 - t0).count(),
+               pkts.size() / chrono::duration<double, micro>(t3 - t2).count());
+    }
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,250 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <random>
+#include <new>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <nba/core/intrinsic.hh>
+#include <nba/core/flowsequencer.hh>
+
+using namespace std;
+using namespace nba;
+
+TEST(FlowSequencerTest, Tickets) {
+    FlowSequencer seq;
+    struct flow_tickets a, b, c, d;
+    seq.issue(0x0001, a);
+    seq.issue(0x0003, b);
+    seq.issue(0x0002, c);
+    seq.issue(0x0004, d);
+    EXPECT_TRUE(seq.ready(a));
+    EXPECT_FALSE(seq.ready(b));     /* waits for a in group 0 */
+    EXPECT_FALSE(seq.ready(c));     /* waits for b in group 1 */
+    EXPECT_TRUE(seq.ready(d));      /* no earlier batch in group 2 */
+    seq.done(d);
+    seq.done(a);
+    EXPECT_TRUE(seq.ready(b));
+    EXPECT_FALSE(seq.ready(c));
+    seq.done(b);
+    EXPECT_TRUE(seq.ready(c));
+    seq.done(c);
+
+    /* A cancelled ticket is issued again to the next batch. */
+    struct flow_tickets e, f;
+    seq.issue(0x0001, e);
+    seq.cancel(e);
+    seq.issue(0x0001, f);
+    EXPECT_EQ(e.seq[0], f.seq[0]);
+    EXPECT_TRUE(seq.ready(f));
+
+    /* Batches without groups never wait. */
+    struct flow_tickets none;
+    seq.issue(0, none);
+    EXPECT_TRUE(seq.ready(none));
+}
+
+namespace {
+
+struct test_pkt {
+    uint32_t flow;
+    uint32_t flow_seq;
+};
+
+struct test_batch {
+    vector<struct test_pkt> pkts;
+    struct flow_tickets tickets;
+};
+
+/* A stand-in of the comp thread input queues. */
+struct test_queue {
+    mutex lock;
+    deque<struct test_batch *> batches;
+    FlowSequencer seq;
+
+    /* FlowSequencer is cache-aligned, as allocated by NEW() in NBA. */
+    static void *operator new(size_t size)
+    {
+        void *p = nullptr;
+        if (posix_memalign(&p, CACHE_LINE_SIZE, size) != 0)
+            throw bad_alloc();
+        return p;
+    }
+
+    static void operator delete(void *p) { free(p); }
+
+    struct test_batch *pop()
+    {
+        lock_guard<mutex> guard(lock);
+        if (batches.empty())
+            return nullptr;
+        struct test_batch *b = batches.front();
+        batches.pop_front();
+        return b;
+    }
+
+    size_t size()
+    {
+        lock_guard<mutex> guard(lock);
+        return batches.size();
+    }
+};
+
+/**
+ * Generates skewed traffic: a few elephant flows carry most packets and
+ * the RSS puts all of them into the first queue, while the mice are
+ * spread over all queues.  Returns the number of batches.
+ */
+unsigned generate_skewed(vector<test_queue *> &queues, unsigned num_pkts, unsigned batch_size,
+                         vector<uint32_t> &flow_hashes)
+{
+    const unsigned num_elephants = 4, num_mice = 60;
+    mt19937 rng(7);
+    vector<unsigned> flow_queue;
+    for (unsigned f = 0; f < num_elephants + num_mice; f++) {
+        flow_hashes.push_back(rng());
+        flow_queue.push_back(f < num_elephants ? 0 : f % queues.size());
+    }
+    vector<uint32_t> next_seq(flow_hashes.size(), 0);
+    vector<struct test_batch *> pending(queues.size(), nullptr);
+    vector<uint16_t> groups(queues.size(), 0);
+    uniform_int_distribution<unsigned> elephant(0, num_elephants - 1);
+    uniform_int_distribution<unsigned> mouse(num_elephants, num_elephants + num_mice - 1);
+    uniform_int_distribution<unsigned> pct(0, 99);
+    unsigned num_batches = 0;
+    for (unsigned i = 0; i < num_pkts; i++) {
+        uint32_t f = (pct(rng) < 80) ? elephant(rng) : mouse(rng);
+        unsigned q = flow_queue[f];
+        if (pending[q] == nullptr)
+            pending[q] = new struct test_batch;
+        pending[q]->pkts.push_back({f, next_seq[f] ++});
+        groups[q] |= (uint16_t) (1u << FlowSequencer::group_of(flow_hashes[f]));
+        if (pending[q]->pkts.size() == batch_size) {
+            queues[q]->seq.issue(groups[q], pending[q]->tickets);
+            queues[q]->batches.push_back(pending[q]);
+            pending[q] = nullptr;
+            groups[q] = 0;
+            num_batches ++;
+        }
+    }
+    for (unsigned q = 0; q < queues.size(); q++) {
+        if (pending[q] == nullptr)
+            continue;
+        queues[q]->seq.issue(groups[q], pending[q]->tickets);
+        queues[q]->batches.push_back(pending[q]);
+        num_batches ++;
+    }
+    return num_batches;
+}
+
+/* Runs the workers with or without stealing, returning the elapsed time.
+ * worker_pkts receives the number of packets processed by each worker. */
+double run_workers(vector<test_queue *> &queues, bool stealing, size_t num_flows,
+                   uint64_t &num_steals, uint64_t &num_pkts, unsigned &num_reordered,
+                   vector<uint64_t> &worker_pkts)
+{
+    vector<int64_t> last_seq(num_flows, -1);
+    worker_pkts.assign(queues.size(), 0);
+    atomic<uint64_t> steals(0), pkts(0);
+    atomic<unsigned> reordered(0);
+    auto t0 = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned w = 0; w < queues.size(); w++) {
+        workers.emplace_back([&, w]() {
+            volatile uint64_t sink = 0;
+            while (true) {
+                test_queue *from = queues[w];
+                struct test_batch *batch = from->pop();
+                if (batch == nullptr && stealing) {
+                    size_t max_backlog = 0;
+                    for (unsigned v = 1; v < queues.size(); v++) {
+                        test_queue *c = queues[(w + v) % queues.size()];
+                        size_t backlog = c->size();
+                        if (backlog > max_backlog) {
+                            max_backlog = backlog;
+                            from = c;
+                        }
+                    }
+                    if (max_backlog > 0 && (batch = from->pop()) != nullptr)
+                        steals ++;
+                }
+                if (batch == nullptr) {
+                    bool all_empty = true;
+                    for (auto &q : queues)
+                        all_empty &= (q->size() == 0);
+                    if (all_empty)
+                        break;
+                    this_thread::yield();
+                    continue;
+                }
+                while (!from->seq.ready(batch->tickets))
+                    this_thread::yield();
+                for (auto &p : batch->pkts) {
+                    if ((int64_t) p.flow_seq <= last_seq[p.flow])
+                        reordered ++;
+                    last_seq[p.flow] = p.flow_seq;
+                    for (unsigned k = 0; k < 2000; k++)
+                        sink = sink + k;
+                }
+                pkts += batch->pkts.size();
+                worker_pkts[w] += batch->pkts.size();
+                from->seq.done(batch->tickets);
+                delete batch;
+            }
+        });
+    }
+    for (auto &t : workers)
+        t.join();
+    auto t1 = chrono::steady_clock::now();
+    num_steals = steals;
+    num_pkts = pkts;
+    num_reordered = reordered;
+    return chrono::duration<double, milli>(t1 - t0).count();
+}
+
+}
+
+TEST(FlowSequencerTest, SkewedWorkStealing) {
+    const unsigned num_workers = 4, num_pkts = 6400, batch_size = 16;
+    double elapsed[2], idle_share[2];
+    for (int stealing = 0; stealing < 2; stealing++) {
+        vector<test_queue *> queues;
+        for (unsigned w = 0; w < num_workers; w++)
+            queues.push_back(new test_queue);
+        vector<uint32_t> flow_hashes;
+        unsigned num_batches = generate_skewed(queues, num_pkts, batch_size, flow_hashes);
+        EXPECT_GT(queues[0]->size(), num_batches * 3 / 4);
+        uint64_t steals, pkts;
+        unsigned reordered;
+        vector<uint64_t> worker_pkts;
+        elapsed[stealing] = run_workers(queues, stealing, flow_hashes.size(),
+                                        steals, pkts, reordered, worker_pkts);
+        EXPECT_EQ((uint64_t) num_pkts, pkts);
+        /* All but the first worker get little traffic by themselves. */
+        uint64_t idle_pkts = 0;
+        for (unsigned w = 1; w < num_workers; w++)
+            idle_pkts += worker_pkts[w];
+        idle_share[stealing] = (double) idle_pkts / pkts;
+        EXPECT_EQ(0u, reordered);
+        if (stealing)
+            EXPECT_GT(steals, 0u);
+        else
+            EXPECT_EQ(0u, steals);
+        for (test_queue *q : queues)
+            delete q;
+    }
+    /* Stealing moves the work of the hot queue to the idle workers.  The
+     * elapsed time is only reported since the speedup depends on the
+     * number of available cores. */
+    EXPECT_GT(idle_share[1], idle_share[0]);
+    printf("skewed traffic on %u workers: idle workers processed %.1f%% without stealing "
+           "(%.1f ms), %.1f%% with stealing (%.1f ms)\n",
+           num_workers, idle_share[0] * 100, elapsed[0], idle_share[1] * 100, elapsed[1]);
+}
+
+// vim: ts=8 sts=4 sw=4 et
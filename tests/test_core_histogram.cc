@@ -0,0 +1,81 @@
+#include <nba/core/histogram.hh>
+#include <cstdint>
+#include <random>
+#include <algorithm>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace nba;
+
+TEST(CoreHistogramTest, BucketBounds) {
+    const unsigned nb = LatencyHistogram::NUM_BUCKETS;
+    /* Small values are exact. */
+    for (uint64_t v = 0; v < 32; v++) {
+        unsigned b = LatencyHistogram::bucket_of(v);
+        EXPECT_EQ(v, LatencyHistogram::bucket_lower(b));
+        EXPECT_EQ(v, LatencyHistogram::bucket_upper(b));
+    }
+    /* Buckets are contiguous and monotonic. */
+    for (unsigned b = 1; b < nb; b++) {
+        EXPECT_EQ(LatencyHistogram::bucket_upper(b - 1) + 1, LatencyHistogram::bucket_lower(b));
+        EXPECT_EQ(b, LatencyHistogram::bucket_of(LatencyHistogram::bucket_lower(b)));
+        EXPECT_EQ(b, LatencyHistogram::bucket_of(LatencyHistogram::bucket_upper(b)));
+    }
+    /* Huge values are clamped. */
+    EXPECT_EQ(nb - 1, LatencyHistogram::bucket_of(UINT64_MAX));
+}
+
+TEST(CoreHistogramTest, RelativeError) {
+    std::mt19937_64 rng(1);
+    for (int i = 0; i < 100000; i++) {
+        uint64_t v = rng() >> (rng() % 40 + 24);
+        unsigned b = LatencyHistogram::bucket_of(v);
+        uint64_t lo = LatencyHistogram::bucket_lower(b);
+        uint64_t hi = LatencyHistogram::bucket_upper(b);
+        ASSERT_LE(lo, v);
+        ASSERT_GE(hi, v);
+        ASSERT_LE((double) (hi - lo), v / 16.0);
+    }
+}
+
+TEST(CoreHistogramTest, Percentiles) {
+    LatencyHistogram h;
+    EXPECT_EQ(0u, h.percentile(50.0));
+    std::vector<uint64_t> samples;
+    std::mt19937_64 rng(7);
+    std::lognormal_distribution<double> dist(8.0, 1.0);
+    for (int i = 0; i < 200000; i++) {
+        uint64_t v = (uint64_t) dist(rng);
+        samples.push_back(v);
+        h.record(v);
+    }
+    EXPECT_EQ(samples.size(), h.count());
+    std::sort(samples.begin(), samples.end());
+    const double ps[] = { 50.0, 99.0, 99.9 };
+    for (double p : ps) {
+        uint64_t exact = samples[(size_t) (p / 100.0 * samples.size()) - 1];
+        uint64_t approx = h.percentile(p);
+        EXPECT_GE(approx, exact);
+        EXPECT_LE((double) approx, exact * (1.0 + 1.0 / 16) + 1);
+    }
+    EXPECT_EQ(h.percentile(100.0), LatencyHistogram::bucket_upper(
+              LatencyHistogram::bucket_of(samples.back())));
+}
+
+TEST(CoreHistogramTest, Merge) {
+    LatencyHistogram a, b, all;
+    for (uint64_t v = 1; v <= 1000; v++) {
+        ((v % 3 == 0) ? a : b).record(v * 37);
+        all.record(v * 37);
+    }
+    a.merge(b);
+    EXPECT_EQ(all.count(), a.count());
+    for (unsigned k = 0; k < LatencyHistogram::NUM_BUCKETS; k++)
+        EXPECT_EQ(all.get_bucket(k), a.get_bucket(k));
+    EXPECT_EQ(all.percentile(99.0), a.percentile(99.0));
+    a.reset();
+    EXPECT_EQ(0u, a.count());
+    EXPECT_EQ(0u, a.percentile(99.0));
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,166 @@
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include <nba/core/idlebackoff.hh>
+#include <nba/core/threading.hh>
+#include <nba/core/timing.hh>
+#include <gtest/gtest.h>
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+uint64_t now_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000llu + ts.tv_nsec;
+}
+
+struct load_result {
+    double cpu_util;
+    uint64_t num_pkts;
+    uint64_t p50_nsec, p99_nsec, max_nsec;
+};
+
+/*
+ * Emulates an IO loop polling a software packet source with Poisson
+ * arrivals at the given rate (packets per second) for duration_nsec.
+ * Each poll receives up to 32 packets that have arrived; the latency is
+ * the time from the arrival to the poll that receives it.
+ */
+load_result run_load(IdleBackoff &backoff, double pps, uint64_t duration_nsec)
+{
+    mt19937_64 rng(1);
+    exponential_distribution<double> gap(pps > 0 ? pps / 1e9 : 1.0);
+    vector<uint64_t> latencies;
+    uint64_t start = now_nsec();
+    uint64_t next_arrival = (pps > 0) ? start + (uint64_t) gap(rng) : UINT64_MAX;
+    uint64_t cpu_start = get_thread_cpu_time();
+    uint64_t now;
+    while ((now = now_nsec()) < start + duration_nsec) {
+        unsigned count = 0;
+        while (count < 32 && next_arrival <= now) {
+            latencies.push_back(now - next_arrival);
+            next_arrival += (uint64_t) gap(rng) + 1;
+            count ++;
+        }
+        backoff.poll_done(count);
+    }
+    uint64_t cpu_time = (get_thread_cpu_time() - cpu_start) * (1000000000llu / get_thread_cpu_time_unit());
+    load_result r;
+    r.cpu_util = (double) cpu_time / (now - start);
+    r.num_pkts = latencies.size();
+    r.p50_nsec = r.p99_nsec = r.max_nsec = 0;
+    if (!latencies.empty()) {
+        sort(latencies.begin(), latencies.end());
+        r.p50_nsec = latencies[latencies.size() / 2];
+        r.p99_nsec = latencies[latencies.size() * 99 / 100];
+        r.max_nsec = latencies.back();
+    }
+    return r;
+}
+
+}
+
+TEST(IdleBackoffTest, Escalation) {
+    IdleBackoff backoff;
+    backoff.init(3, 2, 8);
+    for (int i = 0; i < 5; i++)
+        backoff.poll_done(0);       /* spin, then pause */
+    EXPECT_EQ(0u, backoff.num_sleeps);
+    for (int i = 0; i < 6; i++)
+        backoff.poll_done(0);
+    EXPECT_EQ(6u, backoff.num_sleeps);
+    EXPECT_EQ(1u + 2 + 4 + 8 + 8 + 8, backoff.slept_usec);
+    backoff.poll_done(1);           /* reset */
+    for (int i = 0; i < 6; i++)
+        backoff.poll_done(0);
+    EXPECT_EQ(7u, backoff.num_sleeps);
+    EXPECT_EQ(1u + 2 + 4 + 8 + 8 + 8 + 1, backoff.slept_usec);
+
+    IdleBackoff disabled;
+    disabled.init(0, 0, 0);
+    EXPECT_FALSE(disabled.enabled());
+    for (int i = 0; i < 100; i++)
+        disabled.poll_done(0);
+    EXPECT_EQ(0u, disabled.num_sleeps);
+}
+
+TEST(IdleBackoffTest, PendingSkipsSleep) {
+    /* Work published right before the sleep is noticed by the re-check. */
+    IdleBackoff backoff;
+    backoff.init(0, 0, 1000000);
+    bool pending = true;
+    uint64_t t0 = now_nsec();
+    backoff.poll_done(0, [&] { return pending; });
+    EXPECT_EQ(0u, backoff.num_sleeps);
+    EXPECT_LT(now_nsec() - t0, 100000000llu);
+    pending = false;
+    backoff.poll_done(0, [&] { return pending; });
+    EXPECT_EQ(1u, backoff.num_sleeps);
+    EXPECT_EQ(1u, backoff.slept_usec);
+}
+
+TEST(IdleBackoffTest, WakeupByEvent) {
+    /* Long sleeps end as soon as the event is triggered. */
+    UserEvent ev;
+    IdleBackoff backoff;
+    backoff.init(0, 0, 1000000, ev.getfd());
+    ev.trigger();
+    uint64_t t0 = now_nsec();
+    backoff.poll_done(0);
+    EXPECT_EQ(1u, backoff.num_sleeps);
+    EXPECT_EQ(1u, backoff.num_wakeups);
+    EXPECT_LT(now_nsec() - t0, 100000000llu);
+
+    /* Triggered by another thread while sleeping, as offload completions do. */
+    backoff.init(0, 0, 1000000, ev.getfd());
+    for (int i = 0; i < 17; i++)
+        backoff.poll_done(0);       /* 1 usec to 65 msec; the next is 131 msec. */
+    thread notifier([&] {
+        while (!backoff.is_sleeping())
+            ;
+        ev.trigger();
+    });
+    t0 = now_nsec();
+    backoff.poll_done(0);
+    notifier.join();
+    EXPECT_EQ(2u, backoff.num_wakeups);
+    EXPECT_LT(now_nsec() - t0, 100000000llu);
+    EXPECT_FALSE(ev.is_triggered());
+}
+
+TEST(IdleBackoffBenchTest, OfferedLoads) {
+    const uint64_t duration_nsec = 100000000llu;   /* 0.1 sec */
+    const unsigned max_sleep_usec = 50;
+    const double loads[] = { 0, 1e3, 1e4, 1e5, 1e6 };
+    double idle_util[2] = { 0, 0 };
+    for (double pps : loads) {
+        load_result r[2];
+        for (int adaptive = 0; adaptive < 2; adaptive++) {
+            IdleBackoff backoff;
+            backoff.init(64, 1024, adaptive ? max_sleep_usec : 0);
+            r[adaptive] = run_load(backoff, pps, duration_nsec);
+        }
+        printf("%9.0f pps: busy-poll cpu %5.1f%% p50/p99/max %6.1f/%6.1f/%7.1f usec | "
+               "adaptive cpu %5.1f%% p50/p99/max %6.1f/%6.1f/%7.1f usec\n", pps,
+               r[0].cpu_util * 100, r[0].p50_nsec / 1e3, r[0].p99_nsec / 1e3, r[0].max_nsec / 1e3,
+               r[1].cpu_util * 100, r[1].p50_nsec / 1e3, r[1].p99_nsec / 1e3, r[1].max_nsec / 1e3);
+        /* Every arrived packet is received either way. */
+        double expected = pps * duration_nsec / 1e9;
+        EXPECT_NEAR(expected, r[1].num_pkts, 10 + expected * 0.1);
+        if (pps == 0) {
+            idle_util[0] = r[0].cpu_util;
+            idle_util[1] = r[1].cpu_util;
+        }
+    }
+    EXPECT_LT(idle_util[1], idle_util[0] * 0.5);
+}
+
+// vim: ts=8 sts=4 sw=4 et
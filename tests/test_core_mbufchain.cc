@@ -0,0 +1,233 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <tuple>
+#include <nba/core/mbufchain.hh>
+#include <nba/framework/datablock.hh>
+#include <nba/element/packet.hh>
+#include <nba/element/packetbatch.hh>
+#include <nba/framework/test_utils.hh>
+#include <gtest/gtest.h>
+#include <rte_cycles.h>
+#include <rte_mbuf.h>
+/*
+#require <lib/datablock.o>
+#require <lib/packet.o>
+#require <lib/test_utils.o>
+*/
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+const size_t jumbo_size = 9000;
+const size_t seg_size = NBA_MAX_PACKET_SIZE;
+
+vector<uint8_t> make_frame(size_t len, unsigned seed)
+{
+    vector<uint8_t> frame(len);
+    for (size_t i = 0; i < len; i++)
+        frame[i] = (uint8_t) (i * 7 + seed);
+    return frame;
+}
+
+class WholePacketDataBlock : public DataBlock
+{
+public:
+    const char *name() const { return "test.whole"; }
+    void get_read_roi(struct read_roi_info *roi) const
+    {
+        roi->type = READ_WHOLE_PACKET;
+        roi->offset = 14;
+        roi->length = 0;
+        roi->align = CACHE_LINE_SIZE;
+        roi->size_delta = 0;
+    }
+    void get_write_roi(struct write_roi_info *roi) const
+    {
+        roi->type = WRITE_NONE;
+        roi->offset = 0;
+        roi->length = 0;
+        roi->align = 0;
+    }
+};
+
+class DestAddrDataBlock : public DataBlock
+{
+public:
+    const char *name() const { return "test.daddr"; }
+    void get_read_roi(struct read_roi_info *roi) const
+    {
+        roi->type = READ_PARTIAL_PACKET;
+        roi->offset = 14 + 16;
+        roi->length = sizeof(uint32_t);
+        roi->align = 0;
+        roi->size_delta = 0;
+    }
+    void get_write_roi(struct write_roi_info *roi) const
+    {
+        roi->type = WRITE_NONE;
+        roi->offset = 0;
+        roi->length = 0;
+        roi->align = 0;
+    }
+};
+
+/* Shortens a chain created by create_chained_batch() to len bytes. */
+void trim_chain(struct rte_mbuf *m, size_t len)
+{
+    struct rte_mbuf *seg = m;
+    m->nb_segs = 1;
+    m->pkt_len = len;
+    while (len > seg->data_len) {
+        len -= seg->data_len;
+        seg = seg->next;
+        m->nb_segs ++;
+    }
+    seg->data_len = len;
+    struct rte_mbuf *rest = seg->next;
+    seg->next = nullptr;
+    while (rest != nullptr) {
+        struct rte_mbuf *next = rest->next;
+        free(rest);
+        rest = next;
+    }
+}
+
+void attach_tracker(PacketBatch *batch)
+{
+    batch->datablock_states = new struct datablock_tracker;
+    batch->datablock_states->aligned_item_sizes_h.ptr = malloc(sizeof(struct item_size_info));
+    batch->datablock_states->aligned_item_sizes = (struct item_size_info *)
+            batch->datablock_states->aligned_item_sizes_h.ptr;
+}
+
+}
+
+TEST(MbufChainTest, CopyContiguous) {
+    vector<uint8_t> frame = make_frame(1500, 1);
+    PacketBatch *batch = nba::testing::create_batch(1, frame.size(),
+        [&](size_t pkt_idx, struct Packet *pkt) {
+            memcpy(pkt->data(), frame.data(), frame.size());
+        });
+    struct rte_mbuf *m = batch->packets[0];
+    Packet *pkt = Packet::from_base(m);
+    EXPECT_TRUE(pkt->is_contiguous());
+    EXPECT_EQ(pkt->length(), pkt->pkt_length());
+    uint8_t buf[1500];
+    EXPECT_EQ(100u, mbuf_copy_out(m, 1000, 100, buf));
+    EXPECT_EQ(0, memcmp(frame.data() + 1000, buf, 100));
+    EXPECT_TRUE(pkt->linearize());
+    nba::testing::free_batch(batch);
+}
+
+TEST(MbufChainTest, CopyAcrossSegments) {
+    vector<uint8_t> frame = make_frame(jumbo_size, 3);
+    PacketBatch *batch = nba::testing::create_chained_batch(1, jumbo_size, seg_size,
+        [&](size_t pkt_idx, struct Packet *pkt) {
+            mbuf_copy_in(pkt->get_base(), 0, frame.data(), frame.size());
+        });
+    struct rte_mbuf *m = batch->packets[0];
+    Packet *pkt = Packet::from_base(m);
+    EXPECT_EQ(5u, pkt->nb_segs());
+    EXPECT_FALSE(pkt->is_contiguous());
+    EXPECT_EQ(seg_size, pkt->length());
+    EXPECT_EQ(jumbo_size, pkt->pkt_length());
+    EXPECT_EQ(0, memcmp(frame.data(), pkt->data(), seg_size));
+
+    vector<uint8_t> buf(jumbo_size);
+    EXPECT_EQ(jumbo_size, mbuf_copy_out(m, 0, jumbo_size, buf.data()));
+    EXPECT_EQ(frame, buf);
+    /* Ranges that start and end in the middle of segments. */
+    const uint32_t ranges[][2] = { {2000, 100}, {2048, 2048}, {1, 8990}, {6000, 3000} };
+    for (auto &r : ranges) {
+        memset(buf.data(), 0, buf.size());
+        ASSERT_EQ(r[1], mbuf_copy_out(m, r[0], r[1], buf.data()));
+        EXPECT_EQ(0, memcmp(frame.data() + r[0], buf.data(), r[1]));
+    }
+    /* Beyond the end, only the last segment's tailroom is accessible. */
+    uint32_t tailroom = rte_pktmbuf_tailroom(m->next->next->next->next);
+    EXPECT_EQ(100u, mbuf_copy_out(m, jumbo_size - 100, 100, buf.data()));
+    EXPECT_EQ(100u + tailroom, mbuf_copy_out(m, jumbo_size - 100, 100 + tailroom + 64, buf.data()));
+
+    /* Round trip through mbuf_copy_in(). */
+    vector<uint8_t> other = make_frame(jumbo_size, 11);
+    EXPECT_EQ(5000u, mbuf_copy_in(m, 1000, other.data(), 5000));
+    EXPECT_EQ(jumbo_size, mbuf_copy_out(m, 0, jumbo_size, buf.data()));
+    EXPECT_EQ(0, memcmp(frame.data(), buf.data(), 1000));
+    EXPECT_EQ(0, memcmp(other.data(), buf.data() + 1000, 5000));
+    EXPECT_EQ(0, memcmp(frame.data() + 6000, buf.data() + 6000, jumbo_size - 6000));
+    nba::testing::free_batch(batch);
+}
+
+TEST(MbufChainTest, DatablockGather) {
+    const size_t num_pkts = 4;
+    const size_t sizes[num_pkts] = { 64, 1514, 4000, jumbo_size };
+    vector<vector<uint8_t>> frames;
+    for (unsigned i = 0; i < num_pkts; i++)
+        frames.push_back(make_frame(sizes[i], i));
+    PacketBatch *batch = nba::testing::create_chained_batch(num_pkts, jumbo_size, seg_size,
+        [&](size_t pkt_idx, struct Packet *pkt) { });
+    for (unsigned i = 0; i < num_pkts; i++) {
+        trim_chain(batch->packets[i], sizes[i]);
+        mbuf_copy_in(batch->packets[i], 0, frames[i].data(), sizes[i]);
+    }
+    attach_tracker(batch);
+
+    WholePacketDataBlock whole;
+    whole.set_id(0);
+    size_t in_size, in_count;
+    tie(in_size, in_count) = whole.calc_read_buffer_size(batch);
+    ASSERT_EQ(num_pkts, in_count);
+    struct item_size_info *items = batch->datablock_states->aligned_item_sizes;
+    vector<uint8_t> in_buffer(in_size);
+    whole.preprocess(batch, in_buffer.data());
+    for (unsigned i = 0; i < num_pkts; i++) {
+        ASSERT_EQ(sizes[i] - 14, items->sizes[i]);
+        size_t offset = items->offsets[i].as_value<size_t>();
+        EXPECT_EQ(0, offset % CACHE_LINE_SIZE);
+        EXPECT_EQ(0, memcmp(frames[i].data() + 14, in_buffer.data() + offset, sizes[i] - 14));
+    }
+
+    DestAddrDataBlock daddr;
+    daddr.set_id(0);
+    tie(in_size, in_count) = daddr.calc_read_buffer_size(batch);
+    ASSERT_EQ(num_pkts * sizeof(uint32_t), in_size);
+    uint32_t daddrs[num_pkts];
+    daddr.preprocess(batch, daddrs);
+    for (unsigned i = 0; i < num_pkts; i++)
+        EXPECT_EQ(0, memcmp(frames[i].data() + 30, &daddrs[i], sizeof(uint32_t)));
+    nba::testing::free_batch(batch);
+}
+
+TEST(MbufChainBenchTest, SingleSegmentGather) {
+    /* The contiguous path should cost the same as the plain memcpy. */
+    const size_t num_pkts = 64;
+    const unsigned num_rounds = 20000;
+    PacketBatch *batch = nba::testing::create_batch(num_pkts, 1514,
+        [&](size_t pkt_idx, struct Packet *pkt) { });
+    vector<uint8_t> buf(num_pkts * 1536);
+    uint64_t cycles[2];
+    for (int use_chain = 0; use_chain < 2; use_chain++) {
+        uint64_t t0 = rte_rdtsc();
+        for (unsigned r = 0; r < num_rounds; r++) {
+            for (unsigned i = 0; i < num_pkts; i++) {
+                if (use_chain)
+                    mbuf_copy_out(batch->packets[i], 14, 1500, buf.data() + i * 1536);
+                else
+                    rte_memcpy(buf.data() + i * 1536,
+                               rte_pktmbuf_mtod(batch->packets[i], char *) + 14, 1500);
+            }
+            asm volatile ("" : : "r" (buf.data()) : "memory");
+        }
+        cycles[use_chain] = rte_rdtsc() - t0;
+    }
+    printf("rte_memcpy: %.1f cycles/pkt, mbuf_copy_out: %.1f cycles/pkt\n",
+           (double) cycles[0] / (num_rounds * num_pkts),
+           (double) cycles[1] / (num_rounds * num_pkts));
+    nba::testing::free_batch(batch);
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,35 @@
+#include <nba/core/metricwriter.hh>
+#include <string>
+#include <gtest/gtest.h>
+
+using namespace nba;
+
+TEST(CoreMetricWriterTest, Family) {
+    std::string out;
+    PrometheusWriter w(out);
+    w.family("nba_port_rx_packets_total", "counter", "Packets received.");
+    EXPECT_EQ("# HELP nba_port_rx_packets_total Packets received.\n"
+              "# TYPE nba_port_rx_packets_total counter\n", out);
+}
+
+TEST(CoreMetricWriterTest, Samples) {
+    std::string out;
+    PrometheusWriter w(out);
+    w.sample("a", {}, (uint64_t) 0);
+    w.sample("b", {{"node", "0"}, {"port", "1"}}, (uint64_t) 18446744073709551615ull);
+    w.sample("c", {{"x", "y"}}, 0.25);
+    EXPECT_EQ("a 0\n"
+              "b{node=\"0\",port=\"1\"} 18446744073709551615\n"
+              "c{x=\"y\"} 0.25\n", out);
+}
+
+TEST(CoreMetricWriterTest, Escape) {
+    EXPECT_EQ("plain", PrometheusWriter::escape("plain"));
+    EXPECT_EQ("a\\\"b\\\\c\\nd", PrometheusWriter::escape("a\"b\\c\nd"));
+    std::string out;
+    PrometheusWriter w(out);
+    w.sample("m", {{"element", "Weird\"Name"}}, (uint64_t) 3);
+    EXPECT_EQ("m{element=\"Weird\\\"Name\"} 3\n", out);
+}
+
+// vim: ts=8 sts=4 sw=4 et
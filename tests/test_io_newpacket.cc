@@ -0,0 +1,99 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <nba/framework/io.hh>
+#include <gtest/gtest.h>
+#include <rte_mbuf.h>
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+struct rte_mbuf *alloc_test_mbuf()
+{
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, CACHE_LINE_SIZE, sizeof(struct rte_mbuf)
+                                              + RTE_PKTMBUF_HEADROOM
+                                              + NBA_MAX_PACKET_SIZE) != 0)
+        return nullptr;
+    struct rte_mbuf *m = (struct rte_mbuf *) ptr;
+    memset(m, 0, sizeof(*m));
+    m->buf_addr = (void *) ((uintptr_t) m + sizeof(struct rte_mbuf));
+    m->buf_len = RTE_PKTMBUF_HEADROOM + NBA_MAX_PACKET_SIZE;
+    m->data_off = RTE_PKTMBUF_HEADROOM;
+    m->nb_segs = 1;
+    return m;
+}
+
+void make_request(struct new_packet &req, int out_port, uint8_t fill)
+{
+    req.len = 60;   /* an ARP request */
+    req.out_port = out_port;
+    memset(req.buf, fill, req.len);
+}
+
+}
+
+TEST(IONewPacketTest, QueuedRequestIsTransmitted) {
+    struct new_packet reqs[3];
+    make_request(reqs[0], 1, 0xa1);
+    make_request(reqs[1], 0, 0xb0);
+    make_request(reqs[2], 1, 0xa2);
+    struct new_packet *req_ptrs[3] = { &reqs[0], &reqs[1], &reqs[2] };
+    struct io_port_stat stats[2];
+    memset(stats, 0, sizeof(stats));
+
+    vector<struct rte_mbuf *> sent[2], dropped;
+    unsigned num_sent = io_send_new_packets(req_ptrs, 3, 2, stats,
+        []() { return alloc_test_mbuf(); },
+        [&](unsigned port, struct rte_mbuf **pkts, unsigned cnt) {
+            /* Port 1 has room for one packet only. */
+            unsigned n = (port == 1) ? 1 : cnt;
+            sent[port].insert(sent[port].end(), pkts, pkts + n);
+            return n;
+        },
+        [&](struct rte_mbuf *m) { dropped.push_back(m); });
+
+    EXPECT_EQ(2u, num_sent);
+    ASSERT_EQ(1u, sent[0].size());
+    ASSERT_EQ(1u, sent[1].size());
+    ASSERT_EQ(1u, dropped.size());
+    EXPECT_EQ(60u, rte_pktmbuf_pkt_len(sent[0][0]));
+    EXPECT_EQ(0, memcmp(rte_pktmbuf_mtod(sent[0][0], void *), reqs[1].buf, 60));
+    /* Each port keeps the order of the requests. */
+    EXPECT_EQ(0, memcmp(rte_pktmbuf_mtod(sent[1][0], void *), reqs[0].buf, 60));
+    EXPECT_EQ(0, memcmp(rte_pktmbuf_mtod(dropped[0], void *), reqs[2].buf, 60));
+
+    EXPECT_EQ(1u, stats[0].num_sent_pkts);
+    EXPECT_EQ(1u, stats[1].num_sent_pkts);
+    EXPECT_EQ(0u, stats[0].num_tx_drop_pkts);
+    EXPECT_EQ(1u, stats[1].num_tx_drop_pkts);
+    EXPECT_EQ(60u + 24, stats[1].num_sent_bytes);
+    for (auto m : sent[0]) free(m);
+    for (auto m : sent[1]) free(m);
+    for (auto m : dropped) free(m);
+}
+
+TEST(IONewPacketTest, NoMbufs) {
+    struct new_packet req;
+    make_request(req, 0, 0xcc);
+    struct new_packet *req_ptr = &req;
+    struct io_port_stat stats[1];
+    memset(stats, 0, sizeof(stats));
+    unsigned num_tx_calls = 0;
+    unsigned num_sent = io_send_new_packets(&req_ptr, 1, 1, stats,
+        []() { return (struct rte_mbuf *) nullptr; },
+        [&](unsigned, struct rte_mbuf **, unsigned cnt) {
+            num_tx_calls ++;
+            return cnt;
+        },
+        [](struct rte_mbuf *m) { free(m); });
+    EXPECT_EQ(0u, num_sent);
+    EXPECT_EQ(0u, num_tx_calls);
+    EXPECT_EQ(0u, stats[0].num_sent_pkts);
+    EXPECT_EQ(1u, stats[0].num_tx_drop_pkts);
+}
+
+// vim: ts=8 sts=4 sw=4 et
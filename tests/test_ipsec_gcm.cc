@@ -0,0 +1,179 @@
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <openssl/aes.h>
+#include <gtest/gtest.h>
+#include "../elements/ipsec/util_esp_ops.hh"
+#include "../elements/ipsec/util_esp_gcm.hh"
+
+using namespace std;
+using namespace nba;
+
+static vector<uint8_t> from_hex(const string &s)
+{
+    vector<uint8_t> v;
+    for (size_t i = 0; i + 1 < s.size(); i += 2)
+        v.push_back((uint8_t) stoul(s.substr(i, 2), nullptr, 16));
+    return v;
+}
+
+/*
+ * Test cases 3 and 4 of the GCM specification, with the 12-byte IV split
+ * into the RFC 4106 salt and explicit IV.
+ */
+static const char *tv_key   = "feffe9928665731c6d6a8f9467308308";
+static const char *tv_salt  = "cafebabe";
+static const char *tv_iv    = "facedbaddecaf888";
+static const char *tv_plain = "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+                              "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255";
+static const char *tv_cipher = "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+                               "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985";
+
+TEST(IPsecGCMTest, TestVectors) {
+    vector<uint8_t> key = from_hex(tv_key), nonce = from_hex(string(tv_salt) + tv_iv);
+    AESGCM128 gcm;
+    gcm.set_key(key.data());
+    uint8_t tag[ESP_GCM_ICV_LENGTH];
+
+    /* Test case 3: no AAD. */
+    vector<uint8_t> data = from_hex(tv_plain);
+    ASSERT_TRUE(gcm.seal(nonce.data(), nullptr, 0, data.data(), data.size(), tag));
+    EXPECT_EQ(from_hex(tv_cipher), data);
+    EXPECT_EQ(from_hex("4d5c2af327cd64a62cf35abd2ba6fab4"), vector<uint8_t>(tag, tag + 16));
+    ASSERT_TRUE(gcm.open(nonce.data(), nullptr, 0, data.data(), data.size(), tag));
+    EXPECT_EQ(from_hex(tv_plain), data);
+
+    /* Test case 4: 20-byte AAD and a partial last block. */
+    vector<uint8_t> aad = from_hex("feedfacedeadbeeffeedfacedeadbeefabaddad2");
+    data = from_hex(tv_plain);
+    data.resize(60);
+    ASSERT_TRUE(gcm.seal(nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag));
+    vector<uint8_t> expected = from_hex(tv_cipher);
+    expected.resize(60);
+    EXPECT_EQ(expected, data);
+    EXPECT_EQ(from_hex("5bc94fbc3221a5db94fae95ae7121a47"), vector<uint8_t>(tag, tag + 16));
+
+    aad[0] ^= 1;
+    EXPECT_FALSE(gcm.open(nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag));
+}
+
+class IPsecGCMPacketTest : public ::testing::Test {
+protected:
+    enum { L2_LEN = 14, HEADROOM = 64 };
+
+    /* Builds an ESP packet as IPsecESPencap does, after an L2 header
+     * which starts at l2. */
+    struct iphdr *build(int ip_len, uint32_t seq)
+    {
+        frame.assign(HEADROOM + ip_len + esp_encap_trailer_len(ip_len), 0xee);
+        struct iphdr *iph = (struct iphdr *) (frame.data() + HEADROOM);
+        memset(iph, 0, sizeof(*iph));
+        iph->version = 4;
+        iph->ihl = 5;
+        iph->ttl = 64;
+        iph->protocol = IPPROTO_UDP;
+        iph->tot_len = htons(ip_len);
+        iph->saddr = htonl(0x0a000001u);
+        iph->daddr = htonl(0x0a000002u);
+        for (int i = sizeof(*iph); i < ip_len; i++)
+            ((uint8_t *) iph)[i] = (uint8_t) (i * 13);
+        iph->check = ip_fast_csum(iph, iph->ihl);
+        inner.assign((uint8_t *) iph, (uint8_t *) iph + ip_len);
+        uint8_t iv[ESP_IV_LENGTH];
+        for (int i = 0; i < ESP_IV_LENGTH; i++)
+            iv[i] = (uint8_t) (i + seq);
+        uint8_t *l3 = esp_encap((uint8_t *) iph, 0x1234, seq, iv);
+        l2 = l3 - L2_LEN;
+        return (struct iphdr *) l3;
+    }
+
+    vector<uint8_t> frame;
+    uint8_t *l2;
+    vector<uint8_t> inner;
+};
+
+TEST_F(IPsecGCMPacketTest, RoundTrip) {
+    const uint8_t *key = (const uint8_t *) "1234123412341234";
+    const uint8_t salt[ESP_GCM_SALT_LENGTH] = { 5, 6, 7, 8 };
+    AESGCM128 gcm;
+    gcm.set_key(key);
+    for (int ip_len : { 28, 61, 64, 1500 }) {
+        int outer_len = ntohs(build(ip_len, 42)->tot_len);
+        struct iphdr *iph = (struct iphdr *) esp_gcm_reformat(l2, L2_LEN);
+        EXPECT_EQ(outer_len - 12, ntohs(iph->tot_len));
+        EXPECT_EQ(0, ip_fast_csum(iph, iph->ihl));
+        EXPECT_EQ(0xee, l2[8]);      /* the L2 header moved by 8 bytes */
+        struct esp_gcm_hdr *esph = (struct esp_gcm_hdr *) (iph + 1);
+        EXPECT_EQ(0x1234u, ntohl(esph->esp_spi));
+        EXPECT_EQ(42u, ntohl(esph->esp_rpl));
+        EXPECT_EQ(8 + 42, esph->esp_iv[0]);
+        ASSERT_TRUE(esp_gcm_seal(iph, gcm, salt));
+        EXPECT_NE(0, memcmp(inner.data(), esp_gcm_payload(iph), ip_len));
+
+        ASSERT_TRUE(esp_gcm_open(iph, gcm, salt));
+        uint8_t *payload = esp_gcm_payload(iph);
+        int len = esp_gcm_payload_len(iph);
+        EXPECT_EQ(ESP_NEXT_HDR_IPIP, payload[len - 1]);
+        EXPECT_EQ(ip_len, len - 2 - payload[len - 2]);
+        EXPECT_EQ(0, memcmp(inner.data(), payload, ip_len));
+
+        ASSERT_EQ(ip_len, esp_gcm_decap(iph));
+        EXPECT_EQ(0, memcmp(inner.data(), iph, ip_len));
+    }
+}
+
+TEST_F(IPsecGCMPacketTest, RejectTampered) {
+    const uint8_t *key = (const uint8_t *) "1234123412341234";
+    const uint8_t salt[ESP_GCM_SALT_LENGTH] = { 5, 6, 7, 8 };
+    AESGCM128 gcm;
+    gcm.set_key(key);
+    build(100, 1);
+    struct iphdr *iph = (struct iphdr *) esp_gcm_reformat(l2, L2_LEN);
+    ASSERT_TRUE(esp_gcm_seal(iph, gcm, salt));
+    ((struct esp_gcm_hdr *) (iph + 1))->esp_rpl ^= htonl(1);    /* in the AAD */
+    EXPECT_FALSE(esp_gcm_open(iph, gcm, salt));
+}
+
+/*
+ * Compares the CPU cost of the AES-GCM element with the AES-CTR and
+ * HMAC-SHA1 element chain on the same packets.
+ */
+TEST_F(IPsecGCMPacketTest, Throughput) {
+    const uint8_t *key = (const uint8_t *) "1234123412341234";
+    const uint8_t salt[ESP_GCM_SALT_LENGTH] = { 5, 6, 7, 8 };
+    uint8_t hmac_key[HMAC_KEY_SIZE];
+    memset(hmac_key, 0x61, sizeof(hmac_key));
+    AESGCM128 gcm;
+    gcm.set_key(key);
+    AES_KEY aes_key;
+    AES_set_encrypt_key(key, 128, &aes_key);
+    const int iters = 20000;
+    for (int ip_len : { 64, 512, 1500 }) {
+        struct iphdr *iph = build(ip_len, 1);
+
+        auto t0 = chrono::steady_clock::now();
+        for (int i = 0; i < iters; i++) {
+            esp_aes_ctr_crypt(iph, &aes_key);
+            esp_hmac_sha1_sign(iph, hmac_key);
+        }
+        auto t1 = chrono::steady_clock::now();
+        void *gcm_l3 = esp_gcm_reformat(l2, L2_LEN);
+        auto t2 = chrono::steady_clock::now();
+        for (int i = 0; i < iters; i++)
+            esp_gcm_seal(gcm_l3, gcm, salt);
+        auto t3 = chrono::steady_clock::now();
+
+        double bits = 8.0 * ip_len * iters;
+        double chain_gbps = bits / chrono::duration<double, nano>(t1 - t0).count();
+        double gcm_gbps = bits / chrono::duration<double, nano>(t3 - t2).count();
+        printf("%5d-byte packets: AES-CTR + HMAC-SHA1 %6.2f Gbps, AES-GCM %6.2f Gbps\n",
+               ip_len, chain_gbps, gcm_gbps);
+    }
+}
+
+// vim: ts=8 sts=4 sw=4 et
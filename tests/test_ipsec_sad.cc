@@ -0,0 +1,230 @@
+#include "../elements/ipsec/util_sad.hh"
+#include "../elements/ipsec/util_ipsec_key.hh"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+#include <unistd.h>
+#include <gtest/gtest.h>
+
+using namespace std;
+using namespace nba;
+
+class IPsecSADTest : public ::testing::Test {
+protected:
+    virtual void SetUp() { mem = nullptr; }
+    virtual void TearDown() { free(mem); }
+
+    void build(const vector<struct ipsec_sa> &sas, size_t max_sas)
+    {
+        mem = malloc(IPsecSAD::memory_size(max_sas));
+        ASSERT_TRUE(mem != nullptr);
+        sad.init(mem, max_sas);
+        for (const struct ipsec_sa &sa : sas)
+            ASSERT_NE(IPsecSAD::NOT_FOUND, sad.add(sa));
+    }
+
+    void *mem;
+    IPsecSAD sad;
+};
+
+TEST_F(IPsecSADTest, Lookup) {
+    vector<struct ipsec_sa> sas;
+    IPsecSAD::generate(1000, sas);
+    build(sas, sas.size());
+    EXPECT_EQ(1000u, sad.size());
+    for (uint32_t i = 0; i < 1000; i++) {
+        EXPECT_EQ(i, sad.lookup_outbound(0x0a000001u, 0x0a000000u + i + 1));
+        EXPECT_EQ(i, sad.lookup_inbound(0x1000u + i, 0x0a000000u + i + 1));
+        EXPECT_EQ(0x1000u + i, sad.get(i)->spi);
+    }
+    EXPECT_EQ(IPsecSAD::NOT_FOUND, sad.lookup_outbound(0x0a000001u, 0x0a000000u));
+    EXPECT_EQ(IPsecSAD::NOT_FOUND, sad.lookup_outbound(0x0a000002u, 0x0a000001u));
+    EXPECT_EQ(IPsecSAD::NOT_FOUND, sad.lookup_inbound(0x1000u, 0x0a000002u));
+    EXPECT_EQ(IPsecSAD::NOT_FOUND, sad.lookup_inbound(0x1000u + 1000, 0x0a000000u + 1001));
+}
+
+TEST_F(IPsecSADTest, RejectDuplicateAndFull) {
+    vector<struct ipsec_sa> sas;
+    IPsecSAD::generate(4, sas);
+    build(vector<struct ipsec_sa>(sas.begin(), sas.begin() + 3), 4);
+    struct ipsec_sa dup = sas[0];
+    dup.spi = 0xdead;
+    EXPECT_EQ(IPsecSAD::NOT_FOUND, sad.add(dup));   /* same address pair */
+    dup = sas[1];
+    dup.src_addr = 0x0a0000ffu;
+    EXPECT_EQ(IPsecSAD::NOT_FOUND, sad.add(dup));   /* same SPI and destination */
+    EXPECT_EQ(3u, sad.add(sas[3]));
+    dup.spi = 0xdead;
+    EXPECT_EQ(IPsecSAD::NOT_FOUND, sad.add(dup));   /* full */
+    EXPECT_EQ(4u, sad.size());
+}
+
+TEST_F(IPsecSADTest, Attach) {
+    vector<struct ipsec_sa> sas;
+    IPsecSAD::generate(100, sas);
+    build(sas, sas.size());
+    void *copy = malloc(sad.get_memory_size());
+    memcpy(copy, sad.get_memory(), sad.get_memory_size());
+    memset(mem, 0, sad.get_memory_size());
+    IPsecSAD other;
+    other.attach(copy);
+    EXPECT_EQ(100u, other.size());
+    EXPECT_EQ(42u, other.lookup_outbound(0x0a000001u, 0x0a000000u + 43));
+    EXPECT_EQ(0, memcmp(other.get(42)->aes_key, "1234123412341234", AES_BLOCK_SIZE));
+    free(copy);
+}
+
+TEST(IPsecSADFileTest, Load) {
+    char path[] = "/tmp/nba-test-sad-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    FILE *fp = fdopen(fd, "w");
+    fprintf(fp, "# src dst spi aes hmac [gw]\n"
+                "\n"
+                "10.0.0.1 10.0.1.1 0x100 000102030405060708090a0b0c0d0e0f aabb\n"
+                "  10.0.0.1 10.0.1.2 257 00 ccdd 192.168.0.1\n"
+                "10.0.0.1 10.0.1.3 0x102 000102030405060708090a0b0c0d0e0f10111213 ccdd\n");
+    fclose(fp);
+
+    vector<struct ipsec_sa> sas;
+    string err;
+    ASSERT_EQ(0, IPsecSAD::load_file(path, sas, err)) << err;
+    ASSERT_EQ(3u, sas.size());
+    EXPECT_EQ(0x0a000001u, sas[0].src_addr);
+    EXPECT_EQ(0x0a000101u, sas[0].dest_addr);
+    EXPECT_EQ(0x100u, sas[0].spi);
+    EXPECT_EQ(0x0a000001u, sas[0].gw_addr);
+    EXPECT_EQ(0x0f, sas[0].aes_key[15]);
+    EXPECT_EQ(0xbb, sas[0].hmac_key[1]);
+    EXPECT_EQ(0x00, sas[0].hmac_key[2]);
+    EXPECT_EQ(257u, sas[1].spi);
+    EXPECT_EQ(0xc0a80001u, sas[1].gw_addr);
+    EXPECT_EQ(0x0f, sas[2].aes_key[15]);
+    EXPECT_EQ(0x13, sas[2].aes_salt[3]);
+
+    fp = fopen(path, "a");
+    fprintf(fp, "10.0.0.1 10.0.1.4 0x103 0g ccdd\n");
+    fclose(fp);
+    EXPECT_EQ(-1, IPsecSAD::load_file(path, sas, err));
+    EXPECT_NE(string::npos, err.find(":6:"));
+    unlink(path);
+
+    EXPECT_EQ(-1, IPsecSAD::load_file("/nonexistent/sa.conf", sas, err));
+}
+
+static void write_sa_file(const char *path, const char *contents)
+{
+    FILE *fp = fopen(path, "w");
+    ASSERT_TRUE(fp != nullptr);
+    fprintf(fp, "%s", contents);
+    fclose(fp);
+}
+
+TEST(IPsecSADStoreTest, ReloadWithChangedSAD) {
+    char path_a[] = "/tmp/nba-test-sad-XXXXXX";
+    char path_b[] = "/tmp/nba-test-sad-XXXXXX";
+    close(mkstemp(path_a));
+    close(mkstemp(path_b));
+    write_sa_file(path_a, "10.0.0.1 10.0.1.1 0x100 00 aabb\n"
+                          "10.0.0.1 10.0.1.2 0x101 00 aabb\n");
+    write_sa_file(path_b, "10.0.0.1 10.0.2.1 0x200 00 aabb\n");
+
+    IPsecSADStore store(1024);
+    string err;
+    /* Startup: elements without the argument follow the others. */
+    EXPECT_EQ(0, store.configure(0, "", err));
+    EXPECT_EQ(0, store.configure(0, path_a, err)) << err;
+    EXPECT_EQ(0, store.configure(0, path_a, err)) << err;
+    EXPECT_EQ(-1, store.configure(0, path_b, err));
+    EXPECT_FALSE(store.loaded());
+    const IPsecSAD &sad = store.load();
+    ASSERT_EQ(2u, sad.size());
+    EXPECT_EQ(path_a, store.get_source());
+
+    /* A reload with another source is rejected, not loaded. */
+    EXPECT_EQ(-1, store.configure(1, path_b, err));
+    EXPECT_NE(string::npos, err.find("restart"));
+    EXPECT_EQ(-1, store.configure(2, "16", err));
+
+    /* So is one with the same source but changed SAs. */
+    write_sa_file(path_a, "10.0.0.1 10.0.1.1 0x100 00 aabb\n");
+    EXPECT_EQ(-1, store.configure(3, path_a, err));
+    EXPECT_NE(string::npos, err.find("changed"));
+
+    /* The unchanged SAs and elements without the argument are fine. */
+    write_sa_file(path_a, "10.0.0.1 10.0.1.1 0x100 00 aabb\n"
+                          "10.0.0.1 10.0.1.2 0x101 00 aabb\n");
+    EXPECT_EQ(0, store.configure(4, path_a, err)) << err;
+    EXPECT_EQ(0, store.configure(5, "", err));
+    EXPECT_EQ(&sad, &store.load());
+    EXPECT_EQ(2u, store.load().size());
+    EXPECT_EQ(0x101u, store.load().get(1)->spi);
+    unlink(path_a);
+    unlink(path_b);
+}
+
+TEST(IPsecSADStoreTest, RefusedBuildIsNotLoaded) {
+    IPsecSADStore store(1024);
+    string err;
+    /* A build refused before the SAD is loaded leaves nothing behind. */
+    EXPECT_EQ(-1, store.configure(1, "/nonexistent/sa.conf", err));
+    EXPECT_EQ(0, store.configure(1, "", err));
+    EXPECT_EQ(0, store.configure(2, "8", err)) << err;
+    EXPECT_EQ(-1, store.configure(2, "16", err));
+    EXPECT_EQ(0, store.configure(3, "16", err)) << err;
+    EXPECT_EQ(16u, store.load().size());
+    EXPECT_EQ("16", store.get_source());
+
+    /* Without any source, the default number of tunnels is used. */
+    IPsecSADStore default_store(1024);
+    EXPECT_EQ(0, default_store.configure(0, "", err));
+    EXPECT_EQ(1024u, default_store.load().size());
+    EXPECT_EQ(0, default_store.configure(1, "1024", err)) << err;
+}
+
+/*
+ * Measures the outbound lookup cost against the number of tunnels,
+ * compared with the std::unordered_map used by the IPsec elements before.
+ */
+TEST(IPsecSADBenchTest, LookupCost) {
+    const size_t num_lookups = 1u << 22;
+    const size_t tunnel_counts[] = { 1024, 16384, 262144, 1048576 };
+    vector<uint32_t> dests(num_lookups);
+    for (size_t num_tunnels : tunnel_counts) {
+        vector<struct ipsec_sa> sas;
+        IPsecSAD::generate(num_tunnels, sas);
+        void *mem = malloc(IPsecSAD::memory_size(num_tunnels));
+        IPsecSAD sad;
+        sad.init(mem, num_tunnels);
+        unordered_map<struct ipaddr_pair, int> map;
+        for (size_t i = 0; i < num_tunnels; i++) {
+            ASSERT_EQ(i, sad.add(sas[i]));
+            struct ipaddr_pair pair = { sas[i].src_addr, sas[i].dest_addr };
+            map.insert(make_pair(pair, (int) i));
+        }
+        srand(7);
+        for (size_t i = 0; i < num_lookups; i++)
+            dests[i] = 0x0a000001u + (uint32_t) (rand() % num_tunnels);
+
+        uint64_t sum = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < num_lookups; i++)
+            sum += sad.lookup_outbound(0x0a000001u, dests[i]);
+        auto t1 = chrono::steady_clock::now();
+        for (size_t i = 0; i < num_lookups; i++) {
+            struct ipaddr_pair pair = { 0x0a000001u, dests[i] };
+            sum -= map.find(pair)->second;
+        }
+        auto t2 = chrono::steady_clock::now();
+        EXPECT_EQ(0u, sum);
+
+        double sad_ns = chrono::duration<double, nano>(t1 - t0).count() / num_lookups;
+        double map_ns = chrono::duration<double, nano>(t2 - t1).count() / num_lookups;
+        printf("%8zu tunnels: IPsecSAD %6.1f ns/lookup, unordered_map %6.1f ns/lookup (%zu KiB)\n",
+               num_tunnels, sad_ns, map_ns, sad.get_memory_size() / 1024);
+        free(mem);
+    }
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,138 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <gtest/gtest.h>
+#include <rte_cycles.h>
+#include "../elements/ip/util_checkip.hh"
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+const size_t frame_len = 64;
+
+/* Builds a valid IPv4 frame with ihl 32-bit words of header. */
+void make_frame(uint8_t *frame, uint32_t seed, unsigned ihl = 5)
+{
+    memset(frame, 0, frame_len);
+    struct ether_hdr *ethh = (struct ether_hdr *) frame;
+    ethh->ether_type = htons(ETHER_TYPE_IPv4);
+    struct iphdr *iph = (struct iphdr *) (ethh + 1);
+    iph->version = 4;
+    iph->ihl = ihl;
+    iph->tot_len = htons(frame_len - sizeof(struct ether_hdr));
+    iph->id = htons(seed);
+    iph->ttl = 64;
+    iph->protocol = IPPROTO_UDP;
+    iph->saddr = htonl(0x0a000000u + seed);
+    iph->daddr = htonl(0xc0a80000u ^ (seed * 2654435761u));
+    for (unsigned k = 20; k < ihl * 4u; k++)
+        ((uint8_t *) iph)[k] = (uint8_t) (seed + k);
+    iph->check = 0;
+    iph->check = ip_fast_csum(iph, iph->ihl);
+}
+
+/* Applies one of several corruptions (or none) depending on kind. */
+void corrupt(uint8_t *frame, unsigned kind, uint32_t seed)
+{
+    struct iphdr *iph = (struct iphdr *) (frame + sizeof(struct ether_hdr));
+    switch (kind) {
+    case 0: break;
+    case 1: frame[12] = 0x86; frame[13] = 0xdd; break;        /* IPv6 ether type */
+    case 2: iph->version = 6; break;
+    case 3: iph->ihl = 4; break;
+    case 4: iph->tot_len = htons(19); break;
+    case 5: iph->check ^= htons(1 << (seed % 16)); break;
+    case 6: ((uint8_t *) iph)[seed % 20] ^= 0x10; break;
+    case 7: make_frame(frame, seed, 5 + seed % 3); break;      /* valid with options */
+    case 8: make_frame(frame, seed, 6); iph->tot_len = htons(20); break;
+    }
+}
+
+}
+
+TEST(CheckIPTest, MatchesScalar) {
+    const unsigned count = 64;
+    vector<uint8_t> buf(count * frame_len);
+    const uint8_t *frames[count];
+    uint64_t scalar_mask[1], vector_mask[1];
+    for (uint32_t round = 0; round < 2000; round++) {
+        for (unsigned i = 0; i < count; i++) {
+            uint32_t seed = round * count + i;
+            uint8_t *frame = &buf[i * frame_len];
+            make_frame(frame, seed);
+            corrupt(frame, (seed * 7 + round) % 12, seed);
+            frames[i] = frame;
+        }
+        unsigned n = 1 + round % count;     /* also covers the scalar tails */
+        check_ipv4_frames_scalar(frames, n, scalar_mask);
+        check_ipv4_frames(frames, n, vector_mask);
+        ASSERT_EQ(scalar_mask[0], vector_mask[0]) << "round " << round << ", count " << n;
+    }
+}
+
+TEST(CheckIPTest, Decisions) {
+    uint8_t buf[10][frame_len];
+    const uint8_t *frames[10];
+    for (unsigned i = 0; i < 10; i++) {
+        make_frame(buf[i], i);
+        frames[i] = buf[i];
+    }
+    corrupt(buf[1], 1, 1);
+    corrupt(buf[3], 5, 3);
+    corrupt(buf[4], 7, 2);      /* valid, with options */
+    corrupt(buf[6], 4, 6);
+    corrupt(buf[9], 8, 9);
+    uint64_t mask[1];
+    check_ipv4_frames(frames, 10, mask);
+    EXPECT_EQ((1u << 1) | (1u << 3) | (1u << 6) | (1u << 9), mask[0]);
+    check_ipv4_frames_scalar(frames, 10, mask);
+    EXPECT_EQ((1u << 1) | (1u << 3) | (1u << 6) | (1u << 9), mask[0]);
+}
+
+TEST(CheckIPBenchTest, BatchVersusScalar) {
+    /* CheckIPHeader validates one packet per call; compare it with the
+     * batch-level check over 64-packet batches of valid packets. */
+    const unsigned count = 64;
+    const unsigned num_batches = 256;
+    const unsigned num_rounds = 200;
+    vector<uint8_t> buf(num_batches * count * frame_len);
+    vector<const uint8_t *> frames(num_batches * count);
+    for (unsigned i = 0; i < num_batches * count; i++) {
+        make_frame(&buf[i * frame_len], i);
+        frames[i] = &buf[i * frame_len];
+    }
+    uint64_t cycles[2], dropped[2] = {0, 0};
+    for (int use_batch = 0; use_batch < 2; use_batch++) {
+        uint64_t t0 = rte_rdtsc();
+        for (unsigned r = 0; r < num_rounds; r++) {
+            for (unsigned b = 0; b < num_batches; b++) {
+                const uint8_t *const *f = &frames[b * count];
+                if (use_batch) {
+                    uint64_t mask[1];
+                    check_ipv4_frames(f, count, mask);
+                    dropped[1] += __builtin_popcountll(mask[0]);
+                } else {
+                    for (unsigned i = 0; i < count; i++)
+                        dropped[0] += !check_ipv4_frame(f[i]);
+                }
+            }
+        }
+        cycles[use_batch] = rte_rdtsc() - t0;
+    }
+    EXPECT_EQ(0u, dropped[0]);
+    EXPECT_EQ(0u, dropped[1]);
+    double total = (double) num_rounds * num_batches * count;
+    printf("scalar: %.2f cycles/pkt, batch%s: %.2f cycles/pkt\n",
+           cycles[0] / total,
+#ifdef __AVX2__
+           " (AVX2)",
+#else
+           " (scalar fallback)",
+#endif
+           cycles[1] / total);
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,192 @@
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <random>
+#include <cmath>
+#include <gtest/gtest.h>
+#include "../elements/loadbalancers/util_flow_buckets.hh"
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+/*
+ * A synthetic flow mix: packets of num_flows flows with Zipf-like
+ * popularity go through either the CPU path (latency: cpu_delay
+ * packets) or the offload path (latency: offl_delay packets).
+ * A packet is counted as reordered if it leaves after a later packet of
+ * the same flow.
+ */
+struct FlowSim {
+    struct inflight_pkt {
+        uint64_t exit_time;
+        unsigned flow;
+        uint64_t seq;
+    };
+
+    FlowSim(unsigned num_flows, unsigned cpu_delay, unsigned offl_delay)
+        : num_flows(num_flows), cpu_delay(cpu_delay), offl_delay(offl_delay),
+          now(0), num_pkts(0), num_cpu_pkts(0), num_reordered(0),
+          rng(1234), next_seq(num_flows, 0), last_exit_seq(num_flows, 0)
+    {
+        double sum = 0;
+        for (unsigned f = 0; f < num_flows; f++) {
+            sum += 1.0 / (f + 1);
+            cdf.push_back(sum);
+        }
+        for (double &c : cdf)
+            c /= sum;
+        for (unsigned f = 0; f < num_flows; f++)
+            flow_hashes.push_back((uint32_t) rng());
+    }
+
+    unsigned pick_flow()
+    {
+        double x = uniform(rng);
+        return (unsigned) (lower_bound(cdf.begin(), cdf.end(), x) - cdf.begin());
+    }
+
+    /* Sends a packet of a random flow to the given path. */
+    template<typename PathFunc>
+    void step(PathFunc path_of)
+    {
+        unsigned f = pick_flow();
+        int path = path_of(f, flow_hashes[f]);
+        uint64_t exit_time = now + ((path == FLOW_PATH_CPU) ? cpu_delay : offl_delay);
+        pipe.push_back({exit_time, f, ++ next_seq[f]});
+        num_pkts ++;
+        if (path == FLOW_PATH_CPU) num_cpu_pkts ++;
+        now ++;
+        drain(now);
+    }
+
+    void drain(uint64_t t)
+    {
+        /* Let out packets in the order of exit time (stable). */
+        bool progress = true;
+        while (progress) {
+            progress = false;
+            auto it_min = pipe.end();
+            for (auto it = pipe.begin(); it != pipe.end(); it++)
+                if (it->exit_time <= t && (it_min == pipe.end() || it->exit_time < it_min->exit_time))
+                    it_min = it;
+            if (it_min != pipe.end()) {
+                if (it_min->seq < last_exit_seq[it_min->flow])
+                    num_reordered ++;
+                else
+                    last_exit_seq[it_min->flow] = it_min->seq;
+                pipe.erase(it_min);
+                progress = true;
+            }
+        }
+    }
+
+    void reset_counters()
+    {
+        num_pkts = num_cpu_pkts = num_reordered = 0;
+    }
+
+    double reorder_rate() const { return (double) num_reordered / num_pkts; }
+    double cpu_ratio() const { return (double) num_cpu_pkts / num_pkts; }
+
+    unsigned num_flows, cpu_delay, offl_delay;
+    uint64_t now, num_pkts, num_cpu_pkts, num_reordered;
+    mt19937 rng;
+    uniform_real_distribution<double> uniform;
+    vector<double> cdf;
+    vector<uint32_t> flow_hashes;
+    vector<uint64_t> next_seq, last_exit_seq;
+    deque<inflight_pkt> pipe;
+};
+
+}
+
+TEST(LBFlowAffinityTest, FlowHash) {
+    uint8_t frame[64] = {0,};
+    frame[12] = 0x08; frame[13] = 0x00;  /* IPv4 */
+    frame[14] = 0x45;                    /* ver 4, ihl 5 */
+    frame[14 + 9] = 17;                  /* UDP */
+    frame[14 + 12] = 10; frame[14 + 16] = 20;
+    frame[34] = 0x12; frame[36] = 0x34;  /* sport, dport */
+    uint32_t h1 = flow_hash_ipv4(frame, sizeof(frame));
+    /* The payload does not matter. */
+    frame[50] = 0xff;
+    EXPECT_EQ(h1, flow_hash_ipv4(frame, sizeof(frame)));
+    /* The ports matter. */
+    frame[34] = 0x13;
+    EXPECT_NE(h1, flow_hash_ipv4(frame, sizeof(frame)));
+}
+
+TEST(LBFlowAffinityTest, InitialAssignment) {
+    const unsigned nb = FlowBucketMap::NUM_BUCKETS;
+    FlowBucketMap m;
+    EXPECT_EQ(nb, m.get_num_cpu_buckets());
+    m.reset(0.25f);
+    EXPECT_EQ(nb / 4, m.get_num_cpu_buckets());
+    /* Without traffic, rebalancing moves buckets by count. */
+    EXPECT_EQ(8u, m.rebalance(0.75f, 8));
+    EXPECT_EQ(nb / 4 + 8, m.get_num_cpu_buckets());
+    m.rebalance(0.75f, nb);
+    EXPECT_EQ(nb * 3 / 4, m.get_num_cpu_buckets());
+}
+
+TEST(LBFlowAffinityTest, RatioAndReordering) {
+    const unsigned epoch_len = 2000;
+    FlowSim sim(4000, 2, 50);
+    FlowBucketMap m;
+    m.reset(0.5f);
+    float target = 0.3f;
+    auto flow_lb = [&m] (unsigned f, uint32_t h) -> int { return m.lookup(h); };
+
+    /* Converge to the first target. */
+    for (unsigned e = 0; e < 20; e++) {
+        for (unsigned i = 0; i < epoch_len; i++)
+            sim.step(flow_lb);
+        m.rebalance(target, 16);
+    }
+    sim.reset_counters();
+    for (unsigned e = 0; e < 10; e++) {
+        for (unsigned i = 0; i < epoch_len; i++)
+            sim.step(flow_lb);
+        m.rebalance(target, 16);
+    }
+    printf("flow-affinity: target %.2f achieved %.3f reorder %.4f%%\n",
+           target, sim.cpu_ratio(), sim.reorder_rate() * 100);
+    EXPECT_NEAR(target, sim.cpu_ratio(), 0.05);
+
+    /* Change the target and keep measuring during the migration. */
+    target = 0.7f;
+    sim.reset_counters();
+    for (unsigned e = 0; e < 30; e++) {
+        for (unsigned i = 0; i < epoch_len; i++)
+            sim.step(flow_lb);
+        m.rebalance(target, 16);
+    }
+    double flow_reorder = sim.reorder_rate();
+    sim.reset_counters();
+    for (unsigned e = 0; e < 10; e++) {
+        for (unsigned i = 0; i < epoch_len; i++)
+            sim.step(flow_lb);
+        m.rebalance(target, 16);
+    }
+    printf("flow-affinity: target %.2f achieved %.3f reorder %.4f%% (during migration)\n",
+           target, sim.cpu_ratio(), flow_reorder * 100);
+    EXPECT_NEAR(target, sim.cpu_ratio(), 0.05);
+    EXPECT_LT(flow_reorder, 0.01);
+
+    /* Compare with per-packet random balancing at the same ratio. */
+    FlowSim sim2(4000, 2, 50);
+    mt19937 rng(42);
+    uniform_real_distribution<float> uniform;
+    auto random_lb = [&] (unsigned f, uint32_t h) -> int {
+        return (uniform(rng) < target) ? FLOW_PATH_CPU : FLOW_PATH_OFFLOAD;
+    };
+    for (unsigned i = 0; i < 10 * epoch_len; i++)
+        sim2.step(random_lb);
+    printf("per-packet random: target %.2f achieved %.3f reorder %.4f%%\n",
+           target, sim2.cpu_ratio(), sim2.reorder_rate() * 100);
+    EXPECT_GT(sim2.reorder_rate(), 10 * flow_reorder);
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,153 @@
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <gtest/gtest.h>
+#include "../elements/loadbalancers/util_pid.hh"
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+/*
+ * A simulated plant: the per-packet processing cost of each path as a
+ * function of the CPU ratio.  The CPU path slows down as it gets more
+ * load (cache/memory contention) and the offloading path gets cheaper
+ * per packet as larger batches amortize the fixed offloading overheads.
+ */
+struct LBPlant {
+    float cpu_base, cpu_contention;
+    float offl_base, offl_fixed;
+    float noise;
+    mt19937 rng;
+    normal_distribution<float> gauss;
+
+    LBPlant(float cpu_base, float offl_base, float noise = 0.0f)
+        : cpu_base(cpu_base), cpu_contention(0.3f),
+          offl_base(offl_base), offl_fixed(0.05f),
+          noise(noise), rng(7), gauss(0.0f, 1.0f)
+    { }
+
+    float ppc_cpu(float c) { return cpu_base * (1.0f + cpu_contention * c); }
+    float ppc_offl(float c) { return offl_base * (1.0f + offl_fixed / ((1.0f - c) + 0.05f)); }
+
+    /* The measured costs include multiplicative noise. */
+    float measure(float c)
+    {
+        float pc = ppc_cpu(c) * (1.0f + noise * gauss(rng));
+        float po = ppc_offl(c) * (1.0f + noise * gauss(rng));
+        return lb_balanced_ratio(pc, po) - c;
+    }
+
+    /* Finds the balanced ratio by bisection. */
+    float optimum()
+    {
+        float lo = 0, hi = 1;
+        for (int i = 0; i < 50; i++) {
+            float mid = (lo + hi) / 2;
+            if (lb_balanced_ratio(ppc_cpu(mid), ppc_offl(mid)) > mid) lo = mid;
+            else hi = mid;
+        }
+        return (lo + hi) / 2;
+    }
+};
+
+struct RunResult {
+    int converge_steps;
+    float steady_error;
+    float max_swing;
+};
+
+/* Runs the loop and measures the convergence time (steps to stay within
+ * 2% of the optimum), the mean steady-state error, and the peak-to-peak
+ * swing in the steady state. */
+RunResult run(PIDRatioController &pid, LBPlant &plant, int steps, float dt)
+{
+    const float target = plant.optimum();
+    RunResult r = {-1, 0, 0};
+    int in_band_since = -1;
+    float lo = 1, hi = 0, err_sum = 0;
+    int n = 0;
+    for (int k = 0; k < steps; k++) {
+        float c = pid.get_ratio();
+        pid.update(plant.measure(c), dt);
+        c = pid.get_ratio();
+        if (fabsf(c - target) < 0.02f) {
+            if (in_band_since < 0) in_band_since = k;
+        } else
+            in_band_since = -1;
+        if (k >= steps / 2) {
+            lo = fminf(lo, c);
+            hi = fmaxf(hi, c);
+            err_sum += fabsf(c - target);
+            n ++;
+        }
+    }
+    r.converge_steps = in_band_since;
+    r.steady_error = err_sum / n;
+    r.max_swing = hi - lo;
+    return r;
+}
+
+}
+
+TEST(LBPIDTest, BalancedRatio) {
+    EXPECT_FLOAT_EQ(0.5f, lb_balanced_ratio(100, 100));
+    EXPECT_FLOAT_EQ(0.25f, lb_balanced_ratio(300, 100));
+    EXPECT_FLOAT_EQ(0.5f, lb_balanced_ratio(0, 0));
+}
+
+TEST(LBPIDTest, Limits) {
+    PIDRatioController pid;
+    pid.set_limits(0.05f, 0.95f);
+    pid.reset(1.0f);
+    EXPECT_FLOAT_EQ(0.95f, pid.get_ratio());
+    for (int k = 0; k < 100; k++)
+        pid.update(-1.0f, 0.2f);
+    EXPECT_FLOAT_EQ(0.05f, pid.get_ratio());
+    /* No wind-up: it leaves the limit as soon as the error reverses. */
+    pid.update(0.5f, 0.2f);
+    EXPECT_GT(pid.get_ratio(), 0.05f);
+}
+
+TEST(LBPIDTest, Converge) {
+    const float dt = 0.2f;
+    float cases[][2] = {{1000, 400}, {400, 1000}, {800, 800}, {2000, 200}};
+    for (auto &cs : cases) {
+        LBPlant plant(cs[0], cs[1]);
+        PIDRatioController pid;
+        pid.reset(1.0f);
+        RunResult r = run(pid, plant, 200, dt);
+        printf("plant(cpu %.0f, offl %.0f): optimum %.3f converged in %d steps (%.1f sec), "
+               "steady-state error %.4f, swing %.4f\n",
+               cs[0], cs[1], plant.optimum(), r.converge_steps, r.converge_steps * dt,
+               r.steady_error, r.max_swing);
+        EXPECT_GE(r.converge_steps, 0);
+        EXPECT_LT(r.converge_steps, 40);
+        EXPECT_LT(r.steady_error, 0.01f);
+        EXPECT_LT(r.max_swing, 0.02f);
+    }
+}
+
+TEST(LBPIDTest, NoisyAndChanging) {
+    const float dt = 0.2f;
+    LBPlant plant(1000, 400, 0.05f);
+    PIDRatioController pid;
+    pid.reset(1.0f);
+    RunResult r = run(pid, plant, 200, dt);
+    printf("noisy plant: optimum %.3f converged in %d steps, steady-state error %.4f, swing %.4f\n",
+           plant.optimum(), r.converge_steps, r.steady_error, r.max_swing);
+    EXPECT_LT(r.steady_error, 0.03f);
+    EXPECT_LT(r.max_swing, 0.15f);
+
+    /* The traffic changes: offloading becomes much more expensive. */
+    plant.offl_base = 1500;
+    r = run(pid, plant, 200, dt);
+    printf("changed plant: optimum %.3f converged in %d steps, steady-state error %.4f, swing %.4f\n",
+           plant.optimum(), r.converge_steps, r.steady_error, r.max_swing);
+    EXPECT_LT(r.steady_error, 0.03f);
+    EXPECT_LT(r.max_swing, 0.15f);
+}
+
+// vim: ts=8 sts=4 sw=4 et
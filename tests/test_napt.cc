@@ -0,0 +1,240 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <vector>
+#include <random>
+#include <new>
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <rte_cycles.h>
+#include "../elements/ip/util_napt.hh"
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+const uint32_t EXT_ADDR = 0xcb007101;   /* 203.0.113.1 */
+
+struct test_packet {
+    uint8_t buf[64] __attribute__((aligned(8)));
+    struct iphdr *iph() { return (struct iphdr *) buf; }
+    uint16_t *ports() { return (uint16_t *) (buf + 20); }
+};
+
+uint32_t sum16(const void *data, size_t len, uint32_t sum)
+{
+    const uint8_t *p = (const uint8_t *) data;
+    for (size_t i = 0; i + 1 < len; i += 2)
+        sum += (p[i] << 8) | p[i + 1];
+    if (len & 1)
+        sum += p[len - 1] << 8;
+    return sum;
+}
+
+uint16_t fold(uint32_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+/* Computes the checksums from scratch (in network order). */
+void full_checksums(struct test_packet &p, uint16_t &ip_csum, uint16_t &l4_csum)
+{
+    struct iphdr *iph = p.iph();
+    uint16_t saved = iph->check;
+    iph->check = 0;
+    ip_csum = htons(fold(sum16(iph, 20, 0)));
+    iph->check = saved;
+
+    size_t l4_len = ntohs(iph->tot_len) - 20;
+    uint8_t *l4 = p.buf + 20;
+    uint16_t *csum = (iph->protocol == IPPROTO_TCP) ? (uint16_t *) (l4 + 16) : (uint16_t *) (l4 + 6);
+    saved = *csum;
+    *csum = 0;
+    uint32_t sum = sum16(&iph->saddr, 8, 0) + iph->protocol + l4_len;
+    l4_csum = htons(fold(sum16(l4, l4_len, sum)));
+    if (iph->protocol == IPPROTO_UDP && l4_csum == 0)
+        l4_csum = 0xffff;
+    *csum = saved;
+}
+
+uint16_t l4_check(struct test_packet &p)
+{
+    return (p.iph()->protocol == IPPROTO_TCP) ? *(uint16_t *) (p.buf + 36) : *(uint16_t *) (p.buf + 26);
+}
+
+void build(struct test_packet &p, uint8_t proto, uint32_t saddr, uint16_t sport,
+           uint32_t daddr, uint16_t dport, mt19937 &rng)
+{
+    memset(p.buf, 0, sizeof(p.buf));
+    size_t l4_len = (proto == IPPROTO_TCP) ? 20 + 12 : 8 + 16;
+    struct iphdr *iph = p.iph();
+    iph->version = 4;
+    iph->ihl = 5;
+    iph->tot_len = htons(20 + l4_len);
+    iph->ttl = 64;
+    iph->protocol = proto;
+    iph->saddr = htonl(saddr);
+    iph->daddr = htonl(daddr);
+    p.ports()[0] = htons(sport);
+    p.ports()[1] = htons(dport);
+    uint8_t *l4 = p.buf + 20;
+    if (proto == IPPROTO_TCP)
+        l4[12] = 5 << 4;
+    else
+        *(uint16_t *) (l4 + 4) = htons(l4_len);
+    for (size_t i = (proto == IPPROTO_TCP) ? 20 : 8; i < l4_len; i++)
+        l4[i] = (uint8_t) rng();
+    uint16_t ip_csum, l4_csum;
+    full_checksums(p, ip_csum, l4_csum);
+    iph->check = ip_csum;
+    if (proto == IPPROTO_TCP)
+        *(uint16_t *) (l4 + 16) = l4_csum;
+    else
+        *(uint16_t *) (l4 + 6) = l4_csum;
+}
+
+void expect_valid_checksums(struct test_packet &p)
+{
+    uint16_t ip_csum, l4_csum;
+    full_checksums(p, ip_csum, l4_csum);
+    EXPECT_EQ(ip_csum, p.iph()->check);
+    EXPECT_EQ(l4_csum, l4_check(p));
+}
+
+/* A heap-allocated NAPTPortMap (too large for the stack). */
+NAPTPortMap *new_port_map()
+{
+    void *mem = nullptr;
+    if (posix_memalign(&mem, 64, sizeof(NAPTPortMap)) != 0)
+        abort();
+    return new (mem) NAPTPortMap();
+}
+
+}
+
+TEST(NAPTTest, Checksums) {
+    /* Corner cases of ones' complement arithmetic. */
+    uint16_t same = csum_replace2(0xffff, 0x1234, 0x1234);
+    EXPECT_TRUE(same == 0xffff || same == 0) << same;
+    const uint16_t words[] = { 0x0000, 0x0001, 0x7fff, 0x8000, 0xfffe, 0xffff };
+    for (uint16_t a : words) {
+        for (uint16_t b : words) {
+            for (uint16_t c : words) {
+                /* A checksum covering a and c, with a replaced by b. */
+                uint16_t before = fold((uint32_t) a + c);
+                uint16_t after = fold((uint32_t) b + c);
+                uint16_t updated = csum_replace2(before, a, b);
+                /* +0 and -0 are the same in ones' complement. */
+                EXPECT_TRUE(updated == after || (updated ^ after) == 0xffff)
+                    << a << " " << b << " " << c;
+            }
+        }
+    }
+}
+
+TEST(NAPTTest, Partitions) {
+    NAPTPortMap *map = new_port_map();
+    EXPECT_FALSE(map->init(EXT_ADDR, 0, 100, 1));
+    EXPECT_FALSE(map->init(EXT_ADDR, 1000, 1010, 4));
+    ASSERT_TRUE(map->init(htonl(EXT_ADDR), 1024, 65535, 6));
+    EXPECT_EQ(0u, map->part_size() % 8);
+    for (unsigned p = 0; p + 1 < map->num_parts(); p++)
+        EXPECT_EQ(map->part_lo(p) + map->part_size(), map->part_lo(p + 1));
+    EXPECT_LE(map->part_lo(5) + map->part_size() - 1, 65535u);
+
+    NAPTPartition part;
+    part.init(map, 2, 1000);
+    set<uint16_t> ports;
+    for (unsigned i = 0; i < map->part_size(); i++) {
+        uint16_t port = part.map_outbound(0, htonl(0x0a000001 + i), htons(5000), 0);
+        ASSERT_GE(port, map->part_lo(2));
+        ASSERT_LT(port, map->part_lo(2) + map->part_size());
+        ports.insert(port);
+    }
+    EXPECT_EQ(map->part_size(), ports.size());
+    /* The same endpoint keeps its port; UDP has its own ports. */
+    EXPECT_EQ(*ports.begin(), part.map_outbound(0, htonl(0x0a000001), htons(5000), 1));
+    EXPECT_EQ(0, part.map_outbound(0, htonl(0x0b000001), htons(5000), 1));
+    EXPECT_EQ(1u, part.num_exhausted);
+    EXPECT_NE(0, part.map_outbound(1, htonl(0x0b000001), htons(5000), 1));
+
+    /* Idle mappings are freed and their ports are reused. */
+    EXPECT_EQ(0u, part.expire(999, map->part_size()));
+    EXPECT_EQ(map->part_size() - 1, part.expire(1000, map->part_size()));
+    uint32_t int_addr;
+    uint16_t int_port;
+    EXPECT_TRUE(map->lookup(0, *ports.begin(), int_addr, int_port));
+    EXPECT_FALSE(map->lookup(0, *ports.rbegin(), int_addr, int_port));
+    EXPECT_NE(0, part.map_outbound(0, htonl(0x0b000001), htons(5000), 1001));
+
+    /* A new configuration does not inherit the mappings. */
+    ASSERT_TRUE(map->init(htonl(EXT_ADDR), 1024, 65535, 6));
+    EXPECT_FALSE(map->lookup(0, *ports.begin(), int_addr, int_port));
+    free(map);
+}
+
+TEST(NAPTTest, BidirectionalFlows) {
+    const unsigned num_threads = 4, num_flows = 20000;
+    NAPTPortMap *map = new_port_map();
+    ASSERT_TRUE(map->init(htonl(EXT_ADDR), 1024, 65535, num_threads));
+    vector<NAPTPartition> parts(num_threads);
+    for (unsigned t = 0; t < num_threads; t++)
+        parts[t].init(map, t, 300000);
+
+    mt19937 rng(5);
+    uint64_t out_cycles = 0, in_cycles = 0;
+    for (unsigned f = 0; f < num_flows; f++) {
+        uint8_t proto = (f % 3 == 0) ? IPPROTO_UDP : IPPROTO_TCP;
+        uint32_t int_addr = 0x0a000000 + (f >> 4);
+        uint16_t int_port = 30000 + (f & 15);
+        uint32_t remote = 0xc6336400 + (rng() & 0xff);
+        uint16_t remote_port = (f & 1) ? 443 : 53;
+        /* Outbound on the thread of the internal endpoint (as by RSS). */
+        unsigned t = (int_addr ^ int_port) % num_threads;
+
+        struct test_packet out;
+        build(out, proto, int_addr, int_port, remote, remote_port, rng);
+        uint64_t t0 = rte_rdtsc();
+        struct iphdr *iph = out.iph();
+        int pidx = NAPTPortMap::proto_idx(iph->protocol);
+        uint16_t ext_port = parts[t].map_outbound(pidx, iph->saddr, out.ports()[0], 0);
+        napt_rewrite_source(iph, map->ext_addr(), ext_port);
+        out_cycles += rte_rdtsc() - t0;
+        ASSERT_NE(0, ext_port);
+        EXPECT_EQ(htonl(EXT_ADDR), iph->saddr);
+        EXPECT_EQ(htonl(remote), iph->daddr);
+        EXPECT_EQ(htons(ext_port), out.ports()[0]);
+        expect_valid_checksums(out);
+
+        /* The reply may come to any thread. */
+        struct test_packet in;
+        build(in, proto, remote, remote_port, EXT_ADDR, ext_port, rng);
+        t0 = rte_rdtsc();
+        iph = in.iph();
+        uint32_t addr;
+        uint16_t port;
+        bool found = map->lookup(pidx, ntohs(in.ports()[1]), addr, port);
+        if (found)
+            napt_rewrite_dest(iph, addr, port);
+        in_cycles += rte_rdtsc() - t0;
+        ASSERT_TRUE(found);
+        EXPECT_EQ(htonl(int_addr), iph->daddr);
+        EXPECT_EQ(htons(int_port), in.ports()[1]);
+        EXPECT_EQ(htonl(remote), iph->saddr);
+        expect_valid_checksums(in);
+    }
+    uint64_t total_mappings = 0;
+    for (auto &p : parts)
+        total_mappings += p.num_mappings;
+    EXPECT_EQ(num_flows, total_mappings);
+    printf("outbound: %.1f cycles/pkt, inbound: %.1f cycles/pkt\n",
+           (double) out_cycles / num_flows, (double) in_cycles / num_flows);
+    free(map);
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,141 @@
+#include <nba/core/intrinsic.hh>
+#include <nba/framework/offloaddispatcher.hh>
+#include <nba/framework/devicefactory.hh>
+#include <nba/framework/computecontext.hh>
+#include <nba/element/element.hh>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#if 0 // for build scripts
+#require <lib/devicefactory.o>
+#require <engines/dummy/computedevice.o>
+#require <engines/dummy/computecontext.o>
+#endif
+
+using namespace std;
+using namespace nba;
+
+TEST(OffloadDispatchTest, FactoryHasDummy) {
+    EXPECT_TRUE(ComputeDeviceFactory::exists("dummy"));
+    EXPECT_FALSE(ComputeDeviceFactory::exists("no-such-driver"));
+    EXPECT_NE("", ComputeDeviceFactory::get_default_driver());
+}
+
+TEST(OffloadDispatchTest, DummyDevice) {
+    void *buf = nullptr;
+    ASSERT_EQ(0, posix_memalign(&buf, CACHE_LINE_SIZE, 4096));
+    ComputeDevice *device = ComputeDeviceFactory::construct("dummy", (ComputeDevice *) buf, 0, 0, 1);
+    ASSERT_NE(nullptr, device);
+    EXPECT_EQ("dummy", device->type_name);
+    ComputeContext *cctx = device->get_available_context();
+    ASSERT_NE(nullptr, cctx);
+    EXPECT_EQ("dummy", cctx->type_name);
+    io_base_t io_base = cctx->alloc_io_base();
+    ASSERT_NE(INVALID_IO_BASE, io_base);
+    host_mem_t hbuf;
+    dev_mem_t dbuf;
+    EXPECT_EQ(0, cctx->alloc_input_buffer(io_base, 64, hbuf, dbuf));
+    EXPECT_EQ(hbuf.ptr, dbuf.ptr);
+    cctx->clear_io_buffers(io_base);
+    device->return_context(cctx);
+    device->~ComputeDevice();
+    free(buf);
+}
+
+TEST(OffloadDispatchTest, PerDeviceMem) {
+    /* Init handlers set up the tables on each device of a node, so
+     * that the dispatcher may send tasks to any of them. */
+    void *bufs[2];
+    ComputeDevice *devices[2];
+    for (int i = 0; i < 2; i++) {
+        ASSERT_EQ(0, posix_memalign(&bufs[i], CACHE_LINE_SIZE, 4096));
+        devices[i] = ComputeDeviceFactory::construct("dummy", (ComputeDevice *) bufs[i], 0, i, 1);
+        ASSERT_NE(nullptr, devices[i]);
+    }
+    host_mem_t hbufs[2];
+    struct per_device_mem table;
+    table.clear();
+    EXPECT_EQ(nullptr, table.find(devices[0]));
+    for (int i = 0; i < 2; i++) {
+        hbufs[i] = devices[i]->alloc_host_buffer(64, 0);
+        *table.add(devices[i]) = devices[i]->alloc_device_buffer(64, 0, hbufs[i]);
+    }
+    EXPECT_EQ(2u, table.num_devices);
+    ASSERT_NE(nullptr, table.find(devices[0]));
+    ASSERT_NE(nullptr, table.find(devices[1]));
+    EXPECT_NE(table.find(devices[0])->ptr, table.find(devices[1])->ptr);
+    /* Adding the same device again reuses its slot. */
+    EXPECT_EQ(table.find(devices[1]), table.add(devices[1]));
+    EXPECT_EQ(2u, table.num_devices);
+    for (int i = 0; i < 2; i++) {
+        devices[i]->free_device_buffer(*table.find(devices[i]));
+        devices[i]->free_host_buffer(hbufs[i]);
+        devices[i]->~ComputeDevice();
+        free(bufs[i]);
+    }
+}
+
+TEST(OffloadDispatchTest, NoCandidate) {
+    OffloadDispatcher d;
+    unsigned qlens[NBA_MAX_COPROCESSORS] = {0,};
+    EXPECT_EQ(-1, d.select(0x3, qlens));
+    d.set_num_devices(2);
+    EXPECT_EQ(-1, d.select(0x0, qlens));
+    EXPECT_EQ(1, d.select(0x2, qlens));
+}
+
+TEST(OffloadDispatchTest, UnmeasuredFirst) {
+    OffloadDispatcher d;
+    unsigned qlens[NBA_MAX_COPROCESSORS] = {0,};
+    d.set_num_devices(2);
+    EXPECT_EQ(0, d.select(0x3, qlens));
+    d.task_sent(0);
+    d.task_completed(0, 0.001f);
+    /* Device 1 has not been measured yet. */
+    EXPECT_EQ(1, d.select(0x3, qlens));
+}
+
+TEST(OffloadDispatchTest, PreferFaster) {
+    OffloadDispatcher d;
+    unsigned qlens[NBA_MAX_COPROCESSORS] = {0,};
+    d.set_num_devices(2);
+    d.task_sent(0);
+    d.task_completed(0, 0.004f);
+    d.task_sent(1);
+    d.task_completed(1, 0.001f);
+    EXPECT_EQ(0u, d.get_inflight(0));
+    EXPECT_EQ(1, d.select(0x3, qlens));
+    /* Excluded by the candidate mask. */
+    EXPECT_EQ(0, d.select(0x1, qlens));
+}
+
+TEST(OffloadDispatchTest, QueueDepth) {
+    OffloadDispatcher d;
+    unsigned qlens[NBA_MAX_COPROCESSORS] = {0,};
+    d.set_num_devices(2);
+    d.task_sent(0);
+    d.task_completed(0, 0.002f);
+    d.task_sent(1);
+    d.task_completed(1, 0.001f);
+    /* (3 + 1) x 1 ms on device 1 > (0 + 1) x 2 ms on device 0. */
+    qlens[1] = 3;
+    EXPECT_EQ(0, d.select(0x3, qlens));
+    qlens[1] = 0;
+    d.task_sent(1);
+    d.task_sent(1);
+    d.task_sent(1);
+    EXPECT_EQ(3u, d.get_inflight(1));
+    EXPECT_EQ(0, d.select(0x3, qlens));
+}
+
+TEST(OffloadDispatchTest, MovingAverage) {
+    OffloadDispatcher d;
+    d.set_num_devices(1);
+    d.task_sent(0);
+    d.task_completed(0, 1.0f);
+    EXPECT_FLOAT_EQ(1.0f, d.get_avg_completion_sec(0));
+    d.task_sent(0);
+    d.task_completed(0, 2.0f);
+    EXPECT_FLOAT_EQ(1.0f + OffloadDispatcher::HISTORY_WEIGHT, d.get_avg_completion_sec(0));
+}
+
+// vim: ts=8 sts=4 sw=4 et
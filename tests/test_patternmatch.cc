@@ -0,0 +1,222 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <set>
+#include <random>
+#include <utility>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include <rte_cycles.h>
+#include "../elements/ids/util_aho_corasick.hh"
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+string random_string(mt19937 &rng, const string &alphabet, size_t len)
+{
+    string s;
+    for (size_t i = 0; i < len; i++)
+        s.push_back(alphabet[rng() % alphabet.size()]);
+    return s;
+}
+
+set<pair<uint32_t, size_t>> naive_matches(const vector<string> &patterns, const string &text)
+{
+    set<pair<uint32_t, size_t>> found;
+    for (uint32_t id = 0; id < patterns.size(); id++) {
+        size_t pos = text.find(patterns[id]);
+        while (pos != string::npos) {
+            found.insert({id, pos + patterns[id].size()});
+            pos = text.find(patterns[id], pos + 1);
+        }
+    }
+    return found;
+}
+
+int naive_first_match(const vector<string> &patterns, const string &text)
+{
+    auto found = naive_matches(patterns, text);
+    int first = -1;
+    size_t first_end = SIZE_MAX;
+    for (auto &m : found) {
+        if (m.second < first_end || (m.second == first_end && (int) m.first < first)) {
+            first = m.first;
+            first_end = m.second;
+        }
+    }
+    return first;
+}
+
+/* Writes the lines into a temporary rule file and returns its name. */
+string write_rule_file(const vector<string> &lines)
+{
+    char name[] = "/tmp/nba-ids-rules-XXXXXX";
+    int fd = mkstemp(name);
+    EXPECT_NE(-1, fd);
+    FILE *fout = fdopen(fd, "w");
+    for (auto &line : lines)
+        fprintf(fout, "%s\n", line.c_str());
+    fclose(fout);
+    return name;
+}
+
+}
+
+TEST(PatternMatchTest, Basic) {
+    ACBuilder builder;
+    builder.add("he");
+    builder.add("she");
+    builder.add("his");
+    builder.add("hers");
+    vector<uint8_t> image;
+    ASSERT_TRUE(builder.build(image));
+    ACMatcher m;
+    ASSERT_TRUE(m.attach(image.data()));
+    EXPECT_EQ(4u, m.header()->num_patterns);
+    /* "she" and "he" both end first, and "he" has the lower id. */
+    const string text = "ushers";
+    EXPECT_EQ(0, m.first_match((const uint8_t *) text.data(), text.size()));
+    set<pair<uint32_t, size_t>> found;
+    m.for_each_match((const uint8_t *) text.data(), text.size(),
+                     [&](uint32_t id, size_t end) { found.insert({id, end}); });
+    set<pair<uint32_t, size_t>> expected = { {0, 4}, {1, 4}, {3, 6} };
+    EXPECT_EQ(expected, found);
+    EXPECT_EQ(-1, m.first_match((const uint8_t *) "xyz", 3));
+    EXPECT_EQ(-1, m.first_match(nullptr, 0));
+
+    ACBuilder empty;
+    ASSERT_TRUE(empty.build(image));
+    ASSERT_TRUE(m.attach(image.data()));
+    EXPECT_EQ(-1, m.first_match((const uint8_t *) text.data(), text.size()));
+    empty.add("");
+    EXPECT_FALSE(empty.build(image));
+    EXPECT_FALSE(m.attach(nullptr));
+}
+
+TEST(PatternMatchTest, CompareWithNaive) {
+    mt19937 rng(42);
+    /* Bytes outside the pattern alphabet exercise the prefilter, and
+     * 0xe1 shares its nibble bucket with 'a' as a false positive. */
+    const string pattern_alphabet = "abc";
+    const string text_alphabet = string("abcxxxx\0\xe1", 9);
+    for (int round = 0; round < 40; round++) {
+        vector<string> patterns;
+        for (int i = 0; i < 1 + round * 2; i++)
+            patterns.push_back(random_string(rng, pattern_alphabet, 1 + rng() % 6));
+        for (uint32_t max_dense : { 1u, 4u, 256u }) {
+            for (bool prefilter : { false, true }) {
+                ACBuilder builder;
+                builder.max_dense = max_dense;
+                for (auto &p : patterns)
+                    builder.add(p);
+                vector<uint8_t> image;
+                ASSERT_TRUE(builder.build(image, prefilter));
+                ACMatcher m;
+                ASSERT_TRUE(m.attach(image.data()));
+                EXPECT_EQ(prefilter, m.header()->use_prefilter != 0);
+                for (int t = 0; t < 20; t++) {
+                    string text = random_string(rng, text_alphabet, rng() % 100);
+                    const uint8_t *data = (const uint8_t *) text.data();
+                    set<pair<uint32_t, size_t>> found;
+                    m.for_each_match(data, text.size(),
+                                     [&](uint32_t id, size_t end) { found.insert({id, end}); });
+                    ASSERT_EQ(naive_matches(patterns, text), found);
+                    ASSERT_EQ(naive_first_match(patterns, text), m.first_match(data, text.size()));
+                    /* Scanning in two pieces, as for chained mbufs. */
+                    size_t split = text.empty() ? 0 : rng() % text.size();
+                    uint32_t state = 0;
+                    int id = m.first_match(data, split, state);
+                    if (id < 0)
+                        id = m.first_match(data + split, text.size() - split, state);
+                    ASSERT_EQ(naive_first_match(patterns, text), id);
+                }
+            }
+        }
+    }
+}
+
+TEST(PatternMatchTest, RuleFile) {
+    string pattern;
+    EXPECT_TRUE(ac_parse_pattern("abc", pattern));
+    EXPECT_EQ("abc", pattern);
+    EXPECT_TRUE(ac_parse_pattern("|90 90|/bin/sh|00|", pattern));
+    EXPECT_EQ(string("\x90\x90/bin/sh\0", 10), pattern);
+    EXPECT_TRUE(ac_parse_pattern("a|7C|b", pattern));
+    EXPECT_EQ("a|b", pattern);
+    EXPECT_FALSE(ac_parse_pattern("|9|", pattern));
+    EXPECT_FALSE(ac_parse_pattern("|zz|", pattern));
+    EXPECT_FALSE(ac_parse_pattern("abc|41", pattern));
+    EXPECT_FALSE(ac_parse_pattern("||", pattern));
+
+    string name = write_rule_file({ "# comment", "", "  GET /admin  ", "|de ad be ef|", "\tcmd.exe" });
+    vector<string> patterns;
+    EXPECT_EQ(0, ac_load_rules(name.c_str(), patterns));
+    ASSERT_EQ(3u, patterns.size());
+    EXPECT_EQ("GET /admin", patterns[0]);
+    EXPECT_EQ("\xde\xad\xbe\xef", patterns[1]);
+    EXPECT_EQ("cmd.exe", patterns[2]);
+    unlink(name.c_str());
+
+    name = write_rule_file({ "ok", "# comment", "bad|4|" });
+    patterns.clear();
+    EXPECT_EQ(3, ac_load_rules(name.c_str(), patterns));
+    unlink(name.c_str());
+    EXPECT_EQ(-1, ac_load_rules(name.c_str(), patterns));
+}
+
+TEST(PatternMatchTest, Throughput) {
+    /* Lowercase patterns of 4 to 16 bytes against random binary
+     * payloads of 1460 bytes, with a few planted matches. */
+    mt19937 rng(7);
+    const string lower = "abcdefghijklmnopqrstuvwxyz";
+    const size_t num_payloads = 4096, payload_len = 1460;
+    vector<string> payloads;
+    for (size_t i = 0; i < num_payloads; i++) {
+        string p(payload_len, '\0');
+        for (auto &c : p)
+            c = (char) (rng() & 0xff);
+        payloads.push_back(p);
+    }
+    for (unsigned num_patterns : { 10u, 100u, 1000u, 10000u }) {
+        vector<string> lines;
+        for (unsigned i = 0; i < num_patterns; i++)
+            lines.push_back(random_string(rng, lower, 4 + rng() % 13));
+        string name = write_rule_file(lines);
+        vector<string> patterns;
+        ASSERT_EQ(0, ac_load_rules(name.c_str(), patterns));
+        unlink(name.c_str());
+        ASSERT_EQ(num_patterns, patterns.size());
+        for (size_t i = 0; i < num_payloads; i += 64) {
+            const string &p = patterns[rng() % num_patterns];
+            payloads[i].replace(rng() % (payload_len - p.size()), p.size(), p);
+        }
+
+        size_t num_matched[2] = { 0, 0 };
+        for (bool prefilter : { false, true }) {
+            ACBuilder builder;
+            for (auto &p : patterns)
+                builder.add(p);
+            vector<uint8_t> image;
+            ASSERT_TRUE(builder.build(image, prefilter));
+            ACMatcher m;
+            ASSERT_TRUE(m.attach(image.data()));
+            uint64_t t0 = rte_rdtsc();
+            for (int rep = 0; rep < 4; rep++)
+                for (auto &p : payloads)
+                    num_matched[prefilter] += (m.first_match((const uint8_t *) p.data(), p.size()) >= 0);
+            uint64_t cycles = rte_rdtsc() - t0;
+            const struct ac_image_header *hdr = m.header();
+            printf("%5u patterns, prefilter %-3s: %6u states, %8lu bytes, %.2f cycles/byte\n",
+                   num_patterns, hdr->use_prefilter ? "on" : "off", hdr->num_states,
+                   hdr->total_size, (double) cycles / (4 * num_payloads * payload_len));
+        }
+        EXPECT_EQ(num_matched[0], num_matched[1]);
+        EXPECT_GE(num_matched[0], 4 * num_payloads / 64);
+    }
+}
+
+// vim: ts=8 sts=4 sw=4 et
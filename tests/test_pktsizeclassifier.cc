@@ -0,0 +1,103 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+#include <gtest/gtest.h>
+#include "../elements/standards/util_pktsizebuckets.hh"
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+void build(PacketSizeBuckets &buckets, const vector<string> &specs)
+{
+    for (auto &spec : specs) {
+        unsigned bound;
+        int port;
+        ASSERT_TRUE(PacketSizeBuckets::parse(spec, bound, port)) << spec;
+        ASSERT_TRUE(buckets.add(bound, port)) << spec;
+    }
+    ASSERT_TRUE(buckets.build());
+}
+
+}
+
+TEST(PacketSizeBucketsTest, Parse) {
+    unsigned bound;
+    int port;
+    EXPECT_TRUE(PacketSizeBuckets::parse("128:0", bound, port));
+    EXPECT_EQ(128u, bound);
+    EXPECT_EQ(0, port);
+    EXPECT_TRUE(PacketSizeBuckets::parse(" 1536 : 3", bound, port));
+    EXPECT_EQ(1536u, bound);
+    EXPECT_EQ(3, port);
+    EXPECT_FALSE(PacketSizeBuckets::parse("128", bound, port));
+    EXPECT_FALSE(PacketSizeBuckets::parse("128:1x", bound, port));
+    EXPECT_FALSE(PacketSizeBuckets::parse("LB_HINT 512", bound, port));
+
+    PacketSizeBuckets buckets;
+    EXPECT_FALSE(buckets.build());
+    EXPECT_FALSE(buckets.add(100, 0));      /* not a multiple of 16 */
+    EXPECT_TRUE(buckets.add(256, 0));
+    EXPECT_FALSE(buckets.add(256, 1));      /* not ascending */
+    EXPECT_FALSE(buckets.add(512, -1));
+    EXPECT_FALSE(buckets.add(65536, 1));
+}
+
+TEST(PacketSizeBucketsTest, Boundaries) {
+    PacketSizeBuckets buckets;
+    build(buckets, { "128:0", "512:1", "2048:2" });
+    EXPECT_EQ(2, buckets.max_port());
+    /* The same map as the previous hard-coded table. */
+    for (unsigned len = 0; len < 2048; len++)
+        ASSERT_EQ(len < 128 ? 0 : (len < 512 ? 1 : 2), buckets.classify(len)) << len;
+    /* Longer (jumbo) frames go to the last bucket. */
+    EXPECT_EQ(2, buckets.classify(2048));
+    EXPECT_EQ(2, buckets.classify(9000));
+    EXPECT_EQ(2, buckets.classify(100000));
+
+    /* Several buckets may share a port. */
+    PacketSizeBuckets shared;
+    build(shared, { "64:1", "1024:0", "1520:1", "9728:2" });
+    EXPECT_EQ(1, shared.classify(63));
+    EXPECT_EQ(0, shared.classify(64));
+    EXPECT_EQ(0, shared.classify(1023));
+    EXPECT_EQ(1, shared.classify(1514));
+    EXPECT_EQ(2, shared.classify(1520));
+    EXPECT_EQ(2, shared.classify(9728));
+}
+
+TEST(PacketSizeBucketsTest, IMIXCounters) {
+    /* The simple IMIX: 64, 576, and 1500 bytes in 7:4:1. */
+    PacketSizeBuckets buckets;
+    build(buckets, { "128:0", "1024:1", "2048:2" });
+    const unsigned sizes[] = { 64, 576, 1500 };
+    const unsigned weights[] = { 7, 4, 1 };
+    mt19937 rng(3);
+    discrete_distribution<int> mix(begin(weights), end(weights));
+    const unsigned batch_size = 64, num_batches = 1000;
+    uint64_t expected_pkts[3] = {0, 0, 0};
+    unsigned num_offload_batches = 0;
+    for (unsigned b = 0; b < num_batches; b++) {
+        unsigned num_long = 0;
+        for (unsigned i = 0; i < batch_size; i++) {
+            int k = mix(rng);
+            expected_pkts[k] ++;
+            ASSERT_EQ(k, buckets.classify(sizes[k]));
+            num_long += (sizes[k] >= 512);
+        }
+        /* The majority rule of LB_HINT 512: IMIX batches mostly stay on CPU. */
+        num_offload_batches += (2 * num_long >= batch_size);
+    }
+    for (unsigned k = 0; k < 3; k++) {
+        EXPECT_EQ(expected_pkts[k], buckets.get(k).num_pkts);
+        EXPECT_EQ(expected_pkts[k] * sizes[k], buckets.get(k).num_bytes);
+    }
+    EXPECT_EQ(num_batches * batch_size,
+              buckets.get(0).num_pkts + buckets.get(1).num_pkts + buckets.get(2).num_pkts);
+    EXPECT_NEAR(7.0 / 12, (double) expected_pkts[0] / (num_batches * batch_size), 0.02);
+    EXPECT_LT(num_offload_batches, num_batches / 4);
+}
+
+// vim: ts=8 sts=4 sw=4 et
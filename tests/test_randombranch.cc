@@ -0,0 +1,123 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <random>
+#include <gtest/gtest.h>
+#include <rte_cycles.h>
+#include "../elements/standards/util_randombranch.hh"
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+/* Pearson's chi-square statistic of the observed counts. */
+double chi_square(const vector<uint64_t> &counts, const vector<double> &weights)
+{
+    double sum_w = 0, stat = 0;
+    uint64_t total = 0;
+    for (double w : weights) sum_w += w;
+    for (uint64_t c : counts) total += c;
+    for (size_t i = 0; i < weights.size(); i++) {
+        if (weights[i] == 0) continue;
+        double expected = total * weights[i] / sum_w;
+        stat += (counts[i] - expected) * (counts[i] - expected) / expected;
+    }
+    return stat;
+}
+
+}
+
+TEST(RandomBranchTest, Distribution) {
+    const vector<vector<double>> cases = {
+        { 0.3, 0.5 },
+        { 1, 2, 3, 4 },
+        { 100 },
+        { 0, 1, 0, 3 },
+        { 0.001, 1 },
+    };
+    /* The 99.9th percentiles of chi-square with 1..3 degrees of freedom. */
+    const double critical[] = { 0, 10.83, 13.82, 16.27 };
+    XorShift128Plus rng(42);
+    for (auto &weights : cases) {
+        AliasTable alias;
+        ASSERT_TRUE(alias.init(weights));
+        vector<uint64_t> counts(weights.size(), 0);
+        int ports[64];
+        for (unsigned b = 0; b < 20000; b++) {
+            alias.sample_n(rng, 64, ports);
+            for (int p : ports) {
+                ASSERT_LT((size_t) p, weights.size());
+                counts[p] ++;
+            }
+        }
+        unsigned dof = 0;
+        for (size_t i = 0; i < weights.size(); i++) {
+            if (weights[i] == 0) {
+                EXPECT_EQ(0u, counts[i]);
+            } else {
+                dof ++;
+            }
+        }
+        if (dof > 1) {
+            EXPECT_LT(chi_square(counts, weights), critical[dof - 1]);
+        }
+    }
+}
+
+TEST(RandomBranchTest, InvalidWeights) {
+    AliasTable alias;
+    EXPECT_FALSE(alias.init({}));
+    EXPECT_FALSE(alias.init({ 0, 0 }));
+    EXPECT_FALSE(alias.init({ 1, -1 }));
+}
+
+TEST(RandomBranchTest, Deterministic) {
+    AliasTable alias;
+    ASSERT_TRUE(alias.init({ 1, 2, 3 }));
+    XorShift128Plus a(7), b(7), c(8);
+    int pa[256], pb[256], pc[256];
+    alias.sample_n(a, 256, pa);
+    alias.sample_n(b, 256, pb);
+    alias.sample_n(c, 256, pc);
+    EXPECT_EQ(0, memcmp(pa, pb, sizeof(pa)));
+    EXPECT_NE(0, memcmp(pa, pc, sizeof(pa)));
+}
+
+TEST(RandomBranchBenchTest, AliasVersusDiscreteDistribution) {
+    const vector<double> weights = { 0.3, 0.5 };
+    const unsigned batch_size = 64, num_batches = 100000;
+    int ports[batch_size];
+    uint64_t sum[2] = { 0, 0 };
+
+    discrete_distribution<int> ddist(weights.begin(), weights.end());
+    default_random_engine gen;
+    uint64_t t0 = rte_rdtsc();
+    for (unsigned b = 0; b < num_batches; b++) {
+        for (unsigned i = 0; i < batch_size; i++)
+            ports[i] = ddist(gen);
+        sum[0] += ports[b % batch_size];
+    }
+    uint64_t ddist_cycles = rte_rdtsc() - t0;
+
+    AliasTable alias;
+    ASSERT_TRUE(alias.init(weights));
+    XorShift128Plus rng(1);
+    t0 = rte_rdtsc();
+    for (unsigned b = 0; b < num_batches; b++) {
+        alias.sample_n(rng, batch_size, ports);
+        sum[1] += ports[b % batch_size];
+    }
+    uint64_t alias_cycles = rte_rdtsc() - t0;
+
+    double total = (double) batch_size * num_batches;
+    printf("discrete_distribution: %.2f cycles/pkt, alias table: %.2f cycles/pkt\n",
+           ddist_cycles / total, alias_cycles / total);
+    /* Both pick port 1 about 5/8 of the time. */
+    EXPECT_NEAR(0.625, sum[0] / (double) num_batches, 0.02);
+    EXPECT_NEAR(0.625, sum[1] / (double) num_batches, 0.02);
+    EXPECT_LT(alias_cycles, ddist_cycles);
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,233 @@
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <gtest/gtest.h>
+#include <rte_cycles.h>
+#include "../elements/standards/util_tokenbucket.hh"
+
+using namespace std;
+using namespace nba;
+
+namespace {
+
+/* The fake TSC clock rate. */
+const uint64_t HZ = 2500000000llu;
+
+const uint64_t GBPS = 1000000000llu;
+
+/* 32 packets of 1500 bytes */
+const uint32_t BATCH_BYTES = 32 * 1500;
+
+double relative_error(double measured, double expected)
+{
+    return fabs(measured - expected) / expected;
+}
+
+}
+
+TEST(TokenBucketTest, ParseRate) {
+    uint64_t bps = 0;
+    EXPECT_TRUE(parse_rate("800k", bps));
+    EXPECT_EQ(800000u, bps);
+    EXPECT_TRUE(parse_rate("2.5G", bps));
+    EXPECT_EQ(2500000000u, bps);
+    EXPECT_TRUE(parse_rate("100Mbps", bps));
+    EXPECT_EQ(100000000u, bps);
+    EXPECT_TRUE(parse_rate("64000", bps));
+    EXPECT_EQ(64000u, bps);
+    EXPECT_FALSE(parse_rate("", bps));
+    EXPECT_FALSE(parse_rate("0", bps));
+    EXPECT_FALSE(parse_rate("10X", bps));
+    EXPECT_FALSE(parse_rate("G", bps));
+}
+
+TEST(TokenBucketTest, MeterColors) {
+    /* 8 Mbps (1 byte per usec) with a burst of 1500 bytes. */
+    const uint64_t usec = HZ / 1000000;
+    TokenBucketMeter srtcm;
+    srtcm.init(8000000, 1500, 0, 0, HZ, 0);
+    EXPECT_EQ(COLOR_GREEN, srtcm.color(0, 1000));
+    EXPECT_EQ(COLOR_RED, srtcm.color(0, 1000));
+    EXPECT_EQ(COLOR_RED, srtcm.color(400 * usec, 1000));
+    EXPECT_EQ(COLOR_GREEN, srtcm.color(600 * usec, 1000));
+    /* Tokens never exceed the burst. */
+    EXPECT_EQ(COLOR_RED, srtcm.color(100000 * usec, 1501));
+
+    /* The peak bucket at twice the rate and burst. */
+    TokenBucketMeter trtcm;
+    trtcm.init(8000000, 1500, 16000000, 3000, HZ, 0);
+    EXPECT_EQ(COLOR_GREEN, trtcm.color(0, 1000));
+    EXPECT_EQ(COLOR_YELLOW, trtcm.color(0, 1000));
+    EXPECT_EQ(COLOR_RED, trtcm.color(0, 1500));
+    /* Red packets take no tokens. */
+    EXPECT_EQ(COLOR_YELLOW, trtcm.color(0, 1000));
+    EXPECT_EQ(COLOR_RED, trtcm.color(0, 1));
+    EXPECT_EQ(COLOR_GREEN, trtcm.color(1000 * usec, 1000));
+}
+
+TEST(TokenBucketTest, PolicerAccuracy) {
+    /* Offer 1.5 times the rate with 1500-byte packets for 50 msec. */
+    const uint32_t pkt_len = 1500;
+    const uint64_t duration = HZ / 20;
+    for (uint64_t rate : { 1 * GBPS, 10 * GBPS, 40 * GBPS, 100 * GBPS }) {
+        const uint64_t burst = rate / 8000;
+        TokenBucketMeter meter;
+        meter.init(rate, burst, 0, 0, HZ, 0);
+        double gap = (double) pkt_len * 8 * HZ / (rate * 1.5);
+        uint64_t green_bytes = 0, num_pkts = 0;
+        uint64_t t0 = rte_rdtsc();
+        for (double t = 0; t < duration; t += gap) {
+            if (meter.color((uint64_t) t, pkt_len) == COLOR_GREEN)
+                green_bytes += pkt_len;
+            num_pkts ++;
+        }
+        uint64_t cycles = rte_rdtsc() - t0;
+        double expected = (double) rate / 8 * duration / HZ + burst;
+        EXPECT_LT(relative_error(green_bytes, expected), 1e-3) << rate;
+        printf("%3lu Gbps: %.4f%% error, %.1f cycles/pkt\n", rate / GBPS,
+               100 * relative_error(green_bytes, expected), (double) cycles / num_pkts);
+    }
+}
+
+TEST(TokenBucketTest, ShaperQueues) {
+    HierarchicalShaper<int> shaper;
+    shaper.init(GBPS, 10000, 2, 4, HZ, 0);
+    int item = -1;
+    EXPECT_FALSE(shaper.dequeue(0, item));
+    EXPECT_EQ(UINT64_MAX, shaper.wait_cycles());
+    for (int i = 0; i < 4; i++)
+        EXPECT_TRUE(shaper.enqueue(1, i, 6000));
+    EXPECT_FALSE(shaper.enqueue(1, 4, 6000));
+
+    uint64_t now = 0;
+    /* The burst lets two items go out at once, then one per 6000 bytes. */
+    EXPECT_TRUE(shaper.dequeue(now, item));
+    EXPECT_EQ(0, item);
+    EXPECT_TRUE(shaper.dequeue(now, item));
+    EXPECT_EQ(1, item);
+    EXPECT_FALSE(shaper.dequeue(now, item));
+    uint64_t wait = shaper.wait_cycles();
+    EXPECT_NEAR(2000.0 * 8 / GBPS * HZ, (double) wait, 2.0);
+    EXPECT_FALSE(shaper.dequeue(now + wait - 2, item));
+    EXPECT_TRUE(shaper.dequeue(now + wait, item));
+    EXPECT_EQ(2, item);
+    EXPECT_EQ(1u, shaper.queued(1));
+    EXPECT_EQ(0u, shaper.queued(0));
+
+    /* Flushing takes out the rest without tokens. */
+    EXPECT_TRUE(shaper.enqueue(0, 5, 6000));
+    vector<int> rest;
+    shaper.flush(rest);
+    ASSERT_EQ(2u, rest.size());
+    EXPECT_EQ(5, rest[0]);
+    EXPECT_EQ(3, rest[1]);
+    EXPECT_EQ(0u, shaper.queued(1));
+    EXPECT_FALSE(shaper.dequeue(now + 10 * wait, item));
+}
+
+namespace {
+
+/*
+ * Keeps all queues of the given classes full with batches of 32 packets
+ * of 1500 bytes and runs dispatch() by a fake clock for duration cycles.
+ * Each dispatch() runs late by up to 2 usec, like a timer wheel would.
+ * Returns the bytes released from each class.
+ */
+vector<uint64_t> run_backlogged(HierarchicalShaper<int> &shaper, const vector<unsigned> &classes,
+                                uint64_t duration, uint64_t &num_pkts, uint64_t &cycles)
+{
+    vector<uint64_t> released(shaper.num_classes(), 0);
+    mt19937 rng(7);
+    const uint64_t max_late = 2 * HZ / 1000000;
+    num_pkts = 0;
+    cycles = 0;
+    uint64_t now = 0;
+    while (now < duration) {
+        uint64_t t0 = rte_rdtsc();
+        for (unsigned c : classes)
+            while (shaper.enqueue(c, c, BATCH_BYTES))
+                ;
+        int item;
+        while (shaper.dequeue(now, item)) {
+            released[item] += BATCH_BYTES;
+            num_pkts += 32;
+        }
+        uint64_t wait = shaper.wait_cycles();
+        cycles += rte_rdtsc() - t0;
+        now += wait + rng() % max_late;
+    }
+    return released;
+}
+
+}
+
+TEST(TokenBucketTest, ShaperAccuracy) {
+    const uint64_t duration = HZ / 10;
+    for (uint64_t rate : { 1 * GBPS, 10 * GBPS, 40 * GBPS, 100 * GBPS }) {
+        HierarchicalShaper<int> shaper;
+        const uint64_t burst = rate / 8000;
+        shaper.init(rate, burst, 1, 64, HZ, 0);
+        uint64_t num_pkts, cycles;
+        vector<uint64_t> released = run_backlogged(shaper, { 0 }, duration, num_pkts, cycles);
+        /* The last batch may overshoot. */
+        double expected = (double) rate / 8 * duration / HZ + burst;
+        EXPECT_GT(released[0], expected * (1 - 1e-4)) << rate;
+        EXPECT_LT(released[0], expected * (1 + 1e-4) + BATCH_BYTES) << rate;
+        printf("%3lu Gbps: %.4f%% error, %.1f cycles/pkt\n", rate / GBPS,
+               100 * relative_error(released[0], expected), (double) cycles / num_pkts);
+    }
+}
+
+TEST(TokenBucketTest, ShaperHierarchy) {
+    const uint64_t rate = 10 * GBPS, duration = HZ / 10;
+    const double total = (double) rate / 8 * duration / HZ + rate / 8000;
+    uint64_t num_pkts, cycles;
+    {
+        /* Class 0: assured 30% up to 50%, class 1: assured 20%,
+         * class 2: best effort. */
+        HierarchicalShaper<int> shaper;
+        shaper.init(rate, rate / 8000, 3, 64, HZ, 0);
+        shaper.set_class(0, rate * 3 / 10, rate / 2, rate / 8000, 0);
+        shaper.set_class(1, rate / 5, 0, rate / 8000, 0);
+        vector<uint64_t> r = run_backlogged(shaper, { 0, 1, 2 }, duration, num_pkts, cycles);
+        EXPECT_LT(relative_error(r[0] + r[1] + r[2], total), 1e-3);
+        EXPECT_GT(r[0], 0.3 * total);
+        EXPECT_LT(r[0], 0.5 * total);
+        EXPECT_GT(r[1], 0.2 * total);
+        EXPECT_GT(r[2], 0.1 * total);
+        printf("shares: %.3f %.3f %.3f\n", r[0] / total, r[1] / total, r[2] / total);
+    }
+    {
+        /* The assured rate holds against a best-effort class. */
+        HierarchicalShaper<int> shaper;
+        shaper.init(rate, rate / 8000, 2, 64, HZ, 0);
+        shaper.set_class(1, rate * 8 / 10, 0, rate / 8000, 0);
+        vector<uint64_t> r = run_backlogged(shaper, { 0, 1 }, duration, num_pkts, cycles);
+        EXPECT_GT(r[1], 0.8 * total);
+        EXPECT_GT(r[0], 0.1 * total);
+        EXPECT_LT(relative_error(r[0] + r[1], total), 1e-3);
+    }
+    {
+        /* The ceiling holds even with spare root tokens. */
+        HierarchicalShaper<int> shaper;
+        shaper.init(rate, rate / 8000, 2, 64, HZ, 0);
+        shaper.set_class(0, 0, rate / 5, rate / 8000, 0);
+        vector<uint64_t> r = run_backlogged(shaper, { 0, 1 }, duration, num_pkts, cycles);
+        EXPECT_LT(relative_error(r[0], 0.2 * rate / 8 * duration / HZ + rate / 8000), 1e-3);
+        EXPECT_LT(relative_error(r[0] + r[1], total), 1e-3);
+    }
+    {
+        /* An idle class leaves its share to the others. */
+        HierarchicalShaper<int> shaper;
+        shaper.init(rate, rate / 8000, 2, 64, HZ, 0);
+        shaper.set_class(0, rate / 2, 0, rate / 8000, 0);
+        shaper.set_class(1, rate / 2, 0, rate / 8000, 0);
+        vector<uint64_t> r = run_backlogged(shaper, { 1 }, duration, num_pkts, cycles);
+        EXPECT_EQ(0u, r[0]);
+        EXPECT_LT(relative_error(r[1], total), 1e-3);
+    }
+}
+
+// vim: ts=8 sts=4 sw=4 et